@@ -17,6 +17,16 @@
  * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef BOWTIE_MM
+#include <sys/mman.h>
+#endif
 #include "aligner_cache.h"
 #include "tinythread.h"
 
@@ -119,6 +129,424 @@ bool AlignmentCache::addOnTheFly(
 	}
 }
 
+/// Slots examined for a key before one is replaced
+static const size_t SEED_CACHE_PROBE = 8;
+
+bool SharedSeedCache::init(uint64_t bytes, int nthreads) {
+	// Enough shards that threads seldom wait on one another's locks
+	size_t nshards = 64;
+	while(nshards < (size_t)std::max(nthreads, 1) * 16) nshards <<= 1;
+	size_t nslots = 0, ringsz = 0;
+	for(; nshards > 0; nshards >>= 1) {
+		// A quarter of each shard's budget for slots, the rest for hits
+		uint64_t per = bytes / nshards;
+		nslots = 1;
+		while((nslots << 1) * sizeof(Slot) <= per / 4) nslots <<= 1;
+		ringsz = (size_t)((per - nslots * sizeof(Slot)) / sizeof(SeedCacheHit));
+		if(nslots >= 64 && ringsz >= 256) {
+			break;
+		}
+	}
+	if(nshards == 0) {
+		return false;
+	}
+	shards_ = new Shard[nshards];
+	for(size_t i = 0; i < nshards; i++) {
+		shards_[i].slots.resizeExact(nslots);
+		for(size_t j = 0; j < nslots; j++) {
+			shards_[i].slots[j].key.reset();
+		}
+		shards_[i].ring.resizeExact(ringsz);
+	}
+	nshards_ = nshards;
+	nslots_ = nslots;
+	ringsz_ = ringsz;
+	return true;
+}
+
+bool SharedSeedCache::lookup(const QKey& qk, EList<SeedCacheHit>& hits) {
+	assert(enabled());
+	assert(qk.cacheable());
+	// The file never changes, so it needs no lock
+	size_t fi = findInFile(qk);
+	if(fi < nfkeys_) {
+		const FileKey& k = fkeys_[fi];
+		for(uint64_t j = k.start; j < k.start + k.n; j++) {
+			const FileHit& fh = fhits_[j];
+			hits.expand();
+			SeedCacheHit& hit = hits.back();
+			hit.key.seq = fh.seq;
+			hit.key.len = fh.len;
+			hit.topf = fh.topf;
+			hit.botf = fh.botf;
+			hit.topb = fh.topb;
+			hit.botb = fh.botb;
+		}
+		__sync_fetch_and_add(&fuses_[fi], 1);
+		return true;
+	}
+	uint64_t h = hash(qk);
+	Shard& sh = shards_[(h >> 32) & (nshards_ - 1)];
+	ThreadSafe ts(sh.lock);
+	sh.lookups++;
+	for(size_t i = 0; i < SEED_CACHE_PROBE; i++) {
+		Slot& s = sh.slots[(h + i) & (nslots_ - 1)];
+		if(s.key == qk) {
+			if(!live(sh, s)) {
+				return false;
+			}
+			size_t off = (size_t)(s.start % ringsz_);
+			for(size_t j = 0; j < s.n; j++) {
+				hits.push_back(sh.ring[off + j]);
+			}
+			s.uses++;
+			sh.hits++;
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t SharedSeedCache::insert(const QKey& qk, const EList<SeedCacheHit>& hits) {
+	assert(enabled());
+	assert(qk.cacheable());
+	if(hits.size() > ringsz_ / 8) {
+		// Would push too much else out of the ring
+		return 0;
+	}
+	uint64_t h = hash(qk);
+	Shard& sh = shards_[(h >> 32) & (nshards_ - 1)];
+	ThreadSafe ts(sh.lock);
+	// Prefer the key's own slot, then a dead one, then the oldest
+	Slot *victim = NULL;
+	for(size_t i = 0; i < SEED_CACHE_PROBE; i++) {
+		Slot& s = sh.slots[(h + i) & (nslots_ - 1)];
+		if(s.key == qk) {
+			victim = &s;
+			break;
+		}
+		if(victim == NULL ||
+		   (live(sh, *victim) && (!live(sh, s) || s.start < victim->start)))
+		{
+			victim = &s;
+		}
+	}
+	size_t evicted = (victim->key != qk && live(sh, *victim)) ? 1 : 0;
+	// Keep each list contiguous in the ring
+	size_t off = (size_t)(sh.head % ringsz_);
+	if(off + hits.size() > ringsz_) {
+		sh.head += ringsz_ - off;
+		off = 0;
+	}
+	for(size_t j = 0; j < hits.size(); j++) {
+		sh.ring[off + j] = hits[j];
+	}
+	victim->key = qk;
+	victim->n = (uint32_t)hits.size();
+	victim->uses = 0;
+	victim->start = sh.head;
+	sh.head += hits.size();
+	return evicted;
+}
+
+/// Identifies a seed cache file, and the version of its layout
+static const char SEED_CACHE_MAGIC[8] = { 'B', 'T', '2', 'S', 'E', 'E', 'D', 'C' };
+static const uint32_t SEED_CACHE_VERSION = 2;
+
+/**
+ * Fold the 'words' 8-byte words at 'p' into checksum 'h' (FNV-1a over
+ * words).  Keys and hits are whole numbers of words, so a file's
+ * checksum can be built up record by record as it is written.
+ */
+static uint64_t seedCacheChecksum(uint64_t h, const void *p, size_t words) {
+	const char *b = (const char*)p;
+	for(size_t i = 0; i < words; i++) {
+		uint64_t w;
+		memcpy(&w, b + i * 8, 8);
+		h = (h ^ w) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+/// Checksum of no words
+static const uint64_t SEED_CACHE_CHECKSUM0 = 0xcbf29ce484222325ull;
+
+size_t SharedSeedCache::findInFile(const QKey& qk) const {
+	size_t lo = 0, hi = (size_t)nfkeys_;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const FileKey& k = fkeys_[mid];
+		if(k.seq < qk.seq || (k.seq == qk.seq && k.len < qk.len)) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if(lo < nfkeys_ && fkeys_[lo].seq == qk.seq && fkeys_[lo].len == qk.len) {
+		return lo;
+	}
+	return (size_t)nfkeys_;
+}
+
+uint64_t SharedSeedCache::fileHits() const {
+	uint64_t tot = 0;
+	for(uint64_t i = 0; i < nfkeys_; i++) {
+		tot += fuses_[i];
+	}
+	return tot;
+}
+
+uint64_t SharedSeedCache::shardHits(uint64_t& lookups) const {
+	uint64_t tot = 0;
+	lookups = 0;
+	for(size_t i = 0; i < nshards_; i++) {
+		tot += shards_[i].hits;
+		lookups += shards_[i].lookups;
+	}
+	return tot;
+}
+
+void SharedSeedCache::unload() {
+	if(file_ != NULL) {
+#ifdef BOWTIE_MM
+		if(fileMapped_) {
+			munmap(file_, fileSz_);
+		} else
+#endif
+		{
+			delete[] (uint64_t*)file_;
+		}
+	}
+	delete[] fuses_;
+	file_ = NULL;
+	fileSz_ = 0;
+	fileMapped_ = false;
+	fkeys_ = NULL;
+	fhits_ = NULL;
+	nfkeys_ = nfhits_ = 0;
+	fuses_ = NULL;
+}
+
+bool SharedSeedCache::load(const std::string& fname, uint64_t index, uint64_t params) {
+	unload();
+	int fd = open(fname.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(FileHeader)) {
+		close(fd);
+		return false;
+	}
+	fileSz_ = (size_t)st.st_size;
+#ifdef BOWTIE_MM
+	void *m = mmap(NULL, fileSz_, PROT_READ, MAP_SHARED, fd, 0);
+	if(m != MAP_FAILED) {
+		file_ = (char*)m;
+		fileMapped_ = true;
+	}
+#endif
+	if(file_ == NULL) {
+		// Keep the contents 8-byte aligned, as a mapping would be
+		file_ = (char*)new uint64_t[(fileSz_ + 7) / 8];
+		size_t got = 0;
+		while(got < fileSz_) {
+			ssize_t r = read(fd, file_ + got, fileSz_ - got);
+			if(r <= 0) break;
+			got += (size_t)r;
+		}
+		if(got < fileSz_) {
+			close(fd);
+			unload();
+			return false;
+		}
+	}
+	close(fd);
+	const FileHeader& hd = *(const FileHeader*)file_;
+	uint64_t keysOff = sizeof(FileHeader);
+	uint64_t hitsOff = keysOff + hd.nkeys * sizeof(FileKey);
+	if(memcmp(hd.magic, SEED_CACHE_MAGIC, sizeof(hd.magic)) != 0 ||
+	   hd.version != SEED_CACHE_VERSION ||
+	   hd.offBytes != sizeof(TIndexOffU) ||
+	   hd.index != index ||
+	   hd.params != params ||
+	   hd.nkeys > fileSz_ / sizeof(FileKey) ||
+	   hd.nhits > fileSz_ / sizeof(FileHit) ||
+	   hitsOff + hd.nhits * sizeof(FileHit) != fileSz_)
+	{
+		unload();
+		return false;
+	}
+	// A file torn by a crash or by two runs saving at once could still
+	// have the right sizes
+	if(seedCacheChecksum(SEED_CACHE_CHECKSUM0, file_ + keysOff, (fileSz_ - keysOff) / 8) !=
+	   hd.checksum)
+	{
+		unload();
+		return false;
+	}
+	fkeys_ = (const FileKey*)(file_ + keysOff);
+	fhits_ = (const FileHit*)(file_ + hitsOff);
+	nfkeys_ = hd.nkeys;
+	nfhits_ = hd.nhits;
+	for(uint64_t i = 0; i < nfkeys_; i++) {
+		if(fkeys_[i].start + fkeys_[i].n > nfhits_) {
+			unload();
+			return false;
+		}
+	}
+	fuses_ = new uint32_t[nfkeys_ + 1];
+	memset(fuses_, 0, (nfkeys_ + 1) * sizeof(uint32_t));
+	return true;
+}
+
+/// A seed that save() might write, from the file in use or a shard
+struct SeedCacheCand {
+	uint64_t seq;
+	uint32_t len;
+	uint32_t n;
+	uint64_t uses;
+	const void *hits; // first hit: FileHit in the file or SeedCacheHit in a ring
+
+	/// Rank by uses, most first, then by fewest hits
+	bool operator<(const SeedCacheCand& o) const {
+		if(uses != o.uses) return uses > o.uses;
+		if(n != o.n) return n < o.n;
+		return seq < o.seq || (seq == o.seq && len < o.len);
+	}
+};
+
+/// Order by key, as the keys of a cache file are
+static bool candKeyLess(const SeedCacheCand& a, const SeedCacheCand& b) {
+	return a.seq < b.seq || (a.seq == b.seq && a.len < b.len);
+}
+
+bool SharedSeedCache::save(
+	const std::string& fname,
+	uint64_t index,
+	uint64_t params,
+	uint64_t maxBytes) const
+{
+	EList<SeedCacheCand> cands(CA_CAT);
+	// Older lookups count for half as much each time the file is saved
+	for(uint64_t i = 0; i < nfkeys_; i++) {
+		const FileKey& k = fkeys_[i];
+		cands.expand();
+		SeedCacheCand& c = cands.back();
+		c.seq = k.seq;
+		c.len = k.len;
+		c.n = k.n;
+		c.uses = k.uses / 2 + fuses_[i];
+		c.hits = &fhits_[k.start];
+	}
+	for(size_t i = 0; i < nshards_; i++) {
+		const Shard& sh = shards_[i];
+		for(size_t j = 0; j < nslots_; j++) {
+			const Slot& s = sh.slots[j];
+			if(!live(sh, s)) {
+				continue;
+			}
+			cands.expand();
+			SeedCacheCand& c = cands.back();
+			c.seq = s.key.seq;
+			c.len = s.key.len;
+			c.n = s.n;
+			// Count the search that found the hits as a use
+			c.uses = (uint64_t)s.uses + 1;
+			c.hits = &sh.ring[(size_t)(s.start % ringsz_)];
+		}
+	}
+	cands.sort();
+	// Keep the most used seeds that fit
+	uint64_t bytes = sizeof(FileHeader);
+	size_t nkeep = 0;
+	uint64_t nhits = 0;
+	for(; nkeep < cands.size(); nkeep++) {
+		uint64_t b = sizeof(FileKey) + cands[nkeep].n * sizeof(FileHit);
+		if(bytes + b > maxBytes) {
+			break;
+		}
+		bytes += b;
+		nhits += cands[nkeep].n;
+	}
+	std::sort(cands.ptr(), cands.ptr() + nkeep, candKeyLess);
+	// Write to a new file and move it into place, so a run mapping the
+	// old one is unaffected.  The new file's name is unique, so runs
+	// saving to the same file at once don't write into each other's.
+	std::string tmp = fname + ".XXXXXX";
+	EList<char> tmpName(CA_CAT);
+	tmpName.resize(tmp.length() + 1);
+	memcpy(tmpName.ptr(), tmp.c_str(), tmp.length() + 1);
+	int fd = mkstemp(tmpName.ptr());
+	if(fd < 0) {
+		return false;
+	}
+	tmp = tmpName.ptr();
+	// mkstemp() makes the file private; give it the usual permissions
+	mode_t um = umask(0);
+	umask(um);
+	fchmod(fd, 0666 & ~um);
+	FILE *f = fdopen(fd, "wb");
+	if(f == NULL) {
+		close(fd);
+		remove(tmp.c_str());
+		return false;
+	}
+	FileHeader hd;
+	memset(&hd, 0, sizeof(hd));
+	memcpy(hd.magic, SEED_CACHE_MAGIC, sizeof(hd.magic));
+	hd.version = SEED_CACHE_VERSION;
+	hd.offBytes = sizeof(TIndexOffU);
+	hd.index = index;
+	hd.params = params;
+	hd.nkeys = nkeep;
+	hd.nhits = nhits;
+	hd.checksum = SEED_CACHE_CHECKSUM0;
+	// The header is written again with the checksum at the end
+	bool ok = fwrite(&hd, sizeof(hd), 1, f) == 1;
+	uint64_t start = 0;
+	for(size_t i = 0; ok && i < nkeep; i++) {
+		FileKey k;
+		memset(&k, 0, sizeof(k));
+		k.seq = cands[i].seq;
+		k.len = cands[i].len;
+		k.n = cands[i].n;
+		k.start = start;
+		k.uses = cands[i].uses;
+		ok = fwrite(&k, sizeof(k), 1, f) == 1;
+		hd.checksum = seedCacheChecksum(hd.checksum, &k, sizeof(k) / 8);
+		start += k.n;
+	}
+	for(size_t i = 0; ok && i < nkeep; i++) {
+		const SeedCacheCand& c = cands[i];
+		bool inFile = (c.hits >= (const void*)fhits_ && c.hits < (const void*)(fhits_ + nfhits_));
+		for(uint32_t j = 0; ok && j < c.n; j++) {
+			FileHit fh;
+			memset(&fh, 0, sizeof(fh));
+			if(inFile) {
+				fh = ((const FileHit*)c.hits)[j];
+			} else {
+				const SeedCacheHit& hit = ((const SeedCacheHit*)c.hits)[j];
+				fh.seq = hit.key.seq;
+				fh.len = hit.key.len;
+				fh.topf = hit.topf;
+				fh.botf = hit.botf;
+				fh.topb = hit.topb;
+				fh.botb = hit.botb;
+			}
+			ok = fwrite(&fh, sizeof(fh), 1, f) == 1;
+			hd.checksum = seedCacheChecksum(hd.checksum, &fh, sizeof(fh) / 8);
+		}
+	}
+	ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&hd, sizeof(hd), 1, f) == 1;
+	ok = (fclose(f) == 0) && ok;
+	if(!ok || rename(tmp.c_str(), fname.c_str()) != 0) {
+		remove(tmp.c_str());
+		return false;
+	}
+	return true;
+}
+
 #ifdef ALIGNER_CACHE_MAIN
 
 #include <iostream>
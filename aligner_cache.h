@@ -56,6 +56,7 @@
  */
 
 #include <iostream>
+#include <string>
 #include "ds.h"
 #include "read.h"
 #include "threading.h"
@@ -659,10 +660,241 @@ private:
 	}
 };
 
+/**
+ * One reference substring found for a seed, with its SA ranges in the
+ * BWT and BWT' indexes; what SeedAligner::reportHit() hands to
+ * AlignmentCacheIface::addOnTheFly().
+ */
+struct SeedCacheHit {
+	SAKey      key;  // reference substring
+	TIndexOffU topf; // top in BWT index
+	TIndexOffU botf; // bot in BWT index
+	TIndexOffU topb; // top in BWT' index
+	TIndexOffU botb; // bot in BWT' index
+};
+
+/**
+ * Across-read seed cache shared by all search threads: maps a seed
+ * sequence (QKey) to the list of hits the seed search found for it, so
+ * a thread aligning a seed another thread already searched can replay
+ * the hits rather than search again.
+ *
+ * The cache is split into shards picked by a hash of the key, each with
+ * its own spin lock, so with enough shards threads rarely contend and
+ * each lock is held only to copy one short hit list in or out.  Within
+ * a shard, keys live in an open-addressed table probed over a short
+ * window, and hit lists are appended to a fixed ring of hits.  A list
+ * is stale once the ring has come back around over it.  When a key's
+ * window is full, the entry written longest ago is replaced, so old
+ * entries give way to new ones first-in first-out.  Memory use is fixed
+ * by the budget given to init() and never grows.
+ *
+ * The cache can also be kept between runs in a file (--seed-cache-file).
+ * load() maps a file written by an earlier run read-only; lookups try
+ * it first, without taking a lock, then the shards.  save() writes the
+ * seeds of the file and of the shards that were looked up most often,
+ * up to a size limit, so the file comes to hold the seeds a library's
+ * reads hit most.  A file is tied to the index and to the seed search
+ * settings it was written for and is ignored by runs with others.
+ */
+class SharedSeedCache {
+
+public:
+
+	SharedSeedCache() :
+		shards_(NULL),
+		nshards_(0),
+		nslots_(0),
+		ringsz_(0),
+		file_(NULL),
+		fileSz_(0),
+		fileMapped_(false),
+		fkeys_(NULL),
+		nfkeys_(0),
+		fhits_(NULL),
+		nfhits_(0),
+		fuses_(NULL) { }
+
+	~SharedSeedCache() {
+		delete[] shards_;
+		unload();
+	}
+
+	/**
+	 * Allocate shards totalling at most 'bytes' bytes for use by
+	 * 'nthreads' threads.  Returns false, leaving the cache disabled,
+	 * if the budget is too small to hold a useful cache.
+	 */
+	bool init(uint64_t bytes, int nthreads);
+
+	/**
+	 * Return true iff init() succeeded.
+	 */
+	bool enabled() const {
+		return shards_ != NULL;
+	}
+
+	/**
+	 * Return the number of bytes held by the shards.
+	 */
+	uint64_t bytes() const {
+		return (uint64_t)nshards_ *
+		       (nslots_ * sizeof(Slot) + ringsz_ * sizeof(SeedCacheHit));
+	}
+
+	/**
+	 * If hits for 'qk' are cached, append them to 'hits' and return
+	 * true.  Otherwise return false.
+	 */
+	bool lookup(const QKey& qk, EList<SeedCacheHit>& hits);
+
+	/**
+	 * Cache 'hits' as the hits for 'qk'.  Returns the number of live
+	 * entries (0 or 1) that had to be replaced to make room.
+	 */
+	size_t insert(const QKey& qk, const EList<SeedCacheHit>& hits);
+
+	/**
+	 * Map the cache file 'fname' for lookups, if it was written by
+	 * save() for the index with fingerprint 'index' and for seed search
+	 * settings 'params'.  Returns false, leaving no file in use, if it
+	 * doesn't exist or doesn't match.
+	 */
+	bool load(const std::string& fname, uint64_t index, uint64_t params);
+
+	/**
+	 * Write the most looked-up seeds of the file in use and of the
+	 * shards to cache file 'fname', in at most 'maxBytes' bytes.
+	 * Returns false if it couldn't be written.
+	 */
+	bool save(
+		const std::string& fname,
+		uint64_t index,
+		uint64_t params,
+		uint64_t maxBytes) const;
+
+	/**
+	 * Return the number of seeds in the file in use.
+	 */
+	uint64_t fileSeeds() const {
+		return nfkeys_;
+	}
+
+	/**
+	 * Return the number of lookups answered from the file so far.
+	 */
+	uint64_t fileHits() const;
+
+	/**
+	 * Return the number of lookups answered from the shards so far,
+	 * and in 'lookups' the number of lookups that reached the shards.
+	 */
+	uint64_t shardHits(uint64_t& lookups) const;
+
+private:
+
+	struct Slot {
+		QKey     key;   // seed sequence; len 0xffffffff = empty
+		uint32_t n;     // # hits
+		uint32_t uses;  // # lookups it answered
+		uint64_t start; // ring position of first hit
+	};
+
+	/// A seed in a cache file; the keys are sorted
+	struct FileKey {
+		uint64_t seq;   // as in QKey
+		uint32_t len;
+		uint32_t n;     // # hits
+		uint64_t start; // index of first hit
+		uint64_t uses;  // lookups answered, halved each time it's saved
+	};
+
+	/// A hit in a cache file
+	struct FileHit {
+		uint64_t   seq; // reference substring, as in QKey
+		uint32_t   len;
+		uint32_t   pad;
+		TIndexOffU topf;
+		TIndexOffU botf;
+		TIndexOffU topb;
+		TIndexOffU botb;
+	};
+
+	/// Start of a cache file
+	struct FileHeader {
+		char     magic[8];
+		uint32_t version;
+		uint32_t offBytes; // sizeof(TIndexOffU)
+		uint64_t index;    // fingerprint of the index
+		uint64_t params;   // seed search settings
+		uint64_t nkeys;
+		uint64_t nhits;
+		uint64_t checksum; // of the keys and hits, see seedCacheChecksum()
+	};
+
+	/**
+	 * Return the position in the file of the key equal to 'qk', or
+	 * nfkeys_ if there's none.
+	 */
+	size_t findInFile(const QKey& qk) const;
+
+	/**
+	 * Stop using the cache file, if any.
+	 */
+	void unload();
+
+	struct Shard {
+		Shard() : slots(CA_CAT), ring(CA_CAT), head(0), lookups(0), hits(0) { }
+
+		MUTEX_T             lock;
+		EList<Slot>         slots;
+		EList<SeedCacheHit> ring;
+		uint64_t            head;  // ring position of next hit written
+		uint64_t            lookups; // # lookups not answered by the file
+		uint64_t            hits;    // # of those answered
+	};
+
+	/**
+	 * Return true iff 's' holds an entry whose hits are still intact.
+	 */
+	bool live(const Shard& sh, const Slot& s) const {
+		return s.key.cacheable() && s.start + ringsz_ >= sh.head;
+	}
+
+	/**
+	 * Mix the bits of a key; the high half picks the shard and the low
+	 * half the first slot probed.
+	 */
+	static uint64_t hash(const QKey& qk) {
+		uint64_t h = (qk.seq ^ ((uint64_t)qk.len << 58)) * 0x9e3779b97f4a7c15ull;
+		return h ^ (h >> 29);
+	}
+
+	Shard   *shards_;
+	size_t   nshards_; // power of 2
+	size_t   nslots_;  // slots per shard, power of 2
+	size_t   ringsz_;  // hits per shard
+
+	char          *file_;      // contents of the cache file in use
+	size_t         fileSz_;
+	bool           fileMapped_; // file_ is mapped rather than read in
+	const FileKey *fkeys_;
+	uint64_t       nfkeys_;
+	const FileHit *fhits_;
+	uint64_t       nfhits_;
+	uint32_t      *fuses_;     // lookups each file key answered this run
+};
+
 /**
  * Interface used to query and update a pair of caches: one thread-
  * local and unsynchronized, another shared and synchronized.  One or
  * both can be NULL.
+ *
+ * The shared cache holds hit lists rather than QVals; hits found for a
+ * seed are gathered as they're added to the current-read cache and
+ * published to the shared cache by finishAlign(), and hits looked up in
+ * the shared cache are replayed into the current-read cache with
+ * addOnTheFly().
  */
 class AlignmentCacheIface {
 
@@ -671,15 +903,18 @@ public:
 	AlignmentCacheIface(
 		AlignmentCache *current,
 		AlignmentCache *local,
-		AlignmentCache *shared) :
+		SharedSeedCache *shared) :
 		qk_(),
 		qv_(NULL),
 		cacheable_(false),
+		publish_(false),
+		unshared_(false),
 		rangen_(0),
 		eltsn_(0),
 		current_(current),
 		local_(local),
-		shared_(shared)
+		shared_(shared),
+		hits_(CA_CAT)
 	{
 		assert(current_ != NULL);
 	}
@@ -698,8 +933,8 @@ public:
 	 */
 	QVal* queryCopy(const QKey& qk, bool getLock = true) {
 		assert(qk.cacheable());
-		AlignmentCache* caches[3] = { current_, local_, shared_ };
-		for(int i = 0; i < 3; i++) {
+		AlignmentCache* caches[2] = { current_, local_ };
+		for(int i = 0; i < 2; i++) {
 			if(caches[i] == NULL) continue;
 			QVal* qv = caches[i]->query(qk, getLock);
 			if(qv != NULL) {
@@ -730,8 +965,8 @@ public:
 		bool getLock = true)
 	{
 		assert(qk.cacheable());
-		AlignmentCache* caches[3] = { current_, local_, shared_ };
-		for(int i = 0; i < 3; i++) {
+		AlignmentCache* caches[2] = { current_, local_ };
+		for(int i = 0; i < 2; i++) {
 			if(caches[i] == NULL) continue;
 			QVal* qv = caches[i]->query(qk, getLock);
 			if(qv != NULL) {
@@ -750,32 +985,39 @@ public:
 	 * map but the corresponding reference substrings are still added
 	 * to the qlist_.
 	 *
+	 * If 'reuse' is true, the caller promises that the hits for this
+	 * substring depend only on its sequence, so hits found for the same
+	 * sequence earlier in this read may be returned, and if 'publish'
+	 * is also true the hits found now are offered to the shared cache
+	 * by finishAlign().
+	 *
 	 * Returns:
 	 *  -1 if out of memory
-	 *  0 if key was found in cache
-	 *  1 if key was not found in cache (and there's enough memory to
+	 *  0 if key was not found in cache (and there's enough memory to
 	 *    add a new key)
+	 *  1 if key was found in the current-read cache; 'qv' holds it
 	 */
 	int beginAlign(
 		const BTDnaString& seq,
 		const BTString& qual,
 		QVal& qv,              // out: filled in if we find it in the cache
+		bool reuse = false,    // true -> may reuse this read's earlier hits
+		bool publish = false,  // true -> publish hits to shared cache
 		bool getLock = true)
 	{
 		assert(repOk());
 		qk_.init(seq ASSERT_ONLY(, tmpdnastr_));
-		//if(qk_.cacheable() && (qv_ = current_->query(qk_, getLock)) != NULL) {
-		//	// qv_ holds the answer
-		//	assert(qv_->valid());
-		//	qv = *qv_;
-		//	resetRead();
-		//	return 1; // found in cache
-		//} else
 		if(qk_.cacheable()) {
 			// Make a QNode for this key and possibly add the QNode to the
 			// Red-Black map; but if 'seq' isn't cacheable, just create the
 			// QNode (without adding it to the map).
 			qv_ = current_->add(qk_, &cacheable_, getLock);
+			if(qv_ != NULL && !cacheable_ && reuse && !unshared_ && qv_->valid()) {
+				// Already searched for this sequence
+				qv = *qv_;
+				resetRead();
+				return 1;
+			}
 		} else {
 			qv_ = &qvbuf_;
 		}
@@ -783,6 +1025,12 @@ public:
 			resetRead();
  			return -1; // Not in memory
 		}
+		if(!reuse) {
+			// Hits in the current-read cache may now depend on more than
+			// their sequence
+			unshared_ = true;
+		}
+		publish_ = publish && reuse && shared_ != NULL && qk_.cacheable();
 		qv_->reset();
 		return 0; // Need to search for it
 	}
@@ -794,37 +1042,22 @@ public:
 	 * final QVal object and resets the alignment state of the
 	 * current-read cache.
 	 *
-	 * Also, if the alignment is cacheable, it commits it to the next
-	 * cache up in the cache hierarchy.
+	 * Also, if beginAlign() was asked to publish, it commits the hits
+	 * to the shared cache and adds the number of entries that made room
+	 * for them to 'evicted'.
 	 */
-	QVal finishAlign(bool getLock = true) {
+	QVal finishAlign(size_t *evicted = NULL, bool getLock = true) {
 		if(!qv_->valid()) {
 			qv_->init(0, 0, 0);
 		}
 		// Copy this pointer because we're about to reset the qv_ field
 		// to NULL
 		QVal* qv = qv_;
-		// Commit the contents of the current-read cache to the next
-		// cache up in the hierarchy.
-		// If qk is cacheable, then it must be in the cache
-#if 0
-		if(qk_.cacheable()) {
-			AlignmentCache* caches[3] = { current_, local_, shared_ };
-			ASSERT_ONLY(AlignmentCache* which);
-			ASSERT_ONLY(QVal* qv2 = query(qk_, &which, true));
-			assert(qv2 == qv);
-			assert(which == current_);
-			for(int i = 1; i < 3; i++) {
-				if(caches[i] != NULL) {
-					// Copy this key/value pair to the to the higher
-					// level cache and, if its memory is exhausted,
-					// clear the cache and try again.
-					caches[i]->clearCopy(qk_, *qv_, *current_, getLock);
-					break;
-				}
-			}
+		// Commit the hits to the shared cache
+		if(publish_) {
+			size_t ev = shared_->insert(qk_, hits_);
+			if(evicted != NULL) *evicted += ev;
 		}
-#endif
 		// Reset the state in this iface in preparation for the next
 		// alignment.
 		resetRead();
@@ -832,6 +1065,40 @@ public:
 		return *qv;
 	}
 
+	/**
+	 * Called instead of finishAlign() when the search for a read
+	 * substring was cut short.  Its partial hits are forgotten so they
+	 * are never mistaken for a finished search.
+	 */
+	void abortAlign() {
+		if(qv_ != NULL) {
+			qv_->reset();
+		}
+		resetRead();
+	}
+
+	/**
+	 * Look 'seq' up in the shared cache and, if it's there, append its
+	 * hits to 'hits' and return true.
+	 */
+	bool lookupShared(const BTDnaString& seq, EList<SeedCacheHit>& hits) {
+		if(shared_ == NULL) {
+			return false;
+		}
+		QKey qk(seq ASSERT_ONLY(, tmpdnastr_));
+		return qk.cacheable() && shared_->lookup(qk, hits);
+	}
+
+	/**
+	 * Return true iff there is a shared cache.
+	 */
+	bool hasShared() const { return shared_ != NULL; }
+
+	/**
+	 * Return true iff finishAlign() will publish the current hits.
+	 */
+	bool publishing() const { return publish_; }
+
 	/**
 	 * A call to this member indicates that the caller has finished
 	 * with the last read (if any) and is ready to work on the next.
@@ -841,6 +1108,7 @@ public:
 	void nextRead() {
 		current_->clear();
 		resetRead();
+		unshared_ = false;
 		assert(!aligning());
 	}
 	
@@ -857,7 +1125,6 @@ public:
 	void clear() {
 		if(current_ != NULL) current_->clear();
 		if(local_   != NULL) local_->clear();
-		if(shared_  != NULL) shared_->clear();
 	}
 	
 	/**
@@ -878,9 +1145,33 @@ public:
 		ASSERT_ONLY(BTDnaString tmp);
 		SAKey sak(rfseq ASSERT_ONLY(, tmp));
 		//assert(sak.cacheable());
+		return addOnTheFly(sak, topf, botf, topb, botb, getLock);
+	}
+
+	/**
+	 * Add an alignment, keyed by the reference substring, to the
+	 * running list of alignments being compiled for the current read
+	 * in the local cache.  Used to replay hits from the shared cache.
+	 */
+	bool addOnTheFly(
+		const SAKey& sak,         // reference sequence close to read seq
+		TIndexOffU topf,            // top in BWT index
+		TIndexOffU botf,            // bot in BWT index
+		TIndexOffU topb,            // top in BWT' index
+		TIndexOffU botb,            // bot in BWT' index
+		bool getLock = true)      // true -> lock is not held by caller
+	{
+		assert(aligning());
 		if(current_->addOnTheFly((*qv_), sak, topf, botf, topb, botb, getLock)) {
 			rangen_++;
 			eltsn_ += (botf-topf);
+			if(publish_) {
+				hits_.expand();
+				SeedCacheHit& h = hits_.back();
+				h.key = sak;
+				h.topf = topf; h.botf = botf;
+				h.topb = topb; h.botb = botb;
+			}
 			return true;
 		}
 		return false;
@@ -939,21 +1230,27 @@ protected:
 	 */
 	void resetRead() {
 		cacheable_ = false;
+		publish_ = false;
 		rangen_ = eltsn_ = 0;
 		qv_ = NULL;
+		hits_.clear();
 	}
 
 	QKey qk_;  // key representation for current read substring
 	QVal *qv_; // pointer to value representation for current read substring
 	QVal qvbuf_; // buffer for when key is uncacheable but we need a qv
 	bool cacheable_; // true iff the read substring currently being aligned is cacheable
+	bool publish_;   // true -> publish hits for current substring to shared_
+	bool unshared_;  // true -> current-read cache has hits that can't be reused
 	
 	size_t rangen_; // number of ranges since last alignment job began
 	size_t eltsn_;  // number of elements since last alignment job began
 
 	AlignmentCache *current_; // cache dedicated to the current read
 	AlignmentCache *local_;   // local, unsynchronized cache
-	AlignmentCache *shared_;  // shared, synchronized cache
+	SharedSeedCache *shared_; // shared, synchronized cache
+
+	EList<SeedCacheHit> hits_; // hits for current substring, if publishing
 };
 
 #endif /*ALIGNER_CACHE_H_*/
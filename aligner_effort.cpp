@@ -0,0 +1,204 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <iomanip>
+#include <algorithm>
+#include "aligner_effort.h"
+#include "assert_helpers.h"
+
+using namespace std;
+
+/// A step up in effort is kept only if the fraction of reads aligning
+/// rose by this many standard errors (one-sided test at about 5%)
+static const double minGainZ = 1.645;
+
+/// Levels ruled out by the ceiling are tried again after this many
+/// epochs, in case the reads have changed
+static const int retryEpochs = 16;
+
+/// Step effort up only when the average read costs less than this
+/// fraction of the budget, so one step up is unlikely to overshoot
+static const double headroom = 0.7;
+
+const int EffortTally::nlevels;
+const uint64_t AdaptiveEffort::flushReads;
+const int AdaptiveEffort::nlevels;
+const int AdaptiveEffort::neutral;
+
+AdaptiveEffort::AdaptiveEffort() :
+	workBudget_(0),
+	usBudget_(0),
+	epochReads_(0),
+	level_(neutral),
+	ceiling_(nlevels - 1),
+	ceilingAge_(0),
+	lastMove_(0),
+	nadjust_(0)
+{
+	base_.maxIters = base_.maxUg = base_.maxDp = 0;
+	base_.maxDpStreak = base_.maxMateStreak = base_.nSeedRounds = 0;
+	base_.ivalMult = 1.0;
+}
+
+void AdaptiveEffort::init(
+	const EffortLimits& base,
+	uint64_t workBudget,
+	uint64_t usBudget,
+	uint64_t epochReads)
+{
+	base_ = base;
+	workBudget_ = workBudget;
+	usBudget_ = usBudget;
+	epochReads_ = max<uint64_t>(epochReads, flushReads);
+	level_ = neutral;
+	ceiling_ = nlevels - 1;
+	ceilingAge_ = 0;
+	lastMove_ = 0;
+	epoch_.reset();
+	prev_.reset();
+	total_.reset();
+	nadjust_ = 0;
+}
+
+/**
+ * Scale 'x' by 'm', rounding, but never below 1.
+ */
+static size_t scaleLimit(size_t x, double m) {
+	return max<size_t>((size_t)(x * m + 0.5), 1);
+}
+
+void AdaptiveEffort::limitsAt(int level, EffortLimits& lim) const {
+	lim = base_;
+	if(level == neutral) {
+		return;
+	}
+	double m = pow(2.0, (level - neutral) / 2.0);
+	lim.maxIters      = scaleLimit(base_.maxIters, m);
+	lim.maxUg         = scaleLimit(base_.maxUg, m);
+	lim.maxDp         = scaleLimit(base_.maxDp, m);
+	lim.maxDpStreak   = scaleLimit(base_.maxDpStreak, m);
+	lim.maxMateStreak = scaleLimit(base_.maxMateStreak, m);
+	lim.nSeedRounds   = scaleLimit(base_.nSeedRounds, m);
+	// Seeding is the one cost every read pays, so the seed interval
+	// changes more gently than the rest
+	lim.ivalMult      = base_.ivalMult / sqrt(m);
+}
+
+void AdaptiveEffort::flush(EffortTally& t) {
+	if(t.reads == 0) {
+		return;
+	}
+	ThreadSafe ts(lock_);
+	epoch_.add(t);
+	t.reset();
+	if(epoch_.reads >= epochReads_) {
+		adjust();
+	}
+}
+
+bool AdaptiveEffort::gainedAt(int level) const {
+	assert_gt(level, 0);
+	double n1 = (double)prev_.levelReads[level - 1];
+	double n2 = (double)epoch_.levelReads[level];
+	if(n1 == 0 || n2 == 0) {
+		return false;
+	}
+	double a1 = (double)prev_.levelAligned[level - 1];
+	double a2 = (double)epoch_.levelAligned[level];
+	// Two-proportion z-test, with the pooled rate for the standard error
+	double p = (a1 + a2) / (n1 + n2);
+	double se = sqrt(p * (1.0 - p) * (1.0 / n1 + 1.0 / n2));
+	return a2 / n2 - a1 / n1 > minGainZ * se;
+}
+
+void AdaptiveEffort::adjust() {
+	double reads = (double)epoch_.reads;
+	double work  = epoch_.work / reads;
+	double usecs = epoch_.usecs / reads;
+	bool over  = (workBudget_ > 0 && work  > workBudget_) ||
+	             (usBudget_   > 0 && usecs > usBudget_);
+	bool under = (workBudget_ == 0 || work  < headroom * workBudget_) &&
+	             (usBudget_   == 0 || usecs < headroom * usBudget_);
+	int level = level_;
+	if(ceiling_ < nlevels - 1 && ++ceilingAge_ >= retryEpochs) {
+		// Give the next level up another chance
+		ceiling_++;
+		ceilingAge_ = 0;
+	}
+	int move = 0;
+	if(over) {
+		if(lastMove_ > 0) {
+			// Don't come back up to a level that went over budget
+			ceiling_ = level - 1;
+			ceilingAge_ = 0;
+		}
+		if(level > 0) move = -1;
+	} else if(lastMove_ > 0 && !gainedAt(level)) {
+		// The last step up didn't pay for itself
+		ceiling_ = level - 1;
+		ceilingAge_ = 0;
+		move = -1;
+	} else if(under && level < ceiling_) {
+		move = 1;
+	}
+	if(move != 0) {
+		level_ = level + move;
+		nadjust_++;
+	}
+	lastMove_ = move;
+	total_.add(epoch_);
+	prev_ = epoch_;
+	epoch_.reset();
+}
+
+void AdaptiveEffort::report(ostream& os) const {
+	ThreadSafe ts(lock_);
+	EffortTally tot = total_;
+	tot.add(epoch_);
+	double wsum = 0.0;
+	for(int i = 0; i < nlevels; i++) {
+		wsum += tot.levelReads[i] * pow(2.0, (i - neutral) / 2.0);
+	}
+	EffortLimits lim;
+	limitsAt(level_, lim);
+	ios_base::fmtflags flags = os.flags();
+	streamsize prec = os.precision();
+	os << fixed << setprecision(2);
+	os << "Adaptive effort: " << nadjust_ << (nadjust_ == 1 ? " adjustment" : " adjustments")
+	   << "; average effort "
+	   << (tot.reads > 0 ? wsum / tot.reads : 1.0) << "x presets, "
+	   << pow(2.0, (level_ - neutral) / 2.0) << "x at the end" << endl;
+	os << "  Effective settings: -D " << lim.maxDpStreak
+	   << " -R " << lim.nSeedRounds
+	   << ", seed interval x" << lim.ivalMult
+	   << ", max " << lim.maxIters << " extend iterations, "
+	   << lim.maxUg << " ungapped and " << lim.maxDp << " gapped extensions, "
+	   << lim.maxMateStreak << " mate-find failures per seed range" << endl;
+	if(tot.reads > 0) {
+		os << "  Per read: " << (double)tot.work / tot.reads << " extensions";
+		if(usBudget_ > 0) {
+			os << ", " << (double)tot.usecs / tot.reads << " us";
+		}
+		os << ", " << (double)tot.rounds / tot.reads << " seed rounds";
+		os << "; " << (100.0 * tot.aligned / tot.reads) << "% aligned" << endl;
+	}
+	os.flags(flags);
+	os.precision(prec);
+}
@@ -0,0 +1,217 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALIGNER_EFFORT_H_
+#define ALIGNER_EFFORT_H_
+
+#include <stdint.h>
+#include <iostream>
+#include "threading.h"
+
+/**
+ * The limits on how hard the aligner tries with each read: -D, -R, the
+ * seed interval and the caps on extend loop iterations, ungapped and
+ * gapped extensions and mate-finding failures.
+ */
+struct EffortLimits {
+	size_t maxIters;      // max iterations of extend loop
+	size_t maxUg;         // max # ungapped extends
+	size_t maxDp;         // max # DPs
+	size_t maxDpStreak;   // max failed extends in a row (-D)
+	size_t maxMateStreak; // max mate-find failures per seed range
+	size_t nSeedRounds;   // # seed rounds (-R)
+	double ivalMult;      // multiply the seed interval by this
+};
+
+/**
+ * A worker thread's tally of the reads it aligned since it last
+ * reported to the AdaptiveEffort controller.
+ */
+struct EffortTally {
+
+	static const int nlevels = 9; // 4x down to 4x up, sqrt(2)x per step
+
+	EffortTally() { reset(); }
+
+	void reset() {
+		reads = aligned = work = usecs = rounds = 0;
+		for(int i = 0; i < nlevels; i++) {
+			levelReads[i] = levelAligned[i] = 0;
+		}
+	}
+
+	/**
+	 * Add the reads tallied in 'o' to this tally.
+	 */
+	void add(const EffortTally& o) {
+		reads   += o.reads;
+		aligned += o.aligned;
+		work    += o.work;
+		usecs   += o.usecs;
+		rounds  += o.rounds;
+		for(int i = 0; i < nlevels; i++) {
+			levelReads[i]   += o.levelReads[i];
+			levelAligned[i] += o.levelAligned[i];
+		}
+	}
+
+	uint64_t reads;   // reads or pairs aligned
+	uint64_t aligned; // ... of which at least one mate aligned
+	uint64_t work;    // extension attempts: end-to-end, ungapped and gapped
+	uint64_t usecs;   // microseconds spent aligning
+	uint64_t rounds;  // seed rounds (see -R) in which seeds were searched
+	uint64_t levelReads[nlevels];   // reads aligned at each effort level
+	uint64_t levelAligned[nlevels]; // ... of which at least one mate aligned
+};
+
+/**
+ * Scales the EffortLimits set by the presets and options up or down
+ * while aligning, to keep the average cost of a read within a budget
+ * of extension attempts and/or microseconds (--effort-budget,
+ * --effort-budget-us).
+ *
+ * Worker threads tally the cost of their reads and whether they
+ * aligned, and hand their tallies in every so often.  Once an epoch's
+ * worth of reads is in, the controller compares its average cost with
+ * the budget.  Over budget, it steps effort down.  Well under budget,
+ * it steps effort up, but if the reads aligned at the new level don't
+ * align significantly more often than those aligned at the old level
+ * in the epoch before, it steps back down and doesn't try that level
+ * again for a while.  Each step multiplies or divides the limits by
+ * sqrt(2), within a factor of 4 of the presets either way.
+ *
+ * Workers read the current level without locking, so a read may be
+ * aligned with limits one step stale; it is tallied at the level it
+ * was actually aligned at.
+ */
+class AdaptiveEffort {
+
+public:
+
+	AdaptiveEffort();
+
+	/**
+	 * Start at 'base' and keep the average read within 'workBudget'
+	 * extension attempts and 'usBudget' microseconds, either of which
+	 * may be 0 for no limit.  Decide whether to adjust every
+	 * 'epochReads' reads.  The controller is disabled if both budgets
+	 * are 0, and then limits() always gives 'base'.
+	 */
+	void init(
+		const EffortLimits& base,
+		uint64_t workBudget,
+		uint64_t usBudget,
+		uint64_t epochReads);
+
+	bool enabled() const { return workBudget_ > 0 || usBudget_ > 0; }
+
+	/**
+	 * Whether workers need to time their reads.
+	 */
+	bool timed() const { return usBudget_ > 0; }
+
+	/**
+	 * Set 'lim' to the limits at the current level and return the
+	 * level, to be passed to addRead() with the read's cost.
+	 */
+	int limits(EffortLimits& lim) const {
+		int level = level_;
+		limitsAt(level, lim);
+		return level;
+	}
+
+	/**
+	 * Count one read or pair, aligned with the limits at 'level', in
+	 * the calling thread's tally 't', and hand the tally in if it has
+	 * grown large enough.
+	 */
+	void addRead(
+		EffortTally& t,
+		int level,
+		uint64_t work,
+		uint64_t usecs,
+		uint64_t rounds,
+		bool aligned)
+	{
+		t.reads++;
+		t.work += work;
+		t.usecs += usecs;
+		t.rounds += rounds;
+		t.levelReads[level]++;
+		if(aligned) {
+			t.aligned++;
+			t.levelAligned[level]++;
+		}
+		if(t.reads >= flushReads) {
+			flush(t);
+		}
+	}
+
+	/**
+	 * Hand in and reset the tally 't', adjusting the level if that
+	 * completes an epoch.
+	 */
+	void flush(EffortTally& t);
+
+	/**
+	 * Print the settings in effect at the end and how often they were
+	 * adjusted.
+	 */
+	void report(std::ostream& os) const;
+
+	static const uint64_t flushReads = 64; // reads a thread tallies before handing them in
+
+protected:
+
+	static const int nlevels = EffortTally::nlevels;
+	static const int neutral = 4;     // the level where the limits are 'base'
+
+	/**
+	 * Set 'lim' to the limits at level 'level'.
+	 */
+	void limitsAt(int level, EffortLimits& lim) const;
+
+	/**
+	 * Pick the next level at the end of an epoch.
+	 */
+	void adjust();
+
+	/**
+	 * Whether the reads aligned at 'level' this epoch aligned
+	 * significantly more often than those aligned at 'level' - 1 in
+	 * the epoch before.
+	 */
+	bool gainedAt(int level) const;
+
+	EffortLimits base_;
+	uint64_t     workBudget_;
+	uint64_t     usBudget_;
+	uint64_t     epochReads_;
+	volatile int level_;     // current level, read by workers without locking
+	int          ceiling_;   // highest level still worth trying
+	int          ceilingAge_;// epochs since ceiling_ was last lowered
+	int          lastMove_;  // -1, 0 or 1: last adjustment
+	EffortTally  epoch_;     // tallies handed in this epoch
+	EffortTally  prev_;      // tallies handed in last epoch
+	EffortTally  total_;     // tallies handed in so far
+	uint64_t     nadjust_;   // # times the level changed
+	mutable MUTEX_T lock_;
+};
+
+#endif /*ndef ALIGNER_EFFORT_H_*/
@@ -983,6 +983,16 @@ public:
 	Coord& refcoord() {
 		return refcoord_;
 	}
+
+	/**
+	 * Add 'amt' to the id of the reference sequence aligned to, e.g. to
+	 * put an alignment to one of several indexes in terms of the
+	 * merged list of their references.
+	 */
+	void shiftRefid(TRefId amt) {
+		refcoord_.setRef(refcoord_.ref() + amt);
+		refival_.setRef(refival_.ref() + amt);
+	}
 	
 	/**
 	 * Return true if this alignment is to the Watson strand.
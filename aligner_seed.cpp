@@ -21,6 +21,7 @@
 #include "aligner_seed.h"
 #include "search_globals.h"
 #include "bt2_idx.h"
+#include "freq_kmers.h"
 
 using namespace std;
 
@@ -460,6 +461,206 @@ pair<int, int> SeedAligner::instantiateSeeds(
 	return ret;
 }
 
+/**
+ * Return true iff the given instantiated seed admits no edits, so that
+ * searchSeedBi() would do nothing more than one right-to-left exact walk
+ * through the BWT.  Such seeds can be handed to the interleaved engine.
+ */
+static inline bool isExactOnlySeed(const InstantiatedSeed& is) {
+	if(is.s.type != SEED_TYPE_EXACT || is.maxjump != (int)is.steps.size()) {
+		return false;
+	}
+	Constraint c = is.cons[0];
+	return !c.canMismatch() && !c.canN() && !c.canGap();
+}
+
+/**
+ * Take one step of the given exact walk: an LF step in the BWT, or, for
+ * the first step, a jump using the ftab or fchr.  Mirrors the exact-
+ * matching path through searchSeedBi() and nextLocsBi().  Before
+ * returning, prefetch whatever the walk's next step will touch.  Return
+ * true iff the walk is finished.
+ */
+inline bool SeedAligner::exactSeedStep(ExactSeedWalk& w) {
+	const InstantiatedSeed& s = *w.is;
+	const BTDnaString& seq = *w.seq;
+	if(w.step == 0) {
+		int off = abs(s.steps[0])-1;
+		int ftabLen = ebwtFw_->eh().ftabChars();
+		if(ftabLen > 1 && ftabLen <= s.maxjump) {
+			// ftab entries were prefetched when the walk was set up
+			w.topf = ebwtFw_->ftabHi(w.fiFw);
+			w.botf = ebwtFw_->ftabLo(w.fiFw+1);
+			if(ebwtBw_ != NULL) {
+				w.topb = ebwtBw_->ftabHi(w.fiBw);
+				w.botb = w.topb + (w.botf - w.topf);
+			}
+			w.step += ftabLen;
+		} else {
+			int c = seq[off];
+			assert_range(0, 3, c);
+			w.topf = w.topb = ebwtFw_->fchr()[c];
+			w.botf = w.botb = ebwtFw_->fchr()[c+1];
+			w.step++;
+		}
+		if(w.botf - w.topf == 0) {
+			w.done = true;
+			return true;
+		}
+	} else {
+		int off = abs(s.steps[w.step])-1;
+		int c = seq[off];
+		assert_range(0, 3, c);
+		// Loci are cheap to recompute; it's the sides they point to
+		// that we prefetched at the end of the previous step
+		SideLocus tloc, bloc;
+		INIT_LOCS(w.topf, w.botf, tloc, bloc, *ebwtFw_);
+		if(bloc.valid()) {
+			TIndexOffU t[4], b[4], tp[4], bp[4];
+			t[0] = t[1] = t[2] = t[3] = b[0] = b[1] = b[2] = b[3] = 0;
+			tp[0] = tp[1] = tp[2] = tp[3] = w.topb;
+			bp[0] = bp[1] = bp[2] = bp[3] = w.botb;
+			bwops_++;
+			ebwtFw_->mapBiLFEx(tloc, bloc, t, b, tp, bp);
+			if(b[c] == t[c]) {
+				w.done = true;
+				return true;
+			}
+			w.topf = t[c]; w.botf = b[c];
+			w.topb = tp[c]; w.botb = bp[c];
+		} else {
+			// Range has size 1; BWT' range stays put
+			bwops_++;
+			TIndexOffU top = ebwtFw_->mapLF1(w.topf, tloc, c);
+			if(top == OFF_MASK) {
+				w.done = true;
+				return true;
+			}
+			w.topf = top;
+			w.botf = top+1;
+		}
+		w.step++;
+	}
+	if(w.step == (int)s.steps.size()) {
+		w.hit = true;
+		w.done = true;
+		return true;
+	}
+	SideLocus tloc, bloc;
+	INIT_LOCS(w.topf, w.botf, tloc, bloc, *ebwtFw_);
+	tloc.prefetch(ebwtFw_->ebwt());
+	if(bloc.valid()) {
+		bloc.prefetch(ebwtFw_->ebwt());
+	}
+	return false;
+}
+
+/**
+ * Advance every walk in walks_ until all are finished.  Walks are
+ * advanced one step at a time in round-robin order; each step prefetches
+ * the memory needed by that walk's next step, so by the time we come
+ * back around to it, its side is (hopefully) already in cache.  This
+ * turns a chain of dependent cache misses per seed into many
+ * independent misses in flight at once.
+ */
+void SeedAligner::searchExactSeedsInterleaved() {
+	int ftabLen = ebwtFw_->eh().ftabChars();
+	// Compute and prefetch the ftab entries for each walk's first step
+	for(size_t i = 0; i < walks_.size(); i++) {
+		ExactSeedWalk& w = walks_[i];
+		const InstantiatedSeed& s = *w.is;
+		if(ftabLen > 1 && ftabLen <= s.maxjump) {
+			int off = abs(s.steps[0]) - ftabLen;
+			w.fiFw = ebwtFw_->ftabSeqToInt(*w.seq, off, false);
+			ebwtFw_->prefetchFtab(w.fiFw);
+			if(ebwtBw_ != NULL) {
+				w.fiBw = ebwtBw_->ftabSeqToInt(*w.seq, off, false);
+				ebwtBw_->prefetchFtab(w.fiBw);
+			}
+		}
+	}
+	size_t nlive = walks_.size();
+	while(nlive > 0) {
+		for(size_t i = 0; i < walks_.size(); i++) {
+			if(!walks_[i].done && exactSeedStep(walks_[i])) {
+				nlive--;
+			}
+		}
+	}
+}
+
+/**
+ * A seed's hits depend on the read's qualities only through the cost of
+ * each mismatch, and on the read's length only through the overall
+ * penalty budget.  If the budget covers every mismatch the zones allow
+ * even at the highest cost, and the zones allow no gaps, the hits
+ * depend on the seed sequence alone.
+ */
+bool SeedAligner::reusableSeeds(
+	const EList<InstantiatedSeed>& iss,
+	int mmMax) const
+{
+	for(size_t j = 0; j < iss.size(); j++) {
+		const InstantiatedSeed& is = iss[j];
+		int64_t mms = 0;
+		for(int k = 0; k < 3; k++) {
+			const Constraint& c = is.cons[k];
+			if(c.edits > 0 || c.ins > 0 || c.dels > 0) {
+				return false;
+			}
+			mms += min<int64_t>(c.mms, is.steps.size());
+		}
+		if((int64_t)is.overall.penalty < mms * mmMax) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Move the instantiated seeds of each seed offset and orientation
+ * estimated to occur at least 'cap' times in the reference to
+ * deferred_, keeping the least frequent one of an orientation whose
+ * seeds are all frequent.
+ */
+uint64_t SeedAligner::skipFrequentSeeds(
+	SeedResults& sr,
+	const FreqKmerTable& freq,
+	uint64_t cap)
+{
+	uint64_t skips = 0;
+	deferred_.clear();
+	freqEst_.resize(sr.numOffs());
+	for(int fwi = 0; fwi < 2; fwi++) {
+		bool fw = (fwi == 0);
+		bool anyRare = false;
+		int keep = -1;
+		for(int i = 0; i < (int)sr.numOffs(); i++) {
+			freqEst_[i] = 0;
+			if(sr.instantiatedSeeds(fw, i).empty()) {
+				continue;
+			}
+			freqEst_[i] = freq.estimate(sr.seqs(fw)[i]);
+			if(freqEst_[i] < cap) {
+				anyRare = true;
+			} else if(keep == -1 || freqEst_[i] < freqEst_[keep]) {
+				keep = i;
+			}
+		}
+		for(int i = 0; i < (int)sr.numOffs(); i++) {
+			if(freqEst_[i] >= cap && (anyRare || i != keep)) {
+				EList<InstantiatedSeed>& iss = sr.instantiatedSeeds(fw, i);
+				for(size_t j = 0; j < iss.size(); j++) {
+					deferred_.push_back(iss[j]);
+				}
+				iss.clear();
+				skips++;
+			}
+		}
+	}
+	return skips;
+}
+
 /**
  * We assume that all seeds are the same length.
  *
@@ -477,7 +678,10 @@ void SeedAligner::searchAllSeeds(
 	AlignmentCacheIface& cache,  // local cache for seed alignments
 	SeedResults& sr,             // holds all the seed hits
 	SeedSearchMetrics& met,      // metrics
-	PerReadMetrics& prm)         // per-read metrics
+	PerReadMetrics& prm,         // per-read metrics
+	bool interleave,             // interleave exact seed searches
+	const FreqKmerTable* freq,   // frequent k-mers in the reference
+	uint64_t freqCap)            // skip seeds occurring this often
 {
 	assert(!seeds.empty());
 	assert(ebwtFw != NULL);
@@ -489,13 +693,130 @@ void SeedAligner::searchAllSeeds(
 	read_ = &read;
 	ca_ = &cache;
 	bwops_ = bwedits_ = 0;
+	int mmMax = 0;
+	for(int q = 0; q < 256; q++) {
+		mmMax = max(mmMax, pens.mm(q));
+	}
+	uint64_t freqskips = 0;
+	if(freq != NULL && freqCap > 0) {
+		freqskips = skipFrequentSeeds(sr, *freq, freqCap);
+	}
+	searchInstantiatedSeeds(sr, mmMax, interleave, met);
+	if(sr.empty() && !deferred_.empty()) {
+		// None of the seeds we kept hit, which is likely when the read
+		// lies wholly in a repeat and the kept seeds have errors, so
+		// search the frequent ones after all
+		for(int i = 0; i < (int)sr.numOffs(); i++) {
+			sr.instantiatedSeeds(true, i).clear();
+			sr.instantiatedSeeds(false, i).clear();
+		}
+		for(size_t j = 0; j < deferred_.size(); j++) {
+			const InstantiatedSeed& is = deferred_[j];
+			sr.instantiatedSeeds(is.fw, is.seedoffidx).push_back(is);
+		}
+		deferred_.clear();
+		freqskips = 0;
+		searchInstantiatedSeeds(sr, mmMax, interleave, met);
+	}
+	prm.nSeedRanges = sr.numRanges();
+	prm.nSeedElts = sr.numElts();
+	prm.nSeedRangesFw = sr.numRangesFw();
+	prm.nSeedRangesRc = sr.numRangesRc();
+	prm.nSeedEltsFw = sr.numEltsFw();
+	prm.nSeedEltsRc = sr.numEltsRc();
+	prm.seedMedian = (uint64_t)(sr.medianHitsPerSeed() + 0.5);
+	prm.seedMean = (uint64_t)sr.averageHitsPerSeed();
+
+	prm.nSdFmops += bwops_;
+	met.nrange += sr.numRanges();
+	met.nelt += sr.numElts();
+	met.freqskip += freqskips;
+	met.bwops += bwops_;
+	met.bweds += bwedits_;
+}
+
+/**
+ * Search the seeds instantiated in 'sr', or look them up in the caches,
+ * and add their hits to 'sr'.  searchAllSeeds() sets up the read,
+ * scoring scheme and cache first.
+ */
+void SeedAligner::searchInstantiatedSeeds(
+	SeedResults& sr,        // holds all the seed hits
+	int mmMax,              // highest mismatch penalty
+	bool interleave,        // interleave exact seed searches
+	SeedSearchMetrics& met) // metrics
+{
+	AlignmentCacheIface& cache = *ca_;
 	uint64_t possearches = 0, seedsearches = 0, intrahits = 0, interhits = 0, ooms = 0;
+	uint64_t lookups = 0, inserts = 0;
+	size_t evicts = 0;
+	// Look up the seeds in the shared cache first, so we don't bother
+	// searching the ones found there
+	shHits_.clear();
+	shLook_.clear();
+	if(cache.hasShared()) {
+		shLook_.resize(sr.numOffs() * 2);
+		for(int i = 0; i < (int)sr.numOffs(); i++) {
+			for(int fwi = 0; fwi < 2; fwi++) {
+				bool fw = (fwi == 0);
+				SharedSeedLookup& lk = shLook_[i * 2 + fwi];
+				lk.found = false;
+				lk.off = shHits_.size();
+				lk.n = 0;
+				const EList<InstantiatedSeed>& iss = sr.instantiatedSeeds(fw, i);
+				if(iss.empty() || !reusableSeeds(iss, mmMax)) {
+					continue;
+				}
+				lookups++;
+				if(cache.lookupShared(sr.seqs(fw)[i], shHits_)) {
+					lk.found = true;
+					lk.n = shHits_.size() - lk.off;
+				}
+			}
+		}
+	}
+	walks_.clear();
+	if(interleave) {
+		// Gather all the exact-only seeds and search them together up
+		// front.  The loop below then consumes the results in the same
+		// order it would otherwise have searched them.
+		for(int i = 0; i < (int)sr.numOffs(); i++) {
+			for(int fwi = 0; fwi < 2; fwi++) {
+				bool fw = (fwi == 0);
+				if(!shLook_.empty() && shLook_[i * 2 + fwi].found) {
+					continue;
+				}
+				const EList<InstantiatedSeed>& iss = sr.instantiatedSeeds(fw, i);
+				for(size_t j = 0; j < iss.size(); j++) {
+					if(!isExactOnlySeed(iss[j])) {
+						continue;
+					}
+					walks_.expand();
+					ExactSeedWalk& w = walks_.back();
+					w.key = i * 2 + fwi;
+					w.j = (int)j;
+					w.is = &iss[j];
+					w.seq = &sr.seqs(fw)[i];
+					w.fiFw = w.fiBw = 0;
+					w.step = 0;
+					w.topf = w.botf = w.topb = w.botb = 0;
+					w.done = w.hit = false;
+				}
+			}
+		}
+		searchExactSeedsInterleaved();
+	}
+	size_t wi = 0; // cursor into walks_
 	// For each instantiated seed
 	for(int i = 0; i < (int)sr.numOffs(); i++) {
 		size_t off = sr.idx2off(i);
 		for(int fwi = 0; fwi < 2; fwi++) {
 			bool fw = (fwi == 0);
 			assert(sr.repOk(&cache.current()));
+			// Skip past walks for seeds we didn't get to
+			while(wi < walks_.size() && walks_[wi].key < i * 2 + fwi) {
+				wi++;
+			}
 			EList<InstantiatedSeed>& iss = sr.instantiatedSeeds(fw, i);
 			if(iss.empty()) {
 				// Cache hit in an across-read cache
@@ -506,9 +827,13 @@ void SeedAligner::searchAllSeeds(
 			qual_ = &sr.quals(fw)[i]; // seed qualities
 			off_  = off;              // seed offset (from 5')
 			fw_   = fw;               // seed orientation
+			bool reuse = reusableSeeds(iss, mmMax);
+			const SharedSeedLookup *lk =
+				shLook_.empty() ? NULL : &shLook_[i * 2 + fwi];
+			bool found = lk != NULL && lk->found;
 			// Tell the cache that we've started aligning, so the cache can
 			// expect a series of on-the-fly updates
-			int ret = cache.beginAlign(*seq_, *qual_, qv);
+			int ret = cache.beginAlign(*seq_, *qual_, qv, reuse, !found);
 			ASSERT_ONLY(hits_.clear());
 			if(ret == -1) {
 				// Out of memory when we tried to add key to map
@@ -516,7 +841,23 @@ void SeedAligner::searchAllSeeds(
 				continue;
 			}
 			bool abort = false;
-			if(ret == 0) {
+			if(ret == 0 && found) {
+				// Found in the shared cache; replay the hits in the order
+				// the search found them
+				assert(cache.aligning());
+				interhits++;
+				for(size_t j = lk->off; j < lk->off + lk->n; j++) {
+					const SeedCacheHit& h = shHits_[j];
+					if(!cache.addOnTheFly(h.key, h.topf, h.botf, h.topb, h.botb)) {
+						ooms++;
+						abort = true;
+						break;
+					}
+				}
+				if(!abort) {
+					qv = cache.finishAlign();
+				}
+			} else if(ret == 0) {
 				// Not already in cache
 				assert(cache.aligning());
 				possearches++;
@@ -526,8 +867,22 @@ void SeedAligner::searchAllSeeds(
 					assert_eq(fw, iss[j].fw);
 					assert_eq(i, (int)iss[j].seedoffidx);
 					s_ = &iss[j];
-					// Do the search with respect to seq_, qual_ and s_.
-					if(!searchSeedBi()) {
+					bool ok;
+					if(wi < walks_.size() &&
+					   walks_[wi].key == i * 2 + fwi &&
+					   walks_[wi].j == (int)j)
+					{
+						// Already searched; just report the hit, if any
+						const ExactSeedWalk& w = walks_[wi++];
+						assert(w.done);
+						ok = !w.hit || reportHit(
+							w.topf, w.botf, w.topb, w.botb,
+							(uint16_t)seq_->length(), NULL);
+					} else {
+						// Do the search with respect to seq_, qual_ and s_.
+						ok = searchSeedBi();
+					}
+					if(!ok) {
 						// Memory exhausted during search
 						ooms++;
 						abort = true;
@@ -537,7 +892,10 @@ void SeedAligner::searchAllSeeds(
 					assert(cache.aligning());
 				}
 				if(!abort) {
-					qv = cache.finishAlign();
+					if(cache.publishing()) {
+						inserts++;
+					}
+					qv = cache.finishAlign(&evicts);
 				}
 			} else {
 				// Already in cache
@@ -545,7 +903,10 @@ void SeedAligner::searchAllSeeds(
 				assert(qv.valid());
 				intrahits++;
 			}
-			assert(abort || !cache.aligning());
+			if(abort) {
+				cache.abortAlign();
+			}
+			assert(!cache.aligning());
 			if(qv.valid()) {
 				sr.add(
 					qv,    // range of ranges in cache
@@ -555,25 +916,14 @@ void SeedAligner::searchAllSeeds(
 			}
 		}
 	}
-	prm.nSeedRanges = sr.numRanges();
-	prm.nSeedElts = sr.numElts();
-	prm.nSeedRangesFw = sr.numRangesFw();
-	prm.nSeedRangesRc = sr.numRangesRc();
-	prm.nSeedEltsFw = sr.numEltsFw();
-	prm.nSeedEltsRc = sr.numEltsRc();
-	prm.seedMedian = (uint64_t)(sr.medianHitsPerSeed() + 0.5);
-	prm.seedMean = (uint64_t)sr.averageHitsPerSeed();
-
-	prm.nSdFmops += bwops_;
 	met.seedsearch += seedsearches;
-	met.nrange += sr.numRanges();
-	met.nelt += sr.numElts();
 	met.possearch += possearches;
 	met.intrahit += intrahits;
 	met.interhit += interhits;
+	met.sharedlookup += lookups;
+	met.sharedinsert += inserts;
+	met.sharedevict += evicts;
 	met.ooms += ooms;
-	met.bwops += bwops_;
-	met.bweds += bwedits_;
 }
 
 bool SeedAligner::sanityPartial(
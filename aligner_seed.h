@@ -1385,6 +1385,7 @@ protected:
 // Forward decl
 class Ebwt;
 struct SideLocus;
+class FreqKmerTable;
 
 /**
  * Encapsulates a sumamry of what the searchAllSeeds aligner did.
@@ -1407,6 +1408,10 @@ struct SeedSearchMetrics {
 		possearch    += m.possearch;
 		intrahit     += m.intrahit;
 		interhit     += m.interhit;
+		sharedlookup += m.sharedlookup;
+		sharedinsert += m.sharedinsert;
+		sharedevict  += m.sharedevict;
+		freqskip     += m.freqskip;
 		filteredseed += m.filteredseed;
 		ooms         += m.ooms;
 		bwops        += m.bwops;
@@ -1426,6 +1431,10 @@ struct SeedSearchMetrics {
 		possearch =
 		intrahit =
 		interhit =
+		sharedlookup =
+		sharedinsert =
+		sharedevict =
+		freqskip =
 		filteredseed =
 		ooms =
 		bwops =
@@ -1441,6 +1450,10 @@ struct SeedSearchMetrics {
 	uint64_t possearch;    // # offsets where aligner executed >= 1 strategy
 	uint64_t intrahit;     // # offsets where current-read cache gave answer
 	uint64_t interhit;     // # offsets where across-read cache gave answer
+	uint64_t sharedlookup; // # offsets looked up in the shared seed cache
+	uint64_t sharedinsert; // # offsets whose hits were offered to shared cache
+	uint64_t sharedevict;  // # shared cache entries replaced to make room
+	uint64_t freqskip;     // # offsets skipped as too frequent in the reference
 	uint64_t filteredseed; // # seed instantiations skipped due to Ns
 	uint64_t ooms;         // out-of-memory errors
 	uint64_t bwops;        // Burrows-Wheeler operations
@@ -1451,6 +1464,39 @@ struct SeedSearchMetrics {
 	MUTEX_T  mutex_m;
 };
 
+/**
+ * State for one exact-matching seed being advanced by the interleaved
+ * search engine in SeedAligner::searchAllSeeds().  Each walk is the
+ * same right-to-left sequence of LF steps searchSeedBi() would perform
+ * for the seed, but broken into individual steps so that many walks can
+ * be advanced round-robin while the side needed by each walk's next
+ * step is prefetched.
+ */
+struct ExactSeedWalk {
+
+	int key;                   // seedoffidx * 2 + fwi; orders walks like searchAllSeeds
+	int j;                     // index of instantiated seed within its list
+	const InstantiatedSeed* is;// seed being searched
+	const BTDnaString* seq;    // seed sequence
+	TIndexOffU fiFw;           // ftab index in BWT, if ftab used for first step
+	TIndexOffU fiBw;           // ftab index in BWT', if ftab used for first step
+	int step;                  // next step into is->steps
+	TIndexOffU topf, botf;     // current range in BWT
+	TIndexOffU topb, botb;     // current range in BWT'
+	bool done;                 // walk finished
+	bool hit;                  // walk finished with non-empty range
+};
+
+/**
+ * What the shared seed cache held for one seed offset and orientation:
+ * a range of SeedAligner::shHits_.
+ */
+struct SharedSeedLookup {
+	bool   found; // seed was in the shared cache
+	size_t off;   // first hit in shHits_
+	size_t n;     // # hits
+};
+
 /**
  * Given an index and a seeding scheme, searches for seed hits.
  */
@@ -1461,7 +1507,7 @@ public:
 	/**
 	 * Initialize with index.
 	 */
-	SeedAligner() : edits_(AL_CAT), offIdx2off_(AL_CAT) { }
+	SeedAligner() : edits_(AL_CAT), offIdx2off_(AL_CAT), walks_(AL_CAT), shHits_(CA_CAT), shLook_(CA_CAT), freqEst_(AL_CAT), deferred_(AL_CAT) { }
 
 	/**
 	 * Given a read and a few coordinates that describe a substring of the
@@ -1496,7 +1542,12 @@ public:
 
 	/**
 	 * Iterate through the seeds that cover the read and initiate a
-	 * search for each seed.
+	 * search for each seed.  If 'interleave' is true, seeds that admit
+	 * no edits are searched together, one LF step at a time, with
+	 * software prefetching; results are identical either way.  If
+	 * 'freq' is given, seeds it estimates to occur at least 'freqCap'
+	 * times in the reference are searched only if the others have no
+	 * hits; see skipFrequentSeeds().
 	 */
 	void searchAllSeeds(
 		const EList<Seed>& seeds,   // search seeds
@@ -1507,7 +1558,10 @@ public:
 		AlignmentCacheIface& cache, // local seed alignment cache
 		SeedResults& hits,          // holds all the seed hits
 		SeedSearchMetrics& met,     // metrics
-		PerReadMetrics& prm);       // per-read metrics
+		PerReadMetrics& prm,        // per-read metrics
+		bool interleave = false,    // interleave exact seed searches
+		const FreqKmerTable* freq = NULL, // frequent k-mers in the reference
+		uint64_t freqCap = 0);      // skip seeds occurring this often
 
 	/**
 	 * Sanity-check a partial alignment produced during oneMmSearch.
@@ -1591,6 +1645,49 @@ protected:
 	 * Given an instantiated seed (in s_ and other fields), search
 	 */
 	bool searchSeedBi();
+
+	/**
+	 * Return true iff searching the seeds in 'iss' finds the same hits
+	 * for any read with the same seed sequence, whatever its qualities
+	 * or length, given that no mismatch costs more than 'mmMax'.
+	 */
+	bool reusableSeeds(const EList<InstantiatedSeed>& iss, int mmMax) const;
+
+	/**
+	 * Search the seeds instantiated in 'sr', or look them up in the
+	 * caches, and add their hits to 'sr'.
+	 */
+	void searchInstantiatedSeeds(
+		SeedResults& sr,         // holds all the seed hits
+		int mmMax,               // highest mismatch penalty
+		bool interleave,         // interleave exact seed searches
+		SeedSearchMetrics& met); // metrics
+
+	/**
+	 * Move the instantiated seeds of each seed offset and orientation
+	 * that 'freq' estimates to occur at least 'cap' times in the
+	 * reference to deferred_, so searchAllSeeds() passes over them as
+	 * it does over seeds found in an across-read cache.  If that would
+	 * leave an orientation with no seeds, its least frequent seed is
+	 * kept.  searchAllSeeds() searches the deferred seeds after all if
+	 * the kept ones have no hits.  Returns the number of seeds
+	 * deferred.
+	 */
+	uint64_t skipFrequentSeeds(
+		SeedResults& sr,
+		const FreqKmerTable& freq,
+		uint64_t cap);
+
+	/**
+	 * Advance all the walks in walks_ to completion, round-robin.
+	 */
+	void searchExactSeedsInterleaved();
+
+	/**
+	 * Take one LF step for the given walk and prefetch the side(s)
+	 * needed for its next step.  Return true iff the walk finished.
+	 */
+	inline bool exactSeedStep(ExactSeedWalk& w);
 	
 	/**
 	 * Main, recursive implementation of the seed search.
@@ -1643,6 +1740,11 @@ protected:
 	uint64_t bwops_;           // Burrows-Wheeler operations
 	uint64_t bwedits_;         // Burrows-Wheeler edits
 	BTDnaString tmprfdnastr_;  // used in reportHit
+	EList<ExactSeedWalk> walks_;// exact seeds being searched in interleaved fashion
+	EList<SeedCacheHit> shHits_;// hits found in the shared seed cache
+	EList<SharedSeedLookup> shLook_;// per seed offset*2+fwi, hits in shHits_
+	EList<uint64_t> freqEst_;  // per seed offset, estimated reference occurrences
+	EList<InstantiatedSeed> deferred_; // frequent seeds searched only if the rest miss
 	
 	ASSERT_ONLY(ESet<BTDnaString> hits_); // Ref hits so far for seed being aligned
 	BTDnaString tmpdnastr_;
@@ -19,6 +19,7 @@
 
 #include <iomanip>
 #include <limits>
+#include <string.h>
 #include "aln_sink.h"
 #include "aligner_seed.h"
 #include "util.h"
@@ -610,7 +611,9 @@ int AlnSinkWrap::nextRead(
 	rs2_.clear();     // clear out paired-end alignments
 	rs1u_.clear();    // clear out unpaired alignments for mate #1
 	rs2u_.clear();    // clear out unpaired alignments for mate #2
+	order_.clear();
 	st_.nextRead(readIsPair()); // reset state
+	refoff_ = 0;
 	assert(empty());
 	assert(!maxed());
 	// Start from the first stage
@@ -1406,17 +1409,22 @@ bool AlnSinkWrap::report(
 	bool one = (rs1 != NULL);
 	const AlnRes* rsa = one ? rs1 : rs2;
 	const AlnRes* rsb = one ? rs2 : rs1;
+	order_.push_back(paired ? 0 : (one ? 1 : 2));
 	if(paired) {
 		assert(readIsPair());
 		st_.foundConcordant();
 		rs1_.push_back(*rs1);
 		rs2_.push_back(*rs2);
+		if(refoff_ != 0) {
+			rs1_.back().shiftRefid(refoff_);
+			rs2_.back().shiftRefid(refoff_);
+		}
 	} else {
 		st_.foundUnpaired(one);
-		if(one) {
-			rs1u_.push_back(*rs1);
-		} else {
-			rs2u_.push_back(*rs2);
+		EList<AlnRes>& rs = one ? rs1u_ : rs2u_;
+		rs.push_back(one ? *rs1 : *rs2);
+		if(refoff_ != 0) {
+			rs.back().shiftRefid(refoff_);
 		}
 	}
 	// Tally overall alignment score
@@ -1450,6 +1458,321 @@ bool AlnSinkWrap::report(
 	return st_.done();
 }
 
+/**
+ * Make 'dst' a copy of 'src' with exactly src.size() alignments
+ * allocated, each with exactly as many edits as it has.
+ */
+static void copyAlnsExact(EList<AlnRes>& dst, const EList<AlnRes>& src) {
+	EList<AlnRes> tmp(dst.cat());
+	if(!src.empty()) {
+		tmp.resizeExact(src.size());
+		for(size_t i = 0; i < src.size(); i++) {
+			// Sized first, so operator= below doesn't allocate a
+			// default-sized block
+			tmp[i].ned().resizeExact(src[i].ned().size());
+			tmp[i].aed().resizeExact(src[i].aed().size());
+			tmp[i] = src[i];
+		}
+	}
+	dst.xfer(tmp);
+}
+
+void AlnReplay::copyExact(const AlnReplay& o) {
+	copyAlnsExact(rs1, o.rs1);
+	copyAlnsExact(rs2, o.rs2);
+	copyAlnsExact(rs1u, o.rs1u);
+	copyAlnsExact(rs2u, o.rs2u);
+	EList<int> tmp(order.cat());
+	if(!o.order.empty()) {
+		tmp.resizeExact(o.order.size());
+		for(size_t i = 0; i < o.order.size(); i++) {
+			tmp[i] = o.order[i];
+		}
+	}
+	order.xfer(tmp);
+	exhaust1 = o.exhaust1;
+	exhaust2 = o.exhaust2;
+}
+
+void AlnReplay::release() {
+	EList<AlnRes> tmp1(rs1.cat()), tmp2(rs2.cat()), tmp1u(rs1u.cat()), tmp2u(rs2u.cat());
+	EList<int> tmpo(order.cat());
+	rs1.xfer(tmp1);
+	rs2.xfer(tmp2);
+	rs1u.xfer(tmp1u);
+	rs2u.xfer(tmp2u);
+	order.xfer(tmpo);
+	exhaust1 = exhaust2 = false;
+}
+
+/**
+ * Bytes allocated for the alignments in 'l' and their edits, assuming
+ * they were copied with copyAlnsExact().
+ */
+static size_t alnsBytes(const EList<AlnRes>& l) {
+	size_t b = l.size() * sizeof(AlnRes);
+	for(size_t i = 0; i < l.size(); i++) {
+		b += (l[i].ned().size() + l[i].aed().size()) * sizeof(Edit);
+	}
+	return b;
+}
+
+size_t AlnReplay::bytes() const {
+	return alnsBytes(rs1) + alnsBytes(rs2) + alnsBytes(rs1u) + alnsBytes(rs2u) +
+	       order.size() * sizeof(int);
+}
+
+/**
+ * Copy the alignments reported since nextRead() into 'rp', in the order
+ * they were reported.  'rp' is the calling thread's scratch copy, reused
+ * from read to read; DupReadCache::insert() keeps an exact-size copy.
+ */
+void AlnSinkWrap::snapshot(AlnReplay& rp) const {
+	assert(init_);
+	rp.rs1 = rs1_;
+	rp.rs2 = rs2_;
+	rp.rs1u = rs1u_;
+	rp.rs2u = rs2u_;
+	rp.order = order_;
+}
+
+/**
+ * Report the alignments in 'rp' for the current read, as though the
+ * aligner had found them in the same order.  Their reference ids were
+ * already shifted when they were first reported.
+ */
+void AlnSinkWrap::replay(const AlnReplay& rp) {
+	assert(init_);
+	assert(empty());
+	assert_eq(0, refoff_);
+	size_t ip = 0, i1 = 0, i2 = 0;
+	for(size_t i = 0; i < rp.order.size(); i++) {
+		if(rp.order[i] == 0) {
+			report(0, &rp.rs1[ip], &rp.rs2[ip]);
+			ip++;
+		} else if(rp.order[i] == 1) {
+			report(0, &rp.rs1u[i1++], NULL);
+		} else {
+			report(0, NULL, &rp.rs2u[i2++]);
+		}
+	}
+	assert_eq(ip, rp.rs1.size());
+	assert_eq(i1, rp.rs1u.size());
+	assert_eq(i2, rp.rs2u.size());
+}
+
+/// Slots of a DupReadCache shard a read may be stored in
+static const size_t DUP_CACHE_PROBE = 4;
+
+void DupReadCache::init(size_t reads, size_t bytes, int nthreads, bool quals) {
+	delete[] shards_;
+	shards_ = NULL;
+	nshards_ = nslots_ = maxBytes_ = 0;
+	quals_ = quals;
+	if(reads == 0 || bytes == 0) {
+		return;
+	}
+	nshards_ = max<size_t>(16, 4 * (size_t)max(nthreads, 1));
+	size_t per = (reads + nshards_ - 1) / nshards_;
+	nslots_ = DUP_CACHE_PROBE;
+	while(nslots_ < per) {
+		nslots_ <<= 1;
+	}
+	maxBytes_ = max<size_t>(bytes / nshards_, 1);
+	shards_ = new Shard[nshards_];
+	for(size_t i = 0; i < nshards_; i++) {
+		shards_[i].ents.resize(nslots_);
+		// Every entry in use has a record in the ring, and a reused
+		// slot leaves a stale one behind, so give it room for both
+		shards_[i].fifo.resize(2 * nslots_);
+	}
+}
+
+void DupReadCache::evict(Shard& sh, Entry& e) {
+	if(!e.used) {
+		return;
+	}
+	assert_geq(sh.bytes, e.bytes);
+	sh.bytes -= e.bytes;
+	e.bytes = 0;
+	e.used = false;
+	e.rp.release();
+	EList<char> tmp(e.seq.cat());
+	e.seq.xfer(tmp);
+}
+
+void DupReadCache::evictOldest(Shard& sh) {
+	assert_gt(sh.nfifo, 0);
+	const Stored& st = sh.fifo[sh.head];
+	Entry& e = sh.ents[st.slot];
+	if(e.used && e.stamp == st.stamp) {
+		evict(sh, e);
+	}
+	sh.head = (sh.head + 1) % sh.fifo.size();
+	sh.nfifo--;
+}
+
+uint64_t DupReadCache::hash(const Read* rd1, const Read* rd2, int filt) const {
+	uint64_t h = 0xcbf29ce484222325ull ^ (uint64_t)filt;
+	for(size_t m = 0; m < 2; m++) {
+		const Read* rd = (m == 0 ? rd1 : rd2);
+		if(rd == NULL) {
+			break;
+		}
+		const BTDnaString& s = rd->patFw;
+		for(size_t i = 0; i < s.length(); i++) {
+			h = (h ^ (uint64_t)s[i]) * 0x100000001b3ull;
+		}
+		if(quals_) {
+			const BTString& q = rd->qual;
+			for(size_t i = 0; i < q.length(); i++) {
+				h = (h ^ (uint64_t)(uint8_t)q[i]) * 0x100000001b3ull;
+			}
+		}
+		h = (h ^ (uint64_t)(rd->trimmed5 * 31 + rd->trimmed3 + 4)) * 0x100000001b3ull;
+	}
+	return h * 0x9e3779b97f4a7c15ull;
+}
+
+bool DupReadCache::matches(
+	const Entry& e,
+	uint64_t h,
+	const Read* rd1,
+	const Read* rd2,
+	int filt) const
+{
+	if(!e.used || e.hash != h || e.filt != filt) {
+		return false;
+	}
+	if((rd2 != NULL) != e.paired) {
+		return false;
+	}
+	if(e.trim[0] != rd1->trimmed5 || e.trim[1] != rd1->trimmed3) {
+		return false;
+	}
+	if(rd2 != NULL && (e.trim[2] != rd2->trimmed5 || e.trim[3] != rd2->trimmed3)) {
+		return false;
+	}
+	size_t len1 = rd1->patFw.length();
+	size_t len2 = (rd2 == NULL ? 0 : rd2->patFw.length());
+	if(e.len1 != len1 || e.seq.size() != (len1 + len2) * (quals_ ? 2 : 1)) {
+		return false;
+	}
+	const char* seq = e.seq.ptr();
+	if(len1 > 0 && memcmp(seq, rd1->patFw.buf(), len1) != 0) {
+		return false;
+	}
+	if(len2 > 0 && memcmp(seq + len1, rd2->patFw.buf(), len2) != 0) {
+		return false;
+	}
+	if(quals_) {
+		seq += len1 + len2;
+		if(len1 > 0 && memcmp(seq, rd1->qual.buf(), len1) != 0) {
+			return false;
+		}
+		if(len2 > 0 && memcmp(seq + len1, rd2->qual.buf(), len2) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool DupReadCache::lookup(
+	const Read* rd1,
+	const Read* rd2,
+	int filt,
+	AlnReplay& rp)
+{
+	assert(enabled());
+	uint64_t h = hash(rd1, rd2, filt);
+	Shard* sh = shard(h);
+	ThreadSafe ts(sh->lock);
+	for(size_t i = 0; i < DUP_CACHE_PROBE; i++) {
+		const Entry& e = sh->ents[(h + i) & (nslots_ - 1)];
+		if(matches(e, h, rd1, rd2, filt)) {
+			rp = e.rp;
+			return true;
+		}
+	}
+	return false;
+}
+
+void DupReadCache::insert(
+	const Read* rd1,
+	const Read* rd2,
+	int filt,
+	const AlnReplay& rp)
+{
+	assert(enabled());
+	uint64_t h = hash(rd1, rd2, filt);
+	Shard* sh = shard(h);
+	ThreadSafe ts(sh->lock);
+	// Take the read's own slot if another thread stored it first, else
+	// a free slot, else the one stored longest ago
+	Entry* victim = NULL;
+	for(size_t i = 0; i < DUP_CACHE_PROBE; i++) {
+		Entry& e = sh->ents[(h + i) & (nslots_ - 1)];
+		if(matches(e, h, rd1, rd2, filt)) {
+			victim = &e;
+			break;
+		}
+		if(victim == NULL || (victim->used && (!e.used || e.stamp < victim->stamp))) {
+			victim = &e;
+		}
+	}
+	assert(victim != NULL);
+	Entry& e = *victim;
+	evict(*sh, e);
+	size_t bytes = rp.bytes() + (rd1->patFw.length() +
+	               (rd2 == NULL ? 0 : rd2->patFw.length())) * (quals_ ? 2 : 1);
+	if(bytes > maxBytes_) {
+		// Would push out everything else in the shard
+		return;
+	}
+	e.used = true;
+	e.paired = (rd2 != NULL);
+	e.hash = h;
+	e.filt = filt;
+	e.stamp = sh->stamp++;
+	e.trim[0] = rd1->trimmed5;
+	e.trim[1] = rd1->trimmed3;
+	e.trim[2] = (rd2 == NULL ? 0 : rd2->trimmed5);
+	e.trim[3] = (rd2 == NULL ? 0 : rd2->trimmed3);
+	size_t len1 = rd1->patFw.length();
+	size_t len2 = (rd2 == NULL ? 0 : rd2->patFw.length());
+	e.len1 = len1;
+	e.seq.resizeExact((len1 + len2) * (quals_ ? 2 : 1));
+	char* seq = e.seq.ptr();
+	if(len1 > 0) {
+		memcpy(seq, rd1->patFw.buf(), len1);
+	}
+	if(len2 > 0) {
+		memcpy(seq + len1, rd2->patFw.buf(), len2);
+	}
+	if(quals_) {
+		seq += len1 + len2;
+		if(len1 > 0) {
+			memcpy(seq, rd1->qual.buf(), len1);
+		}
+		if(len2 > 0) {
+			memcpy(seq + len1, rd2->qual.buf(), len2);
+		}
+	}
+	e.rp.copyExact(rp);
+	e.bytes = bytes;
+	sh->bytes += bytes;
+	if(sh->nfifo == sh->fifo.size()) {
+		evictOldest(*sh);
+	}
+	Stored& st = sh->fifo[(sh->head + sh->nfifo) % sh->fifo.size()];
+	st.slot = (size_t)(&e - sh->ents.ptr());
+	st.stamp = e.stamp;
+	sh->nfifo++;
+	while(sh->bytes > maxBytes_) {
+		evictOldest(*sh);
+	}
+}
+
 /**
  * If there is a configuration of unpaired alignments that fits our
  * criteria for there being one or more discordant alignments, then
@@ -866,6 +866,59 @@ protected:
 	ReportingMetrics   met_;          // global repository of reporting metrics
 };
 
+/**
+ * The alignments reported to an AlnSinkWrap for one read or pair, in
+ * the order they were reported, so that they can be reported again for
+ * an exact duplicate of the read or pair without aligning it.
+ */
+struct AlnReplay {
+
+	AlnReplay() :
+		rs1(),
+		rs2(),
+		rs1u(),
+		rs2u(),
+		order(),
+		exhaust1(false),
+		exhaust2(false) { }
+
+	void reset() {
+		rs1.clear();
+		rs2.clear();
+		rs1u.clear();
+		rs2u.clear();
+		order.clear();
+		exhaust1 = exhaust2 = false;
+	}
+
+	/**
+	 * Make this a copy of 'o' whose lists, and the edit lists of their
+	 * alignments, are allocated at exactly the size needed, freeing
+	 * whatever this held before.  EList::operator= allocates at least
+	 * a default-sized block per list, which is fine for a thread's
+	 * scratch copy but far too much for the many kept in a cache.
+	 */
+	void copyExact(const AlnReplay& o);
+
+	/**
+	 * Free the lists.
+	 */
+	void release();
+
+	/**
+	 * Bytes of alignments held, as allocated by copyExact().
+	 */
+	size_t bytes() const;
+
+	EList<AlnRes> rs1;   // paired alignments for mate #1
+	EList<AlnRes> rs2;   // paired alignments for mate #2
+	EList<AlnRes> rs1u;  // unpaired alignments for mate #1
+	EList<AlnRes> rs2u;  // unpaired alignments for mate #2
+	EList<int>    order; // 0 = paired, 1 = mate #1, 2 = mate #2, per report
+	bool          exhaust1; // mate 1 exhausted?
+	bool          exhaust2; // mate 2 exhausted?
+};
+
 /**
  * Per-thread hit sink "wrapper" for the MultiSeed aligner.  Encapsulates
  * aspects of the MultiSeed aligner hit sink that are per-thread.  This
@@ -983,9 +1036,11 @@ public:
 		rs2_(),        // mate 2 alignments for paired-end alignments
 		rs1u_(),       // mate 1 unpaired alignments
 		rs2u_(),       // mate 2 unpaired alignments
+		order_(),      // which list each report() added to
 		select1_(),    // for selecting random subsets for mate 1
 		select2_(),    // for selecting random subsets for mate 2
-		st_(rp)        // reporting state - what's left to do?
+		st_(rp),       // reporting state - what's left to do?
+		refoff_(0)     // added to reference ids of reported alignments
 	{
 		assert(rp_.repOk());
 	}
@@ -1047,6 +1102,19 @@ public:
 		const AlnRes* rs1,
 		const AlnRes* rs2);
 
+	/**
+	 * Copy the alignments reported since nextRead() into 'rp', in the
+	 * order they were reported.
+	 */
+	void snapshot(AlnReplay& rp) const;
+
+	/**
+	 * Report the alignments in 'rp' for the current read, as though
+	 * the aligner had found them in the same order.  The current read
+	 * must be a duplicate of the one 'rp' was taken from.
+	 */
+	void replay(const AlnReplay& rp);
+
 #ifndef NDEBUG
 	/**
 	 * Check that hit sink wrapper is internally consistent.
@@ -1108,6 +1176,17 @@ public:
 	 */
 	const ReportingState& state() const { return st_; }
 	
+	/**
+	 * Set the amount added to the reference ids of alignments reported
+	 * from here on.  When aligning to several indexes, this puts each
+	 * one's alignments in terms of the merged list of references, so
+	 * that they're all weighed together when it comes to -k, -M and
+	 * MAPQ.  Reset to 0 by nextRead().
+	 */
+	void setRefOffset(TRefId off) {
+		refoff_ = off;
+	}
+
 	/**
 	 * Return true iff we're in -M mode.
 	 */
@@ -1274,15 +1353,137 @@ protected:
 	EList<AlnRes>   rs2_;   // paired alignments for mate #2
 	EList<AlnRes>   rs1u_;  // unpaired alignments for mate #1
 	EList<AlnRes>   rs2u_;  // unpaired alignments for mate #2
+	EList<int>      order_; // list each report() added to, see AlnReplay
 	EList<size_t>   select1_; // parallel to rs1_/rs2_ - which to report
 	EList<size_t>   select2_; // parallel to rs1_/rs2_ - which to report
 	ReportingState  st_;      // reporting state - what's left to do?
+	TRefId          refoff_;  // added to ids of references aligned to
 	
 	EList<std::pair<AlnScore, size_t> > selectBuf_;
 	BTString obuf_;
 	StackedAln staln_;
 };
 
+/**
+ * Alignments of recently aligned reads and pairs, shared by all worker
+ * threads and keyed on the sequences of the mates, so that an exact
+ * duplicate can be given the alignments of the first copy instead of
+ * being aligned again (--collapse-dups).  Anything besides the
+ * sequence that the alignments depend on, namely how much was trimmed
+ * from each mate, which filters the read passed and, unless penalties
+ * don't depend on them, the qualities, is part of the key too.  Read
+ * names are not, so where the aligner leaves things to chance, such as
+ * the choice among equally good repeat alignments, a duplicate gets
+ * the same alignments as whichever copy was aligned first.
+ *
+ * Holds up to a fixed number of reads or pairs, and up to a fixed
+ * number of bytes of their sequences and alignments, split into shards
+ * each with its own lock.  A read hashes to a few slots of one shard;
+ * when they're all taken the one stored longest ago is replaced.  When
+ * a shard goes over its share of the bytes, the entries it stored
+ * longest ago are dropped until it's back under.
+ */
+class DupReadCache {
+
+public:
+
+	DupReadCache() : shards_(NULL), nshards_(0), nslots_(0), maxBytes_(0), quals_(false) { }
+
+	~DupReadCache() {
+		delete[] shards_;
+	}
+
+	/**
+	 * Make room for the alignments of up to 'reads' reads or pairs in
+	 * at most 'bytes' bytes, with enough shards that 'nthreads' threads
+	 * seldom contend.  If 'quals' is set, qualities are part of the key.
+	 */
+	void init(size_t reads, size_t bytes, int nthreads, bool quals);
+
+	bool enabled() const { return shards_ != NULL; }
+
+	/**
+	 * If the alignments of a read or pair identical to rd1/rd2, which
+	 * passed the filters in 'filt', are stored, copy them into 'rp'
+	 * and return true.
+	 */
+	bool lookup(const Read* rd1, const Read* rd2, int filt, AlnReplay& rp);
+
+	/**
+	 * Store the alignments 'rp' of rd1/rd2, which passed the filters in
+	 * 'filt'.
+	 */
+	void insert(const Read* rd1, const Read* rd2, int filt, const AlnReplay& rp);
+
+private:
+
+	struct Entry {
+		Entry() : used(false), paired(false), hash(0), filt(0), stamp(0), bytes(0), len1(0), seq(RES_CAT), rp() {
+			trim[0] = trim[1] = trim[2] = trim[3] = 0;
+		}
+		bool        used;
+		bool        paired;
+		uint64_t    hash;
+		int         filt;    // filters passed
+		int         trim[4]; // 5' and 3' trimming of mate 1, then mate 2
+		uint64_t    stamp;   // when it was stored
+		size_t      bytes;   // counted against the shard's byte budget
+		size_t      len1;    // length of mate 1
+		EList<char> seq;     // mates 1 and 2, then their qualities if keyed
+		AlnReplay   rp;
+	};
+
+	/**
+	 * The slot an entry was stored in and its stamp at the time, in the
+	 * order entries were stored.  Stale once the slot is reused.
+	 */
+	struct Stored {
+		size_t   slot;
+		uint64_t stamp;
+	};
+
+	struct Shard {
+		Shard() : stamp(0), bytes(0), ents(RES_CAT), fifo(RES_CAT), head(0), nfifo(0) { }
+		MUTEX_T       lock;
+		uint64_t      stamp;
+		size_t        bytes;  // sum of the bytes of the entries in use
+		EList<Entry>  ents;
+		EList<Stored> fifo;   // ring buffer, oldest at 'head'
+		size_t        head;
+		size_t        nfifo;
+	};
+
+	uint64_t hash(const Read* rd1, const Read* rd2, int filt) const;
+
+	bool matches(
+		const Entry& e,
+		uint64_t h,
+		const Read* rd1,
+		const Read* rd2,
+		int filt) const;
+
+	Shard* shard(uint64_t h) const {
+		return &shards_[(h >> 32) % nshards_];
+	}
+
+	/**
+	 * Empty entry 'e' of shard 'sh', if it's in use.
+	 */
+	static void evict(Shard& sh, Entry& e);
+
+	/**
+	 * Evict the entry stored longest ago in 'sh', if it's still there,
+	 * and drop it from the ring.
+	 */
+	static void evictOldest(Shard& sh);
+
+	Shard* shards_;
+	size_t nshards_;
+	size_t nslots_;  // slots per shard, a power of 2
+	size_t maxBytes_; // byte budget per shard
+	bool   quals_;    // qualities are part of the key
+};
+
 /**
  * An AlnSink concrete subclass for printing SAM alignments.  The user might
  * want to customize SAM output in various ways.  We encapsulate all these
@@ -31,6 +31,7 @@
 #include <sstream>
 #include <memory>
 #include <stdexcept>
+#include <sys/time.h>
 #include "assert_helpers.h"
 #include "diff_sample.h"
 #include "multikey_qsort.h"
@@ -42,6 +43,8 @@
 #include "ds.h"
 #include "mem_ids.h"
 #include "word_io.h"
+#include "sa_is.h"
+#include "build_metrics.h"
 
 using namespace std;
 
@@ -190,6 +193,19 @@ public:
 
 
 
+/**
+ * Where KarkkainenBlockwiseSA spills sorted blocks for a disk-backed,
+ * resumable build (bowtie2-build --max-mem/--resume).  Each block is
+ * written to "<base>.<i>.sa" as soon as it's sorted, and the sample
+ * suffixes that delimit the blocks to "<base>.ckpt", so a build that's
+ * interrupted can pick up the blocks already sorted.
+ */
+struct SaSpill {
+	SaSpill() : resume(false) { }
+	string base;   // prefix of the block and checkpoint files
+	bool   resume; // reuse a matching checkpoint, if there is one
+};
+
 /**
  * Build the SA a block at a time according to the scheme outlined in
  * Karkkainen's "Fast BWT" paper.
@@ -208,9 +224,11 @@ public:
                           bool __passMemExc = false,
                           bool __verbose = false,
                           string base_fname = "",
+                          const SaSpill* spill = NULL,
                           ostream& __logger = cout) :
     InorderBlockwiseSA<TStr>(__text, __bucketSz, __sanityCheck, __passMemExc, __verbose, __logger),
-    _sampleSuffs(EBWTB_CAT), _nthreads(__nthreads), _itrBucketIdx(0), _cur(0), _dcV(__dcV), _dc(EBWTB_CAT), _built(false), _base_fname(base_fname), _bigEndian(currentlyBigEndian())
+    _sampleSuffs(EBWTB_CAT), _nthreads(__nthreads), _itrBucketIdx(0), _cur(0), _dcV(__dcV), _dc(EBWTB_CAT), _built(false), _base_fname(base_fname), _bigEndian(currentlyBigEndian()),
+    _spill(spill), _ckptId(0), _onDisk(EBWTB_CAT), _blockSizes(EBWTB_CAT), _blockSecs(EBWTB_CAT)
 #ifdef WITH_TBB
 ,thread_group_started(false)
 #endif
@@ -259,6 +277,7 @@ public:
 			if(_threads.size() == 0) {
 #endif
                 _done = std::auto_ptr<volatile bool>(new volatile bool[_sampleSuffs.size() + 1]); 
+                _pool.init(this->_nthreads);
                 for (size_t i = 0; i < _sampleSuffs.size() + 1; i++) {
                     _done.get()[i] = false;
                 }
@@ -290,27 +309,28 @@ public:
 				throw out_of_range("No more suffixes");
 			}
 			if(this->_nthreads == 1) {
-				nextBlock((int)_cur);
+				if(!_onDisk[_cur]) {
+					nextBlock((int)_cur);
+					if(_spill != NULL) {
+						writeBlock(_cur, this->_itrBucket);
+					}
+				} else if(!readBlock(_cur, this->_itrBucket)) {
+					cerr << "Could not read a suffix array block from \"" << blockFname(_cur) << "\"" << endl;
+					throw 1;
+				}
 				_cur++;
 			} else {
 				while(!_done.get()[this->_itrBucketIdx]) {
 					SLEEP(1);
 				}
 				// Read suffixes from a file
-				std::ostringstream number; number << this->_itrBucketIdx;
-				const string fname = _base_fname + "." + number.str() + ".sa";
-				ifstream sa_file(fname.c_str(), ios::binary);
-				if(!sa_file.good()) {
-					cerr << "Could not open file for reading a suffix array: \"" << fname << "\"" << endl;
+				if(!readBlock(this->_itrBucketIdx, this->_itrBucket)) {
+					cerr << "Could not read a suffix array block from \"" << blockFname(this->_itrBucketIdx) << "\"" << endl;
 					throw 1;
 				}
-				size_t numSAs = readU<TIndexOffU>(sa_file, _bigEndian);
-				this->_itrBucket.resizeExact(numSAs);
-				for(size_t i = 0; i < numSAs; i++) {
-					this->_itrBucket[i] = readU<TIndexOffU>(sa_file, _bigEndian);
+				if(_spill == NULL) {
+					std::remove(blockFname(this->_itrBucketIdx).c_str());
 				}
-				sa_file.close();
-				std::remove(fname.c_str());
 			}
 			this->_itrBucketIdx++;
 			this->_itrBucketPos = 0;
@@ -321,8 +341,12 @@ public:
     /// Defined in blockwise_sa.cpp
     virtual void nextBlock(int cur_block, int tid = 0);
     
-    /// Defined in blockwise_sa.cpp
-    virtual void qsort(EList<TIndexOffU>& bucket);
+    /// Defined in blockwise_sa.cpp.  If 'tid' >= 0, big partitions go
+    /// to the pool shared by the block-sorting threads.
+    virtual void qsort(
+        EList<TIndexOffU>& bucket,
+        int tid = -1,
+        SortJobStats *stats = NULL);
     
     /// Return true iff more blocks are available
     virtual bool hasMoreBlocks() const {
@@ -332,6 +356,22 @@ public:
     /// Return the difference-cover period
     uint32_t dcV() const { return _dcV; }
 
+    /// Return the sizes of the blocks sorted so far, in no particular order
+    const EList<uint64_t>& blockSizes() const { return _blockSizes; }
+
+    /// Return the seconds each of blockSizes() took to sort
+    const EList<double>& blockSecs() const { return _blockSecs; }
+
+    /**
+     * Remove the spilled blocks and the checkpoint; for when the index
+     * they were for has been written.
+     */
+    void removeSpill() {
+        if(_spill == NULL) return;
+        removeBlocks(_sampleSuffs.size() + 1);
+        std::remove(ckptFname().c_str());
+    }
+
 //TBB requires a Functor to be passed to the thread group
 //hence the nested class
 #ifdef WITH_TBB
@@ -349,6 +389,7 @@ public:
         pair<KarkkainenBlockwiseSA*, int> param = *(pair<KarkkainenBlockwiseSA*, int>*)vp;
         KarkkainenBlockwiseSA* sa = param.first;
         int tid = param.second;
+        sa->_pool.enter();
         while(true) {
             size_t cur = 0;
             {
@@ -357,24 +398,19 @@ public:
                 if(cur > sa->_sampleSuffs.size()) break;
                 sa->_cur++;
             }
+            if(sa->_onDisk[cur]) {
+                // Sorted before the build was interrupted
+                sa->_done.get()[cur] = true;
+                continue;
+            }
             sa->nextBlock((int)cur, tid);
             // Write suffixes into a file
-            std::ostringstream number; number << cur;
-            const string fname = sa->_base_fname + "." + number.str() + ".sa";
-            ofstream sa_file(fname.c_str(), ios::binary);
-            if(!sa_file.good()) {
-                cerr << "Could not open file for writing a reference graph: \"" << fname << "\"" << endl;
-                throw 1;
-            }
-            const EList<TIndexOffU>& bucket = sa->_itrBuckets[tid];
-            writeU<TIndexOffU>(sa_file, (TIndexOffU)bucket.size(), sa->_bigEndian);
-            for(size_t i = 0; i < bucket.size(); i++) {
-                writeU<TIndexOffU>(sa_file, bucket[i], sa->_bigEndian);
-            }
-            sa_file.close();
+            sa->writeBlock(cur, sa->_itrBuckets[tid]);
             sa->_itrBuckets[tid].clear();
             sa->_done.get()[cur] = true;
         }
+        // Help sort whatever blocks are still being sorted
+        sa->_pool.retire(tid);
     }
 #ifdef WITH_TBB
 };
@@ -404,27 +440,244 @@ protected:
 private:
 
     /**
-     * Calculate the difference-cover sample and sample suffixes.
+     * Calculate the difference-cover sample and sample suffixes.  If
+     * spilling, checkpoint the sample suffixes, or take them and any
+     * blocks already sorted from the checkpoint of an interrupted build.
      */
     void build() {
-        // Calculate difference-cover sample
-        assert(_dc.get() == NULL);
-        if(_dcV != 0) {
-            _dc.init(new TDC(this->text(), _dcV, this->verbose(), this->sanityCheck()));
-            _dc.get()->build(this->_nthreads);
+        if(_spill != NULL && _spill->resume && loadCheckpoint()) {
+            size_t ndone = 0;
+            for(size_t i = 0; i < _onDisk.size(); i++) {
+                if(_onDisk[i]) ndone++;
+            }
+            if(this->verbose()) {
+                this->log() << "Resuming from checkpoint " << ckptFname() << ": " << ndone
+                            << " of " << _onDisk.size() << " blocks already sorted" << endl;
+            }
+            if(ndone < _onDisk.size()) {
+                buildDc();
+            }
+            _built = true;
+            return;
         }
+        buildDc();
         // Calculate sample suffixes
         if(this->bucketSz() <= this->text().length()) {
             VMSG_NL("Building samples");
+            BuildPhase phase("sample_sort", this->_nthreads);
             buildSamples();
         } else {
             VMSG_NL("Skipping building samples since text length " <<
                     this->text().length() << " is less than bucket size: " <<
                     this->bucketSz());
         }
+        _onDisk.resize(_sampleSuffs.size() + 1);
+        _onDisk.fill(false);
+        if(_spill != NULL) {
+            writeCheckpoint();
+        }
         _built = true;
     }
 
+    /**
+     * Calculate the difference-cover sample.
+     */
+    void buildDc() {
+        assert(_dc.get() == NULL);
+        if(_dcV != 0) {
+            BuildPhase phase("dc_sample", this->_nthreads);
+            _dc.init(new TDC(this->text(), _dcV, this->verbose(), this->sanityCheck()));
+            _dc.get()->build(this->_nthreads);
+            // Packed copy of the text for comparing suffixes a word
+            // at a time; optional, so do without it if it won't fit
+            try {
+                _packed.init(this->text(), this->text().length());
+            } catch(bad_alloc& e) {
+                VMSG_NL("Not enough memory to pack the text; comparing suffixes by character");
+            }
+        }
+    }
+
+    /// Return the name of the file holding block 'cur'
+    string blockFname(size_t cur) const {
+        std::ostringstream number; number << cur;
+        return (_spill != NULL ? _spill->base : _base_fname) + "." + number.str() + ".sa";
+    }
+
+    /// Return the name of the checkpoint file
+    string ckptFname() const {
+        return _spill->base + ".ckpt";
+    }
+
+    /**
+     * Write sorted block 'cur' to its file.  It's written under a
+     * temporary name and renamed when complete, so a block file that
+     * exists is a whole one.  Each starts with the id of the checkpoint
+     * it belongs to.
+     */
+    void writeBlock(size_t cur, const EList<TIndexOffU>& bucket) {
+        const string fname = blockFname(cur);
+        const string tmpFname = fname + ".tmp";
+        ofstream sa_file(tmpFname.c_str(), ios::binary);
+        if(!sa_file.good()) {
+            cerr << "Could not open file for writing a suffix array block: \"" << tmpFname << "\"" << endl;
+            throw 1;
+        }
+        // Blocks are only ever read back by this host, so they're
+        // written in its byte order
+        writeU<uint64_t>(sa_file, _ckptId);
+        writeU<TIndexOffU>(sa_file, (TIndexOffU)bucket.size());
+        sa_file.write((const char*)bucket.ptr(), bucket.size() * OFF_SIZE);
+        sa_file.close();
+        if(sa_file.fail() || std::rename(tmpFname.c_str(), fname.c_str()) != 0) {
+            cerr << "Could not write suffix array block \"" << fname << "\"; is the disk full?" << endl;
+            throw 1;
+        }
+    }
+
+    /**
+     * Read block 'cur' from its file into 'bucket'.  Return false if
+     * the file is missing, truncated or from another checkpoint.
+     */
+    bool readBlock(size_t cur, EList<TIndexOffU>& bucket) {
+        const string fname = blockFname(cur);
+        ifstream sa_file(fname.c_str(), ios::binary);
+        if(!sa_file.good()) {
+            return false;
+        }
+        uint64_t id = readU<uint64_t>(sa_file, false);
+        size_t numSAs = readU<TIndexOffU>(sa_file, false);
+        if(!sa_file.good() || id != _ckptId) {
+            return false;
+        }
+        bucket.resizeExact(numSAs);
+        sa_file.read((char*)bucket.ptr(), numSAs * OFF_SIZE);
+        return sa_file.gcount() == (streamsize)(numSAs * OFF_SIZE);
+    }
+
+    /**
+     * Return true iff block 'cur' is on disk, complete and belongs to
+     * the current checkpoint, judging by its header and size.
+     */
+    bool blockOnDisk(size_t cur) const {
+        const string fname = blockFname(cur);
+        ifstream sa_file(fname.c_str(), ios::binary);
+        if(!sa_file.good()) {
+            return false;
+        }
+        uint64_t id = readU<uint64_t>(sa_file, false);
+        TIndexOffU numSAs = readU<TIndexOffU>(sa_file, false);
+        if(!sa_file.good() || id != _ckptId) {
+            return false;
+        }
+        sa_file.seekg(0, ios::end);
+        return (uint64_t)sa_file.tellg() == 8 + OFF_SIZE + (uint64_t)numSAs * OFF_SIZE;
+    }
+
+    /// Remove block files 0 through n-1, and any half-written ones
+    void removeBlocks(size_t n) const {
+        for(size_t i = 0; i < n; i++) {
+            std::remove(blockFname(i).c_str());
+            std::remove((blockFname(i) + ".tmp").c_str());
+        }
+    }
+
+    /**
+     * Return a 64-bit FNV-1a hash of the text, so that a checkpoint
+     * isn't applied to a different reference.
+     */
+    uint64_t textHash() const {
+        const TStr& t = this->text();
+        uint64_t h = 0xcbf29ce484222325ull;
+        for(size_t i = 0; i < t.length(); i++) {
+            h = (h ^ (uint8_t)t[i]) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    /**
+     * Return the id of the checkpoint for the current sample suffixes
+     * and text hash 'th'; stamped on every block file.
+     */
+    uint64_t ckptId(uint64_t th) const {
+        uint64_t h = th;
+        for(size_t i = 0; i < _sampleSuffs.size(); i++) {
+            h = (h ^ _sampleSuffs[i]) * 0x100000001b3ull;
+        }
+        return h == 0 ? 1 : h; // 0 is for blocks that aren't checkpointed
+    }
+
+    /**
+     * Write the checkpoint for a new set of sample suffixes, first
+     * removing the blocks of any old one.
+     */
+    void writeCheckpoint() {
+        const string fname = ckptFname();
+        {
+            ifstream old(fname.c_str(), ios::binary);
+            if(old.good()) {
+                uint64_t hdr[6];
+                old.read((char*)hdr, sizeof(hdr));
+                if(old.good() && hdr[0] == CKPT_MAGIC) {
+                    removeBlocks((size_t)hdr[5] + 1);
+                }
+            }
+        }
+        uint64_t th = textHash();
+        _ckptId = ckptId(th);
+        const string tmpFname = fname + ".tmp";
+        ofstream ckpt(tmpFname.c_str(), ios::binary);
+        uint64_t hdr[6] = {
+            CKPT_MAGIC, (uint64_t)this->text().length(), (uint64_t)this->bucketSz(),
+            (uint64_t)_dcV, th, (uint64_t)_sampleSuffs.size() };
+        ckpt.write((const char*)hdr, sizeof(hdr));
+        ckpt.write((const char*)_sampleSuffs.ptr(), _sampleSuffs.size() * OFF_SIZE);
+        ckpt.close();
+        if(ckpt.fail() || std::rename(tmpFname.c_str(), fname.c_str()) != 0) {
+            cerr << "Could not write checkpoint \"" << fname << "\"; is the disk full?" << endl;
+            throw 1;
+        }
+        VMSG_NL("Wrote checkpoint " << fname << " for " << (_sampleSuffs.size() + 1) << " blocks");
+    }
+
+    /**
+     * Take the sample suffixes from the checkpoint, if there is one and
+     * it's for this text and these parameters, and note which blocks
+     * are already on disk.  Return false if there's nothing to resume.
+     */
+    bool loadCheckpoint() {
+        const string fname = ckptFname();
+        ifstream ckpt(fname.c_str(), ios::binary);
+        if(!ckpt.good()) {
+            VMSG_NL("No checkpoint " << fname << "; starting from scratch");
+            return false;
+        }
+        uint64_t hdr[6];
+        ckpt.read((char*)hdr, sizeof(hdr));
+        uint64_t th = textHash();
+        if(!ckpt.good() || hdr[0] != CKPT_MAGIC ||
+           hdr[1] != (uint64_t)this->text().length() ||
+           hdr[2] != (uint64_t)this->bucketSz() ||
+           hdr[3] != (uint64_t)_dcV || hdr[4] != th)
+        {
+            VMSG_NL("Checkpoint " << fname << " is for another reference or other parameters; starting from scratch");
+            return false;
+        }
+        _sampleSuffs.resizeExact((size_t)hdr[5]);
+        ckpt.read((char*)_sampleSuffs.ptr(), _sampleSuffs.size() * OFF_SIZE);
+        if(ckpt.gcount() != (streamsize)(_sampleSuffs.size() * OFF_SIZE)) {
+            VMSG_NL("Checkpoint " << fname << " is truncated; starting from scratch");
+            _sampleSuffs.clear();
+            return false;
+        }
+        _ckptId = ckptId(th);
+        _onDisk.resize(_sampleSuffs.size() + 1);
+        for(size_t i = 0; i < _onDisk.size(); i++) {
+            _onDisk[i] = blockOnDisk(i);
+        }
+        return true;
+    }
+
 	/**
 	 * Calculate the lcp between two suffixes using the difference
 	 * cover as a tie-breaker.  If the tie-breaker is employed, then
@@ -455,6 +708,7 @@ private:
 	TIndexOffU         _cur;         /// offset to 1st elt of next block
 	const uint32_t   _dcV;         /// difference-cover periodicity
 	PtrWrap<TDC>     _dc;          /// queryable difference-cover data
+	PackedSufText    _packed;      /// text packed 32 chars per word
 	bool             _built;       /// whether samples/DC have been built
 	RandomSource     _randomSrc;   /// source of pseudo-randoms
 
@@ -470,6 +724,14 @@ private:
 	EList<pair<KarkkainenBlockwiseSA*, int> > _tparams;
 	ELList<TIndexOffU>      _itrBuckets;  /// buckets
 	std::auto_ptr<volatile bool>             _done;        /// is a block processed?
+	SortTaskPool            _pool;        /// partitions of blocks being sorted
+	const SaSpill*          _spill;       /// where to spill blocks; NULL = don't
+	uint64_t                _ckptId;      /// id of checkpoint blocks belong to
+	EList<bool>             _onDisk;      /// is a block already sorted on disk?
+	EList<uint64_t>         _blockSizes;  /// sizes of the blocks sorted
+	EList<double>           _blockSecs;   /// seconds each took to sort
+
+	static const uint64_t CKPT_MAGIC = 0x31544b4332544200ull; // "\0BT2CKT1"
 };
 
 
@@ -478,11 +740,16 @@ private:
  * Qsort the set of suffixes whose offsets are in 'bucket'.
  */
 template<typename TStr>
-inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
+inline void KarkkainenBlockwiseSA<TStr>::qsort(
+	EList<TIndexOffU>& bucket,
+	int tid,
+	SortJobStats *stats)
+{
 	const TStr& t = this->text();
 	TIndexOffU *s = bucket.ptr();
 	size_t slen = bucket.size();
 	TIndexOffU len = (TIndexOffU)t.length();
+	SortTaskPool *pool = (tid >= 0 && _pool.enabled()) ? &_pool : NULL;
 	if(_dc.get() != NULL) {
 		// Use the difference cover as a tie-breaker if we have it
 		VMSG_NL("  (Using difference cover)");
@@ -491,13 +758,14 @@ inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
 		const uint8_t *host = (const uint8_t *)t.buf();
 		assert(_dc.get() != NULL);
 		mkeyQSortSufDcU8(t, host, len, s, slen, *_dc.get(), 4,
-		                 this->verbose(), this->sanityCheck());
+		                 this->verbose(), this->sanityCheck(), pool, tid, stats,
+		                 _packed.inited() ? &_packed : NULL);
 	} else {
 		VMSG_NL("  (Not using difference cover)");
 		// We don't have a difference cover - just do a normal
 		// suffix sort
 		mkeyQSortSuf(t, s, slen, 4,
-		             this->verbose(), this->sanityCheck());
+		             this->verbose(), this->sanityCheck(), OFF_MASK, pool, tid, stats);
 	}
 }
 
@@ -509,25 +777,29 @@ inline void KarkkainenBlockwiseSA<TStr>::qsort(EList<TIndexOffU>& bucket) {
  */
 template<>
 inline void KarkkainenBlockwiseSA<S2bDnaString>::qsort(
-	EList<TIndexOffU>& bucket)
+	EList<TIndexOffU>& bucket,
+	int tid,
+	SortJobStats *stats)
 {
 	const S2bDnaString& t = this->text();
 	TIndexOffU *s = bucket.ptr();
 	size_t slen = bucket.size();
 	size_t len = t.length();
+	SortTaskPool *pool = (tid >= 0 && _pool.enabled()) ? &_pool : NULL;
 	if(_dc.get() != NULL) {
 		// Use the difference cover as a tie-breaker if we have it
 		VMSG_NL("  (Using difference cover)");
 		// Can't use the text's 'host' array because the backing
 		// store for the packed string is not one-char-per-elt.
 		mkeyQSortSufDcU8(t, t, len, s, slen, *_dc.get(), 4,
-		                 this->verbose(), this->sanityCheck());
+		                 this->verbose(), this->sanityCheck(), pool, tid, stats,
+		                 _packed.inited() ? &_packed : NULL);
 	} else {
 		VMSG_NL("  (Not using difference cover)");
 		// We don't have a difference cover - just do a normal
 		// suffix sort
 		mkeyQSortSuf(t, s, slen, 4,
-		             this->verbose(), this->sanityCheck());
+		             this->verbose(), this->sanityCheck(), OFF_MASK, pool, tid, stats);
 	}
 }
 
@@ -768,6 +1040,18 @@ void KarkkainenBlockwiseSA<TStr>::buildSamples() {
             }
         }
         if(added == 0) {
+            if(this->verbose() && numBuckets > 0) {
+                // Blocks are sorted one per thread, so the biggest one
+                // bounds how well the sort parallelizes
+                TIndexOffU mn = bucketSzs[0], mx = bucketSzs[0];
+                for(size_t i = 1; i < numBuckets; i++) {
+                    mn = min<TIndexOffU>(mn, bucketSzs[i]);
+                    mx = max<TIndexOffU>(mx, bucketSzs[i]);
+                }
+                double avg = (double)(len - _sampleSuffs.size()) / numBuckets;
+                VMSG_NL("Bucket sizes: min " << mn << ", max " << mx << ", max/avg skew "
+                        << (avg > 0 ? mx / avg : 0.0));
+            }
             //if(this->verbose()) {
             //	cout << "Final bucket sizes:" << endl;
             //	cout << "  (begin): " << bucketSzs[0] << " (" << (int)(bsz - bucketSzs[0]) << ")" << endl;
@@ -1168,7 +1452,20 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock(int cur_block, int tid) {
             ThreadSafe ts(_mutex);
             VMSG_NL("  Sorting block of length " << bucket.size() << " for bucket " << (cur_block+1));
         }
-        this->qsort(bucket);
+        SortJobStats st;
+        timeval tv0, tv1;
+        gettimeofday(&tv0, NULL);
+        this->qsort(bucket, this->_nthreads > 1 ? tid : -1, &st);
+        gettimeofday(&tv1, NULL);
+        double secs = (tv1.tv_sec - tv0.tv_sec) + (tv1.tv_usec - tv0.tv_usec) / 1e6;
+        {
+            ThreadSafe ts(_mutex);
+            VMSG_NL("  Sorted bucket " << (cur_block+1) << " (" << bucket.size()
+                    << " suffixes) in " << secs << " s; " << st.stolen << " of "
+                    << st.spawned << " partitions sorted by other threads");
+            _blockSizes.push_back(bucket.size());
+            _blockSecs.push_back(secs);
+        }
     }
     if(hi != OFF_MASK) {
         // Not the final bucket; throw in the sample on the RHS
@@ -1183,4 +1480,104 @@ void KarkkainenBlockwiseSA<TStr>::nextBlock(int cur_block, int tid) {
     }
 }
 
+/**
+ * Build the entire suffix array in memory in one go with SA-IS (see
+ * sa_is.h) and dole it out as a single block.  This takes linear time
+ * and needs neither a difference-cover sample nor any bucket sorting,
+ * so it's several times faster than KarkkainenBlockwiseSA, but it
+ * holds the whole SA plus up to half that again at once; see
+ * bytesNeeded().
+ */
+template<typename TStr>
+class SaisBlockwiseSA : public InorderBlockwiseSA<TStr> {
+public:
+	SaisBlockwiseSA(const TStr& __text,
+	                bool __sanityCheck = false,
+	                bool __passMemExc = false,
+	                bool __verbose = false,
+	                ostream& __logger = cout) :
+	InorderBlockwiseSA<TStr>(__text, (TIndexOffU)__text.length() + 1, __sanityCheck, __passMemExc, __verbose, __logger),
+	_built(false)
+	{ }
+
+	/**
+	 * Return roughly the peak number of bytes needed, beyond the text
+	 * itself, to build the SA of a text of length 'len': the SA, the
+	 * buckets of the first recursion level (one per LMS substring in
+	 * the worst case) and the type bits.
+	 */
+	static uint64_t bytesNeeded(TIndexOffU len) {
+		uint64_t n = (uint64_t)len + 2;
+		return (n + (n >> 1) + 1) * sizeof(TIndexOffU) + (n >> 3) + (n >> 4) + 2;
+	}
+
+	/**
+	 * Get the next suffix; build the SA first if necessary.
+	 */
+	virtual TIndexOffU nextSuffix() {
+		if(this->_itrPushedBackSuffix != OFF_MASK) {
+			TIndexOffU tmp = this->_itrPushedBackSuffix;
+			this->_itrPushedBackSuffix = OFF_MASK;
+			return tmp;
+		}
+		if(hasMoreBlocks()) {
+			nextBlock(0);
+		}
+		if(this->_itrBucketPos >= this->_itrBucket.size()) {
+			throw out_of_range("No more suffixes");
+		}
+		return this->_itrBucket[this->_itrBucketPos++];
+	}
+
+	/// Return true iff the SA hasn't been built yet
+	virtual bool hasMoreBlocks() const {
+		return !_built;
+	}
+
+protected:
+
+	/// The SA was discarded along with _itrBucket; build it again
+	/// next time
+	virtual void reset() {
+		_built = false;
+	}
+
+	/// Return true iff we're about to dole out the first suffix
+	virtual bool isReset() {
+		return !_built;
+	}
+
+	/**
+	 * Build the whole SA into _itrBucket.
+	 */
+	virtual void nextBlock(int cur_block, int tid = 0) {
+		assert_eq(0, cur_block);
+		const TStr& t = this->text();
+		TIndexOffU len = (TIndexOffU)t.length();
+		EList<TIndexOffU>& sa = this->_itrBucket;
+		VMSG_NL("Building suffix array of " << (len+1) << " suffixes in memory with SA-IS");
+		{
+			Timer timer(cout, "  SA-IS time: ", this->verbose());
+			BuildPhase phase("sa_is");
+			SaisText<TStr> st(t);
+			sa.resizeExact((size_t)st.length());
+			sais(st, sa.ptr(), st.length(), SaisText<TStr>::alphabetMax(),
+			     this->verbose() ? &this->log() : NULL);
+		}
+		// sa[0] is SA-IS's own terminator; skip it
+		assert_eq(len + 1, sa[0]);
+		assert_eq(len, sa.back());
+		if(this->sanityCheck()) {
+			for(TIndexOffU i = 1; i + 2 < sa.size(); i++) {
+				assert(sstr_suf_lt(t, sa[i], t, sa[i+1], false));
+			}
+		}
+		this->_itrBucketPos = 1;
+		_built = true;
+	}
+
+private:
+	bool _built; /// true iff _itrBucket holds the SA
+};
+
 #endif /*BLOCKWISE_SA_H_*/
@@ -21,8 +21,13 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
+#include <iterator>
+#include <cctype>
 #include <cassert>
 #include <getopt.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include "assert_helpers.h"
 #include "endian_swap.h"
 #include "bt2_idx.h"
@@ -34,6 +39,12 @@
 #include "filebuf.h"
 #include "reference.h"
 #include "ds.h"
+#include "threading.h"
+#include "ref_ingest.h"
+#include "build_metrics.h"
+#ifdef WITH_TBB
+ #include <tbb/compat/thread>
+#endif
 
 /**
  * \file Driver for the bowtie-build indexing tool.
@@ -49,6 +60,8 @@ static uint32_t bmaxDivN;
 static int dcv;
 static int noDc;
 static int entireSA;
+static int blockwise;
+static bool blockwiseTuned; // --bmax/--bmaxdivn/--dcv etc. given
 static int seed;
 static int showVersion;
 //   Ebwt parameters
@@ -65,6 +78,14 @@ static bool packed;
 static bool writeRef;
 static bool justRef;
 static bool reverseEach;
+static bool zeroCopy;  // also write zero-copy index files
+static uint64_t freqKmers; // write k-mers occurring this often; 0 = don't
+static int freqKmerLen;    // length of those k-mers
+static bool sequentialBuild; // build mirror index after, not alongside, forward
+static uint64_t maxMem;   // --max-mem budget in bytes; 0 = none
+static string scratchDir; // where to spill sorted SA blocks
+static bool resume;       // pick up an interrupted disk-backed build
+static string metricsFile; // where to write a JSON report of the build
 static int nthreads;
 static string wrapper;
 
@@ -77,7 +98,9 @@ static void resetOptions() {
 	bmaxDivN     = 4;          // same, as divisor of n
 	dcv          = 1024;  // bwise SA difference-cover sample sz
 	noDc         = 0;     // disable difference-cover sample
-	entireSA     = 0;     // 1 = disable blockwise SA
+	entireSA     = 0;     // 1 = always build the entire SA in memory
+	blockwise    = 0;     // 1 = always use the blockwise SA builder
+	blockwiseTuned = false;
 	seed         = 0;     // srandom seed
 	showVersion  = 0;     // just print version and quit?
 	//   Ebwt parameters
@@ -94,6 +117,14 @@ static void resetOptions() {
 	writeRef     = true;  // write compact reference to .3.gEbwt_ext/.4.gEbwt_ext
 	justRef      = false; // *just* write compact reference, don't index
 	reverseEach  = false;
+	zeroCopy     = false;
+	freqKmers    = 0;
+	freqKmerLen  = 20;
+	sequentialBuild = false;
+	maxMem       = 0;
+	scratchDir.clear();
+	resume       = false;
+	metricsFile.clear();
     nthreads     = 1;
 	wrapper.clear();
 }
@@ -112,7 +143,15 @@ enum {
 	ARG_REVERSE_EACH,
 	ARG_SA,
     ARG_THREADS,
-	ARG_WRAPPER
+	ARG_WRAPPER,
+	ARG_ZERO_COPY,
+	ARG_SEQUENTIAL,
+	ARG_MAX_MEM,
+	ARG_SCRATCH_DIR,
+	ARG_RESUME,
+	ARG_METRICS_FILE,
+	ARG_FREQ_KMERS,
+	ARG_FREQ_KMER_LEN
 };
 
 /**
@@ -150,11 +189,20 @@ static void printUsage(ostream& out) {
 	    << "    --bmaxdivn <int>        max bucket sz as divisor of ref len (default: 4)" << endl
 	    << "    --dcv <int>             diff-cover period for blockwise (default: 1024)" << endl
 	    << "    --nodc                  disable diff-cover (algorithm becomes quadratic)" << endl
+	    << "    --blockwise             always use blockwise SA builder, even if SA fits in memory" << endl
 	    << "    -r/--noref              don't build .3/.4 index files" << endl
 	    << "    -3/--justref            just build .3/.4 index files" << endl
 	    << "    -o/--offrate <int>      SA is sampled every 2^<int> BWT chars (default: 5)" << endl
 	    << "    -t/--ftabchars <int>    # of chars consumed in initial lookup (default: 10)" << endl
         << "    --threads <int>         # of threads" << endl
+	    << "    --sequential            build mirror index after forward, not alongside (less memory)" << endl
+	    << "    --max-mem <int>[K|M|G]  hard memory budget; sorts SA blocks to disk to stay within it" << endl
+	    << "    --scratch-dir <dir>     dir for SA blocks and checkpoints (default: next to index)" << endl
+	    << "    --resume                resume an interrupted --max-mem/--scratch-dir build" << endl
+	    << "    --metrics-file <path>   write per-phase times and memory use as JSON to <path>" << endl
+	    << "    --zero-copy             also write zero-copy .zc." + gEbwt_ext + " files for fast loading" << endl
+	    << "    --freq-kmers <int>      write k-mers occurring >= <int> times to .kmer." + gEbwt_ext << endl
+	    << "    --freq-kmer-len <int>   length of those k-mers (default: 20)" << endl
 	    //<< "    --ntoa                  convert Ns in reference to As" << endl
 	    //<< "    --big --little          endianness (default: little, this host: "
 	    //<< (currentlyBigEndian()? "big":"little") << ")" << endl
@@ -188,6 +236,7 @@ static struct option long_options[] = {
 	{(char*)"nodc",         no_argument,       &noDc,        1},
 	{(char*)"seed",         required_argument, 0,            ARG_SEED},
 	{(char*)"entiresa",     no_argument,       &entireSA,    1},
+	{(char*)"blockwise",    no_argument,       &blockwise,   1},
 	{(char*)"version",      no_argument,       &showVersion, 1},
 	{(char*)"noauto",       no_argument,       0,            'a'},
 	{(char*)"noblocks",     required_argument, 0,            'n'},
@@ -204,6 +253,14 @@ static struct option long_options[] = {
     {(char*)"threads",      required_argument, 0,            ARG_THREADS},
 	{(char*)"usage",        no_argument,       0,            ARG_USAGE},
 	{(char*)"wrapper",      required_argument, 0,            ARG_WRAPPER},
+	{(char*)"zero-copy",    no_argument,       0,            ARG_ZERO_COPY},
+	{(char*)"sequential",   no_argument,       0,            ARG_SEQUENTIAL},
+	{(char*)"max-mem",      required_argument, 0,            ARG_MAX_MEM},
+	{(char*)"scratch-dir",  required_argument, 0,            ARG_SCRATCH_DIR},
+	{(char*)"resume",       no_argument,       0,            ARG_RESUME},
+	{(char*)"metrics-file", required_argument, 0,            ARG_METRICS_FILE},
+	{(char*)"freq-kmers",   required_argument, 0,            ARG_FREQ_KMERS},
+	{(char*)"freq-kmer-len", required_argument, 0,           ARG_FREQ_KMER_LEN},
 	{(char*)0, 0, 0, 0} // terminator
 };
 
@@ -230,6 +287,29 @@ static T parseNumber(T lower, const char *errmsg) {
 	return -1;
 }
 
+/**
+ * Parse a size in bytes, optionally suffixed with K, M or G, out of
+ * optarg; exit with an error and a usage message if it's malformed.
+ */
+static uint64_t parseMemSize(const char *errmsg) {
+	char *endPtr = NULL;
+	uint64_t t = (uint64_t)strtoull(optarg, &endPtr, 10);
+	if(endPtr != optarg) {
+		switch(toupper(*endPtr)) {
+			case 'G': t <<= 10; /* fall through */
+			case 'M': t <<= 10; /* fall through */
+			case 'K': t <<= 10; endPtr++; break;
+		}
+		if(*endPtr == '\0' && t > 0) {
+			return t;
+		}
+	}
+	cerr << errmsg << endl;
+	printUsage(cerr);
+	throw 1;
+	return 0;
+}
+
 /**
  * Read command-line arguments
  */
@@ -277,24 +357,57 @@ static bool parseOptions(int argc, const char **argv) {
 				bmax = parseNumber<TIndexOffU>(1, "--bmax arg must be at least 1");
 				bmaxMultSqrt = OFF_MASK; // don't use multSqrt
 				bmaxDivN = 0xffffffff;     // don't use multSqrt
+				blockwiseTuned = true;
 				break;
 			case ARG_BMAX_MULT:
 				bmaxMultSqrt = parseNumber<TIndexOffU>(1, "--bmaxmultsqrt arg must be at least 1");
 				bmax = OFF_MASK;     // don't use bmax
 				bmaxDivN = 0xffffffff; // don't use multSqrt
+				blockwiseTuned = true;
 				break;
 			case ARG_BMAX_DIV:
 				bmaxDivNSet = true;
 				bmaxDivN = parseNumber<uint32_t>(1, "--bmaxdivn arg must be at least 1");
 				bmax = OFF_MASK;         // don't use bmax
 				bmaxMultSqrt = OFF_MASK; // don't use multSqrt
+				blockwiseTuned = true;
 				break;
 			case ARG_DCV:
 				dcv = parseNumber<int>(3, "--dcv arg must be at least 3");
+				blockwiseTuned = true;
 				break;
 			case ARG_SEED:
 				seed = parseNumber<int>(0, "--seed arg must be at least 0");
 				break;
+			case ARG_ZERO_COPY:
+				zeroCopy = true;
+				break;
+			case ARG_SEQUENTIAL:
+				sequentialBuild = true;
+				break;
+			case ARG_MAX_MEM:
+				maxMem = parseMemSize("--max-mem arg must be a positive number of bytes, optionally followed by K, M or G");
+				break;
+			case ARG_SCRATCH_DIR:
+				scratchDir = optarg;
+				break;
+			case ARG_RESUME:
+				resume = true;
+				break;
+			case ARG_METRICS_FILE:
+				metricsFile = optarg;
+				break;
+			case ARG_FREQ_KMERS:
+				freqKmers = parseNumber<uint64_t>(1, "--freq-kmers arg must be at least 1");
+				break;
+			case ARG_FREQ_KMER_LEN:
+				freqKmerLen = parseNumber<int>(1, "--freq-kmer-len arg must be at least 1");
+				if(freqKmerLen > 32) {
+					cerr << "--freq-kmer-len arg must be at most 32" << endl;
+					printUsage(cerr);
+					throw 1;
+				}
+				break;
 			case ARG_REVERSE_EACH:
 				reverseEach = true;
 				break;
@@ -328,6 +441,23 @@ static bool parseOptions(int argc, const char **argv) {
 	if (!bmaxDivNSet) {
 		bmaxDivN *= nthreads;
 	}
+	if(noDc) {
+		blockwiseTuned = true;
+	}
+	if(entireSA && blockwise) {
+		cerr << "Error: --entiresa and --blockwise are mutually exclusive" << endl;
+		printUsage(cerr);
+		throw 1;
+	}
+	if(maxMem > 0 || !scratchDir.empty() || resume) {
+		// Only the blockwise builder can spill to disk
+		if(entireSA) {
+			cerr << "Error: --entiresa can't be combined with --max-mem, --scratch-dir or --resume" << endl;
+			printUsage(cerr);
+			throw 1;
+		}
+		blockwise = 1;
+	}
 	return abort;
 }
 
@@ -351,8 +481,278 @@ static void deleteIdxFiles(
 }
 
 /**
- * Drive the index construction process and optionally sanity-check the
- * result.
+ * Remove 'fname' if an earlier build with the same output name left
+ * it; this build won't rewrite it, and it wouldn't match the new index.
+ */
+static void removeStale(const string& fname) {
+	if(remove(fname.c_str()) == 0 && verbose) {
+		cout << "Removed \"" << fname.c_str() << "\" left by an earlier build" << endl;
+	}
+}
+
+/**
+ * Return the number of bytes of physical memory, or 0 if unknown.
+ */
+static uint64_t physicalMemory() {
+	uint64_t phys = 0;
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+	long pages = sysconf(_SC_PHYS_PAGES), pageSz = sysconf(_SC_PAGESIZE);
+	if(pages > 0 && pageSz > 0) {
+		phys = (uint64_t)pages * (uint64_t)pageSz;
+	}
+#endif
+	return phys;
+}
+
+/**
+ * Return true iff 'copies' suffix arrays of a text of length 'len'
+ * should be built in memory at once (SaisBlockwiseSA) rather than
+ * blockwise.  That's the case if the user asked for it with --entiresa
+ * or, by default, if the user hasn't asked for the blockwise builder
+ * or tuned it, there are no more threads than builds (SA-IS runs in
+ * one thread, and the blockwise sort would use the rest), and the
+ * shared text, the builds' copies of it, their SAs and temporaries fit
+ * comfortably (3/4) in physical memory.
+ */
+template<typename TStr>
+static bool useEntireSA(TIndexOffU len, bool packed, int copies) {
+	if(entireSA) return true;
+	if(blockwise || blockwiseTuned || packed || !autoMem) return false;
+	if(nthreads > copies) return false;
+	uint64_t need = copies * (SaisBlockwiseSA<TStr>::bytesNeeded(len) + len) + len;
+	uint64_t phys = physicalMemory();
+	bool fits = need <= phys - (phys >> 2);
+	if(verbose) {
+		cout << copies << " suffix array(s) need about " << (need >> 20) << " MB in memory, "
+		     << (phys >> 20) << " MB physical memory; "
+		     << (fits ? "building in memory" : "too big to build in memory") << endl;
+	}
+	return fits;
+}
+
+/**
+ * Return the peak resident set size of this process in bytes.
+ */
+static uint64_t peakMemory() {
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return (uint64_t)ru.ru_maxrss;
+#else
+	return (uint64_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+/**
+ * Return the largest bmax with which 'copies' blockwise builds of a
+ * text of length 'len', each with 'threads' threads, should fit in the
+ * --max-mem budget alongside the shared text, or 0 if none does.
+ *
+ * Each build holds a copy of the text, its 2-bit packed copy, the
+ * difference-cover sample (three and a quarter times its final size
+ * while it's being built, counting the lists of tied samples) and the
+ * ftab; then each sorting thread, and the thread reading
+ * the blocks back, holds a block of up to bmax offsets and the
+ * temporaries used to gather and sort it.
+ */
+static TIndexOffU budgetBmax(TIndexOffU len, bool packed, int copies, int threads) {
+	uint64_t textSz = packed ? (len >> 2) : len;
+	if(maxMem <= textSz) return 0;
+	uint64_t perBuild = (maxMem - textSz) / copies;
+	uint64_t fixed = textSz + (len >> 2) +
+		((1ull << (ftabChars << 1)) + 1) * OFF_SIZE * 2 +
+		(16 << 20); // out of caution
+	uint64_t dc = 0;
+	if(!noDc) {
+		EList<uint32_t> ds(getDiffCover<uint32_t>(dcv, false, false));
+		dc = ((uint64_t)len / dcv) * ds.size() * OFF_SIZE;
+	}
+	if(perBuild <= fixed + 3 * dc + dc / 4) return 0;
+	uint64_t holders = threads + (threads > 1 ? 1 : 0);
+	uint64_t b = (perBuild - fixed - dc) / (holders * 4 * OFF_SIZE);
+	if(b < 1024) return 0;
+	return (TIndexOffU)min<uint64_t>(b, OFF_MASK - 1);
+}
+
+/**
+ * Return the prefix for the SA blocks and checkpoint of the index with
+ * basename 'outfile'.
+ */
+static string spillBase(const string& outfile) {
+	if(scratchDir.empty()) {
+		return outfile;
+	}
+	size_t slash = outfile.find_last_of("/");
+	return scratchDir + "/" + (slash == string::npos ? outfile : outfile.substr(slash + 1));
+}
+
+/**
+ * Return a summary of the parameters an index was built with, recorded
+ * in the marker left when a disk-backed build finishes an index so that
+ * --resume only skips it if nothing changed.
+ */
+static string doneStamp(TIndexOffU len) {
+	ostringstream os;
+	os << len << " " << bmax << " " << (noDc ? 0 : dcv) << " "
+	   << offRate << " " << ftabChars << " " << lineRate << endl;
+	return os.str();
+}
+
+/**
+ * Return true iff a disk-backed build has already finished the index
+ * with basename 'outfile' using the same parameters.
+ */
+static bool indexDone(const string& outfile, TIndexOffU len) {
+	ifstream done((spillBase(outfile) + ".done").c_str());
+	if(!done.good()) return false;
+	string stamp((istreambuf_iterator<char>(done)), istreambuf_iterator<char>());
+	ifstream f1((outfile + ".1." + gEbwt_ext).c_str());
+	ifstream f2((outfile + ".2." + gEbwt_ext).c_str());
+	return stamp == doneStamp(len) && f1.good() && f2.good();
+}
+
+/**
+ * One of the two indexes built by driver(): the forward index or the
+ * mirror index.
+ */
+template<typename TStr>
+struct IndexBuild {
+	string                  outfile;
+	int                     reverse;  // REF_READ_*
+	bool                    packed;
+	bool                    useBlockwise;
+	int                     nthreads;
+	EList<FileBuf*>        *is;
+	EList<RefRecord>       *szs;
+	TIndexOffU              sztot;
+	const JoinedRef<TStr>  *shared;
+	const SaSpill          *spill;       // where to spill SA blocks, or NULL
+	bool                    outOfMemory; // set if the build threw bad_alloc
+	int                     error;       // set if the build threw anything else
+};
+
+/**
+ * Build one index from the shared, joined reference and optionally
+ * sanity-check the result.
+ */
+template<typename TStr>
+static void buildIndex(IndexBuild<TStr>& b) {
+	bool bisulfite = false;
+	RefReadInParams refparams(false, b.reverse, nsToAs, bisulfite);
+	Timer timer(cout, b.reverse ?
+		"Total time for backward call to driver() for mirror index: " :
+		"Total time for call to driver() for forward index: ", verbose);
+	BuildMetrics::setIndex(b.reverse ? "mirror" : "forward");
+	BuildPhase phase("index", b.nthreads);
+	Ebwt ebwt(
+		TStr(),
+		b.packed,
+		0,
+		1,  // TODO: maybe not?
+		lineRate,
+		offRate,      // suffix-array sampling rate
+		ftabChars,    // number of chars in initial arrow-pair calc
+		b.nthreads,
+		b.outfile,    // basename for .?.ebwt files
+		b.reverse == 0, // fw
+		b.useBlockwise, // useBlockwise
+		bmax,         // block size for blockwise SA builder
+		bmaxMultSqrt, // block size as multiplier of sqrt(len)
+		bmaxDivN,     // block size as divisor of len
+		noDc? 0 : dcv,// difference-cover period
+		*b.is,        // list of input streams
+		*b.szs,       // list of reference sizes
+		b.sztot,      // total size of all unambiguous ref chars
+		refparams,    // reference read-in parameters
+		seed,         // pseudo-random number generator seed
+		-1,           // override offRate
+		doSaFile,     // make a file with just the suffix array in it
+		doBwtFile,    // make a file with just the BWT string in it
+		verbose,      // be talkative
+		autoMem,      // pass exceptions up to the toplevel so that we can adjust memory settings automatically
+		sanityCheck,  // verify results and internal consistency
+		b.shared,     // joined reference
+		b.spill);     // where to spill SA blocks
+	if(b.spill != NULL) {
+		// Let --resume skip this index
+		ofstream done((b.spill->base + ".done").c_str());
+		done << doneStamp(b.sztot);
+	}
+	// Note that the Ebwt is *not* resident in memory at this time.  To
+	// load it into memory, call ebwt.loadIntoMemory()
+	if(verbose) {
+		// Print Ebwt's vital stats
+		ebwt.eh().print(cout);
+	}
+	if(sanityCheck) {
+		// Try restoring the original string (if there were
+		// multiple texts, what we'll get back is the joined,
+		// padded string, not a list)
+		ebwt.loadIntoMemory(
+			0,
+			b.reverse ? (refparams.reverse == REF_READ_REVERSE) : 0,
+			true,  // load SA sample?
+			true,  // load ftab?
+			true,  // load rstarts?
+			false,
+			false);
+		SString<char> s2;
+		ebwt.restore(s2);
+		ebwt.evictFromMemory();
+		{
+			const TStr& joined = b.shared->s;
+			SString<char> joinedss;
+			joinedss.resize(joined.length());
+			for(size_t i = 0; i < joined.length(); i++) {
+				joinedss.set(joined[i], i);
+			}
+			if(refparams.reverse == REF_READ_REVERSE_EACH) {
+				size_t off = 0;
+				for(size_t i = 0; i < b.szs->size(); i++) {
+					joinedss.reverseWindow(off, (*b.szs)[i].len);
+					off += (*b.szs)[i].len;
+				}
+			} else if(refparams.reverse == REF_READ_REVERSE) {
+				joinedss.reverse();
+			}
+			assert_eq(joinedss.length(), s2.length());
+			assert(sstr_eq(joinedss, s2));
+		}
+		if(verbose) {
+			if(s2.length() < 1000) {
+				cout << "Passed restore check: " << s2.toZBuf() << endl;
+			} else {
+				cout << "Passed restore check: (" << s2.length() << " chars)" << endl;
+			}
+		}
+	}
+}
+
+/**
+ * Thread body for building one index concurrently with the other.
+ * Exceptions can't cross threads, so record them for driver().
+ */
+template<typename TStr>
+static void buildIndexWorker(void *vp) {
+	IndexBuild<TStr>& b = *(IndexBuild<TStr>*)vp;
+	try {
+		buildIndex<TStr>(b);
+	} catch(bad_alloc& e) {
+		b.outOfMemory = true;
+	} catch(std::exception& e) {
+		cerr << "Error: Encountered exception: '" << e.what() << "'" << endl;
+		b.error = 1;
+	} catch(int e) {
+		b.error = (e == 0) ? 1 : e;
+	}
+}
+
+/**
+ * Drive the index construction process: read the reference once, then
+ * build the forward and mirror indexes from it, concurrently if we
+ * have more than one thread, and optionally sanity-check the results.
  */
 template<typename TStr>
 static void driver(
@@ -360,11 +760,12 @@ static void driver(
 	EList<string>& infiles,
 	const string& outfile,
 	bool packed,
-	int reverse)
+	int reverseType)
 {
 	EList<FileBuf*> is(MISC_CAT);
+	EList<string> paths(MISC_CAT); // non-empty input files
 	bool bisulfite = false;
-	RefReadInParams refparams(false, reverse, nsToAs, bisulfite);
+	RefReadInParams refparams(false, REF_READ_FORWARD, nsToAs, bisulfite);
 	assert_gt(infiles.size(), 0);
 	if(format == CMDLINE) {
 		// Adapt sequence strings to stringstreams open for input
@@ -412,111 +813,171 @@ static void driver(
 			ASSERT_ONLY(fb->reset());
 			assert(!fb->eof());
 			is.push_back(fb);
+			paths.push_back(infiles[i]);
 		}
 	}
 	if(is.empty()) {
 		cerr << "Warning: All fasta inputs were empty" << endl;
 		throw 1;
 	}
-	if(!reverse) {
 #ifdef BOWTIE_64BIT_INDEX
-          if (verbose) cerr << "Building a LARGE index" << endl;
+	if (verbose) cerr << "Building a LARGE index" << endl;
 #else
-          if (verbose) cerr << "Building a SMALL index" << endl;
+	if (verbose) cerr << "Building a SMALL index" << endl;
 #endif
-	}
 	// Vector for the ordered list of "records" comprising the input
 	// sequences.  A record represents a stretch of unambiguous
 	// characters in one of the input sequences.
 	EList<RefRecord> szs(MISC_CAT);
 	std::pair<size_t, size_t> sztot;
-	{
-		if(verbose) cout << "Reading reference sizes" << endl;
-		Timer _t(cout, "  Time reading reference sizes: ", verbose);
-		if(!reverse && (writeRef || justRef)) {
+	JoinedRef<TStr> shared;
+	if(format != CMDLINE && RefIngest::applies(refparams)) {
+		// Read, scan and pack the reference in one pass on all threads
+		RefIngest ingest(nthreads, verbose);
+		{
+			if(verbose) cout << "Reading reference sequences" << endl;
+			Timer _t(cout, "  Time reading reference sequences: ", verbose);
+			BuildPhase phase("read_reference", nthreads);
+			sztot = ingest.read(paths, szs, shared.names);
+		}
+		if(writeRef || justRef) {
 			filesWritten.push_back(outfile + ".3." + gEbwt_ext);
 			filesWritten.push_back(outfile + ".4." + gEbwt_ext);
-			sztot = BitPairReference::szsFromFasta(is, outfile, bigEndian, refparams, szs, sanityCheck);
-		} else {
-			sztot = BitPairReference::szsFromFasta(is, string(), bigEndian, refparams, szs, sanityCheck);
+			BuildPhase phase("write_reference");
+			ingest.writeRefFiles(outfile, bigEndian, szs);
+		}
+		if(justRef) return;
+		BuildPhase phase("unpack_reference", nthreads);
+		ingest.unpack(shared.s);
+	} else {
+		{
+			if(verbose) cout << "Reading reference sizes" << endl;
+			Timer _t(cout, "  Time reading reference sizes: ", verbose);
+			// Also writes the .3/.4 files
+			BuildPhase phase("read_reference_sizes");
+			if(writeRef || justRef) {
+				filesWritten.push_back(outfile + ".3." + gEbwt_ext);
+				filesWritten.push_back(outfile + ".4." + gEbwt_ext);
+				sztot = BitPairReference::szsFromFasta(is, outfile, bigEndian, refparams, szs, sanityCheck);
+			} else {
+				sztot = BitPairReference::szsFromFasta(is, string(), bigEndian, refparams, szs, sanityCheck);
+			}
+		}
+		if(justRef) return;
+		// Read and join the reference once for both indexes
+		{
+			if(verbose) cout << "Reading reference sequences" << endl;
+			Timer _t(cout, "  Time reading reference sequences: ", verbose);
+			BuildPhase phase("read_reference");
+			shared.s.resize((TIndexOffU)sztot.first);
+			Ebwt::readJoined(is, szs, refparams, shared.s, shared.names);
 		}
 	}
-	if(justRef) return;
 	assert_gt(sztot.first, 0);
 	assert_gt(sztot.second, 0);
 	assert_gt(szs.size(), 0);
-	// Construct index from input strings and parameters
-	filesWritten.push_back(outfile + ".1." + gEbwt_ext);
-	filesWritten.push_back(outfile + ".2." + gEbwt_ext);
-	Ebwt ebwt(
-		TStr(),
-		packed,
-		0,
-		1,  // TODO: maybe not?
-		lineRate,
-		offRate,      // suffix-array sampling rate
-		ftabChars,    // number of chars in initial arrow-pair calc
-              nthreads,
-		outfile,      // basename for .?.ebwt files
-		reverse == 0, // fw
-		!entireSA,    // useBlockwise
-		bmax,         // block size for blockwise SA builder
-		bmaxMultSqrt, // block size as multiplier of sqrt(len)
-		bmaxDivN,     // block size as divisor of len
-		noDc? 0 : dcv,// difference-cover period
-		is,           // list of input streams
-		szs,          // list of reference sizes
-		(TIndexOffU)sztot.first,  // total size of all unambiguous ref chars
-		refparams,    // reference read-in parameters
-		seed,         // pseudo-random number generator seed
-		-1,           // override offRate
-		doSaFile,     // make a file with just the suffix array in it
-		doBwtFile,    // make a file with just the BWT string in it
-		verbose,      // be talkative
-		autoMem,      // pass exceptions up to the toplevel so that we can adjust memory settings automatically
-		sanityCheck); // verify results and internal consistency
-	// Note that the Ebwt is *not* resident in memory at this time.  To
-	// load it into memory, call ebwt.loadIntoMemory()
-	if(verbose) {
-		// Print Ebwt's vital stats
-		ebwt.eh().print(cout);
+	TIndexOffU len = (TIndexOffU)sztot.first;
+	// Build the indexes side by side, each with half the threads,
+	// unless asked not to or the in-memory SAs only fit one at a time
+	bool concurrent = nthreads > 1 && !sequentialBuild;
+	bool entire = useEntireSA<TStr>(len, packed, concurrent ? 2 : 1);
+	if(concurrent && !entire && useEntireSA<TStr>(len, packed, 1)) {
+		if(verbose) cout << "Building forward and mirror indexes one after the other" << endl;
+		concurrent = false;
+		entire = true;
 	}
-	if(sanityCheck) {
-		// Try restoring the original string (if there were
-		// multiple texts, what we'll get back is the joined,
-		// padded string, not a list)
-		ebwt.loadIntoMemory(
-			0,
-			reverse ? (refparams.reverse == REF_READ_REVERSE) : 0,
-			true,  // load SA sample?
-			true,  // load ftab?
-			true,  // load rstarts?
-			false,
-			false);
-		SString<char> s2;
-		ebwt.restore(s2);
-		ebwt.evictFromMemory();
-		{
-			SString<char> joinedss = Ebwt::join<SString<char> >(
-				is,          // list of input streams
-				szs,         // list of reference sizes
-				(TIndexOffU)sztot.first, // total size of all unambiguous ref chars
-				refparams,   // reference read-in parameters
-				seed);       // pseudo-random number generator seed
-			if(refparams.reverse == REF_READ_REVERSE) {
-				joinedss.reverse();
-			}
-			assert_eq(joinedss.length(), s2.length());
-			assert(sstr_eq(joinedss, s2));
+	bool disk = maxMem > 0 || !scratchDir.empty() || resume;
+	if(maxMem > 0) {
+		// Pick the largest blocks that fit the budget, building the
+		// indexes one after the other if they don't fit side by side
+		TIndexOffU b = concurrent ? budgetBmax(len, packed, 2, max(nthreads / 2, 1)) : 0;
+		if(b == 0) {
+			if(concurrent && verbose) cout << "Building forward and mirror indexes one after the other to fit --max-mem" << endl;
+			concurrent = false;
+			b = budgetBmax(len, packed, 1, nthreads);
 		}
-		if(verbose) {
-			if(s2.length() < 1000) {
-				cout << "Passed restore check: " << s2.toZBuf() << endl;
-			} else {
-				cout << "Passed restore check: (" << s2.length() << " chars)" << endl;
-			}
+		if(b == 0) {
+			cerr << "Error: --max-mem " << (maxMem >> 20) << " MB is too small to index " << len
+			     << " characters; try a larger budget, fewer --threads or a larger --dcv" << endl;
+			throw 1;
+		}
+		if(bmax == OFF_MASK || bmax > b) {
+			bmax = b;
+			bmaxMultSqrt = OFF_MASK;
+			bmaxDivN = 0xffffffff;
+		}
+		autoMem = false; // the budget is a hard limit; don't go looking for more
+		if(verbose) cout << "Using --bmax " << bmax << " to fit --max-mem " << (maxMem >> 20) << " MB" << endl;
+	}
+	SaSpill spills[2];
+	IndexBuild<TStr> builds[2];
+	for(int i = 0; i < 2; i++) {
+		IndexBuild<TStr>& b = builds[i];
+		b.outfile = (i == 0) ? outfile : outfile + ".rev";
+		spills[i].base = spillBase(b.outfile);
+		spills[i].resume = resume;
+		b.spill = disk ? &spills[i] : NULL;
+		b.reverse = (i == 0) ? REF_READ_FORWARD : reverseType;
+		b.packed = packed;
+		b.useBlockwise = !entire;
+		b.nthreads = concurrent ? max((nthreads + 1 - i) / 2, 1) : nthreads;
+		b.is = &is;
+		b.szs = &szs;
+		b.sztot = len;
+		b.shared = &shared;
+		b.outOfMemory = false;
+		b.error = 0;
+	}
+	// On --resume, skip the indexes an interrupted build finished
+	bool skip[2] = { false, false };
+	for(int i = 0; i < 2; i++) {
+		if(resume && indexDone(builds[i].outfile, len)) {
+			if(verbose) cout << "Resuming: " << builds[i].outfile << " is already built" << endl;
+			skip[i] = true;
+		} else {
+			filesWritten.push_back(builds[i].outfile + ".1." + gEbwt_ext);
+			filesWritten.push_back(builds[i].outfile + ".2." + gEbwt_ext);
+		}
+	}
+	if(skip[0] || skip[1]) {
+		concurrent = false;
+	}
+	gBuildMetrics.setValue("reference_length", len);
+	gBuildMetrics.setValue("reference_sequences", shared.names.size());
+	gBuildMetrics.setValue("packed", packed);
+	gBuildMetrics.setValue("blockwise", !entire);
+	gBuildMetrics.setValue("concurrent", concurrent);
+	if(bmax != OFF_MASK) gBuildMetrics.setValue("bmax", bmax);
+	if(concurrent) {
+		if(verbose) cout << "Building forward and mirror indexes concurrently" << endl;
+#ifdef WITH_TBB
+		std::thread *mirror = new std::thread(buildIndexWorker<TStr>, (void*)&builds[1]);
+#else
+		tthread::thread *mirror = new tthread::thread(buildIndexWorker<TStr>, (void*)&builds[1]);
+#endif
+		buildIndexWorker<TStr>((void*)&builds[0]);
+		mirror->join();
+		delete mirror;
+		for(int i = 0; i < 2; i++) {
+			if(builds[i].outOfMemory) throw bad_alloc();
+		}
+		for(int i = 0; i < 2; i++) {
+			if(builds[i].error != 0) throw builds[i].error;
+		}
+	} else {
+		for(int i = 0; i < 2; i++) {
+			if(!skip[i]) buildIndex<TStr>(builds[i]);
+		}
+	}
+	BuildMetrics::setIndex(NULL);
+	if(disk) {
+		for(int i = 0; i < 2; i++) {
+			remove((spills[i].base + ".done").c_str());
 		}
 	}
+	if(verbose) {
+		cout << "Peak memory used: " << (peakMemory() >> 20) << " MB" << endl;
+	}
 }
 
 static const char *argv0 = NULL;
@@ -624,32 +1085,25 @@ int bowtie_build(int argc, const char **argv) {
 				cout << "  " << infiles[i].c_str() << endl;
 			}
 		}
+		if(!metricsFile.empty()) {
+			gBuildMetrics.enable(nthreads);
+			gBuildMetrics.setValue("offrate", offRate);
+			gBuildMetrics.setValue("ftabchars", ftabChars);
+			gBuildMetrics.setValue("dcv", noDc ? 0 : dcv);
+		}
+		if(!justRef && !zeroCopy) {
+			removeStale(outfile + ".zc." + gEbwt_ext);
+			removeStale(outfile + ".rev.zc." + gEbwt_ext);
+		}
+		if(!justRef && freqKmers == 0) {
+			removeStale(outfile + ".kmer." + gEbwt_ext);
+		}
 		// Seed random number generator
 		srand(seed);
-		{
-			Timer timer(cout, "Total time for call to driver() for forward index: ", verbose);
-			if(!packed) {
-				try {
-					driver<SString<char> >(infile, infiles, outfile, false, REF_READ_FORWARD);
-				} catch(bad_alloc& e) {
-					if(autoMem) {
-						cerr << "Switching to a packed string representation." << endl;
-						packed = true;
-					} else {
-						throw e;
-					}
-				}
-			}
-			if(packed) {
-				driver<S2bDnaString>(infile, infiles, outfile, true, REF_READ_FORWARD);
-			}
-		}
 		int reverseType = reverseEach ? REF_READ_REVERSE_EACH : REF_READ_REVERSE;
-		srand(seed);
-		Timer timer(cout, "Total time for backward call to driver() for mirror index: ", verbose);
 		if(!packed) {
 			try {
-				driver<SString<char> >(infile, infiles, outfile + ".rev", false, reverseType);
+				driver<SString<char> >(infile, infiles, outfile, false, reverseType);
 			} catch(bad_alloc& e) {
 				if(autoMem) {
 					cerr << "Switching to a packed string representation." << endl;
@@ -660,7 +1114,25 @@ int bowtie_build(int argc, const char **argv) {
 			}
 		}
 		if(packed) {
-			driver<S2bDnaString>(infile, infiles, outfile + ".rev", true, reverseType);
+			srand(seed);
+			driver<S2bDnaString>(infile, infiles, outfile, true, reverseType);
+		}
+		if(zeroCopy && !justRef) {
+			Timer timer(cout, "Total time for writing zero-copy index files: ", verbose);
+			BuildPhase phase("zero_copy");
+			filesWritten.push_back(outfile + ".zc." + gEbwt_ext);
+			filesWritten.push_back(outfile + ".rev.zc." + gEbwt_ext);
+			writeZeroCopyIndex(outfile, verbose);
+			writeZeroCopyIndex(outfile + ".rev", verbose);
+		}
+		if(freqKmers > 0 && !justRef) {
+			Timer timer(cout, "Total time for writing frequent k-mer table: ", verbose);
+			BuildPhase phase("freq_kmers");
+			filesWritten.push_back(outfile + ".kmer." + gEbwt_ext);
+			gBuildMetrics.setValue("freq_kmers", writeFreqKmerTable(outfile, freqKmerLen, freqKmers, verbose));
+		}
+		if(!metricsFile.empty() && !gBuildMetrics.write(metricsFile, filesWritten)) {
+			cerr << "Warning: could not write metrics to \"" << metricsFile.c_str() << "\"" << endl;
 		}
 		return 0;
 	} catch(std::exception& e) {
@@ -151,7 +151,7 @@ TIndexOffU Ebwt::getOffset(TIndexOffU row) const {
 	assert(offs() != NULL);
 	assert_neq(OFF_MASK, row);
 	if(row == _zOff) return 0;
-	if((row & _eh._offMask) == row) return this->offs()[row >> _eh._offRate];
+	if((row & _eh._offMask) == row) return this->offsAt(row >> _eh._offRate);
 	TIndexOffU jumps = 0;
 	SideLocus l;
 	l.initFromRow(row, _eh, ebwt());
@@ -164,7 +164,7 @@ TIndexOffU Ebwt::getOffset(TIndexOffU row) const {
 		if(row == _zOff) {
 			return jumps;
 		} else if((row & _eh._offMask) == row) {
-			return jumps + this->offs()[row >> _eh._offRate];
+			return jumps + this->offsAt(row >> _eh._offRate);
 		}
 		l.initFromRow(row, _eh, ebwt());
 	}
@@ -45,6 +45,9 @@
 #include "random_source.h"
 #include "ref_read.h"
 #include "threading.h"
+#ifdef WITH_TBB
+ #include <tbb/compat/thread>
+#endif
 #include "str_util.h"
 #include "mm.h"
 #include "timer.h"
@@ -54,6 +57,8 @@
 #include "random_source.h"
 #include "mem_ids.h"
 #include "btypes.h"
+#include "occ_count.h"
+#include "hugepage.h"
 
 #ifdef POPCNT_CAPABILITY 
     #include "processor_support.h" 
@@ -272,6 +277,55 @@ public:
 	bool     _entireReverse;
 };
 
+/**
+ * Sections of a zero-copy index file.
+ */
+enum {
+	EBWT_ZC_PLEN = 0,
+	EBWT_ZC_RSTARTS,
+	EBWT_ZC_EBWT,
+	EBWT_ZC_FCHR,
+	EBWT_ZC_FTAB,
+	EBWT_ZC_EFTAB,
+	EBWT_ZC_OFFS,
+	EBWT_ZC_NAMES,   // names separated by '\n'
+	EBWT_ZC_NSECS
+};
+
+#define EBWT_ZC_MAGIC "BT2ZCIDX"
+#define EBWT_ZC_VERSION 2
+#define EBWT_ZC_ALIGN 4096
+
+/**
+ * Header of a zero-copy index file (<base>.zc.bt2), which holds the
+ * contents of both the .1.bt2 and .2.bt2 files.  The header, including
+ * the table of contents, occupies the first page and is followed by
+ * the sections, each starting on an EBWT_ZC_ALIGN boundary.  Everything
+ * is in the writer's byte order and TIndexOffU width, so a reader that
+ * matches both can point its arrays straight into a mapping of the
+ * file.  The size and a checksum of the .1.bt2 file it was made from
+ * let a reader tell whether the index has been rebuilt since.
+ */
+struct EbwtZcHeader {
+	char     magic[8];  // EBWT_ZC_MAGIC, not NUL-terminated
+	uint32_t version;   // EBWT_ZC_VERSION
+	uint32_t one;       // 1, to detect byte order
+	uint32_t offSize;   // OFF_SIZE of the writer
+	int32_t  lineRate;
+	int32_t  offRate;
+	int32_t  ftabChars;
+	int32_t  flags;     // as in the .1.bt2 header
+	uint32_t pad;
+	uint64_t len;
+	uint64_t zOff;
+	uint64_t nPat;
+	uint64_t nFrag;
+	uint64_t src1Size;  // size of the .1.bt2 file it was made from
+	uint64_t src1Sum;   // ebwtFileSum() of that file
+	uint64_t secOff[EBWT_ZC_NSECS]; // byte offset of each section
+	uint64_t secLen[EBWT_ZC_NSECS]; // byte length of each section
+};
+
 /**
  * Exception to throw when a file-realted error occurs.
  */
@@ -418,6 +472,19 @@ struct SideLocus {
 		return ebwt + _sideByteOff;
 	}
 
+	/**
+	 * Ask the processor to start pulling this locus's side into cache,
+	 * so that a mapLF issued some time later doesn't stall on DRAM.
+	 * The side need not be cache-line aligned, so touch both ends.
+	 */
+	void prefetch(const uint8_t* ebwt) const {
+#if defined(__GNUC__)
+		const uint8_t *s = side(ebwt);
+		__builtin_prefetch(s);
+		__builtin_prefetch(s + 63);
+#endif
+	}
+
 	TIndexOffU _sideByteOff; // offset of top side within ebwt[]
 	TIndexOffU _sideNum;     // index of side
 	uint32_t _charOff;      // character offset within side
@@ -475,6 +542,20 @@ inline static int countInU64(int c, uint64_t dw) {
 
 // Forward declarations for Ebwt class
 class EbwtSearchParams;
+class SAOffsetCache;
+
+/**
+ * The references read in and joined (forward, without reversal) once,
+ * so that the builds of the forward and mirror indexes can share them
+ * rather than each reading the FASTA files again.
+ */
+template<typename TStr>
+struct JoinedRef {
+	JoinedRef() : names(EBWT_CAT) { }
+
+	TStr          s;     // joined unambiguous stretches
+	EList<string> names; // names of the reference sequences
+};
 
 /**
  * Extended Burrows-Wheeler transform data.
@@ -510,9 +591,17 @@ public:
 	    _ebwt(EBWT_CAT), \
 	    _useMm(false), \
 	    useShmem_(false), \
+	    _hugePages(HUGEPAGES_OFF), \
+	    _packOffs(false), \
+	    _loadThreads(1), \
+	    _saCache(NULL), \
+	    _offsBits(0), \
+	    _offsMask(0), \
 	    _refnames(EBWT_CAT), \
 	    mmFile1_(NULL), \
-	    mmFile2_(NULL)
+	    mmFile2_(NULL), \
+	    zcFile_(NULL), \
+	    zcLen_(0)
 
 	/// Construct an Ebwt from the given input file
 	Ebwt(const string& in,
@@ -544,6 +633,7 @@ public:
 		useShmem_ = useShmem;
 		_in1Str = in + ".1." + gEbwt_ext;
 		_in2Str = in + ".2." + gEbwt_ext;
+		_zcStr = in + ".zc." + gEbwt_ext;
 		readIntoMemory(
 			color,       // expect index to be colorspace?
 			fw ? -1 : needEntireReverse, // need REF_READ_REVERSE
@@ -555,6 +645,10 @@ public:
 			mmSweep,     // mmSweep
 			loadNames,   // loadNames
 			startVerbose); // startVerbose
+		_occKernel = selectOccKernel();
+		if(_verbose || startVerbose) {
+			cerr << "  Occurrence counting kernel: " << occKernelName(_occKernel) << endl;
+		}
 		// If the offRate has been overridden, reflect that in the
 		// _eh._offRate field
 		if(offRatePlus > 0 && _overrideOffRate == -1) {
@@ -571,6 +665,10 @@ public:
 	/// vector, optionally using a blockwise suffix sorter with the
 	/// given 'bmax' and 'dcv' parameters.  The string vector is
 	/// ultimately joined and the joined string is passed to buildToDisk().
+	/// If 'shared' is non-NULL, the joined references are copied from it
+	/// rather than read from 'is'.  If 'spill' is non-NULL, sorted blocks
+	/// of the suffix array are spilled and checkpointed there (see
+	/// SaSpill).
 	template<typename TStr>
 	Ebwt(
 		TStr exampleStr,
@@ -598,7 +696,9 @@ public:
 		bool doBwtFile = false,
 		bool verbose = false,
 		bool passMemExc = false,
-		bool sanityCheck = false) :
+		bool sanityCheck = false,
+		const JoinedRef<TStr>* shared = NULL,
+		const SaSpill* spill = NULL) :
 		Ebwt_INITS,
 		_eh(
 			joinedLen(szs),
@@ -612,6 +712,7 @@ public:
         ProcessorSupport ps; 
         _usePOPCNTinstruction = ps.POPCNTenabled(); 
 #endif 
+		_occKernel = selectOccKernel();
 		_in1Str = file + ".1." + gEbwt_ext;
 		_in2Str = file + ".2." + gEbwt_ext;
 		packed_ = packed;
@@ -669,7 +770,9 @@ public:
 		    bmaxDivN,
 		    dcv,
 		    seed,
-		    verbose);
+		    verbose,
+		    shared,
+		    spill);
 		// Close output files
 		fout1.flush();
 		
@@ -931,7 +1034,9 @@ public:
 	                    TIndexOffU bmaxDivN,
 	                    int dcv,
 	                    uint32_t seed,
-	                    bool verbose)
+	                    bool verbose,
+	                    const JoinedRef<TStr>* shared = NULL,
+	                    const SaSpill* spill = NULL)
 	{
 		// Compose text strings into single string
 		VMSG_NL("Calculating joined length");
@@ -948,7 +1053,8 @@ public:
 			if(refparams.reverse == REF_READ_REVERSE) {
 				{
 					Timer timer(cout, "  Time to join reference sequences: ", _verbose);
-					joinToDisk(is, szs, sztot, refparams, s, out1, out2);
+					BuildPhase phase("join");
+					joinToDisk(is, szs, sztot, refparams, shared, s, out1, out2);
 				} {
 					Timer timer(cout, "  Time to reverse reference sequence: ", _verbose);
 					EList<RefRecord> tmp(EBWT_CAT);
@@ -958,7 +1064,8 @@ public:
 				}
 			} else {
 				Timer timer(cout, "  Time to join reference sequences: ", _verbose);
-				joinToDisk(is, szs, sztot, refparams, s, out1, out2);
+				BuildPhase phase("join");
+				joinToDisk(is, szs, sztot, refparams, shared, s, out1, out2);
 				szsToDisk(szs, out1, refparams.reverse);
 			}
 			// Joined reference sequence now in 's'
@@ -1010,10 +1117,36 @@ public:
 		}
 		int iter = 0;
 		bool first = true;
+		bool built = false;
 		streampos out1pos = out1.tellp();
 		streampos out2pos = out2.tellp();
+		if(!useBlockwise) {
+			// Build the whole suffix array in memory at once
+			try {
+				VMSG_NL("Constructing suffix array in memory");
+				SaisBlockwiseSA<TStr> bsa(s, _sanity, _passMemExc, _verbose);
+				assert(bsa.suffixItrIsReset());
+				assert_eq(bsa.size(), s.length()+1);
+				VMSG_NL("Converting suffix-array elements to index image");
+				buildToDisk(bsa, s, nthreads, out1, out2, saOut, bwtOut);
+				if(!flushIndexFiles(out1, out2, saOut, bwtOut)) {
+					cerr << "An error occurred writing the index to disk.  Please check if the disk is full." << endl;
+					throw 1;
+				}
+				built = true;
+			} catch(bad_alloc& e) {
+				if(!_passMemExc) {
+					cerr << "Out of memory while constructing suffix array in memory.  Please try using" << endl
+					     << "the blockwise builder (--blockwise)" << endl;
+					throw 1;
+				}
+				VMSG_NL("  Ran out of memory; falling back on the blockwise suffix-array builder.");
+				out1.seekp(out1pos);
+				out2.seekp(out2pos);
+			}
+		}
 		// Look for bmax/dcv parameters that work.
-		while(true) {
+		while(!built) {
 			if(!first && bmax < 40 && _passMemExc) {
 				cerr << "Could not find approrpiate bmax/dcv settings for building this index." << endl;
 				if(!isPacked()) {
@@ -1048,7 +1181,9 @@ public:
 			}
 			iter++;
 			try {
-				{
+				// A disk-backed build was fitted to its memory budget up
+				// front; the test would itself blow through the budget
+				if(spill == NULL) {
 					VMSG_NL("  Doing ahead-of-time memory usage test");
 					// Make a quick-and-dirty attempt to force a bad_alloc iff
 					// we would have thrown one eventually as part of
@@ -1076,25 +1211,18 @@ public:
 					VMSG_NL("");
 				}
 				VMSG_NL("Constructing suffix-array element generator");
-				KarkkainenBlockwiseSA<TStr> bsa(s, bmax, nthreads, dcv, seed, _sanity, _passMemExc, _verbose, outfile);
+				KarkkainenBlockwiseSA<TStr> bsa(s, bmax, nthreads, dcv, seed, _sanity, _passMemExc, _verbose, outfile, spill);
 				assert(bsa.suffixItrIsReset());
 				assert_eq(bsa.size(), s.length()+1);
 				VMSG_NL("Converting suffix-array elements to index image");
-				buildToDisk(bsa, s, out1, out2, saOut, bwtOut);
-				out1.flush(); out2.flush();
-				bool failed = out1.fail() || out2.fail();
-				if(saOut != NULL) {
-					saOut->flush();
-					failed = failed || saOut->fail();
-				}
-				if(bwtOut != NULL) {
-					bwtOut->flush();
-					failed = failed || bwtOut->fail();
-				}
-				if(failed) {
+				buildToDisk(bsa, s, nthreads, out1, out2, saOut, bwtOut);
+				if(!flushIndexFiles(out1, out2, saOut, bwtOut)) {
 					cerr << "An error occurred writing the index to disk.  Please check if the disk is full." << endl;
 					throw 1;
 				}
+				gBuildMetrics.addBlocks(bsa.blockSizes(), bsa.blockSecs());
+				// The index is written; the spilled blocks aren't needed
+				bsa.removeSpill();
 				break;
 			} catch(bad_alloc& e) {
 				if(_passMemExc) {
@@ -1122,6 +1250,24 @@ public:
 		VMSG_NL("Returning from initFromVector");
 	}
 	
+	/**
+	 * Flush the files written by buildToDisk() and return true iff
+	 * all of them were written successfully.
+	 */
+	static bool flushIndexFiles(ostream& out1, ostream& out2, ostream* saOut, ostream* bwtOut) {
+		out1.flush(); out2.flush();
+		bool failed = out1.fail() || out2.fail();
+		if(saOut != NULL) {
+			saOut->flush();
+			failed = failed || saOut->fail();
+		}
+		if(bwtOut != NULL) {
+			bwtOut->flush();
+			failed = failed || bwtOut->fail();
+		}
+		return !failed;
+	}
+
 	/**
 	 * Return the length that the joined string of the given string
 	 * list will have.  Note that this is indifferent to how the text
@@ -1139,18 +1285,24 @@ public:
 	/// Destruct an Ebwt
 	~Ebwt() {
 		_fchr.reset();
+		if(offs() != NULL && useShmem_) {
+			FREE_SHARED(offs());
+		}
+		if(ebwt() != NULL && useShmem_) {
+			FREE_SHARED(ebwt());
+		}
 		_ftab.reset();
 		_eftab.reset();
 		_plen.reset();
 		_rstarts.reset();
 		_offs.reset();
 		_ebwt.reset();
-		if(offs() != NULL && useShmem_) {
-			FREE_SHARED(offs());
-		}
-		if(ebwt() != NULL && useShmem_) {
-			FREE_SHARED(ebwt());
+		freeHugeRegions();
+#ifdef BOWTIE_MM
+		if(zcFile_ != NULL) {
+			munmap(zcFile_, zcLen_);
 		}
+#endif
 		if (_in1 != NULL) fclose(_in1);
 		if (_in2 != NULL) fclose(_in2);
 	}
@@ -1176,6 +1328,75 @@ public:
 	inline const TIndexOffU* plen() const    { return _plen.get(); }
 	inline const TIndexOffU* rstarts() const { return _rstarts.get(); }
 	inline const uint8_t*  ebwt() const    { return _ebwt.get(); }
+
+	/**
+	 * Return element 'i' of the SA sample, whether it's stored as full
+	 * words or bit-packed (see setPackedOffs()).
+	 */
+	inline TIndexOffU offsAt(TIndexOffU i) const {
+		if(_offsBits == 0) {
+			return offs()[i];
+		}
+		const TIndexOffU *w = offs();
+		uint64_t bit = (uint64_t)i * _offsBits;
+		size_t word = (size_t)(bit / (OFF_SIZE*8));
+		int sh = (int)(bit % (OFF_SIZE*8));
+#ifdef BOWTIE_64BIT_INDEX
+		TIndexOffU v = w[word] >> sh;
+		if(sh + _offsBits > 64) {
+			v |= w[word+1] << (64 - sh);
+		}
+#else
+		// Packed array is padded by a word, so w[word+1] is always valid
+		TIndexOffU v = (TIndexOffU)((((uint64_t)w[word+1] << 32) | w[word]) >> sh);
+#endif
+		return v & _offsMask;
+	}
+
+	/**
+	 * Store 'v' as element 'i' of a bit-packed SA sample.
+	 */
+	inline void packOffsAt(TIndexOffU i, TIndexOffU v) {
+		assert_gt(_offsBits, 0);
+		assert_eq(v, v & _offsMask);
+		TIndexOffU *w = offs();
+		uint64_t bit = (uint64_t)i * _offsBits;
+		size_t word = (size_t)(bit / (OFF_SIZE*8));
+		int sh = (int)(bit % (OFF_SIZE*8));
+		w[word] = (w[word] & ~(_offsMask << sh)) | (v << sh);
+		if(sh + _offsBits > (int)(OFF_SIZE*8)) {
+			int lo = (int)(OFF_SIZE*8) - sh;
+			w[word+1] = (w[word+1] & ~(_offsMask >> lo)) | (v >> lo);
+		}
+	}
+
+	/**
+	 * Store the SA sample with only as many bits per element as needed
+	 * to hold an offset into this index (ceil(log2(bwtLen))) the next
+	 * time it's read into memory.  Ignored with --mm and --shmem, which
+	 * use the file's layout.
+	 */
+	void setPackedOffs(bool pack) {
+		_packOffs = pack;
+	}
+
+	/**
+	 * Read the big arrays (ebwt[] and offs[]) with up to 'nthreads'
+	 * concurrent readers, each handling one chunk of the file.  Only
+	 * applies to arrays read from the file into memory we allocate.
+	 */
+	void setLoadThreads(int nthreads) {
+		_loadThreads = max<int>(nthreads, 1);
+	}
+
+	/**
+	 * Share 'c' among the GroupWalks resolving offsets in this index;
+	 * NULL disables caching.  The Ebwt doesn't own the cache.
+	 */
+	void setSACache(SAOffsetCache *c) {
+		_saCache = c;
+	}
+	SAOffsetCache *saCache() const { return _saCache; }
 	bool        toBe() const         { return _toBigEndian; }
 	bool        verbose() const      { return _verbose; }
 	bool        sanityCheck() const  { return _sanity; }
@@ -1184,6 +1405,46 @@ public:
 #ifdef POPCNT_CAPABILITY 
     bool _usePOPCNTinstruction; 
 #endif 
+	int _occKernel; // OCC_KERNEL_* used by countUpTo/countUpToEx
+
+	/**
+	 * Pick the occurrence-counting kernel for this processor.  The
+	 * vector kernels assume the default 64-byte side.
+	 */
+	int selectOccKernel() const {
+		if(_eh._sideSz != 64) {
+			return OCC_KERNEL_SCALAR;
+		}
+		return occKernelSelect();
+	}
+
+	/**
+	 * Back _ebwt, _offs, _ftab and _eftab with huge pages (HUGEPAGES_*)
+	 * the next time they're read into memory.  Ignored with --mm and
+	 * --shmem, which map those arrays themselves.
+	 */
+	void setHugePages(int mode) {
+		_hugePages = mode;
+	}
+
+	/**
+	 * Return the number of bytes of _ebwt, _offs, _ftab and _eftab that
+	 * were allocated with setHugePages() in effect.
+	 */
+	uint64_t hugePageEligibleBytes() const {
+		uint64_t tot = 0;
+		for(int i = 0; i < EBWT_HUGE_NREGIONS; i++) {
+			tot += _hugeRegions[i].req;
+		}
+		return tot;
+	}
+
+	/**
+	 * Return the number of those bytes actually resident on huge pages.
+	 */
+	uint64_t hugePageResidentBytes() const {
+		return ::hugePageResidentBytes(_hugeRegions, EBWT_HUGE_NREGIONS);
+	}
 
 	/**
 	 * Returns true iff the index contains the given string (exactly).  The
@@ -1208,6 +1469,12 @@ public:
 		return contains(BTDnaString(str, true), top, bot);
 	}
 	
+	/// Return true iff the big arrays point into a memory-mapped file
+	/// (--mm or a zero-copy index) rather than memory we filled in
+	bool isMapped() const {
+		return _useMm || zcFile_ != NULL;
+	}
+
 	/// Return true iff the Ebwt is currently in memory
 	bool isInMemory() const {
 		if(ebwt() != NULL) {
@@ -1271,12 +1538,19 @@ public:
 	 */
 	void evictFromMemory() {
 		assert(isInMemory());
+		if(offs() != NULL && useShmem_) {
+			FREE_SHARED(offs());
+		}
+		if(ebwt() != NULL && useShmem_) {
+			FREE_SHARED(ebwt());
+		}
 		_fchr.free();
 		_ftab.free();
 		_eftab.free();
 		_rstarts.free();
 		_offs.free(); // might not be under control of APtrWrap
 		_ebwt.free(); // might not be under control of APtrWrap
+		freeHugeRegions();
 		// Keep plen; it's small and the client may want to seq it
 		// even when the others are evicted.
 		//_plen  = NULL;
@@ -1315,6 +1589,18 @@ public:
 		return ftabOff;
 	}
 	
+	/**
+	 * Prefetch the ftab entries that ftabHi(i) and ftabLo(i+1) will
+	 * read.
+	 */
+	void prefetchFtab(TIndexOffU i) const {
+#if defined(__GNUC__)
+		assert_lt(i, _eh._ftabLen);
+		__builtin_prefetch(ftab() + i);
+		__builtin_prefetch(ftab() + i + 1);
+#endif
+	}
+
 	/**
 	 * Non-static facade for static function ftabHi.
 	 */
@@ -1445,7 +1731,7 @@ public:
 		if((elt & _eh._offMask) == elt) {
 			TIndexOffU eltOff = elt >> _eh._offRate;
 			assert_lt(eltOff, _eh._offsLen);
-			TIndexOffU off = offs()[eltOff];
+			TIndexOffU off = offsAt(eltOff);
 			assert_neq(OFF_MASK, off);
 			return off;
 		} else {
@@ -1577,20 +1863,25 @@ public:
 		if(offs() == NULL) {
 			out << "NULL" << endl;
 		} else {
-			out << "non-NULL, [0] = " << offs()[0] << endl;
+			out << "non-NULL, [0] = " << offsAt(0) << endl;
 		}
 	}
 
 	// Building
 	template <typename TStr> static TStr join(EList<TStr>& l, uint32_t seed);
 	template <typename TStr> static TStr join(EList<FileBuf*>& l, EList<RefRecord>& szs, TIndexOffU sztot, const RefReadInParams& refparams, uint32_t seed);
-	template <typename TStr> void joinToDisk(EList<FileBuf*>& l, EList<RefRecord>& szs, TIndexOffU sztot, const RefReadInParams& refparams, TStr& ret, ostream& out1, ostream& out2);
-	template <typename TStr> void buildToDisk(InorderBlockwiseSA<TStr>& sa, const TStr& s, ostream& out1, ostream& out2, ostream* saOut, ostream* bwtOut);
+	template <typename TStr> void joinToDisk(EList<FileBuf*>& l, EList<RefRecord>& szs, TIndexOffU sztot, const RefReadInParams& refparams, const JoinedRef<TStr>* shared, TStr& ret, ostream& out1, ostream& out2);
+	template <typename TStr> static void readJoined(EList<FileBuf*>& l, const EList<RefRecord>& szs, const RefReadInParams& refparams, TStr& ret, EList<string>& names);
+	template <typename TStr> void buildToDisk(InorderBlockwiseSA<TStr>& sa, const TStr& s, int nthreads, ostream& out1, ostream& out2, ostream* saOut, ostream* bwtOut);
+	template <typename TStr> void buildFtab(const TStr& s, int nthreads, EList<TIndexOffU>& ftab, EList<TIndexOffU>& eftab);
 
 	// I/O
 	void readIntoMemory(int color, int needEntireRev, bool loadSASamp, bool loadFtab, bool loadRstarts, bool justHeader, EbwtParams *params, bool mmSweep, bool loadNames, bool startVerbose);
 	void writeFromMemory(bool justHeader, ostream& out1, ostream& out2) const;
 	void writeFromMemory(bool justHeader, const string& out1, const string& out2) const;
+	bool useZeroCopy(bool startVerbose);
+	void readZeroCopy(int color, int needEntireRev, bool loadSASamp, bool loadFtab, bool loadRstarts, bool justHeader, EbwtParams *params, bool mmSweep, bool loadNames, bool startVerbose);
+	void writeZeroCopy(const string& out) const;
 
 	// Sanity checking
 	void sanityCheckUpToSide(TIndexOff upToSide) const;
@@ -1802,9 +2093,15 @@ public:
 	 * Function gets 11.09% in profile
 	 */
 	inline TIndexOffU countUpTo(const SideLocus& l, int c) const { // @double-check
-		// Count occurrences of c in each 64-bit (using bit trickery);
-		// Someday countInU64() and pop() functions should be
-		// vectorized/SSE-ized in case that helps.
+		// Count occurrences of c in each 64-bit (using bit trickery)
+		// unless a vector kernel was selected for this processor.
+#ifdef SIMD_OCC_CAPABILITY
+		if(_occKernel != OCC_KERNEL_SCALAR) {
+			uint32_t cnts[4];
+			countUpToSimd(l, cnts);
+			return cnts[c];
+		}
+#endif
 		TIndexOffU cCnt = 0;
 		const uint8_t *side = l.side(this->ebwt());
 		int i = 0;
@@ -1906,8 +2203,19 @@ template<typename Operation>
 		// significant boost to performance in practice.  If you comment
 		// out this whole loop (which won't affect correctness - it will
 		// just cause the following loop to take up the slack) then runtime
-		// does not change noticeably. Someday the countInU64() and pop()
-		// functions should be vectorized/SSE-ized in case that helps.
+		// does not change noticeably.  The vector kernels, when available,
+		// replace both loops with one pass over the side.
+#ifdef SIMD_OCC_CAPABILITY
+		if(_occKernel != OCC_KERNEL_SCALAR) {
+			uint32_t cnts[4];
+			countUpToSimd(l, cnts);
+			arrs[0] += cnts[0];
+			arrs[1] += cnts[1];
+			arrs[2] += cnts[2];
+			arrs[3] += cnts[3];
+			return;
+		}
+#endif
 		const uint8_t *side = l.side(this->ebwt());
 
 #ifdef POPCNT_CAPABILITY
@@ -1943,6 +2251,23 @@ template<typename Operation>
 		}
 	}
 
+#ifdef SIMD_OCC_CAPABILITY
+	/**
+	 * Counts the number of occurrences of all four nucleotides in the
+	 * given side up to (but not including) the given byte/bitpair using
+	 * the vector kernel selected at construction time.
+	 */
+	inline void countUpToSimd(const SideLocus& l, uint32_t* cnts) const {
+		const uint8_t *side = l.side(this->ebwt());
+		int nchars = (l._by << 2) + l._bp;
+		if(_occKernel == OCC_KERNEL_AVX512) {
+			occCountAvx512(side, nchars, cnts);
+		} else {
+			occCountAvx2(side, nchars, cnts);
+		}
+	}
+#endif
+
 #ifndef NDEBUG
 	/**
 	 * Given top and bot loci, calculate counts of all four DNA chars up to
@@ -2402,9 +2727,53 @@ template<typename Operation>
 	APtrWrap<uint8_t> _ebwt;
 	bool       _useMm;        /// use memory-mapped files to hold the index
 	bool       useShmem_;     /// use shared memory to hold large parts of the index
+	int        _hugePages;    /// HUGEPAGES_* mode for the big arrays
+	bool       _packOffs;     /// bit-pack _offs when reading it in
+	int        _loadThreads;  /// # threads reading big arrays in chunks
+	SAOffsetCache *_saCache;  /// resolved offsets shared by GroupWalks, or NULL
+	int        _offsBits;     /// bits per _offs element if packed, 0 otherwise
+	TIndexOffU _offsMask;     /// low _offsBits bits set
+	/// Indexes into _hugeRegions
+	enum {
+		EBWT_HUGE_EBWT = 0,
+		EBWT_HUGE_OFFS,
+		EBWT_HUGE_FTAB,
+		EBWT_HUGE_EFTAB,
+		EBWT_HUGE_NREGIONS
+	};
+	/// Mappings backing the arrays above when _hugePages is set; the
+	/// APtrWraps don't own these
+	HugePageRegion _hugeRegions[EBWT_HUGE_NREGIONS];
+
+	/**
+	 * Allocate 'n' elements for the array tracked by _hugeRegions[which]
+	 * using the current huge-page mode, releasing any previous mapping.
+	 */
+	template<typename T>
+	T* allocHuge(int which, size_t n, const char *name, bool verbose) {
+		freeHugePages(_hugeRegions[which]);
+		void *p = allocHugePages(n * sizeof(T), _hugePages,
+		                         _hugeRegions[which], name, verbose);
+		if(p == NULL) {
+			cerr << "Out of memory allocating the " << name << " array for the Bowtie index.  Please try" << endl
+			     << "again on a computer with more memory." << endl;
+			throw 1;
+		}
+		return (T*)p;
+	}
+
+	void freeHugeRegions() {
+		for(int i = 0; i < EBWT_HUGE_NREGIONS; i++) {
+			freeHugePages(_hugeRegions[i]);
+		}
+	}
+
 	EList<string> _refnames; /// names of the reference sequences
 	char *mmFile1_;
 	char *mmFile2_;
+	string _zcStr;  /// zero-copy index file, used instead of _in1Str/_in2Str if present
+	char *zcFile_;  /// mapping of _zcStr, once read
+	size_t zcLen_;
 	EbwtParams _eh;
 	bool packed_;
 
@@ -2453,6 +2822,20 @@ void readEbwtRefnames(FILE* fin, EList<string>& refnames);
  */
 void readEbwtRefnames(const string& instr, EList<string>& refnames);
 
+/**
+ * Read the index with basename 'base' (e.g. "lambda" or "lambda.rev")
+ * and write it as a zero-copy index file, base + ".zc." + gEbwt_ext.
+ */
+void writeZeroCopyIndex(const string& base, bool verbose);
+
+/**
+ * Read the forward index with basename 'base' and write the k-mers of
+ * length 'k' occurring at least 'minFreq' times in its reference, with
+ * their counts, to base + ".kmer." + gEbwt_ext.  Returns the number of
+ * k-mers written.
+ */
+size_t writeFreqKmerTable(const string& base, int k, uint64_t minFreq, bool verbose);
+
 /**
  * Read just enough of the Ebwt's header to determine whether it's
  * colorspace.
@@ -2558,13 +2941,13 @@ void Ebwt::joinToDisk(
 	EList<RefRecord>& szs,
 	TIndexOffU sztot,
 	const RefReadInParams& refparams,
+	const JoinedRef<TStr>* shared,
 	TStr& ret,
 	ostream& out1,
 	ostream& out2)
 {
-	RefReadInParams rpcp = refparams;
 	assert_gt(szs.size(), 0);
-	assert_gt(l.size(), 0);
+	assert(shared != NULL || l.size() > 0);
 	assert_gt(sztot, 0);
 	// Not every fragment represents a distinct sequence - many
 	// fragments may correspond to a single sequence.  Count the
@@ -2607,37 +2990,66 @@ void Ebwt::joinToDisk(
 	writeU<TIndexOffU>(out1, this->plen()[npat], this->toBe());
 	// Write the number of fragments
 	writeU<TIndexOffU>(out1, this->_nFrag, this->toBe());
+	if(shared != NULL) {
+		// The reference was already read in and joined; copy it,
+		// reversing each fragment if that's what refparams ask for
+		assert_eq(sztot, shared->s.length());
+		for(TIndexOffU i = 0; i < sztot; i++) {
+			ret.set(shared->s[i], i);
+		}
+		if(refparams.reverse == REF_READ_REVERSE_EACH) {
+			TIndexOffU off = 0;
+			for(TIndexOffU i = 0; i < szs.size(); i++) {
+				ret.reverseWindow(off, szs[i].len);
+				off += szs[i].len;
+			}
+		}
+		_refnames = shared->names;
+	} else {
+		readJoined(l, szs, refparams, ret, _refnames);
+	}
+	assert_eq(_refnames.size(), this->_nPat);
+}
+
+/**
+ * Read the unambiguous stretches of the references in 'l' into 'ret',
+ * which has room for all of them, and their names into 'names'.
+ */
+template<typename TStr>
+void Ebwt::readJoined(
+	EList<FileBuf*>& l,
+	const EList<RefRecord>& szs,
+	const RefReadInParams& refparams,
+	TStr& ret,
+	EList<string>& names)
+{
+	RefReadInParams rpcp = refparams;
 	TIndexOffU seqsRead = 0;
 	ASSERT_ONLY(TIndexOffU szsi = 0);
-	ASSERT_ONLY(TIndexOffU entsWritten = 0);
 	TIndexOffU dstoff = 0;
 	// For each filebuf
 	for(unsigned int i = 0; i < l.size(); i++) {
 		assert(!l[i]->eof());
 		bool first = true;
-		TIndexOffU patoff = 0;
 		// For each *fragment* (not necessary an entire sequence) we
 		// can pull out of istream l[i]...
 		while(!l[i]->eof()) {
-			string name;
 			// Push a new name onto our vector
-			_refnames.push_back("");
+			names.push_back("");
 			RefRecord rec = fastaRefReadAppend(
-				*l[i], first, ret, dstoff, rpcp, &_refnames.back());
+				*l[i], first, ret, dstoff, rpcp, &names.back());
 			first = false;
-			TIndexOffU bases = rec.len;
 			if(rec.first && rec.len > 0) {
-				if(_refnames.back().length() == 0) {
+				if(names.back().length() == 0) {
 					// If name was empty, replace with an index
 					ostringstream stm;
 					stm << seqsRead;
-					_refnames.back() = stm.str();
+					names.back() = stm.str();
 				}
 			} else {
 				// This record didn't actually start a new sequence so
 				// no need to add a name
-				//assert_eq(0, _refnames.back().length());
-				_refnames.pop_back();
+				names.pop_back();
 			}
 			assert_lt(szsi, szs.size());
 			assert_eq(rec.off, szs[szsi].off);
@@ -2647,19 +3059,6 @@ void Ebwt::joinToDisk(
 			ASSERT_ONLY(szsi++);
 			// Increment seqsRead if this is the first fragment
 			if(rec.first && rec.len > 0) seqsRead++;
-			if(bases == 0) continue;
-			assert_leq(bases, this->plen()[seqsRead-1]);
-			// Reset the patoff if this is the first fragment
-			if(rec.first) patoff = 0;
-			patoff += rec.off; // add fragment's offset from end of last frag.
-			// Adjust rpcps
-			//uint32_t seq = seqsRead-1;
-			ASSERT_ONLY(entsWritten++);
-			// This is where rstarts elements are written to the output stream
-			//writeU32(out1, oldRetLen, this->toBe()); // offset from beginning of joined string
-			//writeU32(out1, seq,       this->toBe()); // sequence id
-			//writeU32(out1, patoff,    this->toBe()); // offset into sequence
-			patoff += bases;
 		}
 		assert_gt(szsi, 0);
 		l[i]->reset();
@@ -2672,7 +3071,381 @@ void Ebwt::joinToDisk(
 		assert(!l[i]->eof());
 #endif
 	}
-	assert_eq(entsWritten, this->_nFrag);
+}
+
+/**
+ * One thread's share of a phase of Ebwt::buildFtab().
+ */
+template<typename TStr>
+struct EbwtFtabJob {
+	int          phase;     // EBWT_FTAB_*
+	const TStr  *s;
+	int          ftabChars;
+	TIndexOffU   kbegin;    // EBWT_FTAB_COUNT: first k-mer offset ...
+	TIndexOffU   kend;      // ... and one past the last
+	TIndexOffU  *counts;    // ... tallied here
+	bool         atomic;    // ... which other threads share
+	TIndexOffU  *ftab;
+	TIndexOffU **locals;    // per-thread counts to add up, if any
+	int          nlocals;
+	TIndexOffU   fbegin;    // range of ftab this thread sums or scans
+	TIndexOffU   fend;
+	TIndexOffU   sum;       // EBWT_FTAB_SUM result
+	TIndexOffU   base;      // EBWT_FTAB_SCAN starting value
+};
+
+enum {
+	EBWT_FTAB_COUNT = 1, // count the k-mers starting in [kbegin, kend)
+	EBWT_FTAB_SUM,       // add up the local counts into ftab[fbegin, fend)
+	EBWT_FTAB_SCAN       // prefix-sum ftab[fbegin, fend) starting at base
+};
+
+template<typename TStr>
+static void ebwtFtabWorker(void *vp) {
+	EbwtFtabJob<TStr>& j = *(EbwtFtabJob<TStr>*)vp;
+	if(j.phase == EBWT_FTAB_COUNT) {
+		if(j.kbegin >= j.kend) return;
+		const TStr& s = *j.s;
+		uint64_t mask = (((uint64_t)1) << (j.ftabChars << 1)) - 1;
+		uint64_t key = 0;
+		for(int i = 0; i < j.ftabChars - 1; i++) {
+			key = (key << 2) | (uint64_t)(int)s[j.kbegin + i];
+		}
+		for(TIndexOffU off = j.kbegin; off < j.kend; off++) {
+			int c = (int)s[off + j.ftabChars - 1];
+			assert_range(0, 3, c);
+			key = ((key << 2) | (uint64_t)c) & mask;
+			// Entry i+1 counts k-mer i, as in the final ftab
+			if(j.atomic) {
+				__sync_fetch_and_add(&j.counts[key + 1], 1);
+			} else {
+				j.counts[key + 1]++;
+			}
+		}
+	} else if(j.phase == EBWT_FTAB_SUM) {
+		TIndexOffU sum = 0;
+		for(TIndexOffU i = j.fbegin; i < j.fend; i++) {
+			if(j.nlocals > 0) {
+				TIndexOffU c = 0;
+				for(int t = 0; t < j.nlocals; t++) {
+					c += j.locals[t][i];
+				}
+				j.ftab[i] = c;
+			}
+			sum += j.ftab[i];
+		}
+		j.sum = sum;
+	} else {
+		assert_eq(EBWT_FTAB_SCAN, j.phase);
+		TIndexOffU cum = j.base;
+		for(TIndexOffU i = j.fbegin; i < j.fend; i++) {
+			cum += j.ftab[i];
+			j.ftab[i] = cum;
+		}
+	}
+}
+
+/**
+ * Run one phase of buildFtab() on all of 'jobs', one thread apiece.
+ */
+template<typename TStr>
+static void ebwtFtabPhase(EList<EbwtFtabJob<TStr> >& jobs, int phase) {
+#ifdef WITH_TBB
+	EList<std::thread*> threads;
+#else
+	EList<tthread::thread*> threads;
+#endif
+	for(size_t i = 0; i < jobs.size(); i++) {
+		jobs[i].phase = phase;
+	}
+	for(size_t i = 1; i < jobs.size(); i++) {
+#ifdef WITH_TBB
+		threads.push_back(new std::thread(ebwtFtabWorker<TStr>, (void*)&jobs[i]));
+#else
+		threads.push_back(new tthread::thread(ebwtFtabWorker<TStr>, (void*)&jobs[i]));
+#endif
+	}
+	ebwtFtabWorker<TStr>((void*)&jobs[0]);
+	for(size_t i = 0; i < threads.size(); i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+}
+
+/// Per-thread ftab counts are used while they take no more than this
+static const size_t EBWT_FTAB_LOCAL_MAX = 64 * 1024 * 1024;
+
+/**
+ * Build ftab and eftab straight from the text on 'nthreads' threads,
+ * rather than from the suffixes as they come out of the suffix array.
+ *
+ * ftab entry i+1 starts out as the number of occurrences of the i'th
+ * ftabChars-mer, which doesn't depend on the order of the suffixes.
+ * The only thing that does is which ftab entry "absorbs" each suffix
+ * shorter than ftabChars, and since '$' sorts after every character,
+ * that's the first k-mer that occurs in the text and sorts after all
+ * the k-mers the short suffix is a prefix of, or the last entry if
+ * there's none.  A prefix sum then turns counts into offsets.
+ */
+template<typename TStr>
+void Ebwt::buildFtab(
+	const TStr& s,
+	int nthreads,
+	EList<TIndexOffU>& ftab,
+	EList<TIndexOffU>& eftab)
+{
+	const EbwtParams& eh = this->_eh;
+	TIndexOffU len = eh._len;
+	TIndexOffU ftabLen = eh._ftabLen;
+	int ftabChars = eh._ftabChars;
+	TIndexOffU nkmers = (len >= (TIndexOffU)ftabChars) ? (len - ftabChars + 1) : 0;
+	if(nthreads < 1) nthreads = 1;
+	// Don't bother with threads that would have less than 1M k-mers
+	nthreads = (int)max<TIndexOffU>(1, min<TIndexOffU>((TIndexOffU)nthreads, nkmers >> 20));
+	try {
+		VMSG_NL("Allocating ftab");
+		ftab.resize(ftabLen);
+		ftab.fillZero();
+	} catch(bad_alloc &e) {
+		cerr << "Out of memory allocating ftab[] "
+		     << "in Ebwt::buildFtab() at " << __FILE__ << ":"
+		     << __LINE__ << endl;
+		throw e;
+	}
+	EList<EbwtFtabJob<TStr> > jobs(EBWT_CAT);
+	jobs.resize(nthreads);
+	for(int t = 0; t < nthreads; t++) {
+		EbwtFtabJob<TStr>& j = jobs[t];
+		j.s = &s;
+		j.ftabChars = ftabChars;
+		j.kbegin = (TIndexOffU)((uint64_t)nkmers * t / nthreads);
+		j.kend = (TIndexOffU)((uint64_t)nkmers * (t + 1) / nthreads);
+		j.counts = ftab.ptr();
+		j.atomic = nthreads > 1;
+		j.ftab = ftab.ptr();
+		j.locals = NULL;
+		j.nlocals = 0;
+		j.fbegin = (TIndexOffU)((uint64_t)ftabLen * t / nthreads);
+		j.fend = (TIndexOffU)((uint64_t)ftabLen * (t + 1) / nthreads);
+		j.sum = j.base = 0;
+	}
+	{
+		// Each thread counts into its own table if they're small
+		// enough, otherwise they all count into ftab
+		EList<TIndexOffU> localCounts(EBWT_CAT);
+		EList<TIndexOffU*> localPtrs(EBWT_CAT);
+		if(nthreads > 1 && (size_t)ftabLen * OFF_SIZE * nthreads <= EBWT_FTAB_LOCAL_MAX) {
+			localCounts.resize((size_t)ftabLen * nthreads);
+			localCounts.fillZero();
+			for(int t = 0; t < nthreads; t++) {
+				localPtrs.push_back(localCounts.ptr() + (size_t)ftabLen * t);
+			}
+			for(int t = 0; t < nthreads; t++) {
+				jobs[t].counts = localPtrs[t];
+				jobs[t].atomic = false;
+				jobs[t].locals = localPtrs.ptr();
+				jobs[t].nlocals = nthreads;
+			}
+		}
+		ebwtFtabPhase<TStr>(jobs, EBWT_FTAB_COUNT);
+		if(!localPtrs.empty()) {
+			ebwtFtabPhase<TStr>(jobs, EBWT_FTAB_SUM);
+			for(int t = 0; t < nthreads; t++) {
+				jobs[t].locals = NULL;
+				jobs[t].nlocals = 0;
+			}
+		}
+	}
+	assert_eq(0, ftab[0]);
+	// Work out which entries absorb the suffixes shorter than
+	// ftabChars, including the empty one
+	EList<pair<TIndexOffU, TIndexOffU> > absorb(EBWT_CAT); // entry, count
+	for(TIndexOffU off = len + 1 - min<TIndexOffU>(len + 1, ftabChars); off <= len; off++) {
+		// Biggest k-mer with this suffix as a prefix
+		uint64_t key = 0;
+		for(TIndexOffU i = off; i < len; i++) {
+			key = (key << 2) | (uint64_t)(int)s[i];
+		}
+		for(TIndexOffU i = len - off; i < (TIndexOffU)ftabChars; i++) {
+			key = (key << 2) | 3;
+		}
+		// Next k-mer up that occurs; entry x+1 counts k-mer x, and
+		// the last entry takes whatever's left
+		uint64_t x = key + 1;
+		while(x < (uint64_t)(ftabLen - 1) && ftab[(TIndexOffU)x + 1] == 0) x++;
+		size_t a = 0;
+		while(a < absorb.size() && absorb[a].first != (TIndexOffU)x) a++;
+		if(a == absorb.size()) {
+			absorb.push_back(make_pair((TIndexOffU)x, (TIndexOffU)0));
+		}
+		absorb[a].second++;
+	}
+	absorb.sort();
+	// Entry i's offset is the sum of the counts up to i plus whatever
+	// the entries before it absorbed
+	for(size_t a = 0; a < absorb.size(); a++) {
+		if(absorb[a].first + 1 < ftabLen) {
+			ftab[absorb[a].first + 1] += absorb[a].second;
+		}
+	}
+	if(nthreads > 1) {
+		ebwtFtabPhase<TStr>(jobs, EBWT_FTAB_SUM);
+		TIndexOffU base = 0;
+		for(int t = 0; t < nthreads; t++) {
+			jobs[t].base = base;
+			base += jobs[t].sum;
+		}
+	}
+	ebwtFtabPhase<TStr>(jobs, EBWT_FTAB_SCAN);
+	// Point absorbing entries into eftab
+	TIndexOffU eftabLen = eh._ftabChars*2;
+	assert_leq(absorb.size() * 2, eftabLen);
+	try {
+		eftab.resize(eftabLen);
+		eftab.fillZero();
+	} catch(bad_alloc &e) {
+		cerr << "Out of memory allocating eftab[] "
+		     << "in Ebwt::buildFtab() at " << __FILE__ << ":"
+		     << __LINE__ << endl;
+		throw e;
+	}
+	for(size_t a = 0; a < absorb.size(); a++) {
+		TIndexOffU i = absorb[a].first;
+		assert_gt(i, 0);
+		TIndexOffU lo = ftab[i];
+		eftab[a*2] = lo;
+		eftab[a*2+1] = lo + absorb[a].second;
+		ftab[i] = (TIndexOffU)a ^ OFF_MASK; // insert pointer into eftab
+		assert_eq(lo, Ebwt::ftabLo(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i));
+		assert_eq(lo + absorb[a].second, Ebwt::ftabHi(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i));
+	}
+	assert_eq(Ebwt::ftabHi(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, ftabLen-1), len+1);
+}
+
+/**
+ * A run of consecutive BWT rows, a whole number of sides long, on its
+ * way through the final pass of Ebwt::buildToDisk().  The calling
+ * thread fills it with suffixes from the suffix array, any thread packs
+ * it into sides, and the calling thread writes the sides out in order.
+ */
+struct EbwtBwtBatch {
+	EbwtBwtBatch() : sufs(EBWT_CAT), sides(EBWT_CAT), row(0), nrows(0),
+		zOff(OFF_MASK), state(0) { }
+
+	EList<TIndexOffU> sufs;    // suffixes of the rows still in the SA
+	EList<uint8_t>    sides;   // packed sides; occ tallies relative to row
+	TIndexOffU        row;     // first row
+	TIndexOffU        nrows;   // rows, including padding past the SA
+	TIndexOffU        occ[4];  // characters in the batch, padding as A's
+	TIndexOffU        fchr[4]; // characters in the batch, no padding
+	TIndexOffU        zOff;    // row holding '$', if it's in the batch
+	volatile int      state;   // EBWT_BATCH_*
+};
+
+enum {
+	EBWT_BATCH_EMPTY = 0,
+	EBWT_BATCH_FILLED,
+	EBWT_BATCH_PACKING,
+	EBWT_BATCH_PACKED
+};
+
+/// Sides per EbwtBwtBatch
+static const TIndexOffU EBWT_BATCH_SIDES = 2048;
+
+/**
+ * Pack batch 'b' of the BWT of 's' into sides, each with the occ
+ * tallies of the rows before it in the batch.
+ */
+template<typename TStr>
+static void ebwtPackBatch(const TStr& s, const EbwtParams& eh, EbwtBwtBatch& b) {
+	TIndexOffU sideSz = eh._sideSz;
+	TIndexOffU sideBwtSz = eh._sideBwtSz;
+	TIndexOffU sideBwtLen = eh._sideBwtLen;
+	assert_eq(0, b.nrows % sideBwtLen);
+	TIndexOffU nsides = b.nrows / sideBwtLen;
+	b.sides.resizeNoCopy(nsides * sideSz);
+	for(int c = 0; c < 4; c++) {
+		b.occ[c] = b.fchr[c] = 0;
+	}
+	b.zOff = OFF_MASK;
+	const TIndexOffU *sufs = b.sufs.ptr();
+	TIndexOffU nsufs = (TIndexOffU)b.sufs.size();
+	for(TIndexOffU j = 0; j < nsides; j++) {
+		uint8_t *side = b.sides.ptr() + j * sideSz;
+		memset(side, 0, sideBwtSz);
+		TIndexOffU *tally = reinterpret_cast<TIndexOffU*>(side + sideBwtSz);
+		for(int c = 0; c < 4; c++) {
+			tally[c] = b.occ[c];
+		}
+		for(TIndexOffU k = 0; k < sideBwtLen; k++) {
+			TIndexOffU idx = j * sideBwtLen + k;
+			int bwtChar = 0;
+			if(idx < nsufs) {
+				TIndexOffU saElt = sufs[idx];
+				if(saElt == 0) {
+					// Don't add the '$' in the last column to the BWT
+					// transform; we can't encode a $ (only A C T or G)
+					// and counting it as, say, an A, will mess up the
+					// LR mapping
+					b.zOff = b.row + idx;
+					continue;
+				}
+				bwtChar = (int)(s[saElt-1]);
+				assert_lt(bwtChar, 4);
+				b.fchr[bwtChar]++;
+			}
+			// 'A' used for padding; important that padding be
+			// counted in the occ[] array
+			b.occ[bwtChar]++;
+			// Forward bucket: fill from least to most
+#ifdef SIXTY4_FORMAT
+			reinterpret_cast<uint64_t*>(side)[k >> 5] |= ((uint64_t)bwtChar << ((k & 31) << 1));
+#else
+			pack_2b_in_8b(bwtChar, side[k >> 2], (int)(k & 3));
+#endif
+		}
+	}
+}
+
+/**
+ * Shared state of the threads packing batches for buildToDisk().
+ */
+template<typename TStr>
+struct EbwtBwtPass {
+	const TStr       *s;
+	const EbwtParams *eh;
+	EbwtBwtBatch     *batches;
+	int               nbatches;
+	volatile bool     done; // no more batches coming
+
+	/**
+	 * Pack a filled batch, if there is one no one else has claimed.
+	 * Return true iff we packed one.
+	 */
+	bool packOne() {
+		for(int i = 0; i < nbatches; i++) {
+			EbwtBwtBatch& b = batches[i];
+			if(b.state == EBWT_BATCH_FILLED &&
+			   __sync_bool_compare_and_swap(&b.state, EBWT_BATCH_FILLED, EBWT_BATCH_PACKING))
+			{
+				ebwtPackBatch(*s, *eh, b);
+				__sync_synchronize();
+				b.state = EBWT_BATCH_PACKED;
+				return true;
+			}
+		}
+		return false;
+	}
+};
+
+template<typename TStr>
+static void ebwtBwtWorker(void *vp) {
+	EbwtBwtPass<TStr>& p = *(EbwtBwtPass<TStr>*)vp;
+	while(true) {
+		if(p.packOne()) continue;
+		if(p.done) break;
+		SLEEP(1);
+	}
 }
 
 /**
@@ -2690,17 +3463,25 @@ void Ebwt::joinToDisk(
  * additionally written ebwt, zOff, fchr, ftab and eftab to the primary
  * file and offs to the secondary file.
  *
+ * ftab and eftab are built from the text up front (see buildFtab()).
+ * The suffixes are then taken from 'sa' in batches of whole sides; with
+ * more than one thread, helper threads pack the BWT characters of
+ * earlier batches into sides while this thread waits on the suffix
+ * array for the next one.
+ *
  * Assume DNA/RNA/any alphabet with 4 or fewer elements.
  * Assume occ array entries are 32 bits each.
  *
  * @param sa            the suffix array to convert to a Ebwt
  * @param s             the original string
+ * @param nthreads      threads to build ftab and pack the BWT with
  * @param out
  */
 template<typename TStr>
 void Ebwt::buildToDisk(
 	InorderBlockwiseSA<TStr>& sa,
 	const TStr& s,
+	int nthreads,
 	ostream& out1,
 	ostream& out2,
 	ostream* saOut,
@@ -2720,67 +3501,54 @@ void Ebwt::buildToDisk(
 	TIndexOffU ebwtTotSz = eh._ebwtTotSz;
 	TIndexOffU fchr[] = {0, 0, 0, 0, 0};
 	EList<TIndexOffU> ftab(EBWT_CAT);
+	EList<TIndexOffU> eftab(EBWT_CAT);
 	TIndexOffU zOff = OFF_MASK;
+	if(nthreads < 1) nthreads = 1;
+	// Includes sorting the blocks, which happens as the BWT needs them
+	BuildPhase phase("bwt", nthreads);
+
+	{
+		Timer _t(cout, "  Time building ftab: ", _verbose);
+		BuildPhase ftabPhase("ftab", nthreads);
+		buildFtab(s, nthreads, ftab, eftab);
+	}
 
 	// Save # of occurrences of each character as we walk along the bwt
 	TIndexOffU occ[4] = {0, 0, 0, 0};
-	TIndexOffU occSave[4] = {0, 0, 0, 0};
 
-	// Record rows that should "absorb" adjacent rows in the ftab.
-	// The absorbed rows represent suffixes shorter than the ftabChars
-	// cutoff.
-	uint8_t absorbCnt = 0;
-	EList<uint8_t> absorbFtab(EBWT_CAT);
+	// A ring of batches; with one thread there's nothing to overlap
+	int nbatches = (nthreads > 1) ? 2 * nthreads : 1;
+	EbwtBwtBatch *batches = NULL;
 	try {
-		VMSG_NL("Allocating ftab, absorbFtab");
-		ftab.resize(ftabLen);
-		ftab.fillZero();
-		absorbFtab.resize(ftabLen);
-		absorbFtab.fillZero();
+		batches = new EbwtBwtBatch[nbatches];
 	} catch(bad_alloc &e) {
-		cerr << "Out of memory allocating ftab[] or absorbFtab[] "
-		     << "in Ebwt::buildToDisk() at " << __FILE__ << ":"
+		cerr << "Out of memory allocating BWT batches in "
+		     << "Ebwt::buildToDisk() at " << __FILE__ << ":"
 		     << __LINE__ << endl;
 		throw e;
 	}
-
-	// Allocate the side buffer; holds a single side as its being
-	// constructed and then written to disk.  Reused across all sides.
-#ifdef SIXTY4_FORMAT
-	EList<uint64_t> ebwtSide(EBWT_CAT);
+	EbwtBwtPass<TStr> pass;
+	pass.s = &s;
+	pass.eh = &eh;
+	pass.batches = batches;
+	pass.nbatches = nbatches;
+	pass.done = false;
+#ifdef WITH_TBB
+	EList<std::thread*> packers;
 #else
-	EList<uint8_t> ebwtSide(EBWT_CAT);
+	EList<tthread::thread*> packers;
 #endif
-	try {
-#ifdef SIXTY4_FORMAT
-		ebwtSide.resize(sideSz >> 3);
+	for(int i = 1; i < nthreads; i++) {
+#ifdef WITH_TBB
+		packers.push_back(new std::thread(ebwtBwtWorker<TStr>, (void*)&pass));
 #else
-		ebwtSide.resize(sideSz);
+		packers.push_back(new tthread::thread(ebwtBwtWorker<TStr>, (void*)&pass));
 #endif
-	} catch(bad_alloc &e) {
-		cerr << "Out of memory allocating ebwtSide[] in "
-		     << "Ebwt::buildToDisk() at " << __FILE__ << ":"
-		     << __LINE__ << endl;
-		throw e;
 	}
 
-	// Points to the base offset within ebwt for the side currently
-	// being written
-	TIndexOffU side = 0;
-
-	// Whether we're assembling a forward or a reverse bucket
-	bool fw;
-	TIndexOff sideCur = 0;
-	fw = true;
-
 	// Have we skipped the '$' in the last column yet?
 	ASSERT_ONLY(bool dollarSkipped = false);
 
-	TIndexOffU si = 0;   // string offset (chars)
-	ASSERT_ONLY(TIndexOffU lastSufInt = 0);
-	ASSERT_ONLY(bool inSA = true); // true iff saI still points inside suffix
-	                               // array (as opposed to the padding at the
-	                               // end)
 	// Iterate over packed bwt bytes
 	VMSG_NL("Entering Ebwt loop");
 	ASSERT_ONLY(TIndexOffU beforeEbwtOff = (TIndexOffU)out1.tellp()); // @double-check - pos_type, std::streampos 
@@ -2797,174 +3565,91 @@ void Ebwt::buildToDisk(
 		// Write length word
 		writeU<TIndexOffU>(*bwtOut, len+1, this->toBe());
 	}
-	
-	while(side < ebwtTotSz) {
-		// Sanity-check our cursor into the side buffer
-		assert_geq(sideCur, 0);
-		assert_lt(sideCur, (int)eh._sideBwtSz);
-		assert_eq(0, side % sideSz); // 'side' must be on side boundary
-		ebwtSide[sideCur] = 0; // clear
-		assert_lt(side + sideCur, ebwtTotSz);
-		// Iterate over bit-pairs in the si'th character of the BWT
-#ifdef SIXTY4_FORMAT
-		for(int bpi = 0; bpi < 32; bpi++, si++)
-#else
-		for(int bpi = 0; bpi < 4; bpi++, si++)
-#endif
-		{
-			int bwtChar;
-			bool count = true;
-			if(si <= len) {
-				// Still in the SA; extract the bwtChar
-				TIndexOffU saElt = sa.nextSuffix();
-				// Write it to the optional suffix-array output file
-				if(saOut != NULL) {
-					writeU<TIndexOffU>(*saOut, saElt, this->toBe());
-				}
-				// TODO: what exactly to write to the BWT output file?  How to
-				// represent $?  How to pack nucleotides into bytes/words?
-				
-				// (that might have triggered sa to calc next suf block)
-				if(saElt == 0) {
-					// Don't add the '$' in the last column to the BWT
-					// transform; we can't encode a $ (only A C T or G)
-					// and counting it as, say, an A, will mess up the
-					// LR mapping
-					bwtChar = 0; count = false;
-					ASSERT_ONLY(dollarSkipped = true);
-					zOff = si; // remember the SA row that
-					           // corresponds to the 0th suffix
-				} else {
-					bwtChar = (int)(s[saElt-1]);
-					assert_lt(bwtChar, 4);
-					// Update the fchr
-					fchr[bwtChar]++;
-				}
-				// Update ftab
-				if((len-saElt) >= (TIndexOffU)eh._ftabChars) {
-					// Turn the first ftabChars characters of the
-					// suffix into an integer index into ftab.  The
-					// leftmost (lowest index) character of the suffix
-					// goes in the most significant bit pair if the
-					// integer.
-					TIndexOffU sufInt = 0;
-					for(int i = 0; i < eh._ftabChars; i++) {
-						sufInt <<= 2;
-						assert_lt((TIndexOffU)i, len-saElt);
-						sufInt |= (unsigned char)(s[saElt+i]);
+
+	TIndexOffU batchRows = EBWT_BATCH_SIDES * eh._sideBwtLen;
+	TIndexOffU totRows = (ebwtTotSz / sideSz) * eh._sideBwtLen;
+	TIndexOffU nbatchTot = (totRows + batchRows - 1) / batchRows;
+	TIndexOffU filled = 0, written = 0;
+	try {
+		while(written < nbatchTot) {
+			if(filled < nbatchTot && filled - written < (TIndexOffU)nbatches) {
+				// Fill the next batch with suffixes from the suffix array
+				EbwtBwtBatch& b = batches[filled % nbatches];
+				assert_eq(EBWT_BATCH_EMPTY, b.state);
+				b.row = filled * batchRows;
+				b.nrows = min(batchRows, totRows - b.row);
+				TIndexOffU nsufs = (b.row > len) ? 0 : min(b.nrows, len + 1 - b.row);
+				b.sufs.resizeNoCopy(nsufs);
+				for(TIndexOffU i = 0; i < nsufs; i++) {
+					TIndexOffU si = b.row + i;
+					TIndexOffU saElt = sa.nextSuffix();
+					b.sufs[i] = saElt;
+					// Write it to the optional suffix-array output file
+					if(saOut != NULL) {
+						writeU<TIndexOffU>(*saOut, saElt, this->toBe());
 					}
-					// Assert that this prefix-of-suffix is greater
-					// than or equal to the last one (true b/c the
-					// suffix array is sorted)
-					#ifndef NDEBUG
-					if(lastSufInt > 0) assert_geq(sufInt, lastSufInt);
-					lastSufInt = sufInt;
-					#endif
-					// Update ftab
-					assert_lt(sufInt+1, ftabLen);
-					ftab[sufInt+1]++;
-					if(absorbCnt > 0) {
-						// Absorb all short suffixes since the last
-						// transition into this transition
-						absorbFtab[sufInt] = absorbCnt;
-						absorbCnt = 0;
+					// Suffix array offset boundary? - update offset array
+					if((si & eh._offMask) == si) {
+						assert_lt((si >> eh._offRate), eh._offsLen);
+						// Write offsets directly to the secondary output
+						// stream, thereby avoiding keeping them in memory
+						writeU<TIndexOffU>(out2, saElt, this->toBe());
 					}
-				} else {
-					// Otherwise if suffix is fewer than ftabChars
-					// characters long, then add it to the 'absorbCnt';
-					// it will be absorbed into the next transition
-					assert_lt(absorbCnt, 255);
-					absorbCnt++;
-				}
-				// Suffix array offset boundary? - update offset array
-				if((si & eh._offMask) == si) {
-					assert_lt((si >> eh._offRate), eh._offsLen);
-					// Write offsets directly to the secondary output
-					// stream, thereby avoiding keeping them in memory
-					writeU<TIndexOffU>(out2, saElt, this->toBe());
 				}
-			} else {
-				// Strayed off the end of the SA, now we're just
-				// padding out a bucket
-				#ifndef NDEBUG
-				if(inSA) {
-					// Assert that we wrote all the characters in the
-					// string before now
-					assert_eq(si, len+1);
-					inSA = false;
+				__sync_synchronize();
+				b.state = EBWT_BATCH_FILLED;
+				filled++;
+				if(nthreads > 1) continue;
+			}
+			// Write out the oldest batch once it's packed, helping with
+			// the packing while we wait
+			EbwtBwtBatch& b = batches[written % nbatches];
+			if(b.state != EBWT_BATCH_PACKED) {
+				if(!pass.packOne()) SLEEP(1);
+				continue;
+			}
+			TIndexOffU nsides = b.nrows / eh._sideBwtLen;
+			for(TIndexOffU j = 0; j < nsides; j++) {
+				// Write 'A', 'C', 'G' and 'T' tallies
+				TIndexOffU *cpptr = reinterpret_cast<TIndexOffU*>(b.sides.ptr() + j * sideSz + eh._sideBwtSz);
+				for(int c = 0; c < 4; c++) {
+					cpptr[c] = endianizeU<TIndexOffU>(occ[c] + cpptr[c], this->toBe());
 				}
-				#endif
-				// 'A' used for padding; important that padding be
-				// counted in the occ[] array
-				bwtChar = 0;
 			}
-			if(count) occ[bwtChar]++;
-			// Append BWT char to bwt section of current side
-			if(fw) {
-				// Forward bucket: fill from least to most
-#ifdef SIXTY4_FORMAT
-				ebwtSide[sideCur] |= ((uint64_t)bwtChar << (bpi << 1));
-				if(bwtChar > 0) assert_gt(ebwtSide[sideCur], 0);
-#else
-				pack_2b_in_8b(bwtChar, ebwtSide[sideCur], bpi);
-				assert_eq((ebwtSide[sideCur] >> (bpi*2)) & 3, bwtChar);
-#endif
-			} else {
-				// Backward bucket: fill from most to least
-#ifdef SIXTY4_FORMAT
-				ebwtSide[sideCur] |= ((uint64_t)bwtChar << ((31 - bpi) << 1));
-				if(bwtChar > 0) assert_gt(ebwtSide[sideCur], 0);
-#else
-				pack_2b_in_8b(bwtChar, ebwtSide[sideCur], 3-bpi);
-				assert_eq((ebwtSide[sideCur] >> ((3-bpi)*2)) & 3, bwtChar);
-#endif
+			out1.write((const char *)b.sides.ptr(), nsides * sideSz);
+			for(int c = 0; c < 4; c++) {
+				occ[c] += b.occ[c];
+				fchr[c] += b.fchr[c];
 			}
-		} // end loop over bit-pairs
-		assert_eq(dollarSkipped ? 3 : 0, (occ[0] + occ[1] + occ[2] + occ[3]) & 3);
-#ifdef SIXTY4_FORMAT
-		assert_eq(0, si & 31);
-#else
-		assert_eq(0, si & 3);
-#endif
-
-		sideCur++;
-		if(sideCur == (int)eh._sideBwtSz) {
-			sideCur = 0;
-			TIndexOffU *cpptr = reinterpret_cast<TIndexOffU*>(ebwtSide.ptr());
-			// Write 'A', 'C', 'G' and 'T' tallies
-			side += sideSz;
-			assert_leq(side, eh._ebwtTotSz);
-#ifdef BOWTIE_64BIT_INDEX
-			cpptr[(sideSz >> 3)-4] = endianizeU<TIndexOffU>(occSave[0], this->toBe());
-			cpptr[(sideSz >> 3)-3] = endianizeU<TIndexOffU>(occSave[1], this->toBe());
-			cpptr[(sideSz >> 3)-2] = endianizeU<TIndexOffU>(occSave[2], this->toBe());
-			cpptr[(sideSz >> 3)-1] = endianizeU<TIndexOffU>(occSave[3], this->toBe());
-#else
-			cpptr[(sideSz >> 2)-4] = endianizeU<TIndexOffU>(occSave[0], this->toBe());
-			cpptr[(sideSz >> 2)-3] = endianizeU<TIndexOffU>(occSave[1], this->toBe());
-			cpptr[(sideSz >> 2)-2] = endianizeU<TIndexOffU>(occSave[2], this->toBe());
-			cpptr[(sideSz >> 2)-1] = endianizeU<TIndexOffU>(occSave[3], this->toBe());
-#endif
-			occSave[0] = occ[0];
-			occSave[1] = occ[1];
-			occSave[2] = occ[2];
-			occSave[3] = occ[3];
-			// Write backward side to primary file
-			out1.write((const char *)ebwtSide.ptr(), sideSz);
+			if(b.zOff != OFF_MASK) {
+				assert(!dollarSkipped);
+				ASSERT_ONLY(dollarSkipped = true);
+				zOff = b.zOff; // remember the SA row that
+				               // corresponds to the 0th suffix
+			}
+			b.state = EBWT_BATCH_EMPTY;
+			written++;
 		}
+	} catch(...) {
+		pass.done = true;
+		for(size_t i = 0; i < packers.size(); i++) {
+			packers[i]->join();
+			delete packers[i];
+		}
+		delete[] batches;
+		throw;
+	}
+	pass.done = true;
+	for(size_t i = 0; i < packers.size(); i++) {
+		packers[i]->join();
+		delete packers[i];
 	}
+	delete[] batches;
 	VMSG_NL("Exited Ebwt loop");
+	assert(dollarSkipped);
 	assert_neq(zOff, OFF_MASK);
-	if(absorbCnt > 0) {
-		// Absorb any trailing, as-yet-unabsorbed short suffixes into
-		// the last element of ftab
-		absorbFtab[ftabLen-1] = absorbCnt;
-	}
-	// Assert that our loop counter got incremented right to the end
-	assert_eq(side, eh._ebwtTotSz);
 	// Assert that we wrote the expected amount to out1
 	assert_eq(((TIndexOffU)out1.tellp() - beforeEbwtOff), eh._ebwtTotSz); // @double-check - pos_type
-	// assert that the last thing we did was write a forward bucket
 
 	//
 	// Write zOff to primary stream
@@ -2993,50 +3678,12 @@ void Ebwt::buildToDisk(
 		writeU<TIndexOffU>(out1, fchr[i], this->toBe());
 	}
 
-	//
-	// Finish building ftab and build eftab
-	//
-	// Prefix sum on ftable
-	TIndexOffU eftabLen = 0;
-	assert_eq(0, absorbFtab[0]);
-	for(TIndexOffU i = 1; i < ftabLen; i++) {
-		if(absorbFtab[i] > 0) eftabLen += 2;
-	}
-	assert_leq(eftabLen, (TIndexOffU)eh._ftabChars*2);
-	eftabLen = eh._ftabChars*2;
-	EList<TIndexOffU> eftab(EBWT_CAT);
-	try {
-		eftab.resize(eftabLen);
-		eftab.fillZero();
-	} catch(bad_alloc &e) {
-		cerr << "Out of memory allocating eftab[] "
-		     << "in Ebwt::buildToDisk() at " << __FILE__ << ":"
-		     << __LINE__ << endl;
-		throw e;
-	}
-	TIndexOffU eftabCur = 0;
-	for(TIndexOffU i = 1; i < ftabLen; i++) {
-		TIndexOffU lo = ftab[i] + Ebwt::ftabHi(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i-1);
-		if(absorbFtab[i] > 0) {
-			// Skip a number of short pattern indicated by absorbFtab[i]
-			TIndexOffU hi = lo + absorbFtab[i];
-			assert_lt(eftabCur*2+1, eftabLen);
-			eftab[eftabCur*2] = lo;
-			eftab[eftabCur*2+1] = hi;
-			ftab[i] = (eftabCur++) ^ OFF_MASK; // insert pointer into eftab
-			assert_eq(lo, Ebwt::ftabLo(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i));
-			assert_eq(hi, Ebwt::ftabHi(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, i));
-		} else {
-			ftab[i] = lo;
-		}
-	}
-	assert_eq(Ebwt::ftabHi(ftab.ptr(), eftab.ptr(), len, ftabLen, eftabLen, ftabLen-1), len+1);
 	// Write ftab to primary file
 	for(TIndexOffU i = 0; i < ftabLen; i++) {
 		writeU<TIndexOffU>(out1, ftab[i], this->toBe());
 	}
 	// Write eftab to primary file
-	for(TIndexOffU i = 0; i < eftabLen; i++) {
+	for(TIndexOffU i = 0; i < eftab.size(); i++) {
 		writeU<TIndexOffU>(out1, eftab[i], this->toBe());
 	}
 
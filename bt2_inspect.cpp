@@ -36,6 +36,8 @@ static bool showVersion = false; // just print version and quit?
 int verbose             = 0;  // be talkative
 static int names_only   = 0;  // just print the sequence names in the index
 static int summarize_only = 0; // just print summary of index and quit
+static bool zeroCopy    = false; // write zero-copy index files and quit
+static bool shmemRemove = false; // remove the index from shared memory and quit
 static int across       = 60; // number of characters across in FASTA output
 static bool refFromEbwt = false; // true -> when printing reference, decode it from Ebwt instead of reading it from BitPairReference
 static string wrapper;
@@ -45,6 +47,8 @@ enum {
 	ARG_VERSION = 256,
 	ARG_WRAPPER,
 	ARG_USAGE,
+	ARG_ZERO_COPY,
+	ARG_SHMEM_REMOVE,
 };
 
 static struct option long_options[] = {
@@ -57,6 +61,8 @@ static struct option long_options[] = {
 	{(char*)"across",   required_argument,  0, 'a'},
 	{(char*)"ebwt-ref", no_argument,        0, 'e'},
 	{(char*)"wrapper",  required_argument,  0, ARG_WRAPPER},
+	{(char*)"zero-copy", no_argument,       0, ARG_ZERO_COPY},
+	{(char*)"shmem-remove", no_argument,    0, ARG_SHMEM_REMOVE},
 	{(char*)0, 0, 0, 0} // terminator
 };
 
@@ -81,6 +87,11 @@ static void printUsage(ostream& out) {
 	out << "  -a/--across <int>  Number of characters across in FASTA output (default: 60)" << endl
 	<< "  -n/--names         Print reference sequence names only" << endl
 	<< "  -s/--summary       Print summary incl. ref names, lengths, index properties" << endl
+	<< "  --zero-copy        Write <bt2_base>.zc." + gEbwt_ext + " and <bt2_base>.rev.zc." + gEbwt_ext << endl
+	<< "                     zero-copy index files, then quit" << endl
+#ifdef BOWTIE_SHARED_MEM
+	<< "  --shmem-remove     Remove index from shared memory (see bowtie2 --shmem)" << endl
+#endif
 	<< "  -v/--verbose       Verbose output (for debugging)" << endl
 	<< "  -h/--help          print detailed description of tool and its options" << endl
 	<< "  --help             print this usage message" << endl
@@ -139,6 +150,8 @@ static void parseOptions(int argc, char **argv) {
 			case 'e': refFromEbwt = true; break;
 			case 'n': names_only = true; break;
 			case 's': summarize_only = true; break;
+			case ARG_ZERO_COPY: zeroCopy = true; break;
+			case ARG_SHMEM_REMOVE: shmemRemove = true; break;
 			case 'a': across = parseInt(-1, "-a/--across arg must be at least 1"); break;
 			case -1: break; /* Done with options. */
 			case 0:
@@ -374,6 +387,27 @@ static void driver(
 		print_index_sequence_names(adjustedEbwtFileBase, cout);
 	} else if(summarize_only) {
 		print_index_summary(adjustedEbwtFileBase, cout);
+	} else if(zeroCopy) {
+		writeZeroCopyIndex(adjustedEbwtFileBase, true);
+		writeZeroCopyIndex(adjustedEbwtFileBase + ".rev", true);
+	} else if(shmemRemove) {
+#ifdef BOWTIE_SHARED_MEM
+		// Same names Ebwt::readIntoMemory() and BitPairReference use
+		const string& b = adjustedEbwtFileBase;
+		const string& ext = gEbwt_ext;
+		size_t removed = 0;
+		if(removeSharedMem(b + ".1." + ext + "[ebwt]", true)) removed++;
+		if(removeSharedMem(b + ".2." + ext + "[offs]", true)) removed++;
+		if(removeSharedMem(b + ".rev.1." + ext + "[ebwt]", true)) removed++;
+		if(removeSharedMem(b + ".rev.2." + ext + "[offs]", true)) removed++;
+		if(removeSharedMem(b + ".4." + ext + "[ref]", true)) removed++;
+		if(removed == 0) {
+			cerr << "No shared memory found for index " << b << endl;
+		}
+#else
+		cerr << "Error: bowtie2-inspect was built without shared-memory support" << endl;
+		throw 1;
+#endif
 	} else {
 		// Initialize Ebwt object
 		bool color = readEbwtColor(adjustedEbwtFileBase);
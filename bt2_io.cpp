@@ -22,7 +22,11 @@
 #include <iostream>
 #include <fstream>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include "bt2_idx.h"
+#include "freq_kmers.h"
 #include <iomanip>
 
 using namespace std;
@@ -33,6 +37,147 @@ using namespace std;
 //
 ///////////////////////////////////////////////////////////////////////
 
+/**
+ * Check the flags word of an index header against what the caller
+ * expects, throwing if they're incompatible.  Sets 'color' to whether
+ * the index is colorspace and 'entireRev' to whether a reverse index
+ * is the reverse of the concatenated reference.
+ */
+static void checkEbwtFlags(
+	int32_t flags,
+	int& color,
+	int needEntireRev,
+	bool& entireRev)
+{
+	entireRev = false;
+	if(flags < 0 && (((-flags) & EBWT_COLOR) != 0)) {
+		if(color != -1 && !color) {
+			cerr << "Error: -C was not specified when running bowtie, but index is in colorspace.  If" << endl
+			     << "your reads are in colorspace, please use the -C option.  If your reads are not" << endl
+			     << "in colorspace, please use a normal index (one built without specifying -C to" << endl
+			     << "bowtie-build)." << endl;
+			throw 1;
+		}
+		color = 1;
+	} else if(flags < 0) {
+		if(color != -1 && color) {
+			cerr << "Error: -C was specified when running bowtie, but index is not in colorspace.  If" << endl
+			     << "your reads are in colorspace, please use a colorspace index (one built using" << endl
+			     << "bowtie-build -C).  If your reads are not in colorspace, don't specify -C when" << endl
+			     << "running bowtie." << endl;
+			throw 1;
+		}
+		color = 0;
+	}
+	if(flags < 0 && (((-flags) & EBWT_ENTIRE_REV) == 0)) {
+		if(needEntireRev != -1 && needEntireRev != 0) {
+			cerr << "Error: This index is compatible with 0.* versions of Bowtie, but not with 2.*" << endl
+			     << "versions.  Please build or download a version of the index that is compitble" << endl
+				 << "with Bowtie 2.* (i.e. built with bowtie-build 2.* or later)" << endl;
+			throw 1;
+		}
+	} else entireRev = true;
+}
+
+#ifdef BOWTIE_MM
+
+/// Arrays smaller than this are read by a single reader
+static const uint64_t EBWT_CHUNKED_READ_MIN = 16 * 1024 * 1024;
+
+/**
+ * One chunk of an array being read by readChunked().
+ */
+struct EbwtChunkRead {
+	int      fd;
+	char    *dst;
+	off_t    off;
+	uint64_t len;
+	int      err; // errno of a failed read, -1 for early EOF, else 0
+};
+
+static void readChunk(void *vp) {
+	EbwtChunkRead& c = *(EbwtChunkRead*)vp;
+	while(c.len > 0) {
+		ssize_t r = pread(c.fd, c.dst, (size_t)min<uint64_t>(c.len, 1 << 30), c.off);
+		if(r <= 0) {
+			c.err = (r < 0) ? errno : -1;
+			return;
+		}
+		c.dst += r;
+		c.off += r;
+		c.len -= r;
+	}
+}
+
+/**
+ * Read 'len' bytes from the current position of 'f' into 'dst' with up
+ * to 'nthreads' threads, each issuing pread()s for its own contiguous
+ * chunk, and leave 'f' positioned just past them.  Returns false
+ * without reading anything if the array is too small to be worth
+ * splitting, in which case the caller reads it as usual.
+ */
+static bool readChunked(
+	FILE *f,
+	char *dst,
+	uint64_t len,
+	int nthreads,
+	const char *memName,
+	bool verbose)
+{
+	if(nthreads < 2 || len < EBWT_CHUNKED_READ_MIN) {
+		return false;
+	}
+	// At least 4 MB per reader
+	nthreads = (int)min<uint64_t>(nthreads, len / (EBWT_CHUNKED_READ_MIN / 4));
+	if(verbose) {
+		cerr << "  Reading " << memName << " in " << nthreads << " chunks" << endl;
+	}
+	off_t start = ftello(f);
+	uint64_t chunk = (len + nthreads - 1) / nthreads;
+	EList<EbwtChunkRead> chunks;
+	chunks.resize(nthreads);
+#ifdef WITH_TBB
+	EList<std::thread*> readers;
+#else
+	EList<tthread::thread*> readers;
+#endif
+	for(int i = 0; i < nthreads; i++) {
+		EbwtChunkRead& c = chunks[i];
+		c.fd = fileno(f);
+		c.dst = dst + i * chunk;
+		c.off = start + (off_t)(i * chunk);
+		c.len = min<uint64_t>(chunk, len - min<uint64_t>(len, i * chunk));
+		c.err = 0;
+#ifdef WITH_TBB
+		readers.push_back(new std::thread(readChunk, (void*)&c));
+#else
+		readers.push_back(new tthread::thread(readChunk, (void*)&c));
+#endif
+	}
+	for(size_t i = 0; i < readers.size(); i++) {
+		readers[i]->join();
+		delete readers[i];
+	}
+	for(int i = 0; i < nthreads; i++) {
+		if(chunks[i].err != 0) {
+			cerr << "Error reading " << memName << " array: "
+			     << (chunks[i].err > 0 ? strerror(chunks[i].err) : "unexpected end of file")
+			     << endl;
+			throw 1;
+		}
+	}
+	fseeko(f, start + (off_t)len, SEEK_SET);
+	return true;
+}
+
+#else
+
+static bool readChunked(FILE*, char*, uint64_t, int, const char*, bool) {
+	return false;
+}
+
+#endif
+
 /**
  * Read an Ebwt from file with given filename.
  */
@@ -52,6 +197,11 @@ void Ebwt::readIntoMemory(
 #ifdef BOWTIE_MM
 	char *mmFile[] = { NULL, NULL };
 #endif
+	if(useZeroCopy(startVerbose)) {
+		readZeroCopy(color, needEntireRev, loadSASamp, loadFtab, loadRstarts,
+		             justHeader, params, mmSweep, loadNames, startVerbose);
+		return;
+	}
 	if(_in1Str.length() > 0) {
 		if(_verbose || startVerbose) {
 			cerr << "  About to open input files: ";
@@ -173,34 +323,8 @@ void Ebwt::readIntoMemory(
 	// chunkRate was deprecated in an earlier version of Bowtie; now
 	// we use it to hold flags.
 	int32_t flags = readI<int32_t>(_in1, switchEndian);
-	bool entireRev = false;
-	if(flags < 0 && (((-flags) & EBWT_COLOR) != 0)) {
-		if(color != -1 && !color) {
-			cerr << "Error: -C was not specified when running bowtie, but index is in colorspace.  If" << endl
-			     << "your reads are in colorspace, please use the -C option.  If your reads are not" << endl
-			     << "in colorspace, please use a normal index (one built without specifying -C to" << endl
-			     << "bowtie-build)." << endl;
-			throw 1;
-		}
-		color = 1;
-	} else if(flags < 0) {
-		if(color != -1 && color) {
-			cerr << "Error: -C was specified when running bowtie, but index is not in colorspace.  If" << endl
-			     << "your reads are in colorspace, please use a colorspace index (one built using" << endl
-			     << "bowtie-build -C).  If your reads are not in colorspace, don't specify -C when" << endl
-			     << "running bowtie." << endl;
-			throw 1;
-		}
-		color = 0;
-	}
-	if(flags < 0 && (((-flags) & EBWT_ENTIRE_REV) == 0)) {
-		if(needEntireRev != -1 && needEntireRev != 0) {
-			cerr << "Error: This index is compatible with 0.* versions of Bowtie, but not with 2.*" << endl
-			     << "versions.  Please build or download a version of the index that is compitble" << endl
-				 << "with Bowtie 2.* (i.e. built with bowtie-build 2.* or later)" << endl;
-			throw 1;
-		}
-	} else entireRev = true;
+	bool entireRev;
+	checkEbwtFlags(flags, color, needEntireRev, entireRev);
 	bytesRead += 4;
 	
 	// Create a new EbwtParams from the entries read from primary stream
@@ -346,6 +470,9 @@ void Ebwt::readIntoMemory(
 			if(_verbose || startVerbose) {
 				cerr << "  shared-mem " << (shmemLeader ? "leader" : "follower") << endl;
 			}
+		} else if(_hugePages != HUGEPAGES_OFF) {
+			_ebwt.init(allocHuge<uint8_t>(EBWT_HUGE_EBWT, eh->_ebwtTotLen, "ebwt[]",
+			           (_verbose || startVerbose)), eh->_ebwtTotLen, false);
 		} else {
 			try {
 				_ebwt.init(new uint8_t[eh->_ebwtTotLen], eh->_ebwtTotLen, true);
@@ -359,7 +486,10 @@ void Ebwt::readIntoMemory(
 			// Read ebwt from primary stream
 			uint64_t bytesLeft = eh->_ebwtTotLen;
 			char *pebwt = (char*)this->ebwt();
-
+			if(readChunked(_in1, pebwt, bytesLeft, _loadThreads, "_ebwt[]",
+			               (_verbose || startVerbose))) {
+				bytesLeft = 0;
+			}
 			while (bytesLeft>0){
 				size_t r = MM_READ(_in1, (void *)pebwt, bytesLeft);
 				if(MM_IS_IO_ERR(_in1,r,bytesLeft)) {
@@ -433,7 +563,12 @@ void Ebwt::readIntoMemory(
 				fseeko(_in1, eh->_ftabLen*OFF_SIZE, SEEK_CUR);
 #endif
 			} else {
-				_ftab.init(new TIndexOffU[eh->_ftabLen], eh->_ftabLen, true);
+				if(_hugePages != HUGEPAGES_OFF) {
+					_ftab.init(allocHuge<TIndexOffU>(EBWT_HUGE_FTAB, eh->_ftabLen, "ftab[]",
+					           (_verbose || startVerbose)), eh->_ftabLen, false);
+				} else {
+					_ftab.init(new TIndexOffU[eh->_ftabLen], eh->_ftabLen, true);
+				}
 				if(switchEndian) {
 					for(TIndexOffU i = 0; i < eh->_ftabLen; i++)
 						this->ftab()[i] = readU<TIndexOffU>(_in1, switchEndian);
@@ -463,7 +598,12 @@ void Ebwt::readIntoMemory(
 				fseeko(_in1, eh->_eftabLen*OFF_SIZE, SEEK_CUR);
 #endif
 			} else {
-				_eftab.init(new TIndexOffU[eh->_eftabLen], eh->_eftabLen, true);
+				if(_hugePages != HUGEPAGES_OFF) {
+					_eftab.init(allocHuge<TIndexOffU>(EBWT_HUGE_EFTAB, eh->_eftabLen, "eftab[]",
+					            (_verbose || startVerbose)), eh->_eftabLen, false);
+				} else {
+					_eftab.init(new TIndexOffU[eh->_eftabLen], eh->_eftabLen, true);
+				}
 				if(switchEndian) {
 					for(TIndexOffU i = 0; i < eh->_eftabLen; i++)
 						this->eftab()[i] = readU<TIndexOffU>(_in1, switchEndian);
@@ -518,20 +658,44 @@ void Ebwt::readIntoMemory(
 	}
 	
 	_offs.reset();
+	_offsBits = 0;
+	_offsMask = OFF_MASK;
 	if(loadSASamp) {
 		bytesRead = 4; // reset for secondary index file (already read 1-sentinel)
 		
+		// Number of TIndexOffU words holding the sample in memory
+		TIndexOffU offsWords = offsLenSampled;
+		if(_packOffs && !_useMm && !useShmem_) {
+			// Elements are offsets in [0, len], so that's all we need to
+			// be able to represent
+			int bits = 1;
+			while(bits < (int)(OFF_SIZE*8) && (len >> bits) != 0) bits++;
+			if(bits < (int)(OFF_SIZE*8)) {
+				_offsBits = bits;
+				_offsMask = (TIndexOffU)((((TIndexOffU)1) << bits) - 1);
+				// One word of padding lets offsAt() always read a pair
+				offsWords = (TIndexOffU)(((uint64_t)offsLenSampled * bits + OFF_SIZE*8 - 1) / (OFF_SIZE*8)) + 1;
+			}
+		}
+		
 		shmemLeader = true;
 		if(_verbose || startVerbose) {
 			cerr << "Reading offs (" << offsLenSampled << std::setw(2) << OFF_SIZE*8 <<"-bit words): ";
 			logTime(cerr);
+			if(_offsBits > 0) {
+				cerr << "  Packing offs to " << _offsBits << " bits per element ("
+				     << offsWords << " words)" << endl;
+			}
 		}
 		
 		if(!_useMm) {
-			if(!useShmem_) {
+			if(!useShmem_ && _hugePages != HUGEPAGES_OFF) {
+				_offs.init(allocHuge<TIndexOffU>(EBWT_HUGE_OFFS, offsWords, "offs[]",
+				           (_verbose || startVerbose)), offsWords, false);
+			} else if(!useShmem_) {
 				// Allocate offs_
 				try {
-					_offs.init(new TIndexOffU[offsLenSampled], offsLenSampled, true);
+					_offs.init(new TIndexOffU[offsWords], offsWords, true);
 				} catch(bad_alloc& e) {
 					cerr << "Out of memory allocating the offs[] array  for the Bowtie index." << endl
 					<< "Please try again on a computer with more memory." << endl;
@@ -546,10 +710,14 @@ void Ebwt::readIntoMemory(
 			}
 		}
 		
+		if(_offsBits > 0) {
+			offs()[offsWords-1] = 0; // padding
+		}
+		
 		if(_overrideOffRate < 32) {
 			if(shmemLeader) {
 				// Allocate offs (big allocation)
-				if(switchEndian || offRateDiff > 0) {
+				if(switchEndian || offRateDiff > 0 || _offsBits > 0) {
 					assert(!_useMm);
 					const TIndexOffU blockMaxSz = (2 * 1024 * 1024); // 2 MB block size
 					const TIndexOffU blockMaxSzU = (blockMaxSz >> (OFF_SIZE/4 + 1)); // # U32s per block
@@ -570,9 +738,14 @@ void Ebwt::readIntoMemory(
 						TIndexOffU idx = i >> offRateDiff;
 						for(TIndexOffU j = 0; j < block; j += (1 << offRateDiff)) {
 							assert_lt(idx, offsLenSampled);
-							this->offs()[idx] = ((TIndexOffU*)buf)[j];
+							TIndexOffU off = ((TIndexOffU*)buf)[j];
 							if(switchEndian) {
-								this->offs()[idx] = endianSwapU(this->offs()[idx]);
+								off = endianSwapU(off);
+							}
+							if(_offsBits > 0) {
+								this->packOffsAt(idx, off);
+							} else {
+								this->offs()[idx] = off;
 							}
 							idx++;
 						}
@@ -591,7 +764,10 @@ void Ebwt::readIntoMemory(
 						// bytes.
 						uint64_t bytesLeft = offsSz;
 						char *offs = (char *)this->offs();
-
+						if(readChunked(_in2, offs, bytesLeft, _loadThreads, "_offs[]",
+						               (_verbose || startVerbose))) {
+							bytesLeft = 0;
+						}
 						while(bytesLeft > 0) {
 							size_t r = MM_READ(_in2, (void*)offs, bytesLeft);
 							if(MM_IS_IO_ERR(_in2,r,bytesLeft)) {
@@ -636,6 +812,460 @@ done: // Exit hatch for both justHeader and !justHeader
 	}
 }
 
+/**
+ * Number of bytes at each end of a .1.bt2 file that ebwtFileSum()
+ * reads.  The start holds the header, reference lengths and the start
+ * of the BWT, the end holds the ftab tail and the reference names, so
+ * two different indexes are all but certain to differ there.
+ */
+static const size_t EBWT_SUM_BYTES = 64 * 1024;
+
+/**
+ * Set 'size' to the size of file 'fname' and 'sum' to an FNV-1a hash
+ * of its first and last EBWT_SUM_BYTES bytes.  Returns false if the
+ * file can't be read.
+ */
+static bool ebwtFileSum(const string& fname, uint64_t& size, uint64_t& sum) {
+	FILE *f = fopen(fname.c_str(), "rb");
+	if(f == NULL) return false;
+	struct stat sbuf;
+	if(fstat(fileno(f), &sbuf) != 0) {
+		fclose(f);
+		return false;
+	}
+	size = (uint64_t)sbuf.st_size;
+	sum = 14695981039346656037ull;
+	char buf[4096];
+	for(int end = 0; end < 2; end++) {
+		uint64_t off = 0, len = min<uint64_t>(size, EBWT_SUM_BYTES);
+		if(end == 1) {
+			if(size <= EBWT_SUM_BYTES) break;
+			off = max<uint64_t>(size - EBWT_SUM_BYTES, EBWT_SUM_BYTES);
+			len = size - off;
+		}
+		if(fseeko(f, (off_t)off, SEEK_SET) != 0) {
+			fclose(f);
+			return false;
+		}
+		while(len > 0) {
+			size_t n = fread(buf, 1, (size_t)min<uint64_t>(len, sizeof(buf)), f);
+			if(n == 0) {
+				fclose(f);
+				return false;
+			}
+			for(size_t i = 0; i < n; i++) {
+				sum ^= (uint8_t)buf[i];
+				sum *= 1099511628211ull;
+			}
+			len -= n;
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+/**
+ * Return true iff this Ebwt should be read from its zero-copy index
+ * file: the file exists, was made from the current .1.bt2 file, and
+ * no option needs the arrays in memory we own (--shmem, --hugepages,
+ * --packed-sa, an overridden offrate).
+ */
+bool Ebwt::useZeroCopy(bool startVerbose) {
+#ifdef BOWTIE_MM
+	if(zcFile_ != NULL) return true;
+	if(_zcStr.empty() || useShmem_ || _hugePages != HUGEPAGES_OFF ||
+	   _packOffs || _overrideOffRate >= 0)
+	{
+		return false;
+	}
+	FILE *f = fopen(_zcStr.c_str(), "rb");
+	if(f == NULL) return false;
+	// A header that's unreadable or from another version is reported
+	// by readZeroCopy()
+	EbwtZcHeader h;
+	bool haveHeader = fread(&h, sizeof(h), 1, f) == 1 &&
+	                  memcmp(h.magic, EBWT_ZC_MAGIC, 8) == 0 &&
+	                  h.version == EBWT_ZC_VERSION && h.one == 1;
+	fclose(f);
+	uint64_t size1 = 0, sum1 = 0;
+	if(haveHeader && ebwtFileSum(_in1Str, size1, sum1) &&
+	   (size1 != h.src1Size || sum1 != h.src1Sum))
+	{
+		cerr << "Warning: ignoring zero-copy index file " << _zcStr.c_str()
+		     << " because it was made from an earlier " << _in1Str.c_str()
+		     << "; re-create it with bowtie2-inspect --zero-copy" << endl;
+		_zcStr.clear();
+		return false;
+	}
+	if(_verbose || startVerbose) {
+		cerr << "Using zero-copy index file \"" << _zcStr.c_str() << "\"" << endl;
+	}
+	return true;
+#else
+	(void)startVerbose;
+	return false;
+#endif
+}
+
+/**
+ * Counterpart to readIntoMemory() for zero-copy index files.  Maps the
+ * file (once) and points the index arrays into the mapping; nothing
+ * is copied or byte-swapped.
+ */
+void Ebwt::readZeroCopy(
+	int color,
+	int needEntireRev,
+	bool loadSASamp,
+	bool loadFtab,
+	bool loadRstarts,
+	bool justHeader,
+	EbwtParams *params,
+	bool mmSweep,
+	bool loadNames,
+	bool startVerbose)
+{
+#ifdef BOWTIE_MM
+	if(zcFile_ == NULL) {
+		if(_verbose || startVerbose) {
+			cerr << "  Memory-mapping zero-copy index file: ";
+			logTime(cerr);
+		}
+		int fd = open(_zcStr.c_str(), O_RDONLY);
+		struct stat sbuf;
+		if(fd < 0 || fstat(fd, &sbuf) != 0) {
+			perror("open");
+			cerr << "Error: Could not open index file " << _zcStr.c_str() << endl;
+			throw 1;
+		}
+		void *p = mmap((void *)0, (size_t)sbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if(p == MAP_FAILED) {
+			perror("mmap");
+			cerr << "Error: Could not memory-map the index file " << _zcStr.c_str() << endl;
+			throw 1;
+		}
+		zcFile_ = (char*)p;
+		zcLen_ = (size_t)sbuf.st_size;
+		const EbwtZcHeader *h = (const EbwtZcHeader*)zcFile_;
+		bool ok = zcLen_ >= sizeof(EbwtZcHeader) &&
+		          memcmp(h->magic, EBWT_ZC_MAGIC, 8) == 0;
+		if(!ok || h->version != EBWT_ZC_VERSION || h->one != 1 || h->offSize != OFF_SIZE) {
+			cerr << "Error: " << _zcStr.c_str() << " is not a zero-copy index file for this" << endl
+			     << "version of Bowtie 2, this index width, or this machine's byte order.  Please" << endl
+			     << "delete it or re-create it with bowtie2-inspect --zero-copy." << endl;
+			throw 1;
+		}
+		for(int i = 0; i < EBWT_ZC_NSECS; i++) {
+			if(h->secOff[i] > zcLen_ || h->secLen[i] > zcLen_ - h->secOff[i]) {
+				cerr << "Error: zero-copy index file " << _zcStr.c_str() << " is truncated" << endl;
+				throw 1;
+			}
+		}
+		if(mmSweep) {
+			int sum = 0;
+			for(size_t j = 0; j < zcLen_; j += 1024) {
+				sum += (int) zcFile_[j];
+			}
+			if(startVerbose) {
+				cerr << "  Swept the zero-copy index file; checksum: " << sum << ": ";
+				logTime(cerr);
+			}
+		}
+	}
+	const EbwtZcHeader& h = *(const EbwtZcHeader*)zcFile_;
+	bool entireRev;
+	checkEbwtFlags(h.flags, color, needEntireRev, entireRev);
+	EbwtParams *eh;
+	bool deleteEh = false;
+	if(params != NULL) {
+		params->init((TIndexOffU)h.len, h.lineRate, h.offRate, h.ftabChars, color, entireRev);
+		if(_verbose || startVerbose) params->print(cerr);
+		eh = params;
+	} else {
+		eh = new EbwtParams((TIndexOffU)h.len, h.lineRate, h.offRate, h.ftabChars, color, entireRev);
+		deleteEh = true;
+	}
+	if(h.secLen[EBWT_ZC_PLEN]    != h.nPat * OFF_SIZE ||
+	   h.secLen[EBWT_ZC_RSTARTS] != h.nFrag * 3 * OFF_SIZE ||
+	   h.secLen[EBWT_ZC_EBWT]    != eh->_ebwtTotLen ||
+	   h.secLen[EBWT_ZC_FCHR]    != 5 * OFF_SIZE ||
+	   h.secLen[EBWT_ZC_FTAB]    != (uint64_t)eh->_ftabLen * OFF_SIZE ||
+	   h.secLen[EBWT_ZC_EFTAB]   != (uint64_t)eh->_eftabLen * OFF_SIZE ||
+	   h.secLen[EBWT_ZC_OFFS]    != eh->_offsSz)
+	{
+		cerr << "Error: section sizes in zero-copy index file " << _zcStr.c_str()
+		     << " don't match its header" << endl;
+		throw 1;
+	}
+#define ZC_SECTION(T, s) ((T*)(zcFile_ + h.secOff[s]))
+	this->_nPat = (TIndexOffU)h.nPat;
+	_plen.reset();
+	_plen.init(ZC_SECTION(TIndexOffU, EBWT_ZC_PLEN), _nPat, false);
+	if(!justHeader) {
+		this->_nFrag = (TIndexOffU)h.nFrag;
+		_rstarts.reset();
+		if(loadRstarts) {
+			_rstarts.init(ZC_SECTION(TIndexOffU, EBWT_ZC_RSTARTS), _nFrag*3, false);
+		}
+		_ebwt.reset();
+		_ebwt.init(ZC_SECTION(uint8_t, EBWT_ZC_EBWT), eh->_ebwtTotLen, false);
+		_zOff = (TIndexOffU)h.zOff;
+		_fchr.reset();
+		_fchr.init(ZC_SECTION(TIndexOffU, EBWT_ZC_FCHR), 5, false);
+		_ftab.reset();
+		_eftab.reset();
+		if(loadFtab) {
+			_ftab.init(ZC_SECTION(TIndexOffU, EBWT_ZC_FTAB), eh->_ftabLen, false);
+			_eftab.init(ZC_SECTION(TIndexOffU, EBWT_ZC_EFTAB), eh->_eftabLen, false);
+		}
+		if(loadNames) {
+			// Same parsing as for the .1.bt2 names section
+			const char *names = ZC_SECTION(const char, EBWT_ZC_NAMES);
+			for(uint64_t i = 0; i < h.secLen[EBWT_ZC_NAMES]; i++) {
+				char c = names[i];
+				if(c == '\0') break;
+				else if(c == '\n') {
+					this->_refnames.push_back("");
+				} else {
+					if(this->_refnames.size() == 0) {
+						this->_refnames.push_back("");
+					}
+					this->_refnames.back().push_back(c);
+				}
+			}
+		}
+		_offs.reset();
+		_offsBits = 0;
+		_offsMask = OFF_MASK;
+		if(loadSASamp) {
+			_offs.init(ZC_SECTION(TIndexOffU, EBWT_ZC_OFFS), eh->_offsLen, false);
+		}
+		this->postReadInit(*eh);
+		if(_verbose || startVerbose) print(cerr, *eh);
+	}
+#undef ZC_SECTION
+	if(deleteEh) delete eh;
+#else
+	(void)color; (void)needEntireRev; (void)loadSASamp; (void)loadFtab;
+	(void)loadRstarts; (void)justHeader; (void)params; (void)mmSweep;
+	(void)loadNames; (void)startVerbose;
+	assert(false);
+#endif
+}
+
+/**
+ * Write this Ebwt, which must be in memory in its entirety, including
+ * its reference names, as a zero-copy index file.
+ */
+void Ebwt::writeZeroCopy(const string& out) const {
+	const EbwtParams& eh = this->_eh;
+	if(!isInMemory() || offs() == NULL || ftab() == NULL || eftab() == NULL || rstarts() == NULL) {
+		cerr << "Error: index must be fully loaded to write " << out.c_str() << endl;
+		throw 1;
+	}
+	string names;
+	for(size_t i = 0; i < _refnames.size(); i++) {
+		if(i > 0) names.push_back('\n');
+		names += _refnames[i];
+	}
+	EbwtZcHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, EBWT_ZC_MAGIC, 8);
+	h.version = EBWT_ZC_VERSION;
+	h.one = 1;
+	h.offSize = OFF_SIZE;
+	h.lineRate = eh._lineRate;
+	h.offRate = eh._offRate;
+	h.ftabChars = eh._ftabChars;
+	int32_t flags = 1;
+	if(eh._color) flags |= EBWT_COLOR;
+	if(eh._entireReverse) flags |= EBWT_ENTIRE_REV;
+	h.flags = -flags;
+	h.len = eh._len;
+	h.zOff = _zOff;
+	h.nPat = _nPat;
+	h.nFrag = _nFrag;
+	if(!ebwtFileSum(_in1Str, h.src1Size, h.src1Sum)) {
+		cerr << "Error: could not read index file " << _in1Str.c_str()
+		     << " to write " << out.c_str() << endl;
+		throw 1;
+	}
+	const char *data[EBWT_ZC_NSECS];
+	data[EBWT_ZC_PLEN]    = (const char*)plen();
+	h.secLen[EBWT_ZC_PLEN]    = (uint64_t)_nPat * OFF_SIZE;
+	data[EBWT_ZC_RSTARTS] = (const char*)rstarts();
+	h.secLen[EBWT_ZC_RSTARTS] = (uint64_t)_nFrag * 3 * OFF_SIZE;
+	data[EBWT_ZC_EBWT]    = (const char*)ebwt();
+	h.secLen[EBWT_ZC_EBWT]    = eh._ebwtTotLen;
+	data[EBWT_ZC_FCHR]    = (const char*)fchr();
+	h.secLen[EBWT_ZC_FCHR]    = 5 * OFF_SIZE;
+	data[EBWT_ZC_FTAB]    = (const char*)ftab();
+	h.secLen[EBWT_ZC_FTAB]    = (uint64_t)eh._ftabLen * OFF_SIZE;
+	data[EBWT_ZC_EFTAB]   = (const char*)eftab();
+	h.secLen[EBWT_ZC_EFTAB]   = (uint64_t)eh._eftabLen * OFF_SIZE;
+	data[EBWT_ZC_OFFS]    = (const char*)offs();
+	h.secLen[EBWT_ZC_OFFS]    = eh._offsSz;
+	data[EBWT_ZC_NAMES]   = names.c_str();
+	h.secLen[EBWT_ZC_NAMES]   = names.length();
+	uint64_t off = EBWT_ZC_ALIGN;
+	for(int i = 0; i < EBWT_ZC_NSECS; i++) {
+		h.secOff[i] = off;
+		off += (h.secLen[i] + EBWT_ZC_ALIGN - 1) & ~((uint64_t)EBWT_ZC_ALIGN - 1);
+	}
+	ofstream fout(out.c_str(), ios::binary);
+	if(!fout.good()) {
+		cerr << "Could not open index file for writing: \"" << out.c_str() << "\"" << endl;
+		throw 1;
+	}
+	char zeros[EBWT_ZC_ALIGN];
+	memset(zeros, 0, EBWT_ZC_ALIGN);
+	fout.write((const char*)&h, sizeof(h));
+	uint64_t pos = sizeof(h);
+	for(int i = 0; i < EBWT_ZC_NSECS; i++) {
+		fout.write(zeros, (streamsize)(h.secOff[i] - pos));
+		if(i == EBWT_ZC_OFFS && _offsBits > 0) {
+			for(TIndexOffU j = 0; j < eh._offsLen; j++) {
+				TIndexOffU o = offsAt(j);
+				fout.write((const char*)&o, OFF_SIZE);
+			}
+		} else {
+			fout.write(data[i], (streamsize)h.secLen[i]);
+		}
+		pos = h.secOff[i] + h.secLen[i];
+	}
+	if(!fout.good()) {
+		cerr << "Error writing zero-copy index file \"" << out.c_str() << "\"" << endl;
+		throw 1;
+	}
+	fout.close();
+}
+
+/**
+ * Read the index with basename 'base' (e.g. "lambda" or "lambda.rev")
+ * and write it as a zero-copy index file, base + ".zc." + gEbwt_ext.
+ */
+void writeZeroCopyIndex(const string& base, bool verbose) {
+	string out = base + ".zc." + gEbwt_ext;
+	// Make sure the Ebwt reads the classic files, not an old copy of
+	// the file we're about to write
+	remove(out.c_str());
+	Ebwt ebwt(
+		base,
+		-1,      // colorspace?  (don't care)
+		-1,      // need entire reverse?  (don't care)
+		true,    // fw (doesn't matter for writing)
+		-1,      // don't override offrate
+		0,       // offrate plus
+		false,   // use memory-mapped IO
+		false,   // use shared memory
+		false,   // sweep memory-mapped memory
+		true,    // load names?
+		true,    // load SA sample?
+		true,    // load ftab?
+		true,    // load rstarts?
+		false,   // verbose
+		false,   // startVerbose
+		false,   // pass up memory exceptions?
+		false);  // sanity check?
+	ebwt.loadIntoMemory(-1, -1, true, true, true, true, false);
+	ebwt.writeZeroCopy(out);
+	if(verbose) {
+		cerr << "Wrote zero-copy index file " << out.c_str() << endl;
+	}
+}
+
+/**
+ * A BWT range whose rows all begin with the same 'depth'-character
+ * k-mer prefix, as enumerated by writeFreqKmerTable().
+ */
+struct FreqKmerNode {
+	TIndexOffU top, bot;
+	int        depth;  // # characters in 'kmer'
+	uint64_t   kmer;   // last character in the low bits
+};
+
+/**
+ * Read the forward index with basename 'base' and write the table of
+ * 'k'-mers occurring at least 'minFreq' times in its reference to
+ * base + ".kmer." + gEbwt_ext.  The k-mers are enumerated by extending
+ * BWT ranges one character to the left at a time, abandoning a branch
+ * as soon as its range holds fewer than 'minFreq' rows, so the work is
+ * proportional to the number of frequent k-mers, not to the reference
+ * length.  Returns the number of k-mers written.
+ */
+size_t writeFreqKmerTable(const string& base, int k, uint64_t minFreq, bool verbose) {
+	assert_gt(k, 0);
+	assert_leq(k, 32);
+	assert_gt(minFreq, 0);
+	string out = base + ".kmer." + gEbwt_ext;
+	Ebwt ebwt(
+		base,
+		-1,      // colorspace?  (don't care)
+		-1,      // need entire reverse?  (don't care)
+		true,    // fw
+		-1,      // don't override offrate
+		0,       // offrate plus
+		false,   // use memory-mapped IO
+		false,   // use shared memory
+		false,   // sweep memory-mapped memory
+		false,   // load names?
+		false,   // load SA sample?
+		false,   // load ftab?
+		false,   // load rstarts?
+		false,   // verbose
+		false,   // startVerbose
+		false,   // pass up memory exceptions?
+		false);  // sanity check?
+	ebwt.loadIntoMemory(-1, -1, false, false, false, false, false);
+	EList<FreqKmerNode> stack(MISC_CAT);
+	EList<FreqKmerTable::Entry> ents(MISC_CAT);
+	const TIndexOffU *fchr = ebwt.fchr();
+	for(int c = 0; c < 4; c++) {
+		if((uint64_t)(fchr[c+1] - fchr[c]) >= minFreq) {
+			FreqKmerNode n;
+			n.top = fchr[c];
+			n.bot = fchr[c+1];
+			n.depth = 1;
+			n.kmer = (uint64_t)c;
+			stack.push_back(n);
+		}
+	}
+	while(!stack.empty()) {
+		FreqKmerNode n = stack.back();
+		stack.pop_back();
+		if(n.depth == k) {
+			FreqKmerTable::Entry e;
+			e.kmer = n.kmer;
+			e.count = n.bot - n.top;
+			ents.push_back(e);
+			continue;
+		}
+		// Prepend each character
+		TIndexOffU tops[4] = {0, 0, 0, 0}, bots[4] = {0, 0, 0, 0};
+		ebwt.mapLFEx(n.top, n.bot, tops, bots);
+		for(int c = 0; c < 4; c++) {
+			if((uint64_t)(bots[c] - tops[c]) >= minFreq) {
+				FreqKmerNode m;
+				m.top = tops[c];
+				m.bot = bots[c];
+				m.depth = n.depth + 1;
+				m.kmer = n.kmer | ((uint64_t)c << (2 * n.depth));
+				stack.push_back(m);
+			}
+		}
+	}
+	uint64_t index = FreqKmerTable::indexFingerprint(ebwt.eh().len(), ebwt.zOff(), fchr);
+	if(!FreqKmerTable::write(out, index, k, minFreq, ents)) {
+		cerr << "Error writing k-mer table file \"" << out.c_str() << "\"" << endl;
+		throw 1;
+	}
+	if(verbose) {
+		cerr << "Wrote " << ents.size() << " " << k << "-mers occurring at least "
+		     << minFreq << " times to " << out.c_str() << endl;
+	}
+	return ents.size();
+}
+
 /**
  * Read reference names from an input stream 'in' for an Ebwt primary
  * file and store them in 'refnames'.
@@ -853,7 +1483,7 @@ void Ebwt::writeFromMemory(bool justHeader,
 		writeU<TIndexOffU>(out1, this->zOff(), be);
 		TIndexOffU offsLen = eh._offsLen;
 		for(TIndexOffU i = 0; i < offsLen; i++)
-			writeU<TIndexOffU>(out2, this->offs()[i], be);
+			writeU<TIndexOffU>(out2, this->offsAt(i), be);
 		
 		// 'fchr', 'ftab' and 'eftab' are not fully determined until the
 		// loop is finished, so they are written to the primary file after
@@ -27,12 +27,21 @@
 #include <math.h>
 #include <utility>
 #include <limits>
+#include <set>
 #include <time.h>
 #include <dirent.h>
 
 #ifndef _WIN32
 #include <signal.h>
 #endif
+#ifdef BOWTIE_MM
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 
 #include "alphabet.h"
 #include "assert_helpers.h"
@@ -61,6 +70,10 @@
 #include "outq.h"
 #include "aligner_seed2.h"
 #include "bt2_search.h"
+#include "cpu_numa_info.h"
+#include "sa_cache.h"
+#include "freq_kmers.h"
+#include "aligner_effort.h"
 #ifdef WITH_TBB
  #include <tbb/compat/thread>
 #endif
@@ -115,6 +128,22 @@ static bool fileParallel; // separate threads read separate input files in paral
 static bool useShmem;     // use shared memory to hold the index
 static bool useMm;        // use memory-mapped files to hold the index
 static bool mmSweep;      // sweep through memory-mapped files immediately after mapping
+static bool mmWarmup;     // prefault memory-mapped index in the background while aligning
+static int hugePages;     // back the big index arrays with huge pages (HUGEPAGES_*)
+static bool numaReplicate; // one index replica per NUMA node, threads bound to nodes
+static bool packedSa;     // bit-pack the SA sample in memory
+static size_t saCacheMb;  // MB for the cache of resolved SA offsets; 0 = off
+static SAOffsetCache saCache; // resolved SA offsets shared by all threads
+static size_t seedCacheMb; // MB for the cache of seed hits shared by threads; 0 = off
+static SharedSeedCache seedCache; // seed hits shared by all threads
+static string seedCacheFile; // file seedCache is loaded from and saved to between runs
+static size_t dupWindow;  // distinct reads whose alignments duplicates can reuse; 0 = off
+static size_t dupWindowMb; // MB the alignments kept for duplicates may take
+static DupReadCache dupCache; // alignments of recent reads shared by all threads
+static uint64_t freqSeedCap; // don't search seeds occurring this often; 0 = search all
+static uint64_t effortBudget;   // avg extension attempts per read to adapt effort to; 0 = off
+static uint64_t effortBudgetUs; // avg microseconds per read to adapt effort to; 0 = off
+static AdaptiveEffort effort; // scales the effort limits to stay within the budgets
 int gMinInsert;           // minimum insert size
 int gMaxInsert;           // maximum insert size
 bool gMate1fw;            // -1 mate aligns in fw orientation on fw strand
@@ -192,7 +221,6 @@ static EList<string> qualities;
 static EList<string> qualities1;
 static EList<string> qualities2;
 static string polstr;         // temporary holder for policy string
-static bool  msNoCache;       // true -> disable local cache
 static int   bonusMatchType;  // how to reward matches
 static int   bonusMatch;      // constant reward if bonusMatchType=constant
 static int   penMmcType;      // how to penalize mismatches
@@ -218,7 +246,6 @@ static SimpleFunc descentTotFmops; // maximum # FM ops a DescentDriver can perfo
 static int    multiseedMms;   // mismatches permitted in a multiseed seed
 static int    multiseedLen;   // length of multiseed seeds
 static size_t multiseedOff;   // offset to begin extracting seeds
-static uint32_t seedCacheLocalMB;   // # MB to use for non-shared seed alignment cacheing
 static uint32_t seedCacheCurrentMB; // # MB to use for current-read seed hit cacheing
 static uint32_t exactCacheCurrentMB; // # MB to use for current-read seed hit cacheing
 static size_t maxhalf;        // max width on one side of DP table
@@ -250,6 +277,7 @@ static int tighten;           // -M tighten mode (0=none, 1=best, 2=secbest+1)
 static bool doExactUpFront;   // do exact search up front if seeds seem good enough
 static bool do1mmUpFront;     // do 1mm search up front if seeds seem good enough
 static size_t do1mmMinLen;    // length below which we disable 1mm e2e search
+static bool seedInterleave;   // interleave exact seed searches w/ prefetching
 static int seedBoostThresh;   // if average non-zero position has more than this many elements
 static size_t nSeedRounds;    // # seed rounds
 static bool reorder;          // true -> reorder SAM recs in -p mode
@@ -260,6 +288,7 @@ static string logDps;         // log seed-extend dynamic programming problems
 static string logDpsOpp;      // log mate-search dynamic programming problems
 
 static string bt2index;      // read Bowtie 2 index from files with this prefix
+static EList<string> shardIdxs; // further indexes to align to along with bt2index
 static EList<pair<int, string> > extra_opts;
 static size_t extra_opts_cur;
 
@@ -307,6 +336,18 @@ static void resetOptions() {
 	useShmem				= false; // use shared memory to hold the index
 	useMm					= false; // use memory-mapped files to hold the index
 	mmSweep					= false; // sweep through memory-mapped files immediately after mapping
+	mmWarmup				= false; // prefault memory-mapped index in the background
+	hugePages				= HUGEPAGES_OFF; // back the big index arrays with huge pages
+	numaReplicate			= false; // one index replica per NUMA node
+	packedSa				= false; // bit-pack the SA sample in memory
+	saCacheMb				= 0;     // no cache of resolved SA offsets
+	seedCacheMb				= 0;     // no cache of seed hits shared by threads
+	seedCacheFile.clear();           // don't keep seed hits between runs
+	dupWindow				= 0;     // align duplicate reads like any other
+	dupWindowMb				= 256;   // MB the alignments kept for duplicates may take
+	freqSeedCap				= 0;     // search seeds however frequent
+	effortBudget			= 0;     // effort fixed by presets and options
+	effortBudgetUs			= 0;     // effort fixed by presets and options
 	gMinInsert				= 0;     // minimum insert size
 	gMaxInsert				= 500;   // maximum insert size
 	gMate1fw				= true;  // -1 mate aligns in fw orientation on fw strand
@@ -384,7 +425,6 @@ static void resetOptions() {
 	qualities1.clear();
 	qualities2.clear();
 	polstr.clear();
-	msNoCache       = true; // true -> disable local cache
 	bonusMatchType  = DEFAULT_MATCH_BONUS_TYPE;
 	bonusMatch      = DEFAULT_MATCH_BONUS;
 	penMmcType      = DEFAULT_MM_PENALTY_TYPE;
@@ -410,7 +450,6 @@ static void resetOptions() {
 	multiseedMms    = DEFAULT_SEEDMMS;
 	multiseedLen    = gDefaultSeedLen;
 	multiseedOff    = 0;
-	seedCacheLocalMB   = 32; // # MB to use for non-shared seed alignment cacheing
 	seedCacheCurrentMB = 20; // # MB to use for current-read seed hit cacheing
 	exactCacheCurrentMB = 20; // # MB to use for current-read seed hit cacheing
 	maxhalf            = 15; // max width on one side of DP table
@@ -436,6 +475,7 @@ static void resetOptions() {
 	extra_opts.clear();
 	extra_opts_cur = 0;
 	bt2index.clear();        // read Bowtie 2 index from files with this prefix
+	shardIdxs.clear();       // further indexes to align to along with bt2index
 	ignoreQuals = false;     // all mms incur same penalty, regardless of qual
 	wrapper.clear();         // type of wrapper script, so we can print correct usage
 	queries.clear();         // list of query files
@@ -447,6 +487,7 @@ static void resetOptions() {
 	seedBoostThresh = 300;   // if average non-zero position has more than this many elements
 	nSeedRounds = 2;         // # rounds of seed searches to do for repetitive reads
 	do1mmMinLen = 60;        // length below which we disable 1mm search
+	seedInterleave = true;   // interleave exact seed searches w/ prefetching
 	reorder = false;         // reorder SAM records with -p > 1
 	sampleFrac = 1.1f;       // align all reads
 	arbitraryRandom = false; // let pseudo-random seeds be a function of read properties
@@ -515,6 +556,21 @@ static struct option long_options[] = {
 {(char*)"mm",                          no_argument,        0,                   ARG_MM},
 {(char*)"shmem",                       no_argument,        0,                   ARG_SHMEM},
 {(char*)"mmsweep",                     no_argument,        0,                   ARG_MMSWEEP},
+{(char*)"mm-warmup",                   no_argument,        0,                   ARG_MM_WARMUP},
+{(char*)"hugepages",                   no_argument,        0,                   ARG_HUGEPAGES},
+{(char*)"hugepages-1g",                no_argument,        0,                   ARG_HUGEPAGES_1G},
+{(char*)"numa",                        no_argument,        0,                   ARG_NUMA},
+{(char*)"packed-sa",                   no_argument,        0,                   ARG_PACKED_SA},
+{(char*)"sa-cache",                    required_argument,  0,                   ARG_SA_CACHE},
+{(char*)"shared-seed-cache",           required_argument,  0,                   ARG_SEED_CACHE},
+{(char*)"seed-cache-file",             required_argument,  0,                   ARG_SEED_CACHE_FILE},
+{(char*)"collapse-dups",               no_argument,        0,                   ARG_COLLAPSE_DUPS},
+{(char*)"dup-window",                  required_argument,  0,                   ARG_DUP_WINDOW},
+{(char*)"dup-window-mb",               required_argument,  0,                   ARG_DUP_WINDOW_MB},
+{(char*)"skip-freq-seeds",             required_argument,  0,                   ARG_SKIP_FREQ_SEEDS},
+{(char*)"effort-budget",               required_argument,  0,                   ARG_EFFORT_BUDGET},
+{(char*)"effort-budget-us",            required_argument,  0,                   ARG_EFFORT_BUDGET_US},
+{(char*)"shard",                       required_argument,  0,                   ARG_SHARD},
 {(char*)"hadoopout",                   no_argument,        0,                   ARG_HADOOPOUT},
 {(char*)"fullref",                     no_argument,        0,                   ARG_FULLREF},
 {(char*)"usage",                       no_argument,        0,                   ARG_USAGE},
@@ -605,6 +661,8 @@ static struct option long_options[] = {
 {(char*)"no-exact-upfront",            no_argument,        0,                   ARG_EXACT_UPFRONT_NO},
 {(char*)"no-1mm-upfront",              no_argument,        0,                   ARG_1MM_UPFRONT_NO},
 {(char*)"1mm-minlen",                  required_argument,  0,                   ARG_1MM_MINLEN},
+{(char*)"seed-interleave",             no_argument,        0,                   ARG_SEED_INTERLEAVE},
+{(char*)"no-seed-interleave",          no_argument,        0,                   ARG_SEED_INTERLEAVE_NO},
 {(char*)"seed-off",                    required_argument,  0,                   'O'},
 {(char*)"seed-boost",                  required_argument,  0,                   ARG_SEED_BOOST_THRESH},
 {(char*)"read-times",                  no_argument,        0,                   ARG_READ_TIMES},
@@ -739,6 +797,8 @@ static void printUsage(ostream& out) {
 	    << "  --phred33          qualities are Phred+33 (default)" << endl
 	    << "  --phred64          qualities are Phred+64" << endl
 	    << "  --int-quals        qualities encoded as space-delimited integers" << endl
+	    << "  --shard <bt2-idx>  also align to index <bt2-idx>, reporting as if it and" << endl
+	    << "                     <bt2-idx> from -x were one index; may be given many times" << endl
 		<< endl
 	    << " Presets:                 Same as:" << endl
 		<< "  For --end-to-end:" << endl
@@ -837,9 +897,24 @@ static void printUsage(ostream& out) {
 	    << "  --reorder          force SAM output order to match order of input reads" << endl
 #ifdef BOWTIE_MM
 	    << "  --mm               use memory-mapped I/O for index; many 'bowtie's can share" << endl
+	    << "  --mm-warmup        with --mm, page index in in the background while aligning" << endl
+	    << "  --hugepages        back index with 2MB huge pages (hugetlbfs, else THP)" << endl
+	    << "  --hugepages-1g     as --hugepages, but use 1GB pages for the largest arrays" << endl
 #endif
+	    << "  --numa             copy index to each NUMA node; bind threads to nodes" << endl
+	    << "  --packed-sa        store SA sample w/ only as many bits as index needs" << endl
+	    << "  --sa-cache <int>   MB for cache of resolved offsets shared by threads (0)" << endl
+	    << "  --cache            share seed hits among threads (same as --shared-seed-cache 64)" << endl
+	    << "  --shared-seed-cache <int> MB for seed hits shared by threads (0)" << endl
+	    << "  --seed-cache-file <path> keep shared seed hits in <path> between runs" << endl
+	    << "  --collapse-dups    reuse alignments for exact duplicates (same as --dup-window 100000)" << endl
+	    << "  --dup-window <int> # distinct reads/pairs whose alignments duplicates reuse (0)" << endl
+	    << "  --dup-window-mb <int> max MB of alignments kept for --dup-window (256)" << endl
+	    << "  --skip-freq-seeds <int> skip seeds w/ >= <int> hits per index's .kmer table (0)" << endl
+	    << "  --effort-budget <int> adapt -D/-R/-i etc. to avg <int> extends per read (0)" << endl
+	    << "  --effort-budget-us <int> adapt -D/-R/-i etc. to avg <int> usecs per read (0)" << endl
 #ifdef BOWTIE_SHARED_MEM
-		//<< "  --shmem            use shared mem for index; many 'bowtie's can share" << endl
+	    << "  --shmem            use shared mem for index; many 'bowtie2's can share" << endl
 #endif
 		<< endl
 	    << " Other:" << endl
@@ -1039,16 +1114,35 @@ static void parseOption(int next_option, const char *arg) {
 #endif
 		}
 		case ARG_MMSWEEP: mmSweep = true; break;
+		case ARG_MM_WARMUP: mmWarmup = true; break;
+		case ARG_HUGEPAGES: hugePages = HUGEPAGES_2M; break;
+		case ARG_HUGEPAGES_1G: hugePages = HUGEPAGES_1G; break;
+		case ARG_NUMA: numaReplicate = true; break;
+		case ARG_PACKED_SA: packedSa = true; break;
+		case ARG_SA_CACHE: saCacheMb = (size_t)parseInt(0, "--sa-cache arg must be at least 0", arg); break;
+		case ARG_SHARD: tokenize(arg, ",", shardIdxs); break;
 		case ARG_HADOOPOUT: hadoopOut = true; break;
 		case ARG_SOLEXA_QUALS: solexaQuals = true; break;
 		case ARG_INTEGER_QUALS: integerQuals = true; break;
 		case ARG_PHRED64: phred64Quals = true; break;
 		case ARG_PHRED33: solexaQuals = false; phred64Quals = false; break;
 		case ARG_OVERHANG: gReportOverhangs = true; break;
-		case ARG_NO_CACHE: msNoCache = true; break;
-		case ARG_USE_CACHE: msNoCache = false; break;
+		case ARG_NO_CACHE: seedCacheMb = 0; break;
+		case ARG_USE_CACHE: if(seedCacheMb == 0) seedCacheMb = 64; break;
+		case ARG_SEED_CACHE: seedCacheMb = (size_t)parseInt(0, "--shared-seed-cache arg must be at least 0", arg); break;
+		case ARG_SEED_CACHE_FILE: seedCacheFile = arg; break;
+		case ARG_COLLAPSE_DUPS: if(dupWindow == 0) dupWindow = 100000; break;
+		case ARG_DUP_WINDOW: dupWindow = (size_t)parseInt(0, "--dup-window arg must be at least 0", arg); break;
+		case ARG_DUP_WINDOW_MB: dupWindowMb = (size_t)parseInt(1, "--dup-window-mb arg must be at least 1", arg); break;
+		case ARG_SKIP_FREQ_SEEDS: freqSeedCap = (uint64_t)parseInt(0, "--skip-freq-seeds arg must be at least 0", arg); break;
+		case ARG_EFFORT_BUDGET: effortBudget = (uint64_t)parseInt(0, "--effort-budget arg must be at least 0", arg); break;
+		case ARG_EFFORT_BUDGET_US: effortBudgetUs = (uint64_t)parseInt(0, "--effort-budget-us arg must be at least 0", arg); break;
 		case ARG_LOCAL_SEED_CACHE_SZ:
-			seedCacheLocalMB = (uint32_t)parseInt(1, "--local-seed-cache-sz arg must be at least 1", arg);
+			// Threads no longer keep caches of their own; accept the
+			// option so existing command lines still work
+			cerr << "Warning: --local-seed-cache-sz is deprecated and has no effect.  Use "
+			     << "--shared-seed-cache to set the size of the seed cache shared by all threads."
+			     << endl;
 			break;
 		case ARG_CURRENT_SEED_CACHE_SZ:
 			seedCacheCurrentMB = (uint32_t)parseInt(1, "--seed-cache-sz arg must be at least 1", arg);
@@ -1300,6 +1394,8 @@ static void parseOption(int next_option, const char *arg) {
 		case ARG_EXACT_UPFRONT_NO: doExactUpFront = false; break;
 		case ARG_1MM_UPFRONT_NO:   do1mmUpFront   = false; break;
 		case ARG_1MM_MINLEN:       do1mmMinLen = parse<size_t>(arg); break;
+		case ARG_SEED_INTERLEAVE:    seedInterleave = true; break;
+		case ARG_SEED_INTERLEAVE_NO: seedInterleave = false; break;
 		case ARG_NOISY_HPOLY: noisyHpolymer = true; break;
 		case 'x': bt2index = arg; break;
 		case ARG_PRESET_VERY_FAST_LOCAL: localAlign = true;
@@ -1621,6 +1717,22 @@ static void parseOptions(int argc, const char **argv) {
 		cerr << "Warning: --shmem overrides --mm..." << endl;
 		useMm = false;
 	}
+	if(hugePages != HUGEPAGES_OFF && (useMm || useShmem)) {
+		if(!gQuiet) {
+			cerr << "Warning: " << (useMm ? "--mm" : "--shmem") << " overrides --hugepages..." << endl;
+		}
+		hugePages = HUGEPAGES_OFF;
+	}
+	if(numaReplicate && (useMm || useShmem)) {
+		if(!gQuiet) {
+			cerr << "Warning: " << (useMm ? "--mm" : "--shmem") << " overrides --numa..." << endl;
+		}
+		numaReplicate = false;
+	}
+	if(!shardIdxs.empty() && bowtie2p5) {
+		cerr << "Error: --shard is not supported with --test-25" << endl;
+		throw 1;
+	}
 	if(gGapBarrier < 1) {
 		cerr << "Warning: --gbar was set less than 1 (=" << gGapBarrier
 		     << "); setting to 1 instead" << endl;
@@ -1675,10 +1787,60 @@ static Ebwt*                    multiseed_ebwtFw;
 static Ebwt*                    multiseed_ebwtBw;
 static Scoring*                 multiseed_sc;
 static BitPairReference*        multiseed_refs;
-static AlignmentCache*          multiseed_ca; // seed cache
 static AlnSink*                 multiseed_msink;
 static OutFileBuf*              multiseed_metricsOfb;
 
+/**
+ * With --numa, the index and reference used by the threads bound to one
+ * NUMA node.  Each replica is loaded by a thread already bound to its
+ * node, so first-touch places its pages in that node's memory.  The
+ * replica for the first node is the primary copy.
+ */
+struct NumaReplica {
+	NumaReplica() : ebwtFw(NULL), ebwtBw(NULL), refs(NULL), owned(false), failed(false) { }
+
+	EList<int>        cpus;   // CPUs of the node
+	Ebwt*             ebwtFw;
+	Ebwt*             ebwtBw;
+	BitPairReference* refs;
+	bool              owned;  // false for the primary copy
+	bool              failed; // set if the thread loading it threw
+};
+
+static EList<NumaReplica>       multiseed_numa;
+
+/**
+ * One of the indexes reads are aligned to: the -x index, then any
+ * given with --shard.  Alignments to all of them are reported together,
+ * with reference ids in terms of the concatenation of their lists of
+ * references.
+ */
+struct IndexShard {
+	IndexShard() : ebwtFw(NULL), ebwtBw(NULL), refs(NULL), kmers(NULL), refoff(0) { }
+
+	string            base;   // index basename
+	Ebwt*             ebwtFw;
+	Ebwt*             ebwtBw;
+	BitPairReference* refs;
+	FreqKmerTable*    kmers;  // frequent k-mers for --skip-freq-seeds
+	TRefId            refoff; // id of the shard's first reference
+};
+
+static EList<IndexShard>        multiseed_shards;
+
+/**
+ * Bind the calling worker thread to a NUMA node, round-robin by thread
+ * id, and return that node's replica.  Returns NULL without --numa.
+ */
+static const NumaReplica* numaReplicaForThread(int tid) {
+	if(multiseed_numa.empty()) {
+		return NULL;
+	}
+	const NumaReplica& r = multiseed_numa[tid % multiseed_numa.size()];
+	numaBindThread(r.cpus);
+	return &r;
+}
+
 /**
  * Metrics for measuring the work done by the outer read alignment
  * loop.
@@ -1969,16 +2131,22 @@ struct PerfMetrics {
 				/* 118 */ "DPBtFiltStart"  "\t"
 				/* 119 */ "DPBtFiltScore"  "\t"
 				/* 120 */ "DpBtFiltDom"    "\t"
+				/* 121 */ "ResSACacheHit"  "\t"
+				/* 122 */ "ResSACacheMiss" "\t"
+				/* 123 */ "SeedCacheLookup" "\t"
+				/* 124 */ "SeedCacheInsert" "\t"
+				/* 125 */ "SeedCacheEvict" "\t"
+				/* 126 */ "FreqSeedSkip"   "\t"
 #ifdef USE_MEM_TALLY
-				/* 121 */ "MemPeak"        "\t"
-				/* 122 */ "UncatMemPeak"   "\t" // 0
-				/* 123 */ "EbwtMemPeak"    "\t" // EBWT_CAT
-				/* 124 */ "CacheMemPeak"   "\t" // CA_CAT
-				/* 125 */ "ResolveMemPeak" "\t" // GW_CAT
-				/* 126 */ "AlignMemPeak"   "\t" // AL_CAT
-				/* 127 */ "DPMemPeak"      "\t" // DP_CAT
-				/* 128 */ "MiscMemPeak"    "\t" // MISC_CAT
-				/* 129 */ "DebugMemPeak"   "\t" // DEBUG_CAT
+				/* 127 */ "MemPeak"        "\t"
+				/* 128 */ "UncatMemPeak"   "\t" // 0
+				/* 129 */ "EbwtMemPeak"    "\t" // EBWT_CAT
+				/* 130 */ "CacheMemPeak"   "\t" // CA_CAT
+				/* 131 */ "ResolveMemPeak" "\t" // GW_CAT
+				/* 132 */ "AlignMemPeak"   "\t" // AL_CAT
+				/* 133 */ "DPMemPeak"      "\t" // DP_CAT
+				/* 134 */ "MiscMemPeak"    "\t" // MISC_CAT
+				/* 135 */ "DebugMemPeak"   "\t" // DEBUG_CAT
 #endif
 				"\n";
 			
@@ -2517,41 +2685,65 @@ struct PerfMetrics {
 		itoa10<uint64_t>(total ? nbtfiltdo : nbtfiltdo_u, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+		// 121. Offsets found in the SA offset cache
+		itoa10<uint64_t>(wl.sacHits, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+		// 122. Offsets looked up in the SA offset cache but not found
+		itoa10<uint64_t>(wl.sacMisses, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+		// 123. Seeds looked up in the shared seed cache
+		itoa10<uint64_t>(sd.sharedlookup, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+		// 124. Seeds whose hits were offered to the shared seed cache
+		itoa10<uint64_t>(sd.sharedinsert, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+		// 125. Shared seed cache entries replaced to make room
+		itoa10<uint64_t>(sd.sharedevict, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
+		// 126. Seeds not searched because they occur too often
+		itoa10<uint64_t>(sd.freqskip, buf);
+		if(metricsStderr) stderrSs << buf << '\t';
+		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
 		
 #ifdef USE_MEM_TALLY
-		// 121. Overall memory peak
+		// 127. Overall memory peak
 		itoa10<size_t>(gMemTally.peak() >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 122. Uncategorized memory peak
+		// 128. Uncategorized memory peak
 		itoa10<size_t>(gMemTally.peak(0) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 123. Ebwt memory peak
+		// 129. Ebwt memory peak
 		itoa10<size_t>(gMemTally.peak(EBWT_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 124. Cache memory peak
+		// 130. Cache memory peak
 		itoa10<size_t>(gMemTally.peak(CA_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 125. Resolver memory peak
+		// 131. Resolver memory peak
 		itoa10<size_t>(gMemTally.peak(GW_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 126. Seed aligner memory peak
+		// 132. Seed aligner memory peak
 		itoa10<size_t>(gMemTally.peak(AL_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 127. Dynamic programming aligner memory peak
+		// 133. Dynamic programming aligner memory peak
 		itoa10<size_t>(gMemTally.peak(DP_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 128. Miscellaneous memory peak
+		// 134. Miscellaneous memory peak
 		itoa10<size_t>(gMemTally.peak(MISC_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf << '\t';
 		if(o != NULL) { o->writeChars(buf); o->write('\t'); }
-		// 129. Debug memory peak
+		// 135. Debug memory peak
 		itoa10<size_t>(gMemTally.peak(DEBUG_CAT) >> 20, buf);
 		if(metricsStderr) stderrSs << buf;
 		if(o != NULL) { o->writeChars(buf); }
@@ -2877,10 +3069,8 @@ static void multiseedSearchWorker(void *vp) {
 	assert(multiseedMms == 0 || multiseed_ebwtBw != NULL);
 	PatternComposer&        patsrc   = *multiseed_patsrc;
 	PatternParams           pp       = multiseed_pp;
-	const Ebwt&             ebwtFw   = *multiseed_ebwtFw;
-	const Ebwt&             ebwtBw   = *multiseed_ebwtBw;
+	const NumaReplica*      numa     = numaReplicaForThread(tid);
 	const Scoring&          sc       = *multiseed_sc;
-	const BitPairReference& ref      = *multiseed_refs;
 	AlnSink&                msink    = *multiseed_msink;
 	OutFileBuf*             metricsOfb = multiseed_metricsOfb;
 
@@ -2908,19 +3098,19 @@ static void multiseedSearchWorker(void *vp) {
 		auto_ptr<PatternSourcePerThreadFactory> patsrcFact(createPatsrcFactory(patsrc, pp, tid));
 		auto_ptr<PatternSourcePerThread> ps(patsrcFact->create());
 		
-		// Thread-local cache for seed alignments
-		PtrWrap<AlignmentCache> scLocal;
-		if(!msNoCache) {
-			scLocal.init(new AlignmentCache(seedCacheLocalMB * 1024 * 1024, false));
-		}
-		AlignmentCache scCurrent(seedCacheCurrentMB * 1024 * 1024, false);
 		// Thread-local cache for current seed alignments
+		AlignmentCache scCurrent(seedCacheCurrentMB * 1024 * 1024, false);
 		
-		// Interfaces for alignment and seed caches
-		AlignmentCacheIface ca(
-			&scCurrent,
-			scLocal.get(),
-			msNoCache ? NULL : multiseed_ca);
+		// Interfaces for alignment and seed caches.  Seed hits are SA
+		// ranges in one particular index, so only the first shard uses
+		// the cache shared by all threads.
+		EList<AlignmentCacheIface*> cas;
+		for(size_t i = 0; i < multiseed_shards.size(); i++) {
+			cas.push_back(new AlignmentCacheIface(
+				&scCurrent,
+				NULL,
+				(i == 0 && seedCache.enabled()) ? &seedCache : NULL));
+		}
 		
 		// Instantiate an object for holding reporting-related parameters.
 		ReportingParams rp(
@@ -3019,6 +3209,11 @@ static void multiseedSearchWorker(void *vp) {
 		bool lenfilt[2] = { true, true };
 		// Keep track of whether mates 1/2 were filtered out by upstream qc
 		bool qcfilt[2]  = { true, true };
+		// Alignments of the current read, kept for or taken from dupCache
+		AlnReplay dupRp;
+		// Cost of reads not yet handed in to the effort controller
+		EffortTally effTally;
+		struct timeval effBeg;
 
 		rndArb.init((uint32_t)time(0));
 		int mergei = 0;
@@ -3073,6 +3268,9 @@ static void multiseedSearchWorker(void *vp) {
 				if(sam_print_xt) {
 					gettimeofday(&prm.tv_beg, &prm.tz_beg);
 				}
+				if(effort.timed()) {
+					gettimeofday(&effBeg, NULL);
+				}
 #ifdef PER_THREAD_TIMING
 				int cpu = 0, node = 0;
 				get_cpu_and_node(cpu, node);
@@ -3088,9 +3286,9 @@ static void multiseedSearchWorker(void *vp) {
 				// Try to align this read
 				while(retry) {
 					retry = false;
-					ca.nextRead(); // clear the cache
+					cas[0]->nextRead(); // clear the cache
 					olm.reads++;
-					assert(!ca.aligning());
+					assert(!cas[0]->aligning());
 					bool paired = !ps->read_b().empty();
 					const size_t rdlen1 = ps->read_a().length();
 					const size_t rdlen2 = paired ? ps->read_b().length() : 0;
@@ -3206,6 +3404,9 @@ static void multiseedSearchWorker(void *vp) {
 					} else {
 						rnd.init(ps->read_a().seed);
 					}
+					// Limits on effort, as adapted to --effort-budget
+					EffortLimits eff;
+					int effLevel = effort.limits(eff);
 					// Calculate interval length for both mates
 					int interval[2] = { 0, 0 };
 					for(size_t mate = 0; mate < (paired ? 2:1); mate++) {
@@ -3214,14 +3415,17 @@ static void multiseedSearchWorker(void *vp) {
 							// Boost interval length by 20% for paired-end reads
 							interval[mate] = (int)(interval[mate] * 1.2 + 0.5);
 						}
+						if(eff.ivalMult != 1.0) {
+							interval[mate] = (int)(interval[mate] * eff.ivalMult + 0.5);
+						}
 						interval[mate] = max(interval[mate], 1);
 					}
 					// Calculate streak length
-					size_t streak[2]    = { maxDpStreak,   maxDpStreak };
-					size_t mtStreak[2]  = { maxMateStreak, maxMateStreak };
-					size_t mxDp[2]      = { maxDp,         maxDp       };
-					size_t mxUg[2]      = { maxUg,         maxUg       };
-					size_t mxIter[2]    = { maxIters,      maxIters    };
+					size_t streak[2]    = { eff.maxDpStreak,   eff.maxDpStreak };
+					size_t mtStreak[2]  = { eff.maxMateStreak, eff.maxMateStreak };
+					size_t mxDp[2]      = { eff.maxDp,         eff.maxDp       };
+					size_t mxUg[2]      = { eff.maxUg,         eff.maxUg       };
+					size_t mxIter[2]    = { eff.maxIters,      eff.maxIters    };
 					if(allHits) {
 						streak[0]   = streak[1]   = std::numeric_limits<size_t>::max();
 						mtStreak[0] = mtStreak[1] = std::numeric_limits<size_t>::max();
@@ -3244,7 +3448,7 @@ static void multiseedSearchWorker(void *vp) {
 					}
 					assert_gt(streak[0], 0);
 					// Calculate # seed rounds for each mate
-					size_t nrounds[2] = { nSeedRounds, nSeedRounds };
+					size_t nrounds[2] = { eff.nSeedRounds, eff.nSeedRounds };
 					if(filt[0] && filt[1]) {
 						nrounds[0] = (size_t)ceil((double)nrounds[0] / 2.0);
 						nrounds[1] = (size_t)ceil((double)nrounds[1] / 2.0);
@@ -3265,11 +3469,67 @@ static void multiseedSearchWorker(void *vp) {
 							olm.ubases += rdlens[mate]; // bases passing filter
 						}
 					}
-					size_t eePeEeltLimit = std::numeric_limits<size_t>::max();
-					// Whether we're done with mate1 / mate2
-					bool done[2] = { !filt[0], !filt[1] };
-					size_t nelt[2] = {0, 0};
-										
+					size_t seedsTried = 0;
+					size_t seedsTriedMS[] = {0, 0, 0, 0};
+					size_t seedRounds = 0; // rounds in which seeds were searched
+					size_t nUniqueSeeds = 0, nRepeatSeeds = 0, seedHitTot = 0;
+					size_t nUniqueSeedsMS[] = {0, 0, 0, 0};
+					size_t nRepeatSeedsMS[] = {0, 0, 0, 0};
+					size_t seedHitTotMS[] = {0, 0, 0, 0};
+					// An exact duplicate of a read or pair aligned recently
+					// gets that one's alignments without being aligned
+					bool replayed = false;
+					int dupFilt = 0;
+					if(dupCache.enabled()) {
+						for(size_t mate = 0; mate < 2; mate++) {
+							dupFilt = (dupFilt << 4) |
+								(nfilt[mate] ? 1 : 0) | (scfilt[mate] ? 2 : 0) |
+								(lenfilt[mate] ? 4 : 0) | (qcfilt[mate] ? 8 : 0);
+						}
+						replayed = dupCache.lookup(
+							rds[0], paired ? rds[1] : NULL, dupFilt, dupRp);
+						if(replayed) {
+							msinkwrap.replay(dupRp);
+							exhaustive[0] = dupRp.exhaust1;
+							exhaustive[1] = dupRp.exhaust2;
+							olm.srreads++;
+							olm.srbases += (rdlen1 + rdlen2);
+						}
+					}
+					// Align to each shard in turn.  They all report to
+					// msinkwrap, so -k, -M and MAPQ take the alignments to
+					// all of them into account.
+					for(size_t shardi = 0; !replayed && shardi < multiseed_shards.size(); shardi++) {
+						const IndexShard& shard = multiseed_shards[shardi];
+						// Use this thread's NUMA replica of the first shard
+						bool useNuma = (shardi == 0 && numa != NULL);
+						const Ebwt&             ebwtFw = useNuma ? *numa->ebwtFw : *shard.ebwtFw;
+						const Ebwt&             ebwtBw = useNuma ? *numa->ebwtBw : *shard.ebwtBw;
+						const BitPairReference& ref    = useNuma ? *numa->refs   : *shard.refs;
+						AlignmentCacheIface&    ca     = *cas[shardi];
+						msinkwrap.setRefOffset(shard.refoff);
+						if(shardi > 0) {
+							if(msinkwrap.state().done()) {
+								break;
+							}
+							// Start over on this shard, with whatever is
+							// left of the read's effort limits
+							ca.nextRead();
+							sd.nextRead(paired, rdrows[0], rdrows[1]);
+							for(size_t mate = 0; mate < (paired ? 2:1); mate++) {
+								minedfw[mate] = minedrc[mate] = 0;
+								if(filt[mate]) {
+									shs[mate].clear();
+									shs[mate].nextRead(*rds[mate]);
+								}
+							}
+							matemap[0] = 0; matemap[1] = 1;
+						}
+						size_t eePeEeltLimit = std::numeric_limits<size_t>::max();
+						// Whether we're done with mate1 / mate2
+						bool done[2] = { !filt[0], !filt[1] };
+						size_t nelt[2] = {0, 0};
+
 						// Find end-to-end exact alignments for each read
 						if(doExactUpFront) {
 							for(size_t matei = 0; matei < (paired ? 2:1); matei++) {
@@ -3635,13 +3895,10 @@ static void multiseedSearchWorker(void *vp) {
 						nrounds[0] = min<size_t>(nrounds[0], interval[0]);
 						nrounds[1] = min<size_t>(nrounds[1], interval[1]);
 						Constraint gc = Constraint::penaltyFuncBased(scoreMin);
-						size_t seedsTried = 0;
-					size_t seedsTriedMS[] = {0, 0, 0, 0};
-						size_t nUniqueSeeds = 0, nRepeatSeeds = 0, seedHitTot = 0;
-					size_t nUniqueSeedsMS[] = {0, 0, 0, 0};
-					size_t nRepeatSeedsMS[] = {0, 0, 0, 0};
-					size_t seedHitTotMS[] = {0, 0, 0, 0};
-						for(size_t roundi = 0; roundi < nSeedRounds; roundi++) {
+						// --effort-budget can make nrounds[] exceed -R
+						size_t maxRounds = max<size_t>(nrounds[0], nrounds[1]);
+						for(size_t roundi = 0; roundi < maxRounds; roundi++) {
+							bool seeded = false;
 							ca.nextRead(); // Clear cache in preparation for new search
 							shs[0].clearSeeds();
 							shs[1].clearSeeds();
@@ -3712,6 +3969,7 @@ static void multiseedSearchWorker(void *vp) {
 									break;
 								}
 								seedsTried += (inst.first + inst.second);
+								seeded = true;
 							seedsTriedMS[mate * 2 + 0] = instFw.first + instFw.second;
 							seedsTriedMS[mate * 2 + 1] = instRc.first + instRc.second;
 								// Align seeds
@@ -3724,7 +3982,10 @@ static void multiseedSearchWorker(void *vp) {
 									ca,               // alignment cache
 									shs[mate],        // store seed hits here
 									sdm,              // metrics
-									prm);             // per-read metrics
+									prm,              // per-read metrics
+									seedInterleave,   // interleave exact seeds
+									shard.kmers,      // frequent k-mers
+									freqSeedCap);     // skip seeds this frequent
 								assert(shs[mate].repOk(&ca.current()));
 								if(shs[mate].empty()) {
 									// No seed alignments!  Done with this mate.
@@ -3732,6 +3993,9 @@ static void multiseedSearchWorker(void *vp) {
 									break;
 								}
 							}
+							if(seeded) {
+								seedRounds++;
+							}
 							// shs contain what we need to know to update our seed
 							// summaries for this seeding
 							for(size_t mate = 0; mate < 2; mate++) {
@@ -3908,6 +4172,7 @@ static void multiseedSearchWorker(void *vp) {
 								}
 							}
 						} // end loop over reseeding rounds
+					} // for(size_t shardi = 0; shardi < multiseed_shards.size(); shardi++)
 					if(seedsTried > 0) {
 							prm.seedPctUnique = (float)nUniqueSeeds / seedsTried;
 							prm.seedPctRep = (float)nRepeatSeeds / seedsTried;
@@ -3952,6 +4217,29 @@ static void multiseedSearchWorker(void *vp) {
 							assert_leq(prm.nUgFail,  streak[i]);
 							assert_leq(prm.nEeFail,  streak[i]);
 						}
+					if(dupCache.enabled() && !replayed) {
+						msinkwrap.snapshot(dupRp);
+						dupRp.exhaust1 = exhaustive[0];
+						dupRp.exhaust2 = exhaustive[1];
+						dupCache.insert(
+							rds[0], paired ? rds[1] : NULL, dupFilt, dupRp);
+					}
+					if(effort.enabled() && !replayed) {
+						uint64_t usecs = 0;
+						if(effort.timed()) {
+							struct timeval tv_end;
+							gettimeofday(&tv_end, NULL);
+							usecs = (uint64_t)(tv_end.tv_sec - effBeg.tv_sec) * 1000000 +
+							        (tv_end.tv_usec - effBeg.tv_usec);
+						}
+						effort.addRead(
+							effTally,
+							effLevel,
+							prm.nExDps + prm.nMateDps + prm.nExUgs + prm.nMateUgs + prm.nExEes,
+							usecs,
+							seedRounds,
+							!msinkwrap.empty());
+					}
 
 				// Commit and report paired-end/unpaired alignments
 				//uint32_t sd = rds[0]->seed ^ rds[1]->seed;
@@ -3994,9 +4282,13 @@ static void multiseedSearchWorker(void *vp) {
 	
 	// One last metrics merge
 	MERGE_METRICS(metrics);
+	effort.flush(effTally);
 	
 	if(dpLog    != NULL) dpLog->close();
 	if(dpLogOpp != NULL) dpLogOpp->close();
+	for(size_t i = 0; i < cas.size(); i++) {
+		delete cas[i];
+	}
 
 #ifdef PER_THREAD_TIMING
 		ss.str("");
@@ -4027,10 +4319,11 @@ static void multiseedSearchWorker_2p5(void *vp) {
 	assert(multiseedMms == 0 || multiseed_ebwtBw != NULL);
 	PatternComposer&        patsrc   = *multiseed_patsrc;
 	PatternParams           pp       = multiseed_pp;
-	const Ebwt&             ebwtFw   = *multiseed_ebwtFw;
-	const Ebwt&             ebwtBw   = *multiseed_ebwtBw;
+	const NumaReplica*      numa     = numaReplicaForThread(tid);
+	const Ebwt&             ebwtFw   = numa != NULL ? *numa->ebwtFw : *multiseed_ebwtFw;
+	const Ebwt&             ebwtBw   = numa != NULL ? *numa->ebwtBw : *multiseed_ebwtBw;
 	const Scoring&          sc       = *multiseed_sc;
-	const BitPairReference& ref      = *multiseed_refs;
+	const BitPairReference& ref      = numa != NULL ? *numa->refs   : *multiseed_refs;
 	AlnSink&                msink    = *multiseed_msink;
 	OutFileBuf*             metricsOfb = multiseed_metricsOfb;
 
@@ -4531,6 +4824,502 @@ static void thread_monitor(int pid, int orig_threads, EList<int>& tids, EList<T*
 	}
 }
 #endif
+
+/**
+ * Print how much of an index's big arrays the kernel actually put on
+ * huge pages.  Explicit hugetlbfs pages may run out and transparent
+ * huge pages are best-effort, so --hugepages alone is no guarantee.
+ */
+static void reportHugePages(const char *name, const Ebwt& ebwt) {
+	uint64_t elig = ebwt.hugePageEligibleBytes();
+	uint64_t res = ebwt.hugePageResidentBytes();
+	cerr << "Huge pages backing " << name << " index: " << res << " of "
+	     << elig << " bytes";
+	if(elig > 0) {
+		cerr << " (" << (res * 100 / elig) << "%)";
+	}
+	cerr << endl;
+}
+
+/**
+ * Load one NUMA replica of the reference and index.  Binds the calling
+ * thread to the replica's node first so that the pages it touches are
+ * allocated there.
+ */
+static void numaLoadReplica(NumaReplica& r) {
+	numaBindThread(r.cpus);
+	r.refs = new BitPairReference(
+		adjIdxBase,
+		false,
+		sanityCheck,
+		NULL,
+		NULL,
+		false,
+		useMm,
+		useShmem,
+		mmSweep,
+		gVerbose,
+		startVerbose);
+	r.ebwtFw = new Ebwt(
+		adjIdxBase,
+		0,        // index is colorspace
+		-1,       // fw index
+		true,     // index is for the forward direction
+		/* overriding: */ offRate,
+		0, // amount to add to index offrate or <= 0 to do nothing
+		useMm,    // whether to use memory-mapped files
+		useShmem, // whether to use shared memory
+		mmSweep,  // sweep memory-mapped files
+		!noRefNames, // load names?
+		true,        // load SA sample?
+		true,        // load ftab?
+		true,        // load rstarts?
+		gVerbose, // whether to be talkative
+		startVerbose, // talkative during initialization
+		false /*passMemExc*/,
+		sanityCheck);
+	r.ebwtFw->setHugePages(hugePages);
+	r.ebwtFw->setPackedOffs(packedSa);
+	r.ebwtFw->loadIntoMemory(0, -1, true, true, true, !noRefNames, startVerbose);
+	if(multiseedMms > 0 || do1mmUpFront) {
+		r.ebwtBw = new Ebwt(
+			adjIdxBase + ".rev",
+			0,       // index is colorspace
+			1,       // TODO: maybe not
+			false, // index is for the reverse direction
+			/* overriding: */ offRate,
+			0, // amount to add to index offrate or <= 0 to do nothing
+			useMm,    // whether to use memory-mapped files
+			useShmem, // whether to use shared memory
+			mmSweep,  // sweep memory-mapped files
+			!noRefNames, // load names?
+			true,        // load SA sample?
+			true,        // load ftab?
+			true,        // load rstarts?
+			gVerbose,    // whether to be talkative
+			startVerbose, // talkative during initialization
+			false /*passMemExc*/,
+			sanityCheck);
+		r.ebwtBw->setHugePages(hugePages);
+		r.ebwtBw->loadIntoMemory(0, 1, false, true, false, !noRefNames, startVerbose);
+	}
+	if(!r.refs->loaded()) throw 1;
+}
+
+/**
+ * Thread body for numaLoadReplica().  Anything thrown is noted for the
+ * main thread, which reports the failure once all loaders are done.
+ * Index and reference errors have already been printed by then; other
+ * exceptions (e.g. running out of memory on the node) are printed here.
+ */
+static void numaLoadReplicaWorker(void *vp) {
+	NumaReplica& r = *(NumaReplica*)vp;
+	try {
+		numaLoadReplica(r);
+	} catch(std::exception& e) {
+		cerr << "Error: Encountered exception: '" << e.what()
+		     << "' while replicating the index on a NUMA node" << endl;
+		r.failed = true;
+	} catch(...) {
+		r.failed = true;
+	}
+}
+
+/**
+ * Free the NUMA replicas made by numaLoadReplicas().
+ */
+static void numaFreeReplicas() {
+	for(size_t i = 0; i < multiseed_numa.size(); i++) {
+		if(multiseed_numa[i].owned) {
+			delete multiseed_numa[i].ebwtFw;
+			delete multiseed_numa[i].ebwtBw;
+			delete multiseed_numa[i].refs;
+		}
+	}
+	multiseed_numa.clear();
+}
+
+/**
+ * Load a replica of the reference and index for every NUMA node but
+ * the first, in parallel, and point the first node's entry at the
+ * primary copies.  'nodes' lists the CPUs of each node.
+ */
+static void numaLoadReplicas(
+	EList<EList<int> >& nodes,
+	Ebwt& ebwtFw,
+	Ebwt& ebwtBw,
+	BitPairReference& refs)
+{
+	multiseed_numa.resize(nodes.size());
+	for(size_t i = 0; i < nodes.size(); i++) {
+		multiseed_numa[i].cpus = nodes[i];
+	}
+	multiseed_numa[0].ebwtFw = &ebwtFw;
+	multiseed_numa[0].ebwtBw = &ebwtBw;
+	multiseed_numa[0].refs = &refs;
+#ifdef WITH_TBB
+	EList<std::thread*> loaders;
+#else
+	EList<tthread::thread*> loaders;
+#endif
+	for(size_t i = 1; i < nodes.size(); i++) {
+		multiseed_numa[i].owned = true;
+#ifdef WITH_TBB
+		loaders.push_back(new std::thread(numaLoadReplicaWorker, (void*)&multiseed_numa[i]));
+#else
+		loaders.push_back(new tthread::thread(numaLoadReplicaWorker, (void*)&multiseed_numa[i]));
+#endif
+	}
+	for(size_t i = 0; i < loaders.size(); i++) {
+		loaders[i]->join();
+		delete loaders[i];
+	}
+	for(size_t i = 1; i < nodes.size(); i++) {
+		if(multiseed_numa[i].failed) {
+			numaFreeReplicas();
+			throw 1;
+		}
+	}
+	if(gVerbose || startVerbose) {
+		cerr << "Replicated index on " << nodes.size() << " NUMA nodes: ";
+		logTime(cerr, true);
+	}
+}
+
+/// Parts of the reference and index that can be loaded concurrently
+enum {
+	INDEX_LOAD_REF = 1,
+	INDEX_LOAD_FW,
+	INDEX_LOAD_MIRROR
+};
+
+/**
+ * One part of the reference and index for loadIndexPart() to load.
+ */
+struct IndexLoadTask {
+	int                what;   // INDEX_LOAD_*
+	const string      *base;   // index basename, for INDEX_LOAD_REF
+	Ebwt              *ebwt;   // for INDEX_LOAD_FW and _MIRROR
+	BitPairReference  *refs;   // set by INDEX_LOAD_REF
+	bool               timing; // print time taken
+	bool               failed; // set if a thread's load threw
+};
+
+/**
+ * Load one part of the reference and index, timing it.
+ */
+static void loadIndexPart(IndexLoadTask& t) {
+	if(t.what == INDEX_LOAD_REF) {
+		Timer _t(cerr, "Time loading reference: ", t.timing);
+		t.refs = new BitPairReference(
+			*t.base,
+			false,
+			sanityCheck,
+			NULL,
+			NULL,
+			false,
+			useMm,
+			useShmem,
+			mmSweep,
+			gVerbose,
+			startVerbose);
+	} else if(t.what == INDEX_LOAD_FW) {
+		assert(!t.ebwt->isInMemory());
+		Timer _t(cerr, "Time loading forward index: ", t.timing);
+		t.ebwt->loadIntoMemory(
+			0,  // colorspace?
+			-1, // not the reverse index
+			true,         // load SA samp? (yes, need forward index's SA samp)
+			true,         // load ftab (in forward index)
+			true,         // load rstarts (in forward index)
+			!noRefNames,  // load names?
+			startVerbose);
+	} else {
+		assert_eq(INDEX_LOAD_MIRROR, t.what);
+		assert(!t.ebwt->isInMemory());
+		Timer _t(cerr, "Time loading mirror index: ", t.timing);
+		t.ebwt->loadIntoMemory(
+			0, // colorspace?
+			// It's bidirectional search, so we need the reverse to be
+			// constructed as the reverse of the concatenated strings.
+			1,
+			false,        // don't load SA samp in reverse index
+			true,         // yes, need ftab in reverse index
+			false,        // don't load rstarts in reverse index
+			!noRefNames,  // load names?
+			startVerbose);
+	}
+}
+
+/**
+ * Thread body for loadIndexPart().  Errors thrown as ints have already
+ * been reported; report others, like bad_alloc, then note the failure
+ * for the main thread.
+ */
+static void loadIndexPartWorker(void *vp) {
+	IndexLoadTask& t = *(IndexLoadTask*)vp;
+	try {
+		loadIndexPart(t);
+	} catch(std::exception& e) {
+		const char *part =
+			(t.what == INDEX_LOAD_REF) ? "the reference" :
+			(t.what == INDEX_LOAD_FW)  ? "the index" : "the mirror index";
+		cerr << "Error: Encountered exception: '" << e.what()
+		     << "' while loading " << part << endl;
+		t.failed = true;
+	} catch(...) {
+		t.failed = true;
+	}
+}
+
+/**
+ * Load the reference, forward index and (if needed) mirror index with
+ * basename 'base'.  With more than one search thread, the parts are
+ * loaded concurrently, and the big index arrays are split into chunks
+ * read in parallel, using the threads that are otherwise idle until the
+ * search starts.
+ */
+static BitPairReference* loadIndex(const string& base, Ebwt& ebwtFw, Ebwt& ebwtBw, bool loadMirror) {
+	bool loadTiming = timing || gVerbose || startVerbose;
+	EList<IndexLoadTask> tasks;
+	tasks.resize(loadMirror ? 3 : 2);
+	for(size_t i = 0; i < tasks.size(); i++) {
+		tasks[i].what = INDEX_LOAD_REF + (int)i;
+		tasks[i].base = &base;
+		tasks[i].ebwt = NULL;
+		tasks[i].refs = NULL;
+		tasks[i].timing = loadTiming;
+		tasks[i].failed = false;
+	}
+	tasks[1].ebwt = &ebwtFw;
+	if(loadMirror) {
+		tasks[2].ebwt = &ebwtBw;
+	}
+	if(nthreads <= 1) {
+		for(size_t i = 0; i < tasks.size(); i++) {
+			loadIndexPart(tasks[i]);
+		}
+		return tasks[0].refs;
+	}
+	// Split the threads between the indexes being read; the reference
+	// is read by a single stream
+	int perIndex = max<int>(1, nthreads / (loadMirror ? 2 : 1));
+	ebwtFw.setLoadThreads(perIndex);
+	if(loadMirror) {
+		ebwtBw.setLoadThreads(perIndex);
+	}
+	Timer _t(cerr, "Time loading reference and index in parallel: ", loadTiming);
+#ifdef WITH_TBB
+	EList<std::thread*> loaders;
+#else
+	EList<tthread::thread*> loaders;
+#endif
+	for(size_t i = 0; i < tasks.size(); i++) {
+#ifdef WITH_TBB
+		loaders.push_back(new std::thread(loadIndexPartWorker, (void*)&tasks[i]));
+#else
+		loaders.push_back(new tthread::thread(loadIndexPartWorker, (void*)&tasks[i]));
+#endif
+	}
+	for(size_t i = 0; i < loaders.size(); i++) {
+		loaders[i]->join();
+		delete loaders[i];
+	}
+	for(size_t i = 0; i < tasks.size(); i++) {
+		if(tasks[i].failed) {
+			delete tasks[0].refs;
+			throw 1;
+		}
+	}
+	return tasks[0].refs;
+}
+
+/**
+ * One contiguous piece of a memory-mapped index for the warm-up thread
+ * to page in.
+ */
+struct WarmupRegion {
+	const char *name;
+	const char *p;
+	uint64_t    len;
+};
+
+static EList<WarmupRegion> warmupRegions;
+static volatile bool warmupStop;
+
+/**
+ * Thread body that pages in each of warmupRegions in turn, at idle CPU
+ * and I/O priority so that it only uses what the search threads leave.
+ * It asks for readahead with madvise(MADV_WILLNEED) a chunk at a time
+ * and then touches every page so the mappings are in our page tables,
+ * logging progress as it goes.  Stops early if warmupStop is set.
+ */
+static void indexWarmupWorker(void *) {
+#ifdef __linux__
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	setpriority(PRIO_PROCESS, tid, 19);
+#ifdef SYS_ioprio_set
+	syscall(SYS_ioprio_set, 1 /* IOPRIO_WHO_PROCESS */, tid, 3 << 13 /* IOPRIO_CLASS_IDLE */);
+#endif
+#endif
+	const uint64_t chunk = 16 * 1024 * 1024;
+	const size_t pageSz = (size_t)sysconf(_SC_PAGESIZE);
+	uint64_t tot = 0, done = 0;
+	for(size_t i = 0; i < warmupRegions.size(); i++) {
+		tot += warmupRegions[i].len;
+	}
+	int lastPct = 0;
+	volatile char sum = 0;
+	time_t start = time(0);
+	for(size_t i = 0; i < warmupRegions.size() && !warmupStop; i++) {
+		const WarmupRegion& r = warmupRegions[i];
+		for(uint64_t off = 0; off < r.len && !warmupStop; off += chunk) {
+			uint64_t len = min<uint64_t>(chunk, r.len - off);
+			const char *p = r.p + off;
+			const char *pg = (const char*)((size_t)p & ~(pageSz - 1));
+			madvise((void*)pg, (size_t)(len + (p - pg)), MADV_WILLNEED);
+			for(uint64_t j = 0; j < len; j += pageSz) {
+				sum += p[j];
+			}
+			done += len;
+			int pct = (int)(done * 100 / tot);
+			if(!gQuiet && pct / 10 > lastPct / 10 && pct < 100) {
+				cerr << "Warm-up: " << pct << "% of " << (tot >> 20) << " MB paged in" << endl;
+			}
+			lastPct = pct;
+		}
+		if(!gQuiet && !warmupStop && (gVerbose || startVerbose)) {
+			cerr << "Warm-up: paged in " << r.name << " (" << (r.len >> 20) << " MB): ";
+			logTime(cerr, true);
+		}
+	}
+	if(!gQuiet) {
+		cerr << "Warm-up: " << (warmupStop ? "stopped after " : "finished ")
+		     << (done >> 20) << " of " << (tot >> 20) << " MB in "
+		     << (time(0) - start) << " s" << endl;
+	}
+	(void)sum;
+}
+
+/**
+ * Queue an Ebwt array for warm-up.
+ */
+static void addWarmupRegion(const char *name, const void *p, uint64_t len) {
+	if(p != NULL && len > 0) {
+		warmupRegions.expand();
+		warmupRegions.back().name = name;
+		warmupRegions.back().p = (const char*)p;
+		warmupRegions.back().len = len;
+	}
+}
+
+/**
+ * Collect the memory-mapped parts of the index in the order the search
+ * touches them most (ftab/eftab, which every seed search starts from,
+ * then the BWTs, then the SA sample and finally the reference) and
+ * return true iff there's anything to warm up.
+ */
+static bool setupWarmup(const Ebwt& ebwtFw, const Ebwt* ebwtBw, const BitPairReference& refs) {
+	warmupRegions.clear();
+	warmupStop = false;
+	const Ebwt* ebwts[] = { &ebwtFw, ebwtBw };
+	const char *ftabNames[] = { "forward ftab", "mirror ftab" };
+	const char *ebwtNames[] = { "forward BWT", "mirror BWT" };
+	for(int i = 0; i < 2; i++) {
+		if(ebwts[i] == NULL || !ebwts[i]->isMapped()) continue;
+		const EbwtParams& eh = ebwts[i]->eh();
+		addWarmupRegion(ftabNames[i], ebwts[i]->ftab(), eh._ftabSz);
+		addWarmupRegion(ftabNames[i], ebwts[i]->eftab(), eh._eftabSz);
+	}
+	for(int i = 0; i < 2; i++) {
+		if(ebwts[i] == NULL || !ebwts[i]->isMapped()) continue;
+		addWarmupRegion(ebwtNames[i], ebwts[i]->ebwt(), ebwts[i]->eh()._ebwtTotLen);
+	}
+	if(ebwtFw.isMapped()) {
+		addWarmupRegion("SA sample", ebwtFw.offs(), ebwtFw.eh()._offsSz);
+	}
+	if(refs.mapped()) {
+		addWarmupRegion("reference", refs.buf(), refs.bufBytes());
+	}
+	return !warmupRegions.empty();
+}
+
+/**
+ * Owns the warm-up thread, if any, and stops and joins it when it goes
+ * out of scope, so that the thread neither outlives the index it reads
+ * nor is left joinable if the search throws.
+ */
+struct WarmupGuard {
+#ifdef WITH_TBB
+	typedef std::thread Thread;
+#else
+	typedef tthread::thread Thread;
+#endif
+
+	WarmupGuard() : thread(NULL) { }
+	~WarmupGuard() { stop(); }
+
+	void stop() {
+		if(thread != NULL) {
+			warmupStop = true;
+			thread->join();
+			delete thread;
+			thread = NULL;
+		}
+	}
+
+	Thread *thread;
+};
+
+/// Mix 'v' into fingerprint 'h'
+static inline uint64_t fingerprintAdd(uint64_t h, uint64_t v) {
+	return (h ^ v) * 0x100000001b3ull;
+}
+
+/**
+ * Fingerprint the index that seed hits are found in, so that a seed
+ * cache file is only used with the index it was written for.  Covers
+ * the text lengths and the parts of the BWT every search starts from.
+ */
+static uint64_t indexFingerprint(const Ebwt& fw, const Ebwt& bw) {
+	uint64_t h = 0xcbf29ce484222325ull;
+	for(int e = 0; e < 2; e++) {
+		const Ebwt& ebwt = (e == 0 ? fw : bw);
+		if(!ebwt.isInMemory()) {
+			continue;
+		}
+		h = fingerprintAdd(h, ebwt.eh().len());
+		h = fingerprintAdd(h, ebwt.zOff());
+		h = fingerprintAdd(h, ebwt.nPat());
+		for(TIndexOffU i = 0; i < ebwt.nPat(); i++) {
+			h = fingerprintAdd(h, ebwt.plen()[i]);
+		}
+		for(int i = 0; i < 5; i++) {
+			h = fingerprintAdd(h, ebwt.fchr()[i]);
+		}
+		for(TIndexOffU i = 0; i < ebwt.eh().ftabLen(); i++) {
+			h = fingerprintAdd(h, ebwt.ftab()[i]);
+		}
+	}
+	return h;
+}
+
+/**
+ * The seed search settings a seed's hits depend on, other than the
+ * seed's length, which is part of its key.
+ */
+static uint64_t seedCacheParams() {
+	return (uint64_t)multiseedMms;
+}
+
+/// Print 'num' as a percentage of 'denom', as the alignment summary does
+static ostream& printPct(ostream& os, uint64_t num, uint64_t denom) {
+	double pct = 0.0;
+	if(denom != 0) { pct = 100.0 * (double)num / (double)denom; }
+	os << fixed << setprecision(2) << pct << '%';
+	return os;
+}
+
 /**
  * Called once per alignment job.  Sets up global pointers to the
  * shared global data structures, creates per-thread structures, then
@@ -4552,24 +5341,63 @@ static void multiseedSearch(
 	multiseed_ebwtBw = &ebwtBw;
 	multiseed_sc     = &sc;
 	multiseed_metricsOfb      = metricsOfb;
-	Timer *_t = new Timer(cerr, "Time loading reference: ", timing);
+	EList<EList<int> > numaNodes;
+	EList<int> mainCpus; // where this thread ran before being bound
+	if(numaReplicate && nthreads > 1 && numaNodeCpus(numaNodes) && numaNodes.size() > 1) {
+		// Load the primary copy from the first node so that it lands
+		// in that node's memory
+		if(numaThreadCpus(mainCpus)) {
+			numaBindThread(numaNodes[0]);
+		} else {
+			numaNodes.clear();
+		}
+	} else {
+		numaNodes.clear();
+	}
 	auto_ptr<BitPairReference> refs(
-		new BitPairReference(
-			adjIdxBase,
-			false,
-			sanityCheck,
-			NULL,
-			NULL,
-			false,
-			useMm,
-			useShmem,
-			mmSweep,
-			gVerbose,
-			startVerbose)
-	);
-	delete _t;
+		loadIndex(adjIdxBase, ebwtFw, ebwtBw, multiseedMms > 0 || do1mmUpFront));
+	if(!mainCpus.empty()) {
+		// Let the main thread, and the threads it starts before they
+		// bind themselves, run anywhere again
+		numaBindThread(mainCpus);
+	}
 	if(!refs->loaded()) throw 1;
 	multiseed_refs = refs.get();
+	assert(!multiseed_shards.empty());
+	multiseed_shards[0].ebwtFw = &ebwtFw;
+	multiseed_shards[0].ebwtBw = &ebwtBw;
+	multiseed_shards[0].refs = refs.get();
+	for(size_t i = 1; i < multiseed_shards.size(); i++) {
+		IndexShard& sh = multiseed_shards[i];
+		sh.refs = loadIndex(sh.base, *sh.ebwtFw, *sh.ebwtBw, multiseedMms > 0 || do1mmUpFront);
+		if(!sh.refs->loaded()) throw 1;
+	}
+	for(size_t i = 0; freqSeedCap > 0 && i < multiseed_shards.size(); i++) {
+		IndexShard& sh = multiseed_shards[i];
+		string fname = sh.base + ".kmer." + gEbwt_ext;
+		sh.kmers = new FreqKmerTable();
+		uint64_t index = FreqKmerTable::indexFingerprint(
+			sh.ebwtFw->eh().len(), sh.ebwtFw->zOff(), sh.ebwtFw->fchr());
+		if(!sh.kmers->load(fname, index)) {
+			if(ifstream(fname.c_str()).good()) {
+				cerr << "Warning: " << fname << " was made from another index or is "
+				     << "damaged; not skipping frequent seeds for that index (rebuild "
+				     << "it with bowtie2-build --freq-kmers)" << endl;
+			} else {
+				cerr << "Warning: could not read k-mer table " << fname << "; not skipping "
+				     << "frequent seeds for that index (see bowtie2-build --freq-kmers)" << endl;
+			}
+			delete sh.kmers;
+			sh.kmers = NULL;
+		} else if(sh.kmers->minFreq() > freqSeedCap && !gQuiet) {
+			cerr << "Warning: " << fname << " lists only k-mers occurring at least "
+			     << sh.kmers->minFreq() << " times; seeds occurring fewer times "
+			     << "won't be skipped" << endl;
+		} else if(gVerbose || startVerbose) {
+			cerr << "Loaded " << sh.kmers->size() << " frequent " << sh.kmers->k()
+			     << "-mers from " << fname << endl;
+		}
+	}
 #ifndef _WIN32
 	sigset_t set;
 	sigemptyset(&set);
@@ -4586,33 +5414,92 @@ static void multiseedSearch(
 #endif
 	threads.reserveExact(std::max(nthreads, thread_ceiling));
 	tids.reserveExact(std::max(nthreads, thread_ceiling));
-	{
-		// Load the other half of the index into memory
-		assert(!ebwtFw.isInMemory());
-		Timer _t(cerr, "Time loading forward index: ", timing);
-		ebwtFw.loadIntoMemory(
-			0,  // colorspace?
-			-1, // not the reverse index
-			true,         // load SA samp? (yes, need forward index's SA samp)
-			true,         // load ftab (in forward index)
-			true,         // load rstarts (in forward index)
-			!noRefNames,  // load names?
-			startVerbose);
+	if(hugePages != HUGEPAGES_OFF && !gQuiet) {
+		reportHugePages("forward", ebwtFw);
+		if(multiseedMms > 0 || do1mmUpFront) {
+			reportHugePages("mirror", ebwtBw);
+		}
 	}
-	if(multiseedMms > 0 || do1mmUpFront) {
-		// Load the other half of the index into memory
-		assert(!ebwtBw.isInMemory());
-		Timer _t(cerr, "Time loading mirror index: ", timing);
-		ebwtBw.loadIntoMemory(
-			0, // colorspace?
-			// It's bidirectional search, so we need the reverse to be
-			// constructed as the reverse of the concatenated strings.
-			1,
-			false,        // don't load SA samp in reverse index
-			true,         // yes, need ftab in reverse index
-			false,        // don't load rstarts in reverse index
-			!noRefNames,  // load names?
-			startVerbose);
+	if(!numaNodes.empty()) {
+		Timer _t(cerr, "Time loading NUMA replicas: ", timing);
+		numaLoadReplicas(numaNodes, ebwtFw, ebwtBw, *refs);
+	}
+#ifdef BOWTIE_MM
+	// Declared after 'refs' so that it's stopped before they're freed
+	WarmupGuard warmup;
+	if(mmWarmup) {
+		if(setupWarmup(ebwtFw, (multiseedMms > 0 || do1mmUpFront) ? &ebwtBw : NULL, *refs)) {
+			warmup.thread = new WarmupGuard::Thread(indexWarmupWorker, (void*)NULL);
+		} else if(!gQuiet) {
+			cerr << "Warning: --mm-warmup has no effect unless the index is memory-mapped (--mm)" << endl;
+		}
+	}
+#endif
+	if(saCacheMb > 0) {
+		if(!saCache.enabled() && !saCache.init(ebwtFw.eh().len(), (uint64_t)saCacheMb << 20)) {
+			cerr << "Warning: --sa-cache " << saCacheMb << " is too small for this index; "
+			     << "not caching resolved offsets" << endl;
+		} else if(gVerbose || startVerbose) {
+			cerr << "Caching resolved offsets in " << saCache.bytes() << " bytes" << endl;
+		}
+		if(saCache.enabled()) {
+			// Rows are the same in every replica
+			ebwtFw.setSACache(&saCache);
+			for(size_t i = 0; i < multiseed_numa.size(); i++) {
+				multiseed_numa[i].ebwtFw->setSACache(&saCache);
+			}
+		}
+	}
+	if(!seedCacheFile.empty() && seedCacheMb == 0) {
+		// The shared cache gathers the seeds to save
+		seedCacheMb = 64;
+	}
+	if(seedCacheMb > 0) {
+		if(!seedCache.enabled() && !seedCache.init((uint64_t)seedCacheMb << 20, nthreads)) {
+			cerr << "Warning: --shared-seed-cache " << seedCacheMb << " is too small; "
+			     << "not sharing seed hits among threads" << endl;
+		} else if(gVerbose || startVerbose) {
+			cerr << "Caching seed hits in " << seedCache.bytes() << " bytes" << endl;
+		}
+	}
+	if(seedCache.enabled() && !seedCacheFile.empty()) {
+		if(seedCache.load(seedCacheFile, indexFingerprint(ebwtFw, ebwtBw), seedCacheParams())) {
+			if(!gQuiet) {
+				cerr << "Loaded " << seedCache.fileSeeds() << " seeds from "
+				     << seedCacheFile << endl;
+			}
+		} else if(!gQuiet && ifstream(seedCacheFile.c_str()).good()) {
+			cerr << "Warning: " << seedCacheFile << " was written for another index "
+			     << "or other seed settings, or is damaged; it will be replaced" << endl;
+		}
+	}
+	if(dupWindow > 0 && !dupCache.enabled()) {
+		if(seedSumm || bowtie2p5) {
+			cerr << "Warning: --collapse-dups is ignored with "
+			     << (seedSumm ? "--seed-summ" : "--test-25") << endl;
+		} else {
+			// Qualities only need to match if they can change penalties
+			bool quals = sc.qualitiesMatter() || sc.npenType != COST_MODEL_CONSTANT;
+			dupCache.init(dupWindow, dupWindowMb * 1024 * 1024, nthreads, quals);
+		}
+	}
+	{
+		EffortLimits base;
+		base.maxIters      = maxIters;
+		base.maxUg         = maxUg;
+		base.maxDp         = maxDp;
+		base.maxDpStreak   = maxDpStreak;
+		base.maxMateStreak = maxMateStreak;
+		base.nSeedRounds   = nSeedRounds;
+		base.ivalMult      = 1.0;
+		if((effortBudget > 0 || effortBudgetUs > 0) && bowtie2p5) {
+			cerr << "Warning: --effort-budget is ignored with --test-25" << endl;
+			effort.init(base, 0, 0, 0);
+		} else {
+			// Long enough that the reads threads hold back don't matter
+			effort.init(base, effortBudget, effortBudgetUs,
+			            max<uint64_t>(4000, (uint64_t)AdaptiveEffort::flushReads * 4 * nthreads));
+		}
 	}
 	// Start the metrics thread
 	
@@ -4681,6 +5568,45 @@ static void multiseedSearch(
 		}
 #endif
 	}
+#ifdef BOWTIE_MM
+	warmup.stop();
+#endif
+	numaFreeReplicas();
+	for(size_t i = 1; i < multiseed_shards.size(); i++) {
+		delete multiseed_shards[i].refs;
+		multiseed_shards[i].refs = NULL;
+	}
+	if(effort.enabled() && !gQuiet) {
+		effort.report(cerr);
+	}
+	if(freqSeedCap > 0) {
+		if(!gQuiet) {
+			cerr << "Skipped " << (metrics.sdm.freqskip + metrics.sdmu.freqskip)
+			     << " seeds occurring at least " << freqSeedCap << " times" << endl;
+		}
+		for(size_t i = 0; i < multiseed_shards.size(); i++) {
+			delete multiseed_shards[i].kmers;
+			multiseed_shards[i].kmers = NULL;
+		}
+	}
+	if(seedCache.enabled() && !seedCacheFile.empty()) {
+		if(!gQuiet) {
+			uint64_t fileHits = seedCache.fileHits();
+			uint64_t lookups = 0;
+			uint64_t runHits = seedCache.shardHits(lookups);
+			lookups += fileHits;
+			cerr << "Seed cache: " << lookups << " lookups; " << fileHits << " (";
+			printPct(cerr, fileHits, lookups);
+			cerr << ") answered from " << seedCacheFile << ", " << runHits << " (";
+			printPct(cerr, runHits, lookups);
+			cerr << ") from this run, " << (lookups - fileHits - runHits) << " searched" << endl;
+		}
+		if(!seedCache.save(seedCacheFile, indexFingerprint(ebwtFw, ebwtBw),
+		                   seedCacheParams(), (uint64_t)seedCacheMb << 20))
+		{
+			cerr << "Warning: could not write seed cache file " << seedCacheFile << endl;
+		}
+	}
 	if(!metricsPerRead && (metricsOfb != NULL || metricsStderr)) {
 		metrics.reportInterval(metricsOfb, metricsStderr, true, NULL);
 	}
@@ -4688,6 +5614,62 @@ static void multiseedSearch(
 
 static string argstr;
 
+/**
+ * Open the forward and, if mismatches are allowed in seeds, mirror
+ * index of a --shard, reading just their headers, as driver() does for
+ * the -x index.
+ */
+static void openShard(IndexShard& sh, const string& idx) {
+	sh.base = adjustEbwtBase(argv0, idx, gVerbose);
+	if(gVerbose || startVerbose) {
+		cerr << "About to initialize fw Ebwt for shard " << idx << ": "; logTime(cerr, true);
+	}
+	sh.ebwtFw = new Ebwt(
+		sh.base,
+		0,        // index is colorspace
+		-1,       // fw index
+		true,     // index is for the forward direction
+		/* overriding: */ offRate,
+		0, // amount to add to index offrate or <= 0 to do nothing
+		useMm,    // whether to use memory-mapped files
+		useShmem, // whether to use shared memory
+		mmSweep,  // sweep memory-mapped files
+		!noRefNames, // load names?
+		true,        // load SA sample?
+		true,        // load ftab?
+		true,        // load rstarts?
+		gVerbose, // whether to be talkative
+		startVerbose, // talkative during initialization
+		false /*passMemExc*/,
+		sanityCheck);
+	sh.ebwtFw->setHugePages(hugePages);
+	sh.ebwtFw->setPackedOffs(packedSa);
+	if(multiseedMms > 0 || do1mmUpFront) {
+		if(gVerbose || startVerbose) {
+			cerr << "About to initialize rev Ebwt for shard " << idx << ": "; logTime(cerr, true);
+		}
+		sh.ebwtBw = new Ebwt(
+			sh.base + ".rev",
+			0,       // index is colorspace
+			1,       // TODO: maybe not
+			false, // index is for the reverse direction
+			/* overriding: */ offRate,
+			0, // amount to add to index offrate or <= 0 to do nothing
+			useMm,    // whether to use memory-mapped files
+			useShmem, // whether to use shared memory
+			mmSweep,  // sweep memory-mapped files
+			!noRefNames, // load names?
+			true,        // load SA sample?
+			true,        // load ftab?
+			true,        // load rstarts?
+			gVerbose,    // whether to be talkative
+			startVerbose, // talkative during initialization
+			false /*passMemExc*/,
+			sanityCheck);
+		sh.ebwtBw->setHugePages(hugePages);
+	}
+}
+
 template<typename TStr>
 static void driver(
 	const char * type,
@@ -4769,6 +5751,8 @@ static void driver(
 	    startVerbose, // talkative during initialization
 	    false /*passMemExc*/,
 	    sanityCheck);
+	ebwt.setHugePages(hugePages);
+	ebwt.setPackedOffs(packedSa);
 	Ebwt* ebwtBw = NULL;
 	// We need the mirror index if mismatches are allowed
 	if(multiseedMms > 0 || do1mmUpFront) {
@@ -4793,8 +5777,17 @@ static void driver(
 		    startVerbose, // talkative during initialization
 		    false /*passMemExc*/,
 		    sanityCheck);
+		ebwtBw->setHugePages(hugePages);
 	}
-	if(sanityCheck && !os.empty()) {
+	// The -x index is the first shard; multiseedSearch() fills it in
+	multiseed_shards.clear();
+	multiseed_shards.expand();
+	multiseed_shards.back().base = adjIdxBase;
+	for(size_t i = 0; i < shardIdxs.size(); i++) {
+		multiseed_shards.expand();
+		openShard(multiseed_shards.back(), shardIdxs[i]);
+	}
+	if(sanityCheck && !os.empty() && multiseed_shards.size() == 1) {
 		// Sanity check number of patterns and pattern lengths in Ebwt
 		// against original strings
 		assert_eq(os.size(), ebwt.nPat());
@@ -4803,7 +5796,7 @@ static void driver(
 		}
 	}
 	// Sanity-check the restored version of the Ebwt
-	if(sanityCheck && !os.empty()) {
+	if(sanityCheck && !os.empty() && multiseed_shards.size() == 1) {
 		ebwt.loadIntoMemory(
 			0,
 			-1, // fw index
@@ -4850,6 +5843,28 @@ static void driver(
 		}
 		EList<string> refnames;
 		readEbwtRefnames(adjIdxBase, refnames);
+		// References of further shards follow those of the -x index
+		set<string> refnameSet;
+		for(size_t i = 0; i < refnames.size(); i++) {
+			refnameSet.insert(refnames[i]);
+		}
+		for(size_t i = 1; i < multiseed_shards.size(); i++) {
+			IndexShard& sh = multiseed_shards[i];
+			sh.refoff = (TRefId)reflens.size();
+			for(size_t j = 0; j < sh.ebwtFw->nPat(); j++) {
+				reflens.push_back(sh.ebwtFw->plen()[j]);
+			}
+			EList<string> shnames;
+			readEbwtRefnames(sh.base, shnames);
+			for(size_t j = 0; j < shnames.size(); j++) {
+				if(!refnameSet.insert(shnames[j]).second) {
+					cerr << "Error: reference \"" << shnames[j] << "\" in index "
+					     << sh.base << " is also in another index" << endl;
+					throw 1;
+				}
+				refnames.push_back(shnames[j]);
+			}
+		}
 		SamConfig samc(
 			refnames,               // reference sequence names
 			reflens,                // reference sequence lengths
@@ -4946,6 +5961,11 @@ static void driver(
 		if(ebwtBw != NULL) {
 			delete ebwtBw;
 		}
+		for(size_t i = 1; i < multiseed_shards.size(); i++) {
+			delete multiseed_shards[i].ebwtFw;
+			delete multiseed_shards[i].ebwtBw;
+		}
+		multiseed_shards.clear();
 		if(!gQuiet && !seedSumm) {
 			size_t repThresh = mhits;
 			if(repThresh == 0) {
@@ -102,9 +102,9 @@ void Ebwt::sanityCheckAll(int reverse) const {
 	memset(seen, 0, OFF_SIZE * seenLen);
 	TIndexOffU offsLen = eh._offsLen;
 	for(TIndexOffU i = 0; i < offsLen; i++) {
-		assert_lt(this->offs()[i], eh._bwtLen);
-		TIndexOff w = this->offs()[i] >> 5;
-		TIndexOff r = this->offs()[i] & 31;
+		assert_lt(this->offsAt(i), eh._bwtLen);
+		TIndexOff w = this->offsAt(i) >> 5;
+		TIndexOff r = this->offsAt(i) & 31;
 		assert_eq(0, (seen[w] >> r) & 1); // shouldn't have been seen before
 		seen[w] |= (1 << r);
 	}
@@ -0,0 +1,286 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "build_metrics.h"
+#include "mem_ids.h"
+
+using namespace std;
+
+BuildMetrics gBuildMetrics;
+
+/// The index the calling thread is building
+static __thread const char *curIndex = NULL;
+
+BuildMetrics::BuildMetrics() :
+	enabled_(false),
+	nthreads_(1),
+	wall0_(0.0),
+	cpu0_(0.0),
+	values_(MISC_CAT),
+	phases_(MISC_CAT),
+	blocks_(MISC_CAT) { }
+
+void BuildMetrics::enable(int nthreads) {
+	enabled_ = true;
+	nthreads_ = max(nthreads, 1);
+	wall0_ = wallSecs();
+	cpu0_ = cpuSecs();
+}
+
+void BuildMetrics::setIndex(const char *index) {
+	curIndex = index;
+}
+
+void BuildMetrics::setValue(const char *key, uint64_t val) {
+	if(!enabled_) return;
+	ThreadSafe ts(lock_);
+	for(size_t i = 0; i < values_.size(); i++) {
+		if(strcmp(values_[i].first, key) == 0) {
+			values_[i].second = val;
+			return;
+		}
+	}
+	values_.push_back(make_pair(key, val));
+}
+
+void BuildMetrics::addPhase(const char *name, int nthreads, double wall, double cpu) {
+	if(!enabled_) return;
+	Phase p;
+	p.index = (curIndex == NULL ? "shared" : curIndex);
+	p.name = name;
+	p.nthreads = max(nthreads, 1);
+	p.wall = wall;
+	p.cpu = cpu;
+	p.rss = peakRss();
+#ifdef USE_MEM_TALLY
+	p.tally = gMemTally.total();
+#else
+	p.tally = 0;
+#endif
+	ThreadSafe ts(lock_);
+	phases_.push_back(p);
+}
+
+void BuildMetrics::addBlocks(const EList<uint64_t>& sizes, const EList<double>& secs) {
+	if(!enabled_) return;
+	ThreadSafe ts(lock_);
+	blocks_.expand();
+	Blocks& b = blocks_.back();
+	b.index = (curIndex == NULL ? "shared" : curIndex);
+	b.sizes.clear();
+	for(size_t i = 0; i < sizes.size(); i++) {
+		b.sizes.push_back(sizes[i]);
+	}
+	b.secs = 0.0;
+	for(size_t i = 0; i < secs.size(); i++) {
+		b.secs += secs[i];
+	}
+}
+
+double BuildMetrics::wallSecs() {
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+double BuildMetrics::cpuSecs() {
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0) {
+		return 0.0;
+	}
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+uint64_t BuildMetrics::peakRss() {
+	struct rusage ru;
+	if(getrusage(RUSAGE_SELF, &ru) != 0) {
+		return 0;
+	}
+#ifdef __APPLE__
+	return (uint64_t)ru.ru_maxrss;
+#else
+	return (uint64_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+/**
+ * Write 's' as a JSON string.
+ */
+static void jsonStr(ostream& os, const string& s) {
+	os << '"';
+	for(size_t i = 0; i < s.length(); i++) {
+		unsigned char c = (unsigned char)s[i];
+		if(c == '"' || c == '\\') {
+			os << '\\' << c;
+		} else if(c < 0x20) {
+			os << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec << setfill(' ');
+		} else {
+			os << c;
+		}
+	}
+	os << '"';
+}
+
+/// Fraction of the CPU time 'nthreads' threads could have used that
+/// they did use
+static double utilization(double wall, double cpu, int nthreads) {
+	return wall > 0.0 ? cpu / (wall * nthreads) : 0.0;
+}
+
+#ifdef USE_MEM_TALLY
+/// Name a MemoryTally category in the report
+static string catName(int cat) {
+	switch(cat) {
+		case 0:         return "default";
+		case EBWT_CAT:  return "ebwt";
+		case EBWTB_CAT: return "ebwt_build";
+		case CA_CAT:    return "cache";
+		case GW_CAT:    return "group_walk";
+		case AL_CAT:    return "alignment";
+		case DP_CAT:    return "dp";
+		case RES_CAT:   return "results";
+		case MISC_CAT:  return "misc";
+		case DEBUG_CAT: return "debug";
+	}
+	ostringstream os;
+	os << "category_" << cat;
+	return os.str();
+}
+#endif
+
+bool BuildMetrics::write(const string& fname, const EList<string>& files) {
+	ofstream os(fname.c_str());
+	if(!os.good()) {
+		return false;
+	}
+	ThreadSafe ts(lock_);
+	double wall = wallSecs() - wall0_;
+	double cpu = cpuSecs() - cpu0_;
+	os << fixed << setprecision(6);
+	os << "{" << endl;
+	os << "  \"version\": ";
+	jsonStr(os, BOWTIE2_VERSION);
+	os << "," << endl;
+	os << "  \"threads\": " << nthreads_ << "," << endl;
+	for(size_t i = 0; i < values_.size(); i++) {
+		os << "  ";
+		jsonStr(os, values_[i].first);
+		os << ": " << values_[i].second << "," << endl;
+	}
+	os << "  \"wall_seconds\": " << wall << "," << endl;
+	os << "  \"cpu_seconds\": " << cpu << "," << endl;
+	os << "  \"thread_utilization\": " << utilization(wall, cpu, nthreads_) << "," << endl;
+	os << "  \"max_rss_bytes\": " << peakRss() << "," << endl;
+	os << "  \"phases\": [";
+	for(size_t i = 0; i < phases_.size(); i++) {
+		const Phase& p = phases_[i];
+		os << (i == 0 ? "" : ",") << endl;
+		os << "    {\"index\": ";
+		jsonStr(os, p.index);
+		os << ", \"phase\": ";
+		jsonStr(os, p.name);
+		os << ", \"threads\": " << p.nthreads
+		   << ", \"wall_seconds\": " << p.wall
+		   << ", \"cpu_seconds\": " << p.cpu
+		   << ", \"thread_utilization\": " << utilization(p.wall, p.cpu, p.nthreads)
+		   << ", \"max_rss_so_far_bytes\": " << p.rss;
+#ifdef USE_MEM_TALLY
+		os << ", \"tallied_bytes\": " << p.tally;
+#endif
+		os << "}";
+	}
+	os << endl << "  ]," << endl;
+	os << "  \"blocks\": [";
+	for(size_t i = 0; i < blocks_.size(); i++) {
+		Blocks& b = blocks_[i];
+		b.sizes.sort();
+		uint64_t tot = 0;
+		for(size_t j = 0; j < b.sizes.size(); j++) {
+			tot += b.sizes[j];
+		}
+		size_t n = b.sizes.size();
+		os << (i == 0 ? "" : ",") << endl;
+		os << "    {\"index\": ";
+		jsonStr(os, b.index);
+		os << ", \"count\": " << n
+		   << ", \"sort_seconds\": " << b.secs;
+		if(n > 0) {
+			os << ", \"min\": " << b.sizes[0]
+			   << ", \"median\": " << b.sizes[n / 2]
+			   << ", \"p90\": " << b.sizes[min(n - 1, n * 9 / 10)]
+			   << ", \"max\": " << b.sizes[n - 1]
+			   << ", \"mean\": " << ((double)tot / n);
+		}
+		// Number of blocks with between 2^k and 2^(k+1)-1 suffixes
+		os << ", \"histogram\": [";
+		size_t j = 0;
+		bool first = true;
+		while(j < n) {
+			int k = 0;
+			while(k < 63 && (b.sizes[j] >> (k + 1)) > 0) k++;
+			size_t cnt = 0;
+			while(j < n && (b.sizes[j] >> k) <= 1) {
+				cnt++;
+				j++;
+			}
+			os << (first ? "" : ", ") << "{\"min_size\": " << ((uint64_t)1 << k)
+			   << ", \"count\": " << cnt << "}";
+			first = false;
+		}
+		os << "]}";
+	}
+	os << endl << "  ]," << endl;
+	os << "  \"memory\": {";
+#ifdef USE_MEM_TALLY
+	os << endl << "    \"tallied_peak_bytes\": " << gMemTally.peak() << "," << endl;
+	os << "    \"categories\": {";
+	bool first = true;
+	for(int cat = 0; cat < 256; cat++) {
+		if(gMemTally.peak(cat) == 0) continue;
+		os << (first ? "" : ",") << endl << "      ";
+		jsonStr(os, catName(cat));
+		os << ": {\"peak_bytes\": " << gMemTally.peak(cat)
+		   << ", \"bytes\": " << gMemTally.total(cat) << "}";
+		first = false;
+	}
+	os << endl << "    }" << endl << "  ";
+#endif
+	os << "}," << endl;
+	os << "  \"files\": [";
+	for(size_t i = 0; i < files.size(); i++) {
+		struct stat st;
+		os << (i == 0 ? "" : ",") << endl << "    {\"path\": ";
+		jsonStr(os, files[i]);
+		os << ", \"bytes\": " << (stat(files[i].c_str(), &st) == 0 ? (uint64_t)st.st_size : 0) << "}";
+	}
+	os << endl << "  ]" << endl;
+	os << "}" << endl;
+	os.close();
+	return !os.fail();
+}
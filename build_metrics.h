@@ -0,0 +1,161 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BUILD_METRICS_H_
+#define BUILD_METRICS_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include "ds.h"
+#include "threading.h"
+
+/**
+ * Figures gathered while bowtie2-build runs and written as a JSON
+ * report by --metrics-file: the wall-clock and CPU time of each phase
+ * and how busy its threads kept the CPUs, the sizes of the suffix-array
+ * blocks and how long they took to sort, the process's maximum resident
+ * set size, and the peak of each MemoryTally category when allocations
+ * are tallied.  The OS only reports the maximum RSS over the life of
+ * the process, so a phase's figure is the maximum up to its end, not
+ * its own peak.
+ *
+ * A phase is labelled with the index the thread recording it is
+ * building (see setIndex()), so the forward and mirror indexes can be
+ * built side by side.  CPU time is that of the whole process, so while
+ * the two builds overlap each one's phases include the other's CPU.
+ */
+class BuildMetrics {
+
+public:
+
+	BuildMetrics();
+
+	/**
+	 * Start recording for a build with 'nthreads' threads; until this
+	 * is called nothing is recorded.
+	 */
+	void enable(int nthreads);
+
+	bool enabled() const { return enabled_; }
+
+	/**
+	 * Label the phases and blocks the calling thread records from now
+	 * on with 'index' ("forward", "mirror"), or with "shared" if
+	 * 'index' is NULL.  'index' must outlive the build.
+	 */
+	static void setIndex(const char *index);
+
+	/**
+	 * Record a build parameter or a property of the input.
+	 */
+	void setValue(const char *key, uint64_t val);
+
+	/**
+	 * Record a finished phase of the calling thread's index that ran
+	 * on up to 'nthreads' threads.
+	 */
+	void addPhase(const char *name, int nthreads, double wall, double cpu);
+
+	/**
+	 * Record the sizes of the suffix-array blocks of the calling
+	 * thread's index and the seconds each took to sort.
+	 */
+	void addBlocks(const EList<uint64_t>& sizes, const EList<double>& secs);
+
+	/**
+	 * Write the report to 'fname', giving the sizes of 'files'.
+	 * Return false if it couldn't be written.
+	 */
+	bool write(const std::string& fname, const EList<std::string>& files);
+
+	/// Seconds since the epoch, to the microsecond
+	static double wallSecs();
+
+	/// User plus system CPU seconds used by the process so far
+	static double cpuSecs();
+
+	/// Maximum resident set size of the process so far, in bytes
+	static uint64_t peakRss();
+
+private:
+
+	struct Phase {
+		const char *index;
+		const char *name;
+		int         nthreads;
+		double      wall;
+		double      cpu;
+		uint64_t    rss;    // max RSS of the process up to the end of the phase
+		uint64_t    tally;  // tallied bytes at the end of the phase
+	};
+
+	struct Blocks {
+		const char     *index;
+		EList<uint64_t> sizes;
+		double          secs;
+	};
+
+	bool                                        enabled_;
+	int                                         nthreads_;
+	double                                      wall0_;
+	double                                      cpu0_;
+	MUTEX_T                                     lock_;
+	EList<std::pair<const char*, uint64_t> >    values_;
+	EList<Phase>                                phases_;
+	EList<Blocks>                               blocks_;
+};
+
+extern BuildMetrics gBuildMetrics;
+
+/**
+ * Times one phase of the build, from construction to destruction, and
+ * records it in gBuildMetrics if --metrics-file was given.
+ */
+class BuildPhase {
+
+public:
+
+	BuildPhase(const char *name, int nthreads = 1) :
+		name_(name),
+		nthreads_(nthreads),
+		on_(gBuildMetrics.enabled()),
+		wall0_(on_ ? BuildMetrics::wallSecs() : 0.0),
+		cpu0_(on_ ? BuildMetrics::cpuSecs() : 0.0) { }
+
+	~BuildPhase() {
+		if(on_) {
+			gBuildMetrics.addPhase(
+				name_,
+				nthreads_,
+				BuildMetrics::wallSecs() - wall0_,
+				BuildMetrics::cpuSecs() - cpu0_);
+		}
+	}
+
+private:
+
+	const char *name_;
+	int         nthreads_;
+	bool        on_;
+	double      wall0_;
+	double      cpu0_;
+};
+
+#endif /*BUILD_METRICS_H_*/
@@ -1,9 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include "cpu_numa_info.h"
 
+#ifdef __linux__
+#include <sched.h>
+#include <dirent.h>
+#endif
+
 /// Based on http://stackoverflow.com/questions/16862620/numa-get-current-node-core
 void get_cpu_and_node_(int& cpu, int& node) {
+#if defined(__x86_64__) || defined(__i386__)
 	unsigned long a,d,c;
 	__asm__ volatile("rdtscp" : "=a" (a), "=d" (d), "=c" (c));
 	node = (c & 0xFFF000)>>12;
 	cpu = c & 0xFFF;
+#else
+	cpu = node = 0;
+#endif
+}
+
+#ifdef __linux__
+
+/**
+ * Parse a sysfs CPU list such as "0-3,8-11" into 'cpus', keeping only
+ * CPUs in 'allowed'.
+ */
+static void parseCpuList(const char *s, const cpu_set_t& allowed, EList<int>& cpus) {
+	while(*s != '\0' && *s != '\n') {
+		char *end;
+		long lo = strtol(s, &end, 10);
+		if(end == s) break;
+		long hi = lo;
+		s = end;
+		if(*s == '-') {
+			hi = strtol(s + 1, &end, 10);
+			s = end;
+		}
+		for(long c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+			if(CPU_ISSET(c, &allowed)) {
+				cpus.push_back((int)c);
+			}
+		}
+		if(*s == ',') s++;
+	}
+}
+
+bool numaNodeCpus(EList<EList<int> >& nodes) {
+	nodes.clear();
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return false;
+	}
+	// Node numbers needn't be contiguous, so probe up to the highest
+	// one sysfs lists
+	DIR *dir = opendir("/sys/devices/system/node");
+	if(dir == NULL) {
+		return false;
+	}
+	int maxNode = -1;
+	struct dirent *ent;
+	while((ent = readdir(dir)) != NULL) {
+		int n;
+		if(sscanf(ent->d_name, "node%d", &n) == 1 && n > maxNode) {
+			maxNode = n;
+		}
+	}
+	closedir(dir);
+	char path[128];
+	char buf[4096];
+	for(int n = 0; n <= maxNode; n++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+		FILE *f = fopen(path, "r");
+		if(f == NULL) continue;
+		if(fgets(buf, sizeof(buf), f) != NULL) {
+			EList<int> cpus;
+			parseCpuList(buf, allowed, cpus);
+			if(!cpus.empty()) {
+				nodes.push_back(cpus);
+			}
+		}
+		fclose(f);
+	}
+	return !nodes.empty();
+}
+
+bool numaBindThread(const EList<int>& cpus) {
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	for(size_t i = 0; i < cpus.size(); i++) {
+		CPU_SET(cpus[i], &mask);
+	}
+	return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+}
+
+bool numaThreadCpus(EList<int>& cpus) {
+	cpus.clear();
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if(sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+		return false;
+	}
+	for(int c = 0; c < CPU_SETSIZE; c++) {
+		if(CPU_ISSET(c, &mask)) {
+			cpus.push_back(c);
+		}
+	}
+	return !cpus.empty();
 }
+
+#else
+
+bool numaNodeCpus(EList<EList<int> >& nodes) {
+	nodes.clear();
+	return false;
+}
+
+bool numaBindThread(const EList<int>& cpus) {
+	(void)cpus;
+	return false;
+}
+
+bool numaThreadCpus(EList<int>& cpus) {
+	cpus.clear();
+	return false;
+}
+
+#endif
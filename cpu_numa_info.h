@@ -1,6 +1,31 @@
 #ifndef CPU_AND_NODE_H_
 #define CPU_AND_NODE_H_
 
+#include "ds.h"
+
 extern void get_cpu_and_node_(int& cpu, int& node);
 
+/**
+ * Fill 'nodes' with one list per NUMA node, holding the CPUs of that
+ * node this process may run on.  Nodes with no such CPUs (e.g.
+ * memory-only nodes, or ones excluded by taskset/cpusets) are left out.
+ * Returns false if the topology can't be determined, in which case
+ * 'nodes' is empty.
+ */
+extern bool numaNodeCpus(EList<EList<int> >& nodes);
+
+/**
+ * Restrict the calling thread to the given CPUs.  Memory the thread
+ * touches first afterwards is then allocated on their node.  Returns
+ * false if the affinity couldn't be set.
+ */
+extern bool numaBindThread(const EList<int>& cpus);
+
+/**
+ * Fill 'cpus' with the CPUs the calling thread may run on, so that a
+ * later numaBindThread(cpus) undoes a binding in between.  Returns
+ * false if the affinity can't be determined.
+ */
+extern bool numaThreadCpus(EList<int>& cpus);
+
 #endif
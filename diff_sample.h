@@ -483,8 +483,10 @@ public:
 		size_t len = text.length();
 		size_t sPrimeSz = (len / v) * ds.size();
 		// sPrime, sPrimeOrder, _isaPrime all exist in memory at
-		// once and that's the peak
-		AutoArray<TIndexOffU> aa(sPrimeSz * 3 + (1024 * 1024 /*out of caution*/), EBWT_CAT);
+		// once and that's the peak, along with refineRanks()'s lists
+		// of tied groups: sPrimeSz/16 groups of two offsets for this
+		// round and as many for the next
+		AutoArray<TIndexOffU> aa(sPrimeSz * 3 + sPrimeSz / 4 + (1024 * 1024 /*out of caution*/), EBWT_CAT);
 		return sPrimeSz * 4; // sPrime array
 	}
 
@@ -502,6 +504,7 @@ public:
 	ostream& log() const                 { return _logger; }
 
 	void     build(int nthreads);
+	void     runSlice(int phase, int tid);
 	uint32_t tieBreakOff(TIndexOffU i, TIndexOffU j) const;
 	int64_t  breakTie(TIndexOffU i, TIndexOffU j) const;
 	bool     isCovered(TIndexOffU i) const;
@@ -527,8 +530,89 @@ public:
 
 private:
 
+	/// Phases of build() that are split among threads by runSlice()
+	enum {
+		DCS_SPRIME = 1, // fill in sPrime
+		DCS_COUNT,      // count samples per bucket
+		DCS_SCATTER,    // move samples into their buckets
+		DCS_RANK,       // rank v-sorted samples
+		DCS_RANK_FIX,   // rank samples whose group began in another slice
+		DCS_GROUPS,     // find groups of tied samples
+		DCS_SORT,       // sort and split tied groups by rank h rows on
+		DCS_UPDATE      // give split groups their new ranks
+	};
+
+	/// A range of the sorted samples that all have the same rank
+	struct DcsGroup {
+		TIndexOffU begin;
+		TIndexOffU end;
+	};
+
+	/**
+	 * State shared by the threads of build().  Ranks are the position
+	 * in the sorted order of the first sample with that rank, so a
+	 * group can be split without renumbering any other group.
+	 */
+	struct DcsBuildState {
+		DcsBuildState() : sPrime(NULL), tmp(NULL), order(NULL), isa(NULL),
+			n(0), nthreads(1), bdepth(0), nbuckets(0), cur(0), grab(1), h(0),
+			cap(0), record(false) { }
+
+		TIndexOffU      *sPrime;   // sample offsets; later scratch ranks
+		TIndexOffU      *tmp;      // sPrime rearranged into buckets
+		TIndexOffU      *order;    // sPrimeOrder
+		TIndexOffU      *isa;      // _isaPrime
+		size_t           n;        // number of samples
+		int              nthreads;
+		uint32_t         bdepth;   // characters bucketed on
+		size_t           nbuckets; // 5^bdepth
+		EList<TIndexOffU> counts;  // per-thread bucket counts/offsets
+		EList<TIndexOffU> carry;   // rank in effect at end of each slice
+		EList<DcsGroup>  groups;   // tied groups to split this round
+		ELList<DcsGroup> next;     // per-thread tied groups for next round
+		volatile size_t  cur;      // next group to hand out
+		size_t           grab;     // groups handed out at a time
+		TIndexOffU       h;        // compare ranks h rows on
+		EList<size_t>    scan;     // where each thread's DCS_GROUPS resumes
+		size_t           cap;      // most groups one thread lists
+		bool             record;   // list the groups DCS_SORT splits off
+	};
+
 	void doBuiltSanityCheck() const;
-	void buildSPrime(EList<TIndexOffU>& sPrime, size_t padding);
+	void buildSPrime(EList<TIndexOffU>& sPrime, size_t padding, int nthreads);
+	void runPhase(int phase, int nthreads);
+	void bucketSamples(EList<TIndexOffU>& sPrime, EList<TIndexOffU>& sPrimeOrder,
+	                   EList<size_t>& boundaries, int nthreads);
+	size_t refineRanks(int nthreads);
+	bool   findGroups(int nthreads, bool restart);
+	void   takeGroups(int nthreads);
+	void   splitGroups(int nthreads);
+
+	/**
+	 * List the tied group [begin, end) in 'out' for the next round,
+	 * unless this round's groups aren't all listed or 'out' is full;
+	 * either way refineRanks() finds the next round's groups by
+	 * scanning the ranks.
+	 */
+	void listGroup(EList<DcsGroup>& out, TIndexOffU begin, TIndexOffU end) {
+		if(!_bs.record || out.size() >= _bs.cap) return;
+		out.expand();
+		out.back().begin = begin;
+		out.back().end = end;
+	}
+
+	/**
+	 * Return the bucket of the sample at text offset 'off', given by
+	 * its first bdepth characters, where off-the-end counts as 4.
+	 */
+	size_t bucketOf(TIndexOffU off) const {
+		size_t tlen = _text.length();
+		size_t key = 0;
+		for(uint32_t c = 0; c < _bs.bdepth; c++) {
+			key = key * 5 + ((off + c < tlen) ? (size_t)(int)_text[off + c] : 4);
+		}
+		return key;
+	}
 
 	bool built() const {
 		return _isaPrime.size() > 0;
@@ -554,6 +638,7 @@ private:
 	uint32_t         _log2v;
 	TIndexOffU         _vmask;
 	ostream&         _logger;
+	DcsBuildState    _bs;       // only used during build()
 };
 
 /**
@@ -598,12 +683,13 @@ void DifferenceCoverSample<TStr>::doBuiltSanityCheck() const {
 template <typename TStr>
 void DifferenceCoverSample<TStr>::buildSPrime(
 	EList<TIndexOffU>& sPrime,
-	size_t padding)
+	size_t padding,
+	int nthreads)
 {
 	const TStr& t = this->text();
 	const EList<uint32_t>& ds = this->ds();
 	TIndexOffU tlen = (TIndexOffU)t.length();
-	uint32_t v = this->v();
+	ASSERT_ONLY(uint32_t v = this->v());
 	uint32_t d = this->d();
 	assert_gt(v, 2);
 	assert_lt(d, v);
@@ -633,25 +719,19 @@ void DifferenceCoverSample<TStr>::buildSPrime(
 	assert_eq(_doffs.size(), d+1);
 	// Size sPrime appropriately
 	sPrime.resizeExact((size_t)sPrimeSz + padding);
-	sPrime.fill(OFF_MASK);
+	ASSERT_ONLY(sPrime.fill(OFF_MASK));
+	for(size_t i = sPrimeSz; i < sPrime.size(); i++) {
+		sPrime[i] = OFF_MASK;
+	}
 	// Slot suffixes from text into sPrime according to the mu
-	// mapping; where the mapping would leave a blank, insert a 0
-	TIndexOffU added = 0;
-	TIndexOffU i = 0;
-	for(TIndexOffU ti = 0; ti <= tlen; ti += v) {
-		for(uint32_t di = 0; di < d; di++) {
-			TIndexOffU tti = ti + ds[di];
-			if(tti > tlen) break;
-			TIndexOffU spi = _doffs[di] + i;
-			assert_lt(spi, _doffs[di+1]);
-			assert_leq(tti, tlen);
-			assert_lt(spi, sPrimeSz);
-			assert_eq(OFF_MASK, sPrime[spi]);
-			sPrime[spi] = tti; added++;
-		}
-		i++;
+	// mapping, each thread taking a range of rows
+	_bs.sPrime = sPrime.ptr();
+	runPhase(DCS_SPRIME, nthreads);
+#ifndef NDEBUG
+	for(size_t i = 0; i < sPrimeSz; i++) {
+		assert_neq(OFF_MASK, sPrime[i]);
 	}
-	assert_eq(added, sPrimeSz);
+#endif
 }
 
 /**
@@ -737,9 +817,398 @@ static void VSorting_worker(void *vp)
 };
 #endif
 
+/**
+ * Orders tied samples by the rank of the sample h rows further on, i.e.
+ * h*v characters further into the text.
+ */
+struct DcsRankLess {
+	DcsRankLess(const TIndexOffU *isa, TIndexOffU h) : isa_(isa), h_(h) { }
+
+	bool operator()(TIndexOffU a, TIndexOffU b) const {
+		return isa_[a + h_] < isa_[b + h_];
+	}
+
+	const TIndexOffU *isa_;
+	TIndexOffU        h_;
+};
+
+/**
+ * Do thread 'tid''s share of one phase of build().  Samples, rows and
+ * groups are divided so that no two threads write the same element.
+ */
+template <typename TStr>
+void DifferenceCoverSample<TStr>::runSlice(int phase, int tid) {
+	DcsBuildState& bs = _bs;
+	const TStr& t = this->text();
+	TIndexOffU tlen = (TIndexOffU)t.length();
+	uint32_t v = this->v();
+	size_t nt = (size_t)bs.nthreads;
+	// This thread's slice of the samples
+	size_t b = bs.n * tid / nt, e = bs.n * (tid + 1) / nt;
+	switch(phase) {
+	case DCS_SPRIME: {
+		// Row i of the mu mapping holds the samples at i*v + ds[di]
+		size_t nrows = (size_t)this->divv(tlen) + 1;
+		size_t rb = nrows * tid / nt, re = nrows * (tid + 1) / nt;
+		for(size_t i = rb; i < re; i++) {
+			TIndexOffU ti = (TIndexOffU)(i << _log2v);
+			for(uint32_t di = 0; di < _d; di++) {
+				TIndexOffU tti = ti + _ds[di];
+				if(tti > tlen) break;
+				TIndexOffU spi = _doffs[di] + (TIndexOffU)i;
+				assert_lt(spi, _doffs[di+1]);
+				assert_eq(OFF_MASK, bs.sPrime[spi]);
+				bs.sPrime[spi] = tti;
+			}
+		}
+		break;
+	}
+	case DCS_COUNT: {
+		TIndexOffU *cnt = bs.counts.ptr() + tid * bs.nbuckets;
+		for(size_t i = b; i < e; i++) {
+			cnt[bucketOf(bs.sPrime[i])]++;
+		}
+		break;
+	}
+	case DCS_SCATTER: {
+		// counts now holds where this thread's samples go in each
+		// bucket; keeping them in order keeps the result deterministic
+		TIndexOffU *off = bs.counts.ptr() + tid * bs.nbuckets;
+		for(size_t i = b; i < e; i++) {
+			TIndexOffU pos = off[bucketOf(bs.sPrime[i])]++;
+			bs.tmp[pos] = bs.sPrime[i];
+			bs.order[pos] = (TIndexOffU)i;
+		}
+		break;
+	}
+	case DCS_RANK: {
+		// A sample's rank is where its group of samples identical up
+		// to v begins; groups that began in an earlier slice are left
+		// for DCS_RANK_FIX
+		TIndexOffU start = OFF_MASK;
+		for(size_t i = b; i < e; i++) {
+			if(i == 0 || !suffixSameUpTo(t, bs.sPrime[i-1], bs.sPrime[i], v)) {
+				start = (TIndexOffU)i;
+			}
+			bs.isa[bs.order[i]] = start;
+		}
+		bs.carry[tid] = start;
+		break;
+	}
+	case DCS_RANK_FIX: {
+		if(tid == 0) break;
+		TIndexOffU start = bs.carry[tid-1];
+		for(size_t i = b; i < e && bs.isa[bs.order[i]] == OFF_MASK; i++) {
+			bs.isa[bs.order[i]] = start;
+		}
+		break;
+	}
+	case DCS_GROUPS: {
+		// The first sample of a group has its own position as its rank;
+		// stop once the list is full and resume there next time
+		EList<DcsGroup>& out = bs.next[tid];
+		size_t i = bs.scan[tid];
+		for(; i < e && out.size() < bs.cap; i++) {
+			if(bs.isa[bs.order[i]] != (TIndexOffU)i) continue;
+			size_t j = i + 1;
+			while(j < bs.n && bs.isa[bs.order[j]] == (TIndexOffU)i) j++;
+			if(j - i > 1) {
+				out.expand();
+				out.back().begin = (TIndexOffU)i;
+				out.back().end = (TIndexOffU)j;
+			}
+			i = j - 1;
+		}
+		bs.scan[tid] = i;
+		break;
+	}
+	case DCS_SORT:
+	case DCS_UPDATE: {
+		EList<DcsGroup>& out = bs.next[tid];
+		TIndexOffU *o = bs.order;
+		const TIndexOffU h = bs.h;
+		while(true) {
+			size_t gi = __sync_fetch_and_add(&bs.cur, bs.grab);
+			if(gi >= bs.groups.size()) break;
+			size_t ge = std::min(gi + bs.grab, bs.groups.size());
+			for(; gi < ge; gi++) {
+				const DcsGroup& g = bs.groups[gi];
+				if(phase == DCS_UPDATE) {
+					for(TIndexOffU k = g.begin; k < g.end; k++) {
+						bs.isa[o[k]] = bs.sPrime[k];
+					}
+					continue;
+				}
+				// Ranks don't change until DCS_UPDATE, so the samples h
+				// rows on can be compared while other groups are split.
+				// Tied samples share their first v*h characters, so the
+				// samples h rows on are in the same d section.
+				std::sort(o + g.begin, o + g.end, DcsRankLess(bs.isa, h));
+				TIndexOffU start = g.begin;
+				for(TIndexOffU k = g.begin; k < g.end; k++) {
+					assert_lt(o[k] + h, bs.n);
+					if(k > g.begin && bs.isa[o[k] + h] != bs.isa[o[k-1] + h]) {
+						if(k - start > 1) listGroup(out, start, k);
+						start = k;
+					}
+					bs.sPrime[k] = start;
+				}
+				if(g.end - start > 1) listGroup(out, start, g.end);
+			}
+		}
+		break;
+	}
+	default:
+		assert(false);
+	}
+}
+
+template<typename TStr>
+struct DcsPhaseParam {
+	DifferenceCoverSample<TStr>* dcs;
+	int                          phase;
+	int                          tid;
+};
+
+template<typename TStr>
+#ifdef WITH_TBB
+class DcsPhase_worker {
+	void *vp;
+
+public:
+
+	DcsPhase_worker(const DcsPhase_worker& W): vp(W.vp) {};
+	DcsPhase_worker(void *vp_):vp(vp_) {};
+	void operator()() const
+	{
+#else
+static void DcsPhase_worker(void *vp)
+{
+#endif
+	DcsPhaseParam<TStr>* param = (DcsPhaseParam<TStr>*)vp;
+	param->dcs->runSlice(param->phase, param->tid);
+}
+
+#ifdef WITH_TBB
+};
+#endif
+
+/**
+ * Run one phase of build() on 'nthreads' threads and wait for it.
+ */
+template <typename TStr>
+void DifferenceCoverSample<TStr>::runPhase(int phase, int nthreads) {
+	_bs.nthreads = nthreads;
+	if(nthreads == 1) {
+		runSlice(phase, 0);
+		return;
+	}
+	EList<DcsPhaseParam<TStr> > tparams;
+	tparams.resize(nthreads);
+#ifdef WITH_TBB
+	tbb::task_group tbb_grp;
+#else
+	AutoArray<tthread::thread*> threads(nthreads);
+#endif
+	for(int tid = 0; tid < nthreads; tid++) {
+		tparams[tid].dcs = this;
+		tparams[tid].phase = phase;
+		tparams[tid].tid = tid;
+#ifdef WITH_TBB
+		tbb_grp.run(DcsPhase_worker<TStr>(((void*)&tparams[tid])));
+	}
+	tbb_grp.wait();
+#else
+		threads[tid] = new tthread::thread(DcsPhase_worker<TStr>, (void*)&tparams[tid]);
+	}
+	for(int tid = 0; tid < nthreads; tid++) {
+		threads[tid]->join();
+		delete threads[tid];
+	}
+#endif
+}
+
+/**
+ * Rearrange the samples into buckets by their first few characters, on
+ * all threads, leaving sPrimeOrder mapping each sample back to where it
+ * came from and 'boundaries' holding where each nonempty bucket ends.
+ * This does the work of the top levels of the multikey quicksort.
+ */
+template <typename TStr>
+void DifferenceCoverSample<TStr>::bucketSamples(
+	EList<TIndexOffU>& sPrime,
+	EList<TIndexOffU>& sPrimeOrder,
+	EList<size_t>& boundaries,
+	int nthreads)
+{
+	DcsBuildState& bs = _bs;
+	size_t sPrimeSz = bs.n;
+	// Enough buckets to keep the threads busy even if a few are big;
+	// stay short of v, since mkeyQSortSuf2() has to sort something
+	bs.bdepth = 1;
+	while(bs.bdepth < 7 && bs.bdepth + 1 < this->v() &&
+	      ((size_t)1 << (2 * bs.bdepth)) < 256 * (size_t)nthreads)
+	{
+		bs.bdepth++;
+	}
+	bs.nbuckets = 1;
+	for(uint32_t i = 0; i < bs.bdepth; i++) {
+		bs.nbuckets *= 5;
+	}
+	bs.counts.resizeExact(bs.nbuckets * nthreads);
+	bs.counts.fill(0);
+	bs.sPrime = sPrime.ptr();
+	runPhase(DCS_COUNT, nthreads);
+	// Turn the counts into each thread's first slot in each bucket
+	TIndexOffU off = 0;
+	for(size_t bi = 0; bi < bs.nbuckets; bi++) {
+		for(int tid = 0; tid < nthreads; tid++) {
+			TIndexOffU c = bs.counts[tid * bs.nbuckets + bi];
+			bs.counts[tid * bs.nbuckets + bi] = off;
+			off += c;
+		}
+		if(boundaries.empty() || boundaries.back() != off) {
+			if(off > 0) boundaries.push_back(off);
+		}
+	}
+	assert_eq(sPrimeSz, off);
+	EList<TIndexOffU> tmp;
+	tmp.resizeExact(sPrime.size());
+	for(size_t i = sPrimeSz; i < tmp.size(); i++) {
+		tmp[i] = sPrime[i];
+	}
+	sPrimeOrder.resizeExact(sPrimeSz);
+	bs.tmp = tmp.ptr();
+	bs.order = sPrimeOrder.ptr();
+	runPhase(DCS_SCATTER, nthreads);
+	sPrime.xfer(tmp);
+	bs.sPrime = sPrime.ptr();
+	bs.tmp = NULL;
+	bs.counts.clear();
+	VMSG_NL("  Bucketed samples on first " << bs.bdepth << " characters into "
+	        << boundaries.size() << " nonempty buckets");
+}
+
+/**
+ * Starting from the ranks of the v-sorted samples, split groups of tied
+ * samples by the ranks of the samples h = 1, 2, 4, ... rows on until no
+ * ties remain, as Larsson-Sadakane does, but with the groups of each
+ * round divided among the threads.  Leaves each sample's final rank in
+ * _isaPrime and returns the number of rounds.
+ *
+ * Each thread lists at most bs.cap groups, so that the lists stay
+ * within what simulateAllocs() allows for.  A round with more groups
+ * than that is found by scanning the ranks and split a batch at a
+ * time.  A batch may then see ranks that earlier batches of the same
+ * round refined, which only sorts its groups further.
+ */
+template <typename TStr>
+size_t DifferenceCoverSample<TStr>::refineRanks(int nthreads) {
+	DcsBuildState& bs = _bs;
+	bs.cap = std::max<size_t>(1024, bs.n / (16 * nthreads));
+	bs.next.resize(nthreads);
+	for(int tid = 0; tid < nthreads; tid++) {
+		bs.next[tid].clear();
+		bs.next[tid].reserveExact(bs.cap);
+	}
+	bs.groups.reserveExact(bs.cap * nthreads);
+	bs.scan.resizeExact(nthreads);
+	size_t rounds = 0;
+	bs.h = 1;
+	// Whether bs.next holds all of the next round's groups
+	bool listed = findGroups(nthreads, true);
+	while(true) {
+		takeGroups(nthreads);
+		if(bs.groups.empty()) break;
+		rounds++;
+		bs.record = listed;
+		splitGroups(nthreads);
+		if(listed) {
+			// A full list may have had to leave groups out
+			for(int tid = 0; tid < nthreads; tid++) {
+				if(bs.next[tid].size() >= bs.cap) listed = false;
+			}
+		} else {
+			bool done;
+			do {
+				done = findGroups(nthreads, false);
+				takeGroups(nthreads);
+				splitGroups(nthreads);
+			} while(!done);
+		}
+		bs.h *= 2;
+		if(!listed) listed = findGroups(nthreads, true);
+	}
+	// The sample outlives the rest of the build; free the lists
+	{
+		EList<DcsGroup> dead;
+		dead.xfer(bs.groups);
+		ELList<DcsGroup> deadNext;
+		deadNext.xfer(bs.next);
+	}
+	return rounds;
+}
+
+/**
+ * List the tied groups under the current ranks, up to bs.cap per
+ * thread, starting from each thread's first sample if 'restart' or
+ * else from where the last call left off.  Returns true iff the scan
+ * has reached the last sample, i.e. no group is left to list.
+ */
+template <typename TStr>
+bool DifferenceCoverSample<TStr>::findGroups(int nthreads, bool restart) {
+	DcsBuildState& bs = _bs;
+	for(int tid = 0; tid < nthreads; tid++) {
+		bs.next[tid].clear();
+		if(restart) bs.scan[tid] = bs.n * tid / nthreads;
+	}
+	runPhase(DCS_GROUPS, nthreads);
+	bool done = true;
+	for(int tid = 0; tid < nthreads; tid++) {
+		if(bs.scan[tid] < bs.n * (tid + 1) / nthreads) done = false;
+	}
+	return done;
+}
+
+/**
+ * Move the groups the threads listed into bs.groups.
+ */
+template <typename TStr>
+void DifferenceCoverSample<TStr>::takeGroups(int nthreads) {
+	DcsBuildState& bs = _bs;
+	bs.groups.clear();
+	for(int tid = 0; tid < nthreads; tid++) {
+		for(size_t i = 0; i < bs.next[tid].size(); i++) {
+			bs.groups.push_back(bs.next[tid][i]);
+		}
+		bs.next[tid].clear();
+	}
+}
+
+/**
+ * Sort the groups in bs.groups by the ranks h rows on, split them and
+ * give the pieces their new ranks.
+ */
+template <typename TStr>
+void DifferenceCoverSample<TStr>::splitGroups(int nthreads) {
+	DcsBuildState& bs = _bs;
+	if(bs.groups.empty()) return;
+	bs.grab = std::max<size_t>(1, bs.groups.size() / (64 * nthreads));
+	bs.cur = 0;
+	runPhase(DCS_SORT, nthreads);
+	bs.cur = 0;
+	runPhase(DCS_UPDATE, nthreads);
+}
+
 /**
  * Calculates a ranking of all suffixes in the sample and stores them,
  * packed according to the mu mapping, in _isaPrime.
+ *
+ * Each phase runs on all threads: building sPrime, bucketing the
+ * samples by their first few characters, v-sorting the buckets,
+ * ranking the sorted samples and, in place of Larsson-Sadakane,
+ * refining the ranks until they're unique.  With one thread the
+ * samples are v-sorted in one go and Larsson-Sadakane finishes the job.
  */
 template <typename TStr>
 void DifferenceCoverSample<TStr>::build(int nthreads) {
@@ -749,144 +1218,152 @@ void DifferenceCoverSample<TStr>::build(int nthreads) {
 	const TStr& t = this->text();
 	uint32_t v = this->v();
 	assert_gt(v, 2);
+	if(nthreads < 1) nthreads = 1;
 	// Build s'
 	EList<TIndexOffU> sPrime;
 	// Need to allocate 2 extra elements at the end of the sPrime and _isaPrime
 	// arrays.  One element that's less than all others, and another that acts
 	// as needed padding for the Larsson-Sadakane sorting code.
 	size_t padding = 1;
-	VMSG_NL("  Building sPrime");
-	buildSPrime(sPrime, padding);
+	{
+		Timer timer(cout, "  Building sPrime time: ", this->verbose());
+		VMSG_NL("  Building sPrime");
+		buildSPrime(sPrime, padding, nthreads);
+	}
 	size_t sPrimeSz = sPrime.size() - padding;
 	assert_gt(sPrime.size(), padding);
 	assert_leq(sPrime.size(), t.length() + padding + 1);
-	TIndexOffU nextRank = 0;
-	{
+	_bs.n = sPrimeSz;
+	EList<TIndexOffU> sPrimeOrder;
+	EList<size_t> boundaries; // bucket boundaries for parallelization
+	TIndexOffU *sOrig = NULL;
+	if(this->sanityCheck() && nthreads > 1) {
+		sOrig = new TIndexOffU[sPrimeSz];
+		memcpy(sOrig, sPrime.ptr(), OFF_SIZE * sPrimeSz);
+	}
+	if(nthreads == 1) {
 		VMSG_NL("  Building sPrimeOrder");
-		EList<TIndexOffU> sPrimeOrder;
 		sPrimeOrder.resizeExact(sPrimeSz);
 		for(TIndexOffU i = 0; i < sPrimeSz; i++) {
 			sPrimeOrder[i] = i;
 		}
-		// sPrime now holds suffix-offsets for DC samples.
-		{
-			Timer timer(cout, "  V-Sorting samples time: ", this->verbose());
-			VMSG_NL("  V-Sorting samples");
-			// Extract backing-store array from sPrime and sPrimeOrder;
-			// the mkeyQSortSuf2 routine works on the array for maximum
-			// efficiency
-			TIndexOffU *sPrimeArr = (TIndexOffU*)sPrime.ptr();
-			assert_eq(sPrimeArr[0], sPrime[0]);
-			assert_eq(sPrimeArr[sPrimeSz-1], sPrime[sPrimeSz-1]);
-			TIndexOffU *sPrimeOrderArr = (TIndexOffU*)sPrimeOrder.ptr();
-			assert_eq(sPrimeOrderArr[0], sPrimeOrder[0]);
-			assert_eq(sPrimeOrderArr[sPrimeSz-1], sPrimeOrder[sPrimeSz-1]);
-			// Sort sample suffixes up to the vth character using a
-			// multikey quicksort.  Sort time is proportional to the
-			// number of samples times v.  It isn't quadratic.
-			// sPrimeOrder is passed in as a swapping partner for
-			// sPrimeArr, i.e., every time the multikey qsort swaps
-			// elements in sPrime, it swaps the same elements in
-			// sPrimeOrder too.  This allows us to easily reconstruct
-			// what the sort did.
-			if(nthreads == 1) {
-				mkeyQSortSuf2(t, sPrimeArr, sPrimeSz, sPrimeOrderArr, 4,
-				              this->verbose(), this->sanityCheck(), v);
-			} else {
-				int query_depth = 0;
-				int tmp_nthreads = nthreads;
-				while(tmp_nthreads > 0) {
-					query_depth++;
-					tmp_nthreads >>= 1;
-				}
-				EList<size_t> boundaries; // bucket boundaries for parallelization
-				TIndexOffU *sOrig = NULL;
-				if(this->sanityCheck()) {
-					sOrig = new TIndexOffU[sPrimeSz];
-					memcpy(sOrig, sPrimeArr, OFF_SIZE * sPrimeSz);
-				}
-				mkeyQSortSuf2(t, sPrimeArr, sPrimeSz, sPrimeOrderArr, 4,
-				              this->verbose(), false, query_depth, &boundaries);
-				if(boundaries.size() > 0) {
+	} else {
+		Timer timer(cout, "  Bucketing samples time: ", this->verbose());
+		VMSG_NL("  Bucketing samples");
+		bucketSamples(sPrime, sPrimeOrder, boundaries, nthreads);
+	}
+	// sPrime now holds suffix-offsets for DC samples.
+	{
+		Timer timer(cout, "  V-Sorting samples time: ", this->verbose());
+		VMSG_NL("  V-Sorting samples");
+		// Extract backing-store array from sPrime and sPrimeOrder;
+		// the mkeyQSortSuf2 routine works on the array for maximum
+		// efficiency
+		TIndexOffU *sPrimeArr = (TIndexOffU*)sPrime.ptr();
+		assert_eq(sPrimeArr[0], sPrime[0]);
+		assert_eq(sPrimeArr[sPrimeSz-1], sPrime[sPrimeSz-1]);
+		TIndexOffU *sPrimeOrderArr = (TIndexOffU*)sPrimeOrder.ptr();
+		assert_eq(sPrimeOrderArr[0], sPrimeOrder[0]);
+		assert_eq(sPrimeOrderArr[sPrimeSz-1], sPrimeOrder[sPrimeSz-1]);
+		// Sort sample suffixes up to the vth character using a
+		// multikey quicksort.  Sort time is proportional to the
+		// number of samples times v.  It isn't quadratic.
+		// sPrimeOrder is passed in as a swapping partner for
+		// sPrimeArr, i.e., every time the multikey qsort swaps
+		// elements in sPrime, it swaps the same elements in
+		// sPrimeOrder too.  This allows us to easily reconstruct
+		// what the sort did.
+		if(nthreads == 1) {
+			mkeyQSortSuf2(t, sPrimeArr, sPrimeSz, sPrimeOrderArr, 4,
+			              this->verbose(), this->sanityCheck(), v);
+		} else {
+			// Sort each bucket past the characters it was bucketed on
+			if(boundaries.size() > 0) {
 #ifdef WITH_TBB
-					tbb::task_group tbb_grp;
+				tbb::task_group tbb_grp;
 #else
-					AutoArray<tthread::thread*> threads(nthreads);
+				AutoArray<tthread::thread*> threads(nthreads);
 #endif
-					EList<VSortingParam<TStr> > tparams;
-					size_t cur = 0;
-					MUTEX_T mutex;
-					tparams.resize(nthreads);
-					for(int tid = 0; tid < nthreads; tid++) {
-						// Calculate bucket sizes by doing a binary search for each
-						// suffix and noting where it lands
-						tparams[tid].dcs = this;
-						tparams[tid].sPrimeArr = sPrimeArr;
-						tparams[tid].sPrimeSz = sPrimeSz;
-						tparams[tid].sPrimeOrderArr = sPrimeOrderArr;
-						tparams[tid].depth = query_depth;
-						tparams[tid].boundaries = &boundaries;
-						tparams[tid].cur = &cur;
-						tparams[tid].mutex = &mutex;
+				EList<VSortingParam<TStr> > tparams;
+				size_t cur = 0;
+				MUTEX_T mutex;
+				tparams.resize(nthreads);
+				for(int tid = 0; tid < nthreads; tid++) {
+					// Calculate bucket sizes by doing a binary search for each
+					// suffix and noting where it lands
+					tparams[tid].dcs = this;
+					tparams[tid].sPrimeArr = sPrimeArr;
+					tparams[tid].sPrimeSz = sPrimeSz;
+					tparams[tid].sPrimeOrderArr = sPrimeOrderArr;
+					tparams[tid].depth = _bs.bdepth;
+					tparams[tid].boundaries = &boundaries;
+					tparams[tid].cur = &cur;
+					tparams[tid].mutex = &mutex;
 #ifdef WITH_TBB
-						tbb_grp.run(VSorting_worker<TStr>(((void*)&tparams[tid])));
-					}
-					tbb_grp.wait();
+					tbb_grp.run(VSorting_worker<TStr>(((void*)&tparams[tid])));
+				}
+				tbb_grp.wait();
 #else
-						threads[tid] = new tthread::thread(VSorting_worker<TStr>, (void*)&tparams[tid]);
-					}
-					for (int tid = 0; tid < nthreads; tid++) {
-						threads[tid]->join();
-					}
-#endif
+					threads[tid] = new tthread::thread(VSorting_worker<TStr>, (void*)&tparams[tid]);
 				}
-				if(this->sanityCheck()) {
-					sanityCheckOrderedSufs(t, t.length(), sPrimeArr, sPrimeSz, v);
-					for(size_t i = 0; i < sPrimeSz; i++) {
-						assert_eq(sPrimeArr[i], sOrig[sPrimeOrderArr[i]]);
-					}
-					delete[] sOrig;
+				for (int tid = 0; tid < nthreads; tid++) {
+					threads[tid]->join();
+					delete threads[tid];
 				}
+#endif
 			}
-			// Make sure sPrime and sPrimeOrder are consistent with
-			// their respective backing-store arrays
-			assert_eq(sPrimeArr[0], sPrime[0]);
-			assert_eq(sPrimeArr[sPrimeSz-1], sPrime[sPrimeSz-1]);
-			assert_eq(sPrimeOrderArr[0], sPrimeOrder[0]);
-			assert_eq(sPrimeOrderArr[sPrimeSz-1], sPrimeOrder[sPrimeSz-1]);
-		}
-		// Now assign the ranking implied by the sorted sPrime/sPrimeOrder
-		// arrays back into sPrime.
-		VMSG_NL("  Allocating rank array");
-		_isaPrime.resizeExact(sPrime.size());
-		ASSERT_ONLY(_isaPrime.fill(OFF_MASK));
-		assert_gt(_isaPrime.size(), 0);
-		{
-			Timer timer(cout, "  Ranking v-sort output time: ", this->verbose());
-			VMSG_NL("  Ranking v-sort output");
-			for(size_t i = 0; i < sPrimeSz-1; i++) {
-				// Place the appropriate ranking
-				_isaPrime[sPrimeOrder[i]] = nextRank;
-				// If sPrime[i] and sPrime[i+1] are identical up to v, then we
-				// should give the next suffix the same rank
-				if(!suffixSameUpTo(t, sPrime[i], sPrime[i+1], v)) nextRank++;
+			if(this->sanityCheck()) {
+				sanityCheckOrderedSufs(t, t.length(), sPrimeArr, sPrimeSz, v);
+				for(size_t i = 0; i < sPrimeSz; i++) {
+					assert_eq(sPrimeArr[i], sOrig[sPrimeOrderArr[i]]);
+				}
+				delete[] sOrig;
 			}
-			_isaPrime[sPrimeOrder[sPrimeSz-1]] = nextRank; // finish off
+		}
+		// Make sure sPrime and sPrimeOrder are consistent with
+		// their respective backing-store arrays
+		assert_eq(sPrimeArr[0], sPrime[0]);
+		assert_eq(sPrimeArr[sPrimeSz-1], sPrime[sPrimeSz-1]);
+		assert_eq(sPrimeOrderArr[0], sPrimeOrder[0]);
+		assert_eq(sPrimeOrderArr[sPrimeSz-1], sPrimeOrder[sPrimeSz-1]);
+	}
+	// Now assign the ranking implied by the sorted sPrime/sPrimeOrder
+	// arrays back into sPrime.
+	VMSG_NL("  Allocating rank array");
+	_isaPrime.resizeExact(sPrime.size());
+	ASSERT_ONLY(_isaPrime.fill(OFF_MASK));
+	assert_gt(_isaPrime.size(), 0);
+	{
+		Timer timer(cout, "  Ranking v-sort output time: ", this->verbose());
+		VMSG_NL("  Ranking v-sort output");
+		// Samples identical up to v share the rank of the first of them
+		_bs.sPrime = sPrime.ptr();
+		_bs.order = sPrimeOrder.ptr();
+		_bs.isa = _isaPrime.ptr();
+		_bs.carry.resizeExact(nthreads);
+		runPhase(DCS_RANK, nthreads);
+		for(int tid = 1; tid < nthreads; tid++) {
+			if(_bs.carry[tid] == OFF_MASK) _bs.carry[tid] = _bs.carry[tid-1];
+		}
+		runPhase(DCS_RANK_FIX, nthreads);
 #ifndef NDEBUG
-			for(size_t i = 0; i < sPrimeSz; i++) {
-				assert_neq(OFF_MASK, _isaPrime[i]);
-				assert_lt(_isaPrime[i], sPrimeSz);
-			}
-#endif
+		for(size_t i = 0; i < sPrimeSz; i++) {
+			assert_neq(OFF_MASK, _isaPrime[i]);
+			assert_lt(_isaPrime[i], sPrimeSz);
 		}
-		// sPrimeOrder is destroyed
-		// All the information we need is now in _isaPrime
+#endif
 	}
 	_isaPrime[_isaPrime.size()-1] = (TIndexOffU)sPrimeSz;
 	sPrime[sPrime.size()-1] = (TIndexOffU)sPrimeSz;
-	// _isaPrime[_isaPrime.size()-1] and sPrime[sPrime.size()-1] are just
-	// spacer for the Larsson-Sadakane routine to use
-	{
+	if(nthreads == 1) {
+		{
+			// sPrimeOrder is destroyed
+			// All the information we need is now in _isaPrime
+			EList<TIndexOffU> dead;
+			dead.xfer(sPrimeOrder);
+		}
+		// _isaPrime[_isaPrime.size()-1] and sPrime[sPrime.size()-1] are just
+		// spacer for the Larsson-Sadakane routine to use
 		Timer timer(cout, "  Invoking Larsson-Sadakane on ranks time: ", this->verbose());
 		VMSG_NL("  Invoking Larsson-Sadakane on ranks");
 		if(sPrime.size() >= LS_SIZE) {
@@ -900,12 +1377,20 @@ void DifferenceCoverSample<TStr>::build(int nthreads) {
 			(TIndexOff)sPrimeSz,
 			(TIndexOff)sPrime.size(),
 			0);
+		// Larsson-Sadakane ranks from 1; 0 is its terminator
+		for(size_t i = 0; i < sPrimeSz; i++) {
+			_isaPrime[i]--;
+		}
+	} else {
+		// sPrime is scratch space from here on
+		Timer timer(cout, "  Refining ranks time: ", this->verbose());
+		VMSG_NL("  Refining ranks");
+		size_t rounds = refineRanks(nthreads);
+		VMSG_NL("  Refined ranks in " << rounds << " rounds");
 	}
+	_bs.sPrime = _bs.order = _bs.isa = NULL;
 	// chop off final character of _isaPrime
 	_isaPrime.resizeExact(sPrimeSz);
-	for(size_t i = 0; i < _isaPrime.size(); i++) {
-		_isaPrime[i]--;
-	}
 #ifndef NDEBUG
 	for(size_t i = 0; i < sPrimeSz-1; i++) {
 		assert_lt(_isaPrime[i], sPrimeSz);
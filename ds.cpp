@@ -25,26 +25,36 @@ MemoryTally gMemTally;
  * Tally a memory allocation of size amt bytes.
  */
 void MemoryTally::add(int cat, uint64_t amt) {
-	ThreadSafe ts(mutex_m);
-	tots_[cat] += amt;
-	tot_ += amt;
-	if(tots_[cat] > peaks_[cat]) {
-		peaks_[cat] = tots_[cat];
-	}
-	if(tot_ > peak_) {
-		peak_ = tot_;
-	}
+	// Atomic updates rather than a lock, since every tallied
+	// allocation in every thread comes through here
+	uint64_t cattot = __sync_add_and_fetch(&tots_[cat], amt);
+	uint64_t tot = __sync_add_and_fetch(&tot_, amt);
+	raise(peaks_[cat], cattot);
+	raise(peak_, tot);
 }
 
 /**
  * Tally a memory free of size amt bytes.
  */
 void MemoryTally::del(int cat, uint64_t amt) {
-	ThreadSafe ts(mutex_m);
 	assert_geq(tots_[cat], amt);
 	assert_geq(tot_, amt);
-	tots_[cat] -= amt;
-	tot_ -= amt;
+	__sync_sub_and_fetch(&tots_[cat], amt);
+	__sync_sub_and_fetch(&tot_, amt);
+}
+
+/**
+ * Raise 'peak' to 'val' if it's lower.
+ */
+void MemoryTally::raise(volatile uint64_t& peak, uint64_t val) {
+	uint64_t cur = peak;
+	while(val > cur) {
+		uint64_t prev = __sync_val_compare_and_swap(&peak, cur, val);
+		if(prev == cur) {
+			break;
+		}
+		cur = prev;
+	}
 }
 	
 #ifdef MAIN_DS
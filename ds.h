@@ -39,8 +39,9 @@ class MemoryTally {
 public:
 
 	MemoryTally() : tot_(0), peak_(0) {
-		memset(tots_,  0, 256 * sizeof(uint64_t));
-		memset(peaks_, 0, 256 * sizeof(uint64_t));
+		for(int i = 0; i < 256; i++) {
+			tots_[i] = peaks_[i] = 0;
+		}
 	}
 
 	/**
@@ -92,11 +93,15 @@ public:
 
 protected:
 
-	MUTEX_T mutex_m;
-	uint64_t tots_[256];
-	uint64_t tot_;
-	uint64_t peaks_[256];
-	uint64_t peak_;
+	/**
+	 * Raise 'peak' to 'val' if it's lower.
+	 */
+	static void raise(volatile uint64_t& peak, uint64_t val);
+
+	volatile uint64_t tots_[256];
+	volatile uint64_t tot_;
+	volatile uint64_t peaks_[256];
+	volatile uint64_t peak_;
 };
 
 #ifdef USE_MEM_TALLY
@@ -923,7 +928,7 @@ private:
 		T* tmp = new T[sz];
 		assert(tmp != NULL);
 #ifdef USE_MEM_TALLY
-		gMemTally.add(cat_, sz);
+		gMemTally.add(cat_, sizeof(T) * sz);
 #endif
 		allocCat_ = cat_;
 		return tmp;
@@ -939,7 +944,7 @@ private:
 			assert_eq(allocCat_, cat_);
 			delete[] list_;
 #ifdef USE_MEM_TALLY
-			gMemTally.del(cat_, sz_);
+			gMemTally.del(cat_, sizeof(T) * sz_);
 #endif
 			list_ = NULL;
 			sz_ = cur_ = 0;
@@ -1289,7 +1294,7 @@ protected:
 		assert_gt(sz, 0);
 		EList<T, S1> *tmp = new EList<T, S1>[sz];
 #ifdef USE_MEM_TALLY
-		gMemTally.add(cat_, sz);
+		gMemTally.add(cat_, sizeof(EList<T, S1>) * sz);
 #endif
 		if(cat_ != 0) {
 			for(size_t i = 0; i < sz; i++) {
@@ -1308,7 +1313,7 @@ protected:
 		if(list_ != NULL) {
 			delete[] list_;
 #ifdef USE_MEM_TALLY
-			gMemTally.del(cat_, sz_);
+			gMemTally.del(cat_, sizeof(EList<T, S1>) * sz_);
 #endif
 			list_ = NULL;
 		}
@@ -1629,7 +1634,7 @@ protected:
 		assert_gt(sz, 0);
 		ELList<T, S1, S2> *tmp = new ELList<T, S1, S2>[sz];
 #ifdef USE_MEM_TALLY
-		gMemTally.add(cat_, sz);
+		gMemTally.add(cat_, sizeof(ELList<T, S1, S2>) * sz);
 #endif
 		if(cat_ != 0) {
 			for(size_t i = 0; i < sz; i++) {
@@ -1648,7 +1653,7 @@ protected:
 		if(list_ != NULL) {
 			delete[] list_;
 #ifdef USE_MEM_TALLY
-			gMemTally.del(cat_, sz_);
+			gMemTally.del(cat_, sizeof(ELList<T, S1, S2>) * sz_);
 #endif
 			list_ = NULL;
 		}
@@ -1924,7 +1929,7 @@ private:
 		assert_gt(sz, 0);
 		T *tmp = new T[sz];
 #ifdef USE_MEM_TALLY
-		gMemTally.add(cat_, sz);
+		gMemTally.add(cat_, sizeof(T) * sz);
 #endif
 		return tmp;
 	}
@@ -1937,7 +1942,7 @@ private:
 		if(list_ != NULL) {
 			delete[] list_;
 #ifdef USE_MEM_TALLY
-			gMemTally.del(cat_, sz_);
+			gMemTally.del(cat_, sizeof(T) * sz_);
 #endif
 			list_ = NULL;
 		}
@@ -2323,7 +2328,7 @@ protected:
 		assert_gt(sz, 0);
 		ESet<T> *tmp = new ESet<T>[sz];
 #ifdef USE_MEM_TALLY
-		gMemTally.add(cat_, sz);
+		gMemTally.add(cat_, sizeof(ESet<T>) * sz);
 #endif
 		if(cat_ != 0) {
 			for(size_t i = 0; i < sz; i++) {
@@ -2342,7 +2347,7 @@ protected:
 		if(list_ != NULL) {
 			delete[] list_;
 #ifdef USE_MEM_TALLY
-			gMemTally.del(cat_, sz_);
+			gMemTally.del(cat_, sizeof(ESet<T>) * sz_);
 #endif
 			list_ = NULL;
 		}
@@ -2597,7 +2602,7 @@ private:
 		assert_gt(sz, 0);
 		std::pair<K, V> *tmp = new std::pair<K, V>[sz];
 #ifdef USE_MEM_TALLY
-		gMemTally.add(cat_, sz);
+		gMemTally.add(cat_, sizeof(std::pair<K, V>) * sz);
 #endif
 		return tmp;
 	}
@@ -2610,7 +2615,7 @@ private:
 		if(list_ != NULL) {
 			delete[] list_;
 #ifdef USE_MEM_TALLY
-			gMemTally.del(cat_, sz_);
+			gMemTally.del(cat_, sizeof(std::pair<K, V>) * sz_);
 #endif
 			list_ = NULL;
 		}
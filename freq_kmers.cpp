@@ -0,0 +1,157 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "freq_kmers.h"
+
+using namespace std;
+
+static const char     kmerMagic[8]  = { 'B', 'T', '2', 'K', 'M', 'E', 'R', '\0' };
+static const uint32_t kmerVersion   = 2;
+
+/**
+ * File header, followed by 'n' Entry records sorted by k-mer.  Words
+ * are in the byte order of the machine that wrote the file.
+ */
+struct FreqKmerHeader {
+	char     magic[8];
+	uint32_t version;
+	uint32_t k;
+	uint64_t index;   // fingerprint of the forward index
+	uint64_t minFreq;
+	uint64_t n;
+};
+
+uint64_t FreqKmerTable::indexFingerprint(
+	TIndexOffU len,
+	TIndexOffU zOff,
+	const TIndexOffU *fchr)
+{
+	// FNV-1a over the words
+	uint64_t h = 0xcbf29ce484222325ull;
+	h = (h ^ len) * 0x100000001b3ull;
+	h = (h ^ zOff) * 0x100000001b3ull;
+	for(int i = 0; i < 5; i++) {
+		h = (h ^ fchr[i]) * 0x100000001b3ull;
+	}
+	return h;
+}
+
+bool FreqKmerTable::load(const string& fname, uint64_t index) {
+	ents_.clear();
+	k_ = 0;
+	minFreq_ = 0;
+	FILE *f = fopen(fname.c_str(), "rb");
+	if(f == NULL) {
+		return false;
+	}
+	FreqKmerHeader h;
+	if(fread(&h, sizeof(h), 1, f) != 1 ||
+	   memcmp(h.magic, kmerMagic, sizeof(kmerMagic)) != 0 ||
+	   h.version != kmerVersion ||
+	   h.index != index ||
+	   h.k == 0 || h.k > 32)
+	{
+		fclose(f);
+		return false;
+	}
+	ents_.resizeExact((size_t)h.n);
+	if(h.n > 0 && fread(ents_.ptr(), sizeof(Entry), (size_t)h.n, f) != h.n) {
+		ents_.clear();
+		fclose(f);
+		return false;
+	}
+	fclose(f);
+	k_ = (int)h.k;
+	minFreq_ = h.minFreq;
+	return true;
+}
+
+bool FreqKmerTable::write(
+	const string& fname,
+	uint64_t index,
+	int k,
+	uint64_t minFreq,
+	EList<Entry>& ents)
+{
+	ents.sort();
+	FILE *f = fopen(fname.c_str(), "wb");
+	if(f == NULL) {
+		return false;
+	}
+	FreqKmerHeader h;
+	memcpy(h.magic, kmerMagic, sizeof(kmerMagic));
+	h.version = kmerVersion;
+	h.k = (uint32_t)k;
+	h.index = index;
+	h.minFreq = minFreq;
+	h.n = ents.size();
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1;
+	if(ok && !ents.empty()) {
+		ok = fwrite(ents.ptr(), sizeof(Entry), ents.size(), f) == ents.size();
+	}
+	if(fclose(f) != 0) {
+		ok = false;
+	}
+	return ok;
+}
+
+uint64_t FreqKmerTable::count(uint64_t kmer) const {
+	size_t lo = 0, hi = ents_.size();
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(ents_[mid].kmer < kmer) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if(lo < ents_.size() && ents_[lo].kmer == kmer) {
+		return ents_[lo].count;
+	}
+	return 0;
+}
+
+uint64_t FreqKmerTable::estimate(const BTDnaString& seq) const {
+	size_t len = seq.length();
+	if(k_ == 0 || len < (size_t)k_) {
+		return 0;
+	}
+	uint64_t mask = (k_ == 32) ? ~(uint64_t)0 : (((uint64_t)1 << (2 * k_)) - 1);
+	uint64_t kmer = 0, best = 0;
+	for(size_t i = 0; i < len; i++) {
+		int c = (int)seq[i];
+		if(c > 3) {
+			return 0;
+		}
+		kmer = ((kmer << 2) | (uint64_t)c) & mask;
+		if(i + 1 < (size_t)k_) {
+			continue;
+		}
+		uint64_t cnt = count(kmer);
+		if(cnt == 0) {
+			return 0;
+		}
+		if(best == 0 || cnt < best) {
+			best = cnt;
+		}
+	}
+	return best;
+}
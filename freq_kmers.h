@@ -0,0 +1,113 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FREQ_KMERS_H_
+#define FREQ_KMERS_H_
+
+#include <stdint.h>
+#include <string>
+#include "ds.h"
+#include "sstring.h"
+#include "mem_ids.h"
+#include "btypes.h"
+
+/**
+ * Table of the k-mers occurring at least 'minFreq' times in the
+ * reference, with their counts, written by bowtie2-build --freq-kmers
+ * to <base>.kmer.bt2 and read by bowtie2 --skip-freq-seeds.  The
+ * aligner uses it to recognize seeds that fall in high-copy repeats
+ * (satellites, Alus, rDNA) before searching them, since their hits
+ * cost far more to resolve and extend than they can contribute.
+ *
+ * A k-mer is packed 2 bits per character with its last character in
+ * the least significant bits.  Entries are sorted by k-mer.  The file
+ * records a fingerprint of the forward index it was made from, so a
+ * table left over from an earlier build isn't used with a new index.
+ */
+class FreqKmerTable {
+
+public:
+
+	struct Entry {
+		uint64_t kmer;
+		uint64_t count;
+
+		bool operator<(const Entry& o) const {
+			return kmer < o.kmer;
+		}
+	};
+
+	FreqKmerTable() : k_(0), minFreq_(0), ents_(MISC_CAT) { }
+
+	/**
+	 * Return the fingerprint of a forward index with text length
+	 * 'len', '$' at BWT row 'zOff' and character counts 'fchr' (5
+	 * elements), as written to and checked against the file.
+	 */
+	static uint64_t indexFingerprint(
+		TIndexOffU len,
+		TIndexOffU zOff,
+		const TIndexOffU *fchr);
+
+	/**
+	 * Read the table from 'fname'.  Returns false, leaving the table
+	 * empty, if the file can't be opened, isn't a k-mer table or was
+	 * made from an index other than the one with fingerprint 'index'.
+	 */
+	bool load(const std::string& fname, uint64_t index);
+
+	/**
+	 * Sort 'ents' and write them as a table of 'k'-mers occurring at
+	 * least 'minFreq' times in the index with fingerprint 'index' to
+	 * 'fname'.  Returns false on I/O error.
+	 */
+	static bool write(
+		const std::string& fname,
+		uint64_t index,
+		int k,
+		uint64_t minFreq,
+		EList<Entry>& ents);
+
+	/**
+	 * Return the number of times the packed k-mer occurs in the
+	 * reference, or 0 if it occurs fewer than minFreq() times.
+	 */
+	uint64_t count(uint64_t kmer) const;
+
+	/**
+	 * Return an upper bound on the number of times 'seq' occurs in the
+	 * reference: the smallest count among its k-mers.  Returns 0 if
+	 * any of them is rarer than minFreq() or contains an N, or if
+	 * 'seq' is shorter than k().
+	 */
+	uint64_t estimate(const BTDnaString& seq) const;
+
+	bool     empty()   const { return ents_.empty(); }
+	size_t   size()    const { return ents_.size(); }
+	int      k()       const { return k_; }
+	uint64_t minFreq() const { return minFreq_; }
+
+protected:
+
+	int          k_;       // k-mer length
+	uint64_t     minFreq_; // k-mers rarer than this are left out
+	EList<Entry> ents_;    // sorted by k-mer
+};
+
+#endif /*ndef FREQ_KMERS_H_*/
@@ -87,6 +87,7 @@
 #include "read.h"
 #include "reference.h"
 #include "mem_ids.h"
+#include "sa_cache.h"
 
 /**
  * Encapsulate an SA range and an associated list of slots where the resolved
@@ -175,6 +176,7 @@ struct WalkMetrics {
 	 */
 	void reset() {
 		bwops = branches = resolves = refresolves = reports = 0;
+		sacHits = sacMisses = 0;
 	}
 
 	uint64_t bwops;       // Burrows-Wheeler operations
@@ -182,6 +184,8 @@ struct WalkMetrics {
 	uint64_t resolves;    // # offs resolved with BW walk-left
 	uint64_t refresolves; // # resolutions caused by reference scanning
 	uint64_t reports;     // # offs reported (1 can be reported many times)
+	uint64_t sacHits;     // # offs found in the SAOffsetCache
+	uint64_t sacMisses;   // # offs looked up in the SAOffsetCache but not found
 	MUTEX_T mutex_m;
 
 private:
@@ -195,6 +199,8 @@ private:
 		resolves += m.resolves;
 		refresolves += m.refresolves;
 		reports += m.reports;
+		sacHits += m.sacHits;
+		sacMisses += m.sacMisses;
 	}
 };
 
@@ -510,14 +516,29 @@ public:
 				// Elt not resolved yet; try to resolve it now
 				TIndexOffU bwrow = (TIndexOff)(top - mapi_ + i);
 				TIndexOffU toff = ebwt.tryOffset(bwrow);
-				ASSERT_ONLY(TIndexOffU origBwRow = sa.topf + map(i));
+				TIndexOffU origBwRow = sa.topf + map(i);
 				assert_eq(bwrow, ebwt.walkLeft(origBwRow, step));
-				if(toff != OFF_MASK) {
+				SAOffsetCache *sac = ebwt.saCache();
+				if(toff == OFF_MASK && step == 0 && sac != NULL) {
+					// Some other read may already have walked this row
+					toff = sac->lookup(bwrow);
+					if(toff != OFF_MASK) {
+						assert_eq(toff, ebwt.getOffset(bwrow));
+						met.sacHits++;
+						setOff(i, toff, sa, met);
+						if(!reportList) ret.first++;
+					} else {
+						met.sacMisses++;
+					}
+				} else if(toff != OFF_MASK) {
 					// Yes, toff was resolvable
 					assert_eq(toff, ebwt.getOffset(bwrow));
 					met.resolves++;
 					toff += step;
 					assert_eq(toff, ebwt.getOffset(origBwRow));
+					if(step > 0 && sac != NULL) {
+						sac->insert(origBwRow, toff);
+					}
 					setOff(i, toff, sa, met);
 					if(!reportList) ret.first++;
 #if 0
@@ -0,0 +1,202 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hugepage.h"
+
+#ifdef BOWTIE_MM
+#include <sys/mman.h>
+#endif
+
+using namespace std;
+
+static const size_t HUGE_SZ_2M = (size_t)1 << 21;
+static const size_t HUGE_SZ_1G = (size_t)1 << 30;
+
+static inline size_t roundUp(size_t x, size_t a) {
+	return (x + a - 1) & ~(a - 1);
+}
+
+#ifdef BOWTIE_MM
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+/**
+ * Map 'len' bytes (a multiple of 1 << 'shift') from the hugetlbfs pool
+ * with pages of size 1 << 'shift'.  Returns NULL if the pool can't
+ * satisfy the request or the kernel doesn't support it.
+ */
+static void* mapHugetlb(size_t len, int shift) {
+#ifdef MAP_HUGETLB
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT);
+	void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+	return (p == MAP_FAILED) ? NULL : p;
+#else
+	(void)len; (void)shift;
+	return NULL;
+#endif
+}
+
+/**
+ * Map 'len' bytes (a multiple of 2MB) of ordinary anonymous memory
+ * starting on a 2MB boundary, so that every 2MB extent is eligible for
+ * a transparent huge page.
+ */
+static void* mapAligned(size_t len) {
+	size_t slack = HUGE_SZ_2M;
+	char *p = (char*)mmap(NULL, len + slack, PROT_READ | PROT_WRITE,
+	                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(p == (char*)MAP_FAILED) {
+		return NULL;
+	}
+	char *q = (char*)roundUp((size_t)p, HUGE_SZ_2M);
+	// Trim the unaligned head and the leftover tail
+	if(q > p) {
+		munmap(p, q - p);
+	}
+	if(p + slack > q) {
+		munmap(q + len, (p + slack) - q);
+	}
+	return q;
+}
+
+#endif
+
+void* allocHugePages(
+	size_t len,
+	int mode,
+	HugePageRegion& r,
+	const char *memName,
+	bool verbose)
+{
+	r.reset();
+	r.req = len;
+	if(len == 0) len = 1;
+#ifdef BOWTIE_MM
+	// Arrays much smaller than a huge page aren't worth a whole one;
+	// hugetlbfs pages in particular are a scarce, preallocated pool.
+	if(mode == HUGEPAGES_1G && len >= HUGE_SZ_1G / 2) {
+		size_t mlen = roundUp(len, HUGE_SZ_1G);
+		if((r.p = mapHugetlb(mlen, 30)) != NULL) {
+			r.len = mlen;
+			r.backing = HUGEPAGE_BACKING_1G;
+		}
+	}
+	if(r.p == NULL && mode != HUGEPAGES_OFF && len >= HUGE_SZ_2M / 2) {
+		size_t mlen = roundUp(len, HUGE_SZ_2M);
+		if((r.p = mapHugetlb(mlen, 21)) != NULL) {
+			r.len = mlen;
+			r.backing = HUGEPAGE_BACKING_2M;
+		} else if((r.p = mapAligned(mlen)) != NULL) {
+			r.len = mlen;
+#ifdef MADV_HUGEPAGE
+			if(madvise(r.p, mlen, MADV_HUGEPAGE) == 0) {
+				r.backing = HUGEPAGE_BACKING_THP;
+			}
+#endif
+		}
+	}
+	if(r.p == NULL) {
+		size_t mlen = roundUp(len, (size_t)4096);
+		void *p = mmap(NULL, mlen, PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p != MAP_FAILED) {
+			r.p = p;
+			r.len = mlen;
+		}
+	}
+#else
+	(void)mode;
+	if((r.p = malloc(len)) != NULL) {
+		r.len = len;
+	}
+#endif
+	if(verbose && r.p != NULL) {
+		cerr << "  Allocated " << r.req << " bytes for " << memName
+		     << " using " << hugePageBackingName(r.backing) << endl;
+	}
+	return r.p;
+}
+
+void freeHugePages(HugePageRegion& r) {
+	if(r.p != NULL) {
+#ifdef BOWTIE_MM
+		munmap(r.p, r.len);
+#else
+		free(r.p);
+#endif
+	}
+	r.reset();
+}
+
+uint64_t hugePageResidentBytes(const HugePageRegion *rs, size_t n) {
+	FILE *f = fopen("/proc/self/smaps", "r");
+	if(f == NULL) {
+		return 0;
+	}
+	uint64_t tot = 0;
+	uint64_t vmaHuge = 0;    // huge-page bytes in the current VMA
+	uint64_t vmaOverlap = 0; // bytes of the current VMA holding array data
+	char line[512];
+	while(fgets(line, sizeof(line), f) != NULL) {
+		unsigned long lo, hi;
+		if(sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+			// New VMA; credit the previous one.  A VMA can be bigger
+			// than our region if the kernel merged it with a neighbor,
+			// so never credit more than the overlap.
+			tot += min<uint64_t>(vmaHuge, vmaOverlap);
+			vmaHuge = vmaOverlap = 0;
+			for(size_t i = 0; i < n; i++) {
+				if(rs[i].p == NULL) continue;
+				unsigned long rlo = (unsigned long)rs[i].p;
+				unsigned long rhi = rlo + rs[i].req;
+				if(rlo < hi && lo < rhi) {
+					vmaOverlap += min<unsigned long>(hi, rhi) - max<unsigned long>(lo, rlo);
+				}
+			}
+			continue;
+		}
+		if(vmaOverlap == 0) continue;
+		unsigned long kb;
+		if(sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+		   sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1 ||
+		   sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1)
+		{
+			vmaHuge += (uint64_t)kb * 1024;
+		}
+	}
+	tot += min<uint64_t>(vmaHuge, vmaOverlap);
+	fclose(f);
+	return tot;
+}
+
+const char *hugePageBackingName(int backing) {
+	switch(backing) {
+		case HUGEPAGE_BACKING_THP: return "transparent huge pages";
+		case HUGEPAGE_BACKING_2M:  return "2MB hugetlb pages";
+		case HUGEPAGE_BACKING_1G:  return "1GB hugetlb pages";
+		default:                   return "small pages";
+	}
+}
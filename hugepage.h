@@ -0,0 +1,106 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HUGEPAGE_H_
+#define HUGEPAGE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Huge-page backing for the large, randomly-accessed index arrays
+ * (ebwt[], offs[], ftab[], eftab[]).  FM walks touch a new side for
+ * nearly every LF step, so with 4K pages most steps also miss in the
+ * TLB; 2MB or 1GB pages cut the number of distinct translations by
+ * orders of magnitude.
+ *
+ * Allocation first tries explicit huge pages from the hugetlbfs pool
+ * (MAP_HUGETLB), then falls back to an anonymous mapping aligned to
+ * 2MB and marked with madvise(MADV_HUGEPAGE) so that transparent huge
+ * pages can back it.  Whether the kernel actually did so is reported
+ * by hugePageResidentBytes().
+ */
+
+/// Values for the --hugepages option
+enum {
+	HUGEPAGES_OFF = 0, // ordinary new[] allocations
+	HUGEPAGES_2M,      // 2MB pages, falling back to THP
+	HUGEPAGES_1G       // 1GB pages for big arrays, then 2MB, then THP
+};
+
+/// How a HugePageRegion ended up being backed
+enum {
+	HUGEPAGE_BACKING_NONE = 0, // anonymous mapping, small pages
+	HUGEPAGE_BACKING_THP,      // anonymous mapping with MADV_HUGEPAGE
+	HUGEPAGE_BACKING_2M,       // MAP_HUGETLB, 2MB pages
+	HUGEPAGE_BACKING_1G        // MAP_HUGETLB, 1GB pages
+};
+
+/**
+ * One array allocated with allocHugePages().  'len' is the length of
+ * the mapping, which is the requested length rounded up to the page
+ * size used.
+ */
+struct HugePageRegion {
+
+	HugePageRegion() { reset(); }
+
+	void reset() {
+		p = NULL;
+		req = 0;
+		len = 0;
+		backing = HUGEPAGE_BACKING_NONE;
+	}
+
+	void  *p;       // start of mapping
+	size_t req;     // bytes requested by the caller
+	size_t len;     // bytes mapped
+	int    backing; // HUGEPAGE_BACKING_*
+};
+
+/**
+ * Allocate 'len' bytes according to 'mode' (one of HUGEPAGES_*) and
+ * describe the mapping in 'r'.  Returns NULL if no mapping at all
+ * could be made; the caller decides how to report that.
+ */
+extern void* allocHugePages(
+	size_t len,
+	int mode,
+	HugePageRegion& r,
+	const char *memName,
+	bool verbose);
+
+/**
+ * Unmap a region allocated with allocHugePages() and reset it.
+ */
+extern void freeHugePages(HugePageRegion& r);
+
+/**
+ * Return the number of bytes of the given regions currently backed by
+ * huge pages (hugetlbfs or THP), according to /proc/self/smaps.
+ * Returns 0 where smaps is unavailable.
+ */
+extern uint64_t hugePageResidentBytes(const HugePageRegion *rs, size_t n);
+
+/**
+ * Return a short human-readable name for a HUGEPAGE_BACKING_* value.
+ */
+extern const char *hugePageBackingName(int backing);
+
+#endif /*HUGEPAGE_H_*/
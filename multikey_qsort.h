@@ -27,9 +27,14 @@
 #include "diff_sample.h"
 #include "sstring.h"
 #include "btypes.h"
+#include "sort_task_pool.h"
+#include "packed_text.h"
 
 using namespace std;
 
+// Partitions at least this big go to the task pool, if there is one
+#define MKEY_TASK_CUTOFF (64 * 1024)
+
 /**
  * Swap elements a and b in s
  */
@@ -399,14 +404,20 @@ void mkeyQSortSuf(
 	size_t begin,
 	size_t end,
 	size_t depth,
-	size_t upto = OFF_MASK)
+	size_t upto = OFF_MASK,
+	const SortSpawner *sp = NULL)
 {
 	// Helper for making the recursive call; sanity-checks arguments to
-	// make sure that the problem actually got smaller.
+	// make sure that the problem actually got smaller.  Big partitions
+	// are handed to the task pool, if there is one.
 	#define MQS_RECURSE_SUF(nbegin, nend, ndepth) { \
 		assert(nbegin > begin || nend < end || ndepth > depth); \
 		if(ndepth < upto) { /* don't exceed depth of 'upto' */ \
-			mkeyQSortSuf(host, hlen, s, slen, hi, nbegin, nend, ndepth, upto); \
+			if(sp != NULL && (nend) - (nbegin) >= MKEY_TASK_CUTOFF) { \
+				sp->spawn(nbegin, nend, ndepth); \
+			} else { \
+				mkeyQSortSuf(host, hlen, s, slen, hi, nbegin, nend, ndepth, upto, sp); \
+			} \
 		} \
 	}
 	assert_leq(begin, slen);
@@ -477,7 +488,43 @@ void mkeyQSortSuf(
 }
 
 /**
- * Toplevel function for multikey quicksort over suffixes.
+ * A whole mkeyQSortSuf() sort whose partitions can go to a task pool.
+ */
+template<typename T>
+class MkeyQSortSufJob : public SortJob {
+public:
+	MkeyQSortSufJob(
+		SortTaskPool& pool,
+		int tid,
+		const T& host,
+		size_t hlen,
+		TIndexOffU *s,
+		size_t slen,
+		int hi,
+		size_t upto) :
+		SortJob(tid), pool_(pool), host_(host), hlen_(hlen), s_(s),
+		slen_(slen), hi_(hi), upto_(upto) { }
+
+	virtual void run(const SortTask& t, int tid) {
+		SortSpawner sp(pool_, *this, tid);
+		mkeyQSortSuf(host_, hlen_, s_, slen_, hi_, t.begin, t.end, t.depth, upto_, &sp);
+	}
+
+private:
+	SortTaskPool& pool_;
+	const T&      host_;
+	size_t        hlen_;
+	TIndexOffU   *s_;
+	size_t        slen_;
+	int           hi_;
+	size_t        upto_;
+};
+
+/**
+ * Toplevel function for multikey quicksort over suffixes.  If 'pool'
+ * is non-NULL, big partitions are sorted by whichever of its threads
+ * is free; 'tid' is the caller's thread and 'stats', if non-NULL,
+ * receives the partition counts.
  */
 template<typename T>
 void mkeyQSortSuf(
@@ -487,12 +534,23 @@ void mkeyQSortSuf(
 	int hi,
 	bool verbose = false,
 	bool sanityCheck = false,
-	size_t upto = OFF_MASK)
+	size_t upto = OFF_MASK,
+	SortTaskPool *pool = NULL,
+	int tid = 0,
+	SortJobStats *stats = NULL)
 {
 	size_t hlen = host.length();
 	assert_gt(slen, 0);
 	if(sanityCheck) sanityCheckInputSufs(s, slen);
-	mkeyQSortSuf(host, hlen, s, slen, hi, (size_t)0, slen, (size_t)0, upto);
+	if(pool != NULL) {
+		MkeyQSortSufJob<T> job(*pool, tid, host, hlen, s, slen, hi, upto);
+		SortSpawner sp(*pool, job, tid);
+		mkeyQSortSuf(host, hlen, s, slen, hi, (size_t)0, slen, (size_t)0, upto, &sp);
+		pool->wait(tid, job);
+		job.stats(stats);
+	} else {
+		mkeyQSortSuf(host, hlen, s, slen, hi, (size_t)0, slen, (size_t)0, upto);
+	}
 	if(sanityCheck) sanityCheckOrderedSufs(host, hlen, s, slen, upto);
 }
 
@@ -738,7 +796,52 @@ void qsortSufDc(
 }
 
 /**
- * Toplevel function for multikey quicksort over suffixes.
+ * A whole mkeyQSortSufDcU8() sort whose partitions can go to a task
+ * pool.
+ */
+template<typename T1, typename T2>
+class MkeyQSortSufDcU8Job : public SortJob {
+public:
+	MkeyQSortSufDcU8Job(
+		SortTaskPool& pool,
+		int tid,
+		const T1& host1,
+		const T2& host,
+		size_t hlen,
+		TIndexOffU* s,
+		size_t slen,
+		const DifferenceCoverSample<T1>& dc,
+		int hi,
+		bool sanityCheck,
+		const PackedSufText* pk) :
+		SortJob(tid), pool_(pool), host1_(host1), host_(host), hlen_(hlen),
+		s_(s), slen_(slen), dc_(dc), hi_(hi), sanityCheck_(sanityCheck),
+		pk_(pk) { }
+
+	virtual void run(const SortTask& t, int tid) {
+		SortSpawner sp(pool_, *this, tid);
+		mkeyQSortSufDcU8(host1_, host_, hlen_, s_, slen_, dc_, hi_,
+		                 t.begin, t.end, t.depth, sanityCheck_, &sp, pk_);
+	}
+
+private:
+	SortTaskPool&                    pool_;
+	const T1&                        host1_;
+	const T2&                        host_;
+	size_t                           hlen_;
+	TIndexOffU*                      s_;
+	size_t                           slen_;
+	const DifferenceCoverSample<T1>& dc_;
+	int                              hi_;
+	bool                             sanityCheck_;
+	const PackedSufText*             pk_;
+};
+
+/**
+ * Toplevel function for multikey quicksort over suffixes.  If 'pool'
+ * is non-NULL, big partitions are sorted by whichever of its threads
+ * is free; see mkeyQSortSuf().  If 'pk' is non-NULL it must hold
+ * 'host1' packed, and is used to compare suffixes a word at a time.
  */
 template<typename T1, typename T2>
 void mkeyQSortSufDcU8(
@@ -750,10 +853,23 @@ void mkeyQSortSufDcU8(
 	const DifferenceCoverSample<T1>& dc,
 	int hi,
 	bool verbose = false,
-	bool sanityCheck = false)
+	bool sanityCheck = false,
+	SortTaskPool *pool = NULL,
+	int tid = 0,
+	SortJobStats *stats = NULL,
+	const PackedSufText *pk = NULL)
 {
+	assert(pk == NULL || pk->length() == hlen);
 	if(sanityCheck) sanityCheckInputSufs(s, slen);
-	mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, 0, slen, 0, sanityCheck);
+	if(pool != NULL) {
+		MkeyQSortSufDcU8Job<T1, T2> job(*pool, tid, host1, host, hlen, s, slen, dc, hi, sanityCheck, pk);
+		SortSpawner sp(*pool, job, tid);
+		mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, 0, slen, 0, sanityCheck, &sp, pk);
+		pool->wait(tid, job);
+		job.stats(stats);
+	} else {
+		mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, 0, slen, 0, sanityCheck, NULL, pk);
+	}
 	if(sanityCheck) sanityCheckOrderedSufs(host1, hlen, s, slen, OFF_MASK);
 }
 
@@ -840,6 +956,103 @@ void qsortSufDcU8(
 #define BUCKET_SORT_CUTOFF (4 * 1024 * 1024)
 #define SELECTION_SORT_CUTOFF 6
 
+/**
+ * Return a boolean indicating whether s1 < s2, given that they're equal
+ * in their first 'depth' characters.  The rest is compared a word at a
+ * time on the packed text up to the difference cover's tie-breaking
+ * offset; the difference cover is consulted only if they're still
+ * equal there.
+ */
+template<typename T1> inline
+bool sufDcLtPacked(
+	const PackedSufText& pk,
+	size_t s1,
+	size_t s2,
+	size_t depth,
+	const DifferenceCoverSample<T1>& dc)
+{
+	size_t hlen = pk.length();
+	size_t diff = dc.tieBreakOff((TIndexOffU)s1, (TIndexOffU)s2);
+	if(diff >= dc.v() || s1 + diff >= hlen || s2 + diff >= hlen) {
+		// No usable tie-breaking offset; the suffixes must differ, or
+		// one must end, before the end of the text
+		diff = hlen;
+	}
+	if(diff > depth) {
+		size_t lim = diff - depth;
+		size_t l = pk.lcp(s1 + depth, s2 + depth, lim);
+		if(l < lim) {
+			size_t off1 = s1 + depth + l, off2 = s2 + depth + l;
+			// A suffix that ends here is greater than one that doesn't
+			int c1 = (off1 < hlen) ? pk.get(off1) : 4;
+			int c2 = (off2 < hlen) ? pk.get(off2) : 4;
+			assert_neq(c1, c2);
+			return c1 < c2;
+		}
+	}
+	assert_lt(diff, dc.v());
+	return dc.breakTie((TIndexOffU)(s1+diff), (TIndexOffU)(s2+diff)) < 0;
+}
+
+/**
+ * k log(k) comparisons, each costing a word per 32 characters of common
+ * prefix beyond 'depth'.  Used where suffixes share long prefixes and
+ * sorting them a character at a time would be slow.
+ */
+template<typename T1> inline
+void qsortSufDcPacked(
+	const PackedSufText& pk,
+	const T1& host1,
+	TIndexOffU* s,
+	size_t slen,
+	const DifferenceCoverSample<T1>& dc,
+	size_t begin,
+	size_t end,
+	size_t depth,
+	bool sanityCheck = false)
+{
+	assert_leq(end, slen);
+	assert_lt(begin, slen);
+	assert_gt(end, begin);
+	size_t n = end - begin;
+	if(n <= 1) return;                 // 1-element list already sorted
+	if(n <= SELECTION_SORT_CUTOFF) {
+		// Insertion sort
+		for(size_t i = begin + 1; i < end; i++) {
+			for(size_t j = i; j > begin && sufDcLtPacked(pk, s[j], s[j-1], depth, dc); j--) {
+				SWAP(s, j, j-1);
+			}
+		}
+		return;
+	}
+	// Middle element as the pivot; rand() serializes the block-sorting
+	// threads on its lock, and this gets called very often
+	size_t a = begin + (n >> 1);
+	SWAP(s, end-1, a); // move pivot to end
+	size_t cur = 0;
+	for(size_t i = begin; i < end-1; i++) {
+		if(sufDcLtPacked(pk, s[i], s[end-1], depth, dc)) {
+#ifndef NDEBUG
+			if(sanityCheck) {
+				assert(sstr_suf_lt(host1, s[i], pk.length(), host1, s[end-1], pk.length(), false));
+			}
+			assert_lt(begin + cur, end-1);
+#endif
+			SWAP(s, i, begin + cur);
+			cur++;
+		}
+	}
+	// Put pivot into place
+	assert_lt(cur, end-begin);
+	SWAP(s, end-1, begin+cur);
+	if(begin+cur > begin) qsortSufDcPacked(pk, host1, s, slen, dc, begin, begin+cur, depth, sanityCheck);
+	if(end > begin+cur+1) qsortSufDcPacked(pk, host1, s, slen, dc, begin+cur+1, end, depth, sanityCheck);
+}
+
+// Buckets whose first and last suffixes share at least this many more
+// characters are sorted with whole-word comparisons
+#define PACKED_SORT_MIN_LCP 32
+
 // 5 64-element buckets for bucket-sorting A, C, G, T, $
 extern TIndexOffU bkts[4][4 * 1024 * 1024];
 
@@ -1016,17 +1229,21 @@ static void bucketSortSufDcU8(
                               size_t _begin,
                               size_t _end,
                               size_t _depth,
-                              bool sanityCheck = false)
+                              bool sanityCheck = false,
+                              const SortSpawner *sp = NULL,
+                              const PackedSufText *pk = NULL)
 {
-    // 5 64-element buckets for bucket-sorting A, C, G, T, $
+    // 5 64-element buckets for bucket-sorting A, C, G, T, $.  No bucket
+    // can hold more than the range we were given.
     TIndexOffU* bkts[4];
     for(size_t i = 0; i < 4; i++) {
-        bkts[i] = new TIndexOffU[4 * 1024 * 1024];
+        bkts[i] = new TIndexOffU[max<size_t>(_end - _begin, 1)];
     }
     ELList<size_t, 5, 1024> block_list;
     bool first = true;
     while(true) {
         size_t begin = 0, end = 0;
+        bool popped = false;
         if(first) {
             begin = _begin;
             end = _end;
@@ -1038,6 +1255,7 @@ static void bucketSortSufDcU8(
             if(block_list.back().size() > 1) {
                 end = block_list.back().back(); block_list.back().pop_back();
                 begin = block_list.back().back();
+                popped = true;
             } else {
                 block_list.resize(block_list.size() - 1);
                 if(block_list.size() == 0) {
@@ -1051,6 +1269,11 @@ static void bucketSortSufDcU8(
         if(end <= begin + 1) { // 1-element list already sorted
             continue;
         }
+        if(popped && sp != NULL && end - begin >= MKEY_TASK_CUTOFF) {
+            // Let another thread sort this one
+            sp->spawn(begin, end, depth);
+            continue;
+        }
         if(depth > dc.v()) {
             // Quicksort the remaining suffixes using difference cover
             // for constant-time comparisons; this is O(k*log(k)) where
@@ -1058,6 +1281,19 @@ static void bucketSortSufDcU8(
             qsortSufDcU8<T1,T2>(host1, host, hlen, s, slen, dc, begin, end, sanityCheck);
             continue;
         }
+        if(pk != NULL &&
+           pk->lcp(s[begin] + depth, s[end-1] + depth, PACKED_SORT_MIN_LCP) == PACKED_SORT_MIN_LCP)
+        {
+            // Suffixes that share a long prefix, as in repetitive text:
+            // compare them a word at a time rather than bucketing them a
+            // character at a time
+            qsortSufDcPacked<T1>(*pk, host1, s, slen, dc, begin, end, depth, sanityCheck);
+            if(sanityCheck) {
+                sanityCheckOrderedSufs(host1, hlen, s, slen,
+                                       OFF_MASK, begin, end);
+            }
+            continue;
+        }
         if(end-begin <= SELECTION_SORT_CUTOFF) {
             // Bucket sort remaining items
             selectionSortSufDcU8(host1, host, hlen, s, slen, dc, hi,
@@ -1135,18 +1371,33 @@ void mkeyQSortSufDcU8(
 	size_t begin,
 	size_t end,
 	size_t depth,
-	bool sanityCheck = false)
+	bool sanityCheck = false,
+	const SortSpawner *sp = NULL,
+	const PackedSufText *pk = NULL)
 {
 	// Helper for making the recursive call; sanity-checks arguments to
-	// make sure that the problem actually got smaller.
+	// make sure that the problem actually got smaller.  Big partitions
+	// are handed to the task pool, if there is one.
 	#define MQS_RECURSE_SUF_DC_U8(nbegin, nend, ndepth) { \
 		assert(nbegin > begin || nend < end || ndepth > depth); \
-		mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, nbegin, nend, ndepth, sanityCheck); \
+		if(sp != NULL && (nend) - (nbegin) >= MKEY_TASK_CUTOFF) { \
+			sp->spawn(nbegin, nend, ndepth); \
+		} else { \
+			mkeyQSortSufDcU8(host1, host, hlen, s, slen, dc, hi, nbegin, nend, ndepth, sanityCheck, sp, pk); \
+		} \
 	}
 	assert_leq(begin, slen);
 	assert_leq(end, slen);
 	size_t n = end - begin;
 	if(n <= 1) return; // 1-element list already sorted
+	if(pk != NULL && depth <= dc.v()) {
+		// Skip whatever prefix all the suffixes share, a word at a time
+		size_t m = dc.v() + 1 - depth;
+		for(size_t i = begin + 1; i < end && m > 0; i++) {
+			m = pk->lcp(s[begin] + depth, s[i] + depth, m);
+		}
+		depth += m;
+	}
 	if(depth > dc.v()) {
 		// Quicksort the remaining suffixes using difference cover
 		// for constant-time comparisons; this is O(k*log(k)) where
@@ -1160,8 +1411,8 @@ void mkeyQSortSufDcU8(
 	if(n <= BUCKET_SORT_CUTOFF) {
 		// Bucket sort remaining items
 		bucketSortSufDcU8(host1, host, hlen, s, slen, dc,
-		                  (uint8_t)hi, begin, end, depth, sanityCheck);
-		if(sanityCheck) {
+		                  (uint8_t)hi, begin, end, depth, sanityCheck, sp, pk);
+		if(sanityCheck && sp == NULL) { // else parts may still be in the pool
 			sanityCheckOrderedSufs(host1, hlen, s, slen, OFF_MASK, begin, end);
 		}
 		return;
@@ -0,0 +1,173 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "occ_count.h"
+
+#ifdef POPCNT_CAPABILITY
+#include "processor_support.h"
+#endif
+
+#ifdef SIMD_OCC_CAPABILITY
+#include <immintrin.h>
+#endif
+
+/**
+ * Return the best kernel supported by both this build and the processor
+ * we're running on.
+ */
+int occKernelSelect() {
+#ifdef SIMD_OCC_CAPABILITY
+	ProcessorSupport ps;
+	if(ps.AVX512POPCNTenabled()) {
+		return OCC_KERNEL_AVX512;
+	}
+	if(ps.AVX2enabled()) {
+		return OCC_KERNEL_AVX2;
+	}
+#endif
+	return OCC_KERNEL_SCALAR;
+}
+
+#ifdef SIMD_OCC_CAPABILITY
+
+/*
+ * All kernels use the same identity.  With lo = the low bit of each
+ * bitpair and hi = the high bit:
+ *
+ *   #T = popcount(lo & hi)
+ *   #C = popcount(lo) - #T
+ *   #G = popcount(hi) - #T
+ *   #A = nchars - #C - #G - #T
+ *
+ * so three popcounts give all four counts.  Masked-off bitpairs read as
+ * 'A' but are excluded from 'nchars'.  The three per-lane popcounts are
+ * packed into 16-bit fields of one 64-bit lane so that a single
+ * horizontal sum finishes the job.
+ */
+
+/**
+ * Per-64-bit-lane population count using the PSHUFB nibble lookup.
+ */
+__attribute__((target("avx2")))
+static inline __m256i popcnt256(__m256i v) {
+	const __m256i lut = _mm256_setr_epi8(
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+		0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i lo4 = _mm256_set1_epi8(0x0f);
+	__m256i lo = _mm256_and_si256(v, lo4);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lo4);
+	__m256i cnt = _mm256_add_epi8(
+		_mm256_shuffle_epi8(lut, lo),
+		_mm256_shuffle_epi8(lut, hi));
+	return _mm256_sad_epu8(cnt, _mm256_setzero_si256());
+}
+
+/**
+ * Clear all bits at or beyond side bit offset 'nbits', where 'lanesEnd'
+ * holds the side bit offset at which each 64-bit lane of 'v' ends.
+ */
+__attribute__((target("avx2")))
+static inline __m256i maskLanes256(__m256i v, __m256i nbits, __m256i lanesEnd) {
+	// Shift amount per lane is max(lanesEnd - nbits, 0); amounts >= 64
+	// clear the lane.  The 32-bit max is safe because both halves of a
+	// small negative 64-bit value are negative.
+	__m256i sh = _mm256_max_epi32(
+		_mm256_sub_epi64(lanesEnd, nbits), _mm256_setzero_si256());
+	return _mm256_and_si256(v, _mm256_srlv_epi64(_mm256_set1_epi64x(-1), sh));
+}
+
+__attribute__((target("avx2")))
+void occCountAvx2(const uint8_t *side, int nchars, uint32_t *cnts) {
+	const __m256i m55 = _mm256_set1_epi64x(0x5555555555555555ll);
+	const __m256i nbits = _mm256_set1_epi64x(2 * nchars);
+	__m256i w = maskLanes256(
+		_mm256_loadu_si256(reinterpret_cast<const __m256i*>(side)),
+		nbits,
+		_mm256_setr_epi64x(64, 128, 192, 256));
+	__m256i lo = _mm256_and_si256(w, m55);
+	__m256i hi = _mm256_and_si256(_mm256_srli_epi64(w, 1), m55);
+	__m256i acc = _mm256_add_epi64(
+		popcnt256(_mm256_and_si256(lo, hi)),
+		_mm256_add_epi64(
+			_mm256_slli_epi64(popcnt256(lo), 16),
+			_mm256_slli_epi64(popcnt256(hi), 32)));
+	if(nchars > 128) {
+		w = maskLanes256(
+			_mm256_loadu_si256(reinterpret_cast<const __m256i*>(side + 32)),
+			nbits,
+			_mm256_setr_epi64x(320, 384, 448, 512));
+		lo = _mm256_and_si256(w, m55);
+		hi = _mm256_and_si256(_mm256_srli_epi64(w, 1), m55);
+		acc = _mm256_add_epi64(acc, _mm256_add_epi64(
+			popcnt256(_mm256_and_si256(lo, hi)),
+			_mm256_add_epi64(
+				_mm256_slli_epi64(popcnt256(lo), 16),
+				_mm256_slli_epi64(popcnt256(hi), 32))));
+	}
+	__m128i s = _mm_add_epi64(
+		_mm256_castsi256_si128(acc),
+		_mm256_extracti128_si256(acc, 1));
+	s = _mm_add_epi64(s, _mm_unpackhi_epi64(s, s));
+	uint64_t tot = (uint64_t)_mm_cvtsi128_si64(s);
+	uint32_t t  = (uint32_t)(tot & 0xffff);
+	uint32_t pl = (uint32_t)((tot >> 16) & 0xffff);
+	uint32_t ph = (uint32_t)((tot >> 32) & 0xffff);
+	cnts[0] = (uint32_t)nchars - pl - ph + t;
+	cnts[1] = pl - t;
+	cnts[2] = ph - t;
+	cnts[3] = t;
+}
+
+// Some GCC releases warn spuriously about the _mm512_undefined_*()
+// placeholders used inside the AVX-512 intrinsics (GCC PR 105593).
+#if defined(__GNUC__) && !defined(__clang__)
+# pragma GCC diagnostic push
+# pragma GCC diagnostic ignored "-Wuninitialized"
+#endif
+__attribute__((target("avx512f,avx512vpopcntdq")))
+void occCountAvx512(const uint8_t *side, int nchars, uint32_t *cnts) {
+	const __m512i m55 = _mm512_set1_epi64(0x5555555555555555ll);
+	const __m512i lanesEnd = _mm512_setr_epi64(64, 128, 192, 256, 320, 384, 448, 512);
+	__m512i sh = _mm512_max_epi64(
+		_mm512_sub_epi64(lanesEnd, _mm512_set1_epi64(2 * nchars)),
+		_mm512_setzero_si512());
+	__m512i w = _mm512_and_si512(
+		_mm512_loadu_si512(side),
+		_mm512_srlv_epi64(_mm512_set1_epi64(-1), sh));
+	__m512i lo = _mm512_and_si512(w, m55);
+	__m512i hi = _mm512_and_si512(_mm512_srli_epi64(w, 1), m55);
+	__m512i acc = _mm512_add_epi64(
+		_mm512_popcnt_epi64(_mm512_and_si512(lo, hi)),
+		_mm512_add_epi64(
+			_mm512_slli_epi64(_mm512_popcnt_epi64(lo), 16),
+			_mm512_slli_epi64(_mm512_popcnt_epi64(hi), 32)));
+	uint64_t tot = (uint64_t)_mm512_reduce_add_epi64(acc);
+	uint32_t t  = (uint32_t)(tot & 0xffff);
+	uint32_t pl = (uint32_t)((tot >> 16) & 0xffff);
+	uint32_t ph = (uint32_t)((tot >> 32) & 0xffff);
+	cnts[0] = (uint32_t)nchars - pl - ph + t;
+	cnts[1] = pl - t;
+	cnts[2] = ph - t;
+	cnts[3] = t;
+}
+#if defined(__GNUC__) && !defined(__clang__)
+# pragma GCC diagnostic pop
+#endif
+
+#endif /*SIMD_OCC_CAPABILITY*/
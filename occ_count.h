@@ -0,0 +1,80 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCC_COUNT_H_
+#define OCC_COUNT_H_
+
+#include <stdint.h>
+
+/**
+ * Vectorized kernels for counting occurrences of A/C/G/T in the BWT
+ * portion of an Ebwt side.  The kernels are compiled for their target
+ * instruction set regardless of the flags used for the rest of the
+ * binary; Ebwt picks one at construction time using ProcessorSupport,
+ * so the same binary runs on hosts with and without AVX2/AVX-512.
+ */
+
+#if defined(POPCNT_CAPABILITY) && \
+    (defined(__x86_64__) || defined(__amd64__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 7))
+# define SIMD_OCC_CAPABILITY
+#endif
+
+/**
+ * Occurrence-counting kernels, in increasing order of preference.
+ */
+enum {
+	OCC_KERNEL_SCALAR = 0, // countInU64 + LUT (bit-bashing or POPCNT)
+	OCC_KERNEL_AVX2,       // 2 x 256-bit words, PSHUFB popcount
+	OCC_KERNEL_AVX512      // 1 x 512-bit word, VPOPCNTQ
+};
+
+/**
+ * Return a human-readable name for the given kernel.
+ */
+static inline const char *occKernelName(int kernel) {
+	switch(kernel) {
+		case OCC_KERNEL_AVX2:   return "AVX2";
+		case OCC_KERNEL_AVX512: return "AVX-512 VPOPCNTDQ";
+		default:                return "scalar";
+	}
+}
+
+/**
+ * Return the best kernel supported by both this build and the processor
+ * we're running on.
+ */
+extern int occKernelSelect();
+
+#ifdef SIMD_OCC_CAPABILITY
+
+/**
+ * Count occurrences of each nucleotide among the first 'nchars'
+ * bitpairs of the 64-byte side starting at 'side', putting the count
+ * for A in cnts[0], C in cnts[1], etc.  Bitpairs are packed low-order
+ * first, as by pack_2b_in_8b().  All 64 bytes of the side are read, but
+ * bitpairs at or beyond 'nchars' (including the occ[] words trailing
+ * the BWT portion) are masked off.
+ */
+extern void occCountAvx2(const uint8_t *side, int nchars, uint32_t *cnts);
+extern void occCountAvx512(const uint8_t *side, int nchars, uint32_t *cnts);
+
+#endif /*SIMD_OCC_CAPABILITY*/
+
+#endif /*OCC_COUNT_H_*/
@@ -121,6 +121,23 @@ enum {
 	ARG_EXACT_UPFRONT_NO,       // --no-exact-upfront
 	ARG_1MM_UPFRONT_NO,         // --no-1mm-upfront
 	ARG_1MM_MINLEN,             // --1mm-minlen
+	ARG_SEED_INTERLEAVE,        // --seed-interleave
+	ARG_SEED_INTERLEAVE_NO,     // --no-seed-interleave
+	ARG_HUGEPAGES,              // --hugepages
+	ARG_HUGEPAGES_1G,           // --hugepages-1g
+	ARG_NUMA,                   // --numa
+	ARG_PACKED_SA,              // --packed-sa
+	ARG_SA_CACHE,               // --sa-cache
+	ARG_SEED_CACHE,             // --shared-seed-cache
+	ARG_SEED_CACHE_FILE,        // --seed-cache-file
+	ARG_COLLAPSE_DUPS,          // --collapse-dups
+	ARG_DUP_WINDOW,             // --dup-window
+	ARG_DUP_WINDOW_MB,          // --dup-window-mb
+	ARG_SKIP_FREQ_SEEDS,        // --skip-freq-seeds
+	ARG_EFFORT_BUDGET,          // --effort-budget
+	ARG_EFFORT_BUDGET_US,       // --effort-budget-us
+	ARG_MM_WARMUP,              // --mm-warmup
+	ARG_SHARD,                  // --shard
 	ARG_VERSION,                // --version
 	ARG_SEED_OFF,               // --seed-off
 	ARG_SEED_BOOST_THRESH,      // --seed-boost
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "packed_text.h"
+
+#ifdef SIMD_OCC_CAPABILITY
+#include <immintrin.h>
+#include "processor_support.h"
+#endif
+
+/**
+ * Return true iff this build and processor support the AVX2 kernel.
+ */
+bool PackedSufText::packedLcpAvx2Enabled() {
+#ifdef SIMD_OCC_CAPABILITY
+	ProcessorSupport ps;
+	return ps.AVX2enabled();
+#else
+	return false;
+#endif
+}
+
+#ifdef SIMD_OCC_CAPABILITY
+
+/**
+ * Return the four 32-character windows starting at offset 'off'.
+ * Shifting a lane right by 64 clears it, so sh=0 needs no special case.
+ */
+__attribute__((target("avx2")))
+static inline __m256i windows256(const uint64_t *words, size_t off) {
+	const uint64_t *w = words + (off >> 5);
+	int sh = (int)((off & 31) << 1);
+	__m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w));
+	__m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + 1));
+	return _mm256_or_si256(
+		_mm256_sll_epi64(lo, _mm_cvtsi32_si128(sh)),
+		_mm256_srl_epi64(hi, _mm_cvtsi32_si128(64 - sh)));
+}
+
+__attribute__((target("avx2")))
+size_t PackedSufText::packedLcpAvx2(
+	const uint64_t *words,
+	size_t a,
+	size_t b,
+	size_t lim)
+{
+	size_t k = 0;
+	for(; k + PACKED_LCP_AVX2_CHARS <= lim; k += PACKED_LCP_AVX2_CHARS) {
+		__m256i eq = _mm256_cmpeq_epi64(
+			windows256(words, a + k),
+			windows256(words, b + k));
+		if(_mm256_movemask_epi8(eq) != -1) {
+			break;
+		}
+	}
+	return k;
+}
+
+#endif /*SIMD_OCC_CAPABILITY*/
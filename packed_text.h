@@ -0,0 +1,169 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKED_TEXT_H_
+#define PACKED_TEXT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "assert_helpers.h"
+#include "occ_count.h"
+
+/**
+ * A copy of a DNA text packed 2 bits per character, 32 characters per
+ * 64-bit word, used by the suffix sorter to compare suffixes a word at
+ * a time instead of a character at a time.
+ *
+ * Characters are packed high-order first, so the 64-bit window starting
+ * at any text offset holds the next 32 characters in order and the
+ * first mismatch between two windows is given by the number of leading
+ * zeros in their XOR.  Characters past the end of the text read as A;
+ * lcp() never looks that far.
+ */
+class PackedSufText {
+
+public:
+
+	PackedSufText() : words_(NULL), len_(0), avx2_(false) { }
+
+	~PackedSufText() { delete[] words_; }
+
+	/**
+	 * Pack the first 'len' characters of 't', each of which must be in
+	 * 0..3.  Throws bad_alloc if there isn't room.
+	 */
+	template<typename T>
+	void init(const T& t, size_t len) {
+		assert(words_ == NULL);
+		// Two words of padding let window() and the AVX2 kernel read
+		// past the last character without checking
+		size_t nwords = (len >> 5) + 2;
+		words_ = new uint64_t[nwords];
+		for(size_t i = 0; i < nwords; i++) {
+			words_[i] = 0;
+		}
+		for(size_t i = 0; i < len; i++) {
+			uint64_t c = (uint8_t)t[i];
+			assert_lt(c, 4);
+			words_[i >> 5] |= c << (62 - ((i & 31) << 1));
+		}
+		len_ = len;
+		avx2_ = packedLcpAvx2Enabled();
+	}
+
+	/// Return true iff init() has been called
+	bool inited() const { return words_ != NULL; }
+
+	/// Return the length of the text
+	size_t length() const { return len_; }
+
+	/// Return the character at offset 'off'
+	int get(size_t off) const {
+		assert_lt(off, len_);
+		return (int)((words_[off >> 5] >> (62 - ((off & 31) << 1))) & 3);
+	}
+
+	/**
+	 * Return the 32 characters starting at offset 'off', first one in
+	 * the high-order bits.
+	 */
+	uint64_t window(size_t off) const {
+		size_t i = off >> 5;
+		size_t sh = (off & 31) << 1;
+		// Shifting by 63-sh then 1 keeps the shift below 64 when sh=0
+		return (words_[i] << sh) | ((words_[i+1] >> 1) >> (63 - sh));
+	}
+
+	/**
+	 * Return the length of the longest common prefix of the suffixes at
+	 * 'a' and 'b', up to 'lim' characters and not counting anything past
+	 * the end of the text.
+	 */
+	size_t lcp(size_t a, size_t b, size_t lim) const {
+		size_t mx = (a > b) ? a : b;
+		if(mx >= len_) return 0;
+		if(lim > len_ - mx) lim = len_ - mx;
+		size_t k = 0;
+#ifdef SIMD_OCC_CAPABILITY
+		if(avx2_ && lim >= 64 + PACKED_LCP_AVX2_CHARS) {
+			// Most pairs differ within a word or two, so check those
+			// first; long common prefixes, which are where the time
+			// goes in repetitive text, are then skipped 128 characters
+			// at a time
+			for(; k < 64; k += 32) {
+				uint64_t x = window(a + k) ^ window(b + k);
+				if(x != 0) {
+					return mismatch(k, x, lim);
+				}
+			}
+			k += packedLcpAvx2(words_, a + k, b + k, lim - k);
+		}
+#endif
+		for(; k < lim; k += 32) {
+			uint64_t x = window(a + k) ^ window(b + k);
+			if(x != 0) {
+				return mismatch(k, x, lim);
+			}
+		}
+		return lim;
+	}
+
+private:
+
+	PackedSufText(const PackedSufText&);
+	PackedSufText& operator=(const PackedSufText&);
+
+	/**
+	 * Given that the windows at offset 'k' differ in the bits set in
+	 * 'x', return the offset of the first mismatch, capped at 'lim'.
+	 */
+	static size_t mismatch(size_t k, uint64_t x, size_t lim) {
+		k += (size_t)(__builtin_clzll(x) >> 1);
+		return (k < lim) ? k : lim;
+	}
+
+	/// Characters compared per iteration of the AVX2 kernel
+	static const size_t PACKED_LCP_AVX2_CHARS = 128;
+
+	/**
+	 * Return true iff this build and processor support the AVX2 kernel.
+	 * Defined in packed_text.cpp.
+	 */
+	static bool packedLcpAvx2Enabled();
+
+#ifdef SIMD_OCC_CAPABILITY
+	/**
+	 * Return the largest multiple of 128 no greater than 'lim' such that
+	 * the suffixes at 'a' and 'b' agree in that many characters, or the
+	 * start of the first 128-character block in which they differ.
+	 * Defined in packed_text.cpp.
+	 */
+	static size_t packedLcpAvx2(
+		const uint64_t *words,
+		size_t a,
+		size_t b,
+		size_t lim);
+#endif
+
+	uint64_t *words_;
+	size_t    len_;
+	bool      avx2_; // use packedLcpAvx2() for long prefixes
+};
+
+#endif /*PACKED_TEXT_H_*/
@@ -2,8 +2,11 @@
 #define PROCESSOR_SUPPORT_H_
 
 // Utility class ProcessorSupport provides POPCNTenabled() to determine
-// processor support for POPCNT instruction. It uses CPUID to
-// retrieve the processor capabilities.
+// processor support for POPCNT instruction, and AVX2enabled() /
+// AVX512POPCNTenabled() to determine support for the vector occurrence
+// counting kernels in occ_count.cpp. It uses CPUID to retrieve the
+// processor capabilities and XGETBV to check that the OS saves the
+// wider register state.
 // for Intel ICC compiler __cpuid() is an intrinsic 
 // for Microsoft compiler __cpuid() is provided by #include <intrin.h>
 // for GCC compiler __get_cpuid() is provided by #include <cpuid.h>
@@ -49,7 +52,7 @@ public:
 #elif defined(USING_GCC_COMPILER)
         __get_cpuid(0x1, &regs.EAX, &regs.EBX, &regs.ECX, &regs.EDX);
 #else
-        std::cerr << “ERROR: please define __cpuid() for this build.\n”; 
+        std::cerr << "ERROR: please define __cpuid() for this build.\n"; 
         assert(0);
 #endif
         if( !( (regs.ECX & BIT(20)) && (regs.ECX & BIT(23)) ) ) return false;
@@ -60,6 +63,53 @@ public:
     return true;
     }
 
+#if defined(USING_GCC_COMPILER) && (defined(__x86_64__) || defined(__amd64__))
+    // AVX2: CPUID.07H:EBX.AVX2[bit 5], with the YMM state enabled by the
+    // OS (XCR0 bits 1 and 2).
+    bool AVX2enabled()
+    {
+        if(!POPCNTenabled() || !OSsavesState(0x6)) return false;
+        regs_t regs;
+        if(!cpuidLeaf7(regs)) return false;
+        return (regs.EBX & BIT(5)) != 0;
+    }
+
+    // AVX-512 with VPOPCNTDQ: CPUID.07H:EBX.AVX512F[bit 16] and
+    // CPUID.07H:ECX.AVX512_VPOPCNTDQ[bit 14], with the opmask and ZMM
+    // state enabled by the OS (XCR0 bits 1, 2, 5, 6 and 7).
+    bool AVX512POPCNTenabled()
+    {
+        if(!POPCNTenabled() || !OSsavesState(0xE6)) return false;
+        regs_t regs;
+        if(!cpuidLeaf7(regs)) return false;
+        return (regs.EBX & BIT(16)) && (regs.ECX & BIT(14));
+    }
+
+private:
+
+    bool cpuidLeaf7(regs_t& regs)
+    {
+        if(__get_cpuid_max(0, 0) < 7) return false;
+        __cpuid_count(7, 0, regs.EAX, regs.EBX, regs.ECX, regs.EDX);
+        return true;
+    }
+
+    // Check OSXSAVE (CPUID.01H:ECX[bit 27]) then that all bits in 'mask'
+    // are set in XCR0.
+    bool OSsavesState(unsigned int mask)
+    {
+        regs_t regs;
+        if(!__get_cpuid(0x1, &regs.EAX, &regs.EBX, &regs.ECX, &regs.EDX)) return false;
+        if(!(regs.ECX & BIT(27))) return false;
+        unsigned int xcr0_lo, xcr0_hi;
+        __asm__ __volatile__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+        return (xcr0_lo & mask) == mask;
+    }
+#else
+    bool AVX2enabled() { return false; }
+    bool AVX512POPCNTenabled() { return false; }
+#endif
+
 #endif // POPCNT_CAPABILITY
 };
 
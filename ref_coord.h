@@ -213,6 +213,13 @@ public:
 		len_ = len;
 	}
 	
+	/**
+	 * Set reference id.
+	 */
+	void setRef(TRefId id) {
+		upstream_.setRef(id);
+	}
+
 	/**
 	 * Set offset.
 	 */
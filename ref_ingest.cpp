@@ -0,0 +1,768 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "ref_ingest.h"
+#include "word_io.h"
+#include "btypes.h"
+
+using namespace std;
+
+/// Bytes to read from a file at a time; a chunk holds about this much
+/// unless it's the end of a file
+static const size_t REF_CHUNK_SZ = 16 * 1024 * 1024;
+
+/**
+ * A piece of FASTA input and what the workers found in it.  A chunk
+ * starts at the start of a file or part way through a record's
+ * sequence, and ends part way through a record's sequence or at the
+ * end of a file, so a long sequence is spread over many chunks.
+ *
+ * The fragment a chunk ends in is left open, in 'tail', and the first
+ * fragment of the next chunk, in 'head', continues it; the merge joins
+ * them as the sequential reader would have seen them.
+ */
+struct RefChunk {
+	RefChunk() :
+		buf(MISC_CAT),
+		fileStart(false),
+		contStart(false),
+		openEnd(false),
+		scanned(false),
+		failed(false),
+		notFasta(false),
+		tooLong(false),
+		head(),
+		headOpen(false),
+		headGapEnd(false),
+		tail(),
+		recs(MISC_CAT),
+		names(MISC_CAT),
+		warnings(MISC_CAT),
+		bits(MISC_CAT),
+		nbp(0) { }
+
+	EList<char>    buf;       // the input
+	bool           fileStart; // buf is the start of a file
+	bool           contStart; // buf continues the previous chunk's record
+	bool           openEnd;   // the next chunk continues buf's last record
+	volatile bool  scanned;   // results below are ready
+	bool           failed;    // the worker gave up; results are incomplete
+	bool           notFasta;  // file doesn't start with '>'
+	bool           tooLong;   // a stretch is too long for TIndexOffU
+	RefRecord      head;      // if contStart, the first fragment
+	bool           headOpen;  // head runs to the end of the chunk
+	bool           headGapEnd; // head is one gap character, then file's end
+	RefRecord      tail;      // if openEnd, the last fragment, unfinished
+	string         tailName;  // name of tail's sequence if tail.first
+	EList<RefRecord> recs;    // unambiguous stretches between head and tail
+	EList<string>  names;     // name of each record starting a sequence
+	EList<string>  warnings;  // in the order the sequential reader gives
+	EList<uint8_t> bits;      // unambiguous characters, as in the .4 file
+	size_t         nbp;       // number of characters in bits
+};
+
+/**
+ * Finds the RefRecords in a RefChunk and packs their characters.  This
+ * follows fastaRefReadSize() character for character, and takes names
+ * the way fastaRefReadAppend() does, so that the results are the same
+ * as from the sequential readers.
+ */
+class RefChunkScanner {
+
+public:
+
+	RefChunkScanner(RefChunk& ch) :
+		ch_(ch),
+		p_(ch.buf.ptr()),
+		n_(ch.buf.size()),
+		i_(0),
+		lastc_(ch.contStart ? 0 : '>'),
+		cont_(ch.contStart),
+		acc_(0),
+		nacc_(0) { }
+
+	void scan() {
+		bool first = ch_.fileStart;
+		bool head = ch_.contStart;
+		string name;
+		while(i_ < n_) {
+			RefRecord rec = fragment(first, name);
+			first = false;
+			if(lastc_ == -1 && ch_.openEnd) {
+				// The chunk ends part way through this fragment
+				if(head) {
+					ch_.head = rec;
+					ch_.headOpen = true;
+				} else {
+					ch_.tail = rec;
+					if(rec.first) ch_.tailName = name;
+				}
+				flush();
+				return;
+			}
+			if(head) {
+				ch_.head = rec;
+				ch_.headGapEnd = (i_ == 1 && lastc_ == -1 && rec.off == 1);
+				head = false;
+				continue;
+			}
+			if(rec.len == 0 && rec.off == 0 && !rec.first) continue;
+			ch_.recs.push_back(rec);
+			if(rec.first && rec.len > 0) {
+				ch_.names.push_back(name);
+			}
+		}
+		// A chunk that ends part way through a record ends part way
+		// through a fragment; see splitPoint()
+		assert(!ch_.openEnd);
+		flush();
+	}
+
+private:
+
+	int get() {
+		return i_ < n_ ? (int)(uint8_t)p_[i_++] : -1;
+	}
+
+	int getPastWhitespace() {
+		int c;
+		while(isspace(c = get()) && c != -1);
+		return c;
+	}
+
+	/**
+	 * Set 'name' to the rest of the name line, which ends at the first
+	 * '\r' or '\n', and return the first character after it and any
+	 * newlines.
+	 */
+	int getPastName(string& name) {
+		name.clear();
+		const char *nl = (const char *)memchr(p_ + i_, '\n', n_ - i_);
+		size_t end = (nl == NULL) ? n_ : (size_t)(nl - p_);
+		size_t cr = i_;
+		while(cr < end && p_[cr] != '\r') cr++;
+		name.append(p_ + i_, cr - i_);
+		i_ = cr;
+		int c = get();
+		while(isnewline(c)) c = get();
+		return c;
+	}
+
+	void warn(const char *msg) {
+		ch_.warnings.push_back(msg);
+	}
+
+	/**
+	 * Return the next RefRecord; see fastaRefReadSize().
+	 */
+	RefRecord fragment(bool first, string& name) {
+		int c;
+		size_t len = 0;
+		size_t off = 0;
+		if(first) {
+			lastc_ = '>';
+			c = getPastWhitespace();
+			if(c != '>') {
+				ch_.notFasta = true;
+			}
+			if(i_ == n_) {
+				warn("Warning: Empty input file");
+				lastc_ = -1;
+				return RefRecord(0, 0, true);
+			}
+		}
+		first = true;
+		if(lastc_ == '>') {
+			// Skip to the first line that isn't a name line
+			do {
+				if((c = getPastName(name)) == -1) {
+					warn("Warning: Encountered empty reference sequence");
+					lastc_ = -1;
+					return RefRecord(0, 0, true);
+				}
+				if(c == '>') {
+					warn("Warning: Encountered empty reference sequence");
+				}
+			} while(c == '>');
+		} else {
+			first = false; // not the first in a sequence
+			// The gap has already been consumed, so count it, unless
+			// this continues a fragment from the previous chunk
+			off = cont_ ? 0 : 1;
+			cont_ = false;
+			if((c = get()) == -1) {
+				lastc_ = -1;
+				return RefRecord((TIndexOffU)off, (TIndexOffU)len, first);
+			}
+		}
+		// Skip to the first DNA character, counting gap characters
+		while(true) {
+			int cat = asc2dnacat[c];
+			if(cat == 1) {
+				break;
+			} else if(cat >= 2) {
+				off++;
+			} else if(c == '>') {
+				gapWarnings(off);
+				lastc_ = '>';
+				return RefRecord((TIndexOffU)off, 0, first);
+			}
+			c = get();
+			if(c == -1) {
+				// If the next chunk continues the fragment, the merge
+				// gives any warnings
+				if(!ch_.openEnd) gapWarnings(off);
+				lastc_ = -1;
+				return RefRecord((TIndexOffU)off, 0, first);
+			}
+		}
+		while(c != -1 && c != '>') {
+			int cat = asc2dnacat[c];
+			if(cat == 1) {
+				len++;
+				pack(asc2dna[c]);
+				// Sequence lines are mostly unambiguous characters;
+				// take them 16 at a time while they are
+				uint32_t w;
+				while(n_ - i_ >= 16 && acgt16(p_ + i_, w)) {
+					pack16(w);
+					len += 16;
+					i_ += 16;
+				}
+			} else if(cat >= 2) {
+				// An N or a gap ends the stretch
+				lastc_ = c;
+				return stretch(off, len, first);
+			}
+			c = get();
+		}
+		lastc_ = c;
+		return stretch(off, len, first);
+	}
+
+	/// Return the RefRecord for a stretch of 'len' unambiguous characters
+	RefRecord stretch(size_t off, size_t len, bool first) {
+		if((TIndexOffU)len != len) {
+			ch_.tooLong = true;
+		}
+		return RefRecord((TIndexOffU)off, (TIndexOffU)len, first);
+	}
+
+	void gapWarnings(size_t off) {
+		if(off > 0 && lastc_ == '>') {
+			warn("Warning: Encountered reference sequence with only gaps");
+		} else if(lastc_ == '>') {
+			warn("Warning: Encountered empty reference sequence");
+		}
+	}
+
+	/**
+	 * If the 16 characters at 'p' are all A, C, G or T (either case),
+	 * set 'w' to their 2-bit codes, first character lowest, and return
+	 * true.
+	 */
+	static bool acgt16(const char *p, uint32_t& w) {
+#ifdef __SSE2__
+		__m128i v = _mm_and_si128(
+			_mm_loadu_si128((const __m128i *)p), _mm_set1_epi8((char)0xDF));
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('A')), _mm_cmpeq_epi8(v, _mm_set1_epi8('C'))),
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('G')), _mm_cmpeq_epi8(v, _mm_set1_epi8('T'))));
+		if(_mm_movemask_epi8(m) != 0xffff) {
+			return false;
+		}
+		// A, C, G, T -> 0, 1, 2, 3 is ((c >> 1) ^ (c >> 2)) & 3
+		__m128i x = _mm_and_si128(
+			_mm_xor_si128(_mm_srli_epi16(v, 1), _mm_srli_epi16(v, 2)), _mm_set1_epi8(3));
+		// Gather pairs, then quads, then octets of codes
+		x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi16(x, 6)), _mm_set1_epi16(0x000f));
+		x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 12)), _mm_set1_epi32(0x000000ff));
+		x = _mm_or_si128(x, _mm_srli_epi64(x, 24));
+		uint64_t halves[2];
+		_mm_storeu_si128((__m128i *)halves, x);
+		w = (uint32_t)((halves[0] & 0xffff) | ((halves[1] & 0xffff) << 16));
+		return true;
+#else
+		w = 0;
+		for(int i = 0; i < 16; i++) {
+			int c = (uint8_t)p[i];
+			if(asc2dnacat[c] != 1) return false;
+			w |= (uint32_t)asc2dna[c] << (i << 1);
+		}
+		return true;
+#endif
+	}
+
+	/// Append one character's code
+	void pack(int code) {
+		acc_ |= (uint64_t)code << (nacc_ << 1);
+		if(++nacc_ == 32) {
+			emit();
+		}
+	}
+
+	/// Append 16 characters' codes, first lowest
+	void pack16(uint32_t w) {
+		acc_ |= (uint64_t)w << (nacc_ << 1);
+		if(nacc_ < 16) {
+			nacc_ += 16;
+			return;
+		}
+		// The word fills up; carry the rest of 'w' into the next one
+		size_t used = 32 - nacc_;
+		emit();
+		acc_ = (used < 16) ? ((uint64_t)w >> (used << 1)) : 0;
+		nacc_ = 16 - used;
+	}
+
+	/// Move a full word of codes to the chunk's bits
+	void emit() {
+		for(int i = 0; i < 8; i++) {
+			ch_.bits.push_back((uint8_t)(acc_ >> (i << 3)));
+		}
+		ch_.nbp += 32;
+		acc_ = 0;
+		nacc_ = 0;
+	}
+
+	/// Move the last, partial word of codes to the chunk's bits
+	void flush() {
+		for(size_t i = 0; i < (nacc_ + 3) >> 2; i++) {
+			ch_.bits.push_back((uint8_t)(acc_ >> (i << 3)));
+		}
+		ch_.nbp += nacc_;
+		acc_ = 0;
+		nacc_ = 0;
+	}
+
+	RefChunk&   ch_;
+	const char *p_;
+	size_t      n_;
+	size_t      i_;     // next character to get()
+	int         lastc_; // character that ended the last record
+	bool        cont_;  // next fragment continues the previous chunk's
+	uint64_t    acc_;   // codes not yet in ch_.bits
+	size_t      nacc_;  // number of codes in acc_
+};
+
+RefIngest::RefIngest(int nthreads, bool verbose) :
+	nthreads_(max(nthreads, 1)),
+	verbose_(verbose),
+	chunks_(MISC_CAT),
+	nscanned_(0),
+	nmerged_(0),
+	readDone_(false),
+	bits_(MISC_CAT),
+	nbp_(0),
+	szs_(NULL),
+	names_(NULL),
+	unambigTot_(0),
+	bothTot_(0),
+	seqsRead_(0),
+	openRec_(),
+	open_(false)
+{ }
+
+RefIngest::~RefIngest() {
+	for(size_t i = 0; i < chunks_.size(); i++) {
+		delete chunks_[i];
+	}
+}
+
+/**
+ * Take the next chunk not yet scanned and scan it, until there are no
+ * more.
+ */
+void RefIngest::scanWorker(void *vp) {
+	RefIngest& ri = *(RefIngest*)vp;
+	while(true) {
+		RefChunk *ch = NULL;
+		{
+			ThreadSafe ts(ri.lock_);
+			if(ri.nscanned_ < ri.chunks_.size()) {
+				ch = ri.chunks_[ri.nscanned_++];
+			} else if(ri.readDone_) {
+				break;
+			}
+		}
+		if(ch == NULL) {
+			SLEEP(1);
+			continue;
+		}
+		bool failed = false;
+		try {
+			RefChunkScanner(*ch).scan();
+		} catch(std::exception& e) {
+			cerr << "Error: Encountered exception: '" << e.what() << "' while reading the reference" << endl;
+			failed = true;
+		} catch(...) {
+			cerr << "Error: Encountered internal exception while reading the reference" << endl;
+			failed = true;
+		}
+		{
+			// Free the input; the merge only needs the results
+			EList<char> tmp(MISC_CAT);
+			tmp.xfer(ch->buf);
+		}
+		ThreadSafe ts(ri.lock_);
+		ch->failed = failed;
+		ch->scanned = true;
+	}
+}
+
+/**
+ * Append up to REF_CHUNK_SZ more bytes of 'f' to 'buf'.  Return false
+ * iff the end of the file was reached.
+ */
+bool RefIngest::readMore(gzFile f, EList<char>& buf) {
+	size_t old = buf.size();
+	buf.resize(old + REF_CHUNK_SZ);
+	int r = gzread(f, buf.ptr() + old, (unsigned)REF_CHUNK_SZ);
+	if(r < 0) {
+		int errnum;
+		cerr << "Error: could not read reference: " << gzerror(f, &errnum) << endl;
+		throw 1;
+	}
+	buf.resize(old + r);
+	return (size_t)r == REF_CHUNK_SZ;
+}
+
+/**
+ * Return the offset of the last place in 'buf' after 'from' where a
+ * chunk can end, or 0 if there's none.  That's any place where the
+ * sequential reader would be past a record's name line and in its
+ * sequence: right after a line, or part of a line, that has something
+ * other than whitespace and no '>' on it.  If 'cont', buf starts part
+ * way through a sequence, so the first line counts even if it's blank.
+ *
+ * The chunk mustn't end with a gap character that may end a stretch,
+ * so that it ends part way through a fragment, which the next chunk
+ * continues.
+ */
+static size_t splitPoint(const EList<char>& buf, size_t from, bool cont) {
+	const char *p = buf.ptr();
+	size_t b = buf.size();
+	while(b > from) {
+		if(asc2dnacat[(uint8_t)p[b-1]] >= 2 &&
+		   (b < 2 || asc2dnacat[(uint8_t)p[b-2]] < 2))
+		{
+			b--;
+			continue;
+		}
+		// Look at the line (or part line) ending at b
+		size_t ls = b - 1;
+		while(ls > 0 && p[ls-1] != '\n') ls--;
+		bool content = (ls == 0 && cont), name = false;
+		for(size_t j = ls; j < b; j++) {
+			if(p[j] == '>') { name = true; break; }
+			if(!isspace(p[j])) content = true;
+		}
+		if(content && !name) {
+			return b;
+		}
+		b = ls;
+	}
+	return 0;
+}
+
+/**
+ * Make a chunk available to the workers, merging finished ones first
+ * if too many are in flight.  Since chunks are about REF_CHUNK_SZ
+ * bytes, this bounds the input held in memory at once.
+ */
+void RefIngest::publish(RefChunk *ch) {
+	while(chunks_.size() - nmerged_ >= (size_t)(2 * nthreads_ + 1)) {
+		if(!mergeNext()) SLEEP(1);
+	}
+	ThreadSafe ts(lock_);
+	chunks_.push_back(ch);
+}
+
+/**
+ * Merge the next chunk if it's been scanned.  Return true iff it was.
+ */
+bool RefIngest::mergeNext() {
+	RefChunk *ch = NULL;
+	{
+		ThreadSafe ts(lock_);
+		if(nmerged_ < chunks_.size() && chunks_[nmerged_]->scanned) {
+			ch = chunks_[nmerged_];
+		}
+	}
+	if(ch == NULL) return false;
+	merge(*ch);
+	delete ch;
+	ThreadSafe ts(lock_);
+	chunks_[nmerged_++] = NULL;
+	return true;
+}
+
+/**
+ * Add a chunk's records, names and characters to the totals.
+ */
+void RefIngest::merge(RefChunk& ch) {
+	if(ch.failed) {
+		throw 1;
+	}
+	if(ch.contStart) {
+		// The head continues the fragment the previous chunk left open
+		assert(open_);
+		const RefRecord& h = ch.head;
+		if(openRec_.len > 0 && h.off > 0) {
+			// A gap ended the open stretch and starts the head's,
+			// unless nothing follows it; fastaRefReadSize() only
+			// starts another record if there's more input
+			closeOpen();
+			openRec_ = h;
+			openName_.clear();
+			open_ = !ch.headGapEnd;
+		} else {
+			if((TIndexOffU)(openRec_.len + h.len) < openRec_.len) {
+				cerr << RefTooLongException().what() << endl;
+				throw 1;
+			}
+			openRec_.off += h.off;
+			openRec_.len += h.len;
+		}
+		if(open_ && !ch.headOpen) {
+			closeOpen();
+		}
+	}
+	for(size_t i = 0; i < ch.warnings.size(); i++) {
+		cerr << ch.warnings[i].c_str() << endl;
+	}
+	if(ch.notFasta) {
+		cerr << "Reference file does not seem to be a FASTA file" << endl;
+		throw 1;
+	}
+	if(ch.tooLong) {
+		cerr << RefTooLongException().what() << endl;
+		throw 1;
+	}
+	size_t namei = 0;
+	for(size_t i = 0; i < ch.recs.size(); i++) {
+		const RefRecord& rec = ch.recs[i];
+		addRecord(rec, (rec.first && rec.len > 0) ? ch.names[namei++] : string());
+	}
+	if(ch.openEnd && !ch.headOpen) {
+		openRec_ = ch.tail;
+		openName_ = ch.tailName;
+		open_ = true;
+	}
+	appendBits(ch.bits, ch.nbp);
+}
+
+/**
+ * Finish the fragment left open across chunks, with the warnings
+ * fastaRefReadSize() gives for a sequence without a stretch.
+ */
+void RefIngest::closeOpen() {
+	assert(open_);
+	open_ = false;
+	if(openRec_.first && openRec_.len == 0) {
+		if(openRec_.off > 0) {
+			cerr << "Warning: Encountered reference sequence with only gaps" << endl;
+		} else {
+			cerr << "Warning: Encountered empty reference sequence" << endl;
+		}
+	}
+	if(openRec_.len == 0 && openRec_.off == 0 && !openRec_.first) {
+		return;
+	}
+	addRecord(openRec_, openName_);
+}
+
+/**
+ * Add a record, and the name of its sequence if it starts one, to the
+ * totals.
+ */
+void RefIngest::addRecord(const RefRecord& rec, const string& name) {
+	if((TIndexOffU)(unambigTot_ + rec.len) < unambigTot_) {
+		cerr << RefTooLongException().what() << endl;
+		throw 1;
+	}
+	unambigTot_ += rec.len;
+	bothTot_ += rec.len;
+	bothTot_ += rec.off;
+	szs_->push_back(rec);
+	if(rec.first && rec.len > 0) {
+		names_->push_back(name);
+		if(names_->back().empty()) {
+			// If name was empty, replace with an index
+			ostringstream stm;
+			stm << seqsRead_;
+			names_->back() = stm.str();
+		}
+		seqsRead_++;
+	}
+}
+
+/**
+ * Append 'nbp' packed characters to bits_, which may end part way
+ * through a byte.
+ */
+void RefIngest::appendBits(const EList<uint8_t>& bits, size_t nbp) {
+	size_t sh = (nbp_ & 3) << 1;
+	if(sh == 0) {
+		for(size_t i = 0; i < bits.size(); i++) {
+			bits_.push_back(bits[i]);
+		}
+	} else {
+		for(size_t i = 0; i < bits.size(); i++) {
+			bits_.back() |= (uint8_t)(bits[i] << sh);
+			bits_.push_back((uint8_t)(bits[i] >> (8 - sh)));
+		}
+	}
+	nbp_ += nbp;
+	bits_.resize((nbp_ + 3) >> 2);
+}
+
+pair<size_t, size_t> RefIngest::read(
+	const EList<string>& paths,
+	EList<RefRecord>& szs,
+	EList<string>& names)
+{
+	szs_ = &szs;
+	names_ = &names;
+#ifdef WITH_TBB
+	EList<std::thread*> threads(MISC_CAT);
+#else
+	EList<tthread::thread*> threads(MISC_CAT);
+#endif
+	for(int i = 0; i < nthreads_; i++) {
+#ifdef WITH_TBB
+		threads.push_back(new std::thread(scanWorker, (void*)this));
+#else
+		threads.push_back(new tthread::thread(scanWorker, (void*)this));
+#endif
+	}
+	try {
+		for(size_t i = 0; i < paths.size(); i++) {
+			gzFile f = gzopen(paths[i].c_str(), "rb");
+			if(f == NULL) {
+				cerr << "Error: could not open " << paths[i].c_str() << endl;
+				throw 1;
+			}
+#if ZLIB_VERNUM >= 0x1240
+			gzbuffer(f, 1024 * 1024);
+#endif
+			RefChunk *ch = new RefChunk();
+			ch->fileStart = true;
+			bool more = true;
+			while(more) {
+				// Read until there's somewhere to split or the file ends
+				size_t b = 0;
+				while(more && b == 0) {
+					size_t from = ch->buf.size();
+					more = readMore(f, ch->buf);
+					b = splitPoint(ch->buf, from, ch->contStart);
+				}
+				RefChunk *next = NULL;
+				if(more) {
+					ch->openEnd = true;
+					next = new RefChunk();
+					next->contStart = true;
+					size_t rest = ch->buf.size() - b;
+					next->buf.resizeExact(rest);
+					memcpy(next->buf.ptr(), ch->buf.ptr() + b, rest);
+					ch->buf.resize(b);
+				}
+				publish(ch);
+				ch = next;
+			}
+			gzclose(f);
+		}
+		{
+			ThreadSafe ts(lock_);
+			readDone_ = true;
+		}
+		while(nmerged_ < chunks_.size()) {
+			if(!mergeNext()) SLEEP(1);
+		}
+		assert(!open_);
+	} catch(...) {
+		{
+			ThreadSafe ts(lock_);
+			readDone_ = true;
+			// Nothing more to hand out
+			nscanned_ = chunks_.size();
+		}
+		for(size_t i = 0; i < threads.size(); i++) {
+			threads[i]->join();
+			delete threads[i];
+		}
+		throw;
+	}
+	for(size_t i = 0; i < threads.size(); i++) {
+		threads[i]->join();
+		delete threads[i];
+	}
+	if(verbose_) {
+		cout << "  Read " << chunks_.size() << " chunks of reference on "
+		     << nthreads_ << " threads" << endl;
+	}
+	if(unambigTot_ == 0) {
+		cerr << "Error: No unambiguous stretches of characters in the input.  Aborting..." << endl;
+		throw 1;
+	}
+	assert_eq(unambigTot_, nbp_);
+	return make_pair(unambigTot_, bothTot_);
+}
+
+void RefIngest::writeRefFiles(
+	const string& outfile,
+	bool bigEndian,
+	const EList<RefRecord>& szs) const
+{
+	string file3 = outfile + ".3." + gEbwt_ext;
+	string file4 = outfile + ".4." + gEbwt_ext;
+	ofstream fout3(file3.c_str(), ios::binary);
+	if(!fout3.good()) {
+		cerr << "Could not open index file for writing: \"" << file3.c_str() << "\"" << endl
+			 << "Please make sure the directory exists and that permissions allow writing by" << endl
+			 << "Bowtie." << endl;
+		throw 1;
+	}
+	writeU<int32_t>(fout3, 1, bigEndian); // endianness sentinel
+	writeU<TIndexOffU>(fout3, (TIndexOffU)szs.size(), bigEndian); // write # records
+	for(size_t i = 0; i < szs.size(); i++) {
+		RefRecord rec = szs[i];
+		rec.write(fout3, bigEndian);
+	}
+	fout3.close();
+	FILE *fout4 = fopen(file4.c_str(), "wb");
+	if(fout4 == NULL) {
+		cerr << "Error: Could not open bitpair-output file " << file4.c_str() << endl;
+		throw 1;
+	}
+	if(!bits_.empty() && fwrite(bits_.ptr(), bits_.size(), 1, fout4) != 1) {
+		cerr << "Error writing to the reference index file (.4.ebwt)" << endl;
+		throw 1;
+	}
+	fclose(fout4);
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REF_INGEST_H_
+#define REF_INGEST_H_
+
+#include <string>
+#include <utility>
+#include <zlib.h>
+#include "ds.h"
+#include "mem_ids.h"
+#include "ref_read.h"
+#include "threading.h"
+#ifdef WITH_TBB
+ #include <tbb/compat/thread>
+#endif
+
+struct RefChunk;
+
+/**
+ * Reads FASTA references, optionally gzipped, for bowtie2-build in one
+ * pass on several threads, in place of fastaRefReadSizes() followed by
+ * Ebwt::readJoined().
+ *
+ * The calling thread reads (and decompresses) the input in chunks of
+ * about the same size, which may end part way through a record, worker
+ * threads find the unambiguous stretches in the chunks and pack their
+ * characters 2 bits apiece, and the calling thread stitches the results
+ * together in input order, joining records that span chunks.
+ * The RefRecords, names and packed characters are exactly what the
+ * sequential readers produce, so the .3/.4 files and the joined text
+ * are too.
+ */
+class RefIngest {
+
+public:
+
+	RefIngest(int nthreads, bool verbose);
+
+	~RefIngest();
+
+	/**
+	 * Return true iff the reference can be read this way with these
+	 * parameters; otherwise use the sequential readers.
+	 */
+	static bool applies(const RefReadInParams& p) {
+		return !p.color && !p.nsToAs && !p.bisulfite &&
+		       p.reverse == REF_READ_FORWARD;
+	}
+
+	/**
+	 * Read the FASTA files in 'paths', none of which is empty, filling
+	 * 'szs' with the unambiguous stretches and 'names' with the names
+	 * of the sequences.  Return the number of unambiguous characters
+	 * and the number of characters including ambiguous ones.
+	 */
+	std::pair<size_t, size_t> read(
+		const EList<std::string>& paths,
+		EList<RefRecord>& szs,
+		EList<std::string>& names);
+
+	/**
+	 * Write the .3 and .4 reference files for 'outfile', as
+	 * BitPairReference::szsFromFasta() does.
+	 */
+	void writeRefFiles(
+		const std::string& outfile,
+		bool bigEndian,
+		const EList<RefRecord>& szs) const;
+
+	/**
+	 * Set 's' to the joined unambiguous characters, unpacking them on
+	 * all threads.
+	 */
+	template<typename TStr>
+	void unpack(TStr& s) const {
+		s.resize(nbp_);
+		// Give each thread a run of whole words of a packed string, so
+		// no two threads ever write the same word
+		size_t per = (nbp_ + nthreads_ - 1) / nthreads_;
+		per = (per + 63) & ~(size_t)63;
+		EList<UnpackJob<TStr> > jobs(MISC_CAT);
+		for(size_t off = 0; off < nbp_; off += per) {
+			jobs.expand();
+			jobs.back().ri = this;
+			jobs.back().s = &s;
+			jobs.back().begin = off;
+			jobs.back().end = std::min(off + per, nbp_);
+		}
+#ifdef WITH_TBB
+		EList<std::thread*> threads(MISC_CAT);
+#else
+		EList<tthread::thread*> threads(MISC_CAT);
+#endif
+		for(size_t i = 1; i < jobs.size(); i++) {
+#ifdef WITH_TBB
+			threads.push_back(new std::thread(unpackWorker<TStr>, (void*)&jobs[i]));
+#else
+			threads.push_back(new tthread::thread(unpackWorker<TStr>, (void*)&jobs[i]));
+#endif
+		}
+		if(!jobs.empty()) {
+			unpackWorker<TStr>((void*)&jobs[0]);
+		}
+		for(size_t i = 0; i < threads.size(); i++) {
+			threads[i]->join();
+			delete threads[i];
+		}
+	}
+
+private:
+
+	/// A range of the joined text for one thread to unpack
+	template<typename TStr>
+	struct UnpackJob {
+		const RefIngest *ri;
+		TStr            *s;
+		size_t           begin;
+		size_t           end;
+	};
+
+	template<typename TStr>
+	static void unpackWorker(void *vp) {
+		const UnpackJob<TStr>& j = *(const UnpackJob<TStr>*)vp;
+		const uint8_t *bits = j.ri->bits_.ptr();
+		for(size_t i = j.begin; i < j.end; i++) {
+			j.s->set((char)((bits[i >> 2] >> ((i & 3) << 1)) & 3), i);
+		}
+	}
+
+	static void scanWorker(void *vp);
+
+	bool readMore(gzFile f, EList<char>& buf);
+	void publish(RefChunk *ch);
+	bool mergeNext();
+	void merge(RefChunk& ch);
+	void closeOpen();
+	void addRecord(const RefRecord& rec, const std::string& name);
+	void appendBits(const EList<uint8_t>& bits, size_t nbp);
+
+	int                 nthreads_;
+	bool                verbose_;
+	MUTEX_T             lock_;
+	EList<RefChunk*>    chunks_;   // chunks read so far; NULL once merged
+	size_t              nscanned_; // chunks handed to workers
+	size_t              nmerged_;  // chunks merged
+	volatile bool       readDone_; // no more chunks coming
+	EList<uint8_t>      bits_;     // packed characters, as in the .4 file
+	size_t              nbp_;      // number of characters in bits_
+	// Running state of the merge
+	EList<RefRecord>   *szs_;
+	EList<std::string> *names_;
+	size_t              unambigTot_;
+	size_t              bothTot_;
+	size_t              seqsRead_;
+	RefRecord           openRec_;  // fragment continuing into the next chunk
+	std::string         openName_; // name of its sequence if it's first
+	bool                open_;     // openRec_ is in use
+};
+
+#endif /*REF_INGEST_H_*/
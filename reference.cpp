@@ -315,6 +315,9 @@ BitPairReference::BitPairReference(
 
 BitPairReference::~BitPairReference() {
 	if(buf_ != NULL && !useMm_ && !useShmem_) delete[] buf_;
+#ifdef BOWTIE_SHARED_MEM
+	if(buf_ != NULL && useShmem_) FREE_SHARED(buf_);
+#endif
 	if(sanityBuf_ != NULL) delete[] sanityBuf_;
 }
 
@@ -139,6 +139,15 @@ public:
 	bool loaded() const {
 		return loaded_;
 	}
+
+	/**
+	 * Return the bitpacked reference and its length in bytes.
+	 */
+	const uint8_t *buf() const { return buf_; }
+	size_t bufBytes() const { return bufAllocSz_; }
+
+	/// Return true iff buf() points into a memory-mapped file
+	bool mapped() const { return useMm_; }
 	
 	/**
 	 * Given a reference sequence id, return its offset into the pasted
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SA_CACHE_H_
+#define SA_CACHE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "btypes.h"
+
+/**
+ * Process-wide cache mapping rows of the forward BWT to the reference
+ * offsets that GroupWalk resolved for them by walking left.  Seeds
+ * falling in repeats (Alu, LINE, satellites) hit the same SA ranges
+ * read after read, and without the cache each read walks every row of
+ * the range again until it reaches a sampled row.
+ *
+ * The cache is a direct-mapped table of 64-bit words indexed by the low
+ * bits of the row.  Each word holds a valid bit, the remaining high
+ * bits of the row as a tag, and the offset, so an entry is read and
+ * written with one aligned 64-bit access and threads never lock.  A
+ * racing insert just overwrites the slot, and since either entry is
+ * correct, so is whichever one survives.  The table is never resized.
+ * Its size is fixed by the memory budget given to init().
+ */
+class SAOffsetCache {
+
+public:
+
+	SAOffsetCache() :
+		slots_(NULL),
+		slotMask_(0),
+		slotBits_(0),
+		offBits_(0),
+		offMask_(0) { }
+
+	~SAOffsetCache() {
+		free((void*)slots_);
+	}
+
+	/**
+	 * Allocate a table of at most 'bytes' bytes for an index with
+	 * 'len' rows.  Returns false, leaving the cache disabled, if the
+	 * budget is too small to represent rows and offsets of that size.
+	 */
+	bool init(uint64_t len, uint64_t bytes) {
+		int bits = 1;
+		while(bits < 64 && (len >> bits) != 0) bits++;
+		int slotBits = 0;
+		while(slotBits < 40 && ((uint64_t)8 << (slotBits + 1)) <= bytes) slotBits++;
+		// valid bit + tag + offset must fit in a word
+		int tagBits = (bits > slotBits) ? (bits - slotBits) : 0;
+		if(slotBits < 10 || 1 + tagBits + bits > 64) {
+			return false;
+		}
+		slots_ = (volatile uint64_t*)calloc((size_t)1 << slotBits, sizeof(uint64_t));
+		if(slots_ == NULL) {
+			return false;
+		}
+		slotBits_ = slotBits;
+		slotMask_ = ((uint64_t)1 << slotBits) - 1;
+		offBits_ = bits;
+		offMask_ = ((uint64_t)1 << bits) - 1;
+		return true;
+	}
+
+	/**
+	 * Return true iff init() succeeded.
+	 */
+	bool enabled() const {
+		return slots_ != NULL;
+	}
+
+	/**
+	 * Return the number of bytes held by the table.
+	 */
+	uint64_t bytes() const {
+		return enabled() ? (slotMask_ + 1) * sizeof(uint64_t) : 0;
+	}
+
+	/**
+	 * Return the reference offset cached for 'row', or OFF_MASK.
+	 */
+	inline TIndexOffU lookup(TIndexOffU row) const {
+		uint64_t w = slots_[row & slotMask_];
+		if(w == (tag(row) | ((uint64_t)(w & offMask_)))) {
+			return (TIndexOffU)(w & offMask_);
+		}
+		return OFF_MASK;
+	}
+
+	/**
+	 * Remember that 'row' resolves to reference offset 'off'.
+	 */
+	inline void insert(TIndexOffU row, TIndexOffU off) {
+		slots_[row & slotMask_] = tag(row) | (uint64_t)off;
+	}
+
+private:
+
+	inline uint64_t tag(TIndexOffU row) const {
+		return ((uint64_t)1 << 63) | ((((uint64_t)row) >> slotBits_) << offBits_);
+	}
+
+	volatile uint64_t *slots_;
+	uint64_t slotMask_;
+	int      slotBits_;
+	int      offBits_;
+	uint64_t offMask_;
+};
+
+#endif /*SA_CACHE_H_*/
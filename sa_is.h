@@ -0,0 +1,308 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SA_IS_H_
+#define SA_IS_H_
+
+#include <stdint.h>
+#include <iostream>
+#include "assert_helpers.h"
+#include "btypes.h"
+#include "ds.h"
+#include "mem_ids.h"
+
+/**
+ * Linear-time suffix-array construction by induced sorting (SA-IS),
+ * after Nong, Zhang and Chan, "Two Efficient Algorithms for Linear
+ * Time Suffix Array Construction", IEEE Trans. Computers 60(10), 2011.
+ *
+ * Each suffix is classified as S-type (smaller than the suffix to its
+ * right) or L-type.  The leftmost S-type suffixes of each run (LMS
+ * suffixes) are bucketed by first character, and two linear scans of
+ * the SA induce the order of every other suffix from them.  Doing that
+ * once sorts the LMS substrings, which are then named and, if names
+ * aren't unique, the string of names (at most half as long) is sorted
+ * recursively.  A final pair of scans induces the full SA from the
+ * sorted LMS suffixes.
+ *
+ * Apart from the SA itself, each level needs one bit per character for
+ * the types and one word per distinct character for the buckets; the
+ * reduced string and its SA live in the SA being built.
+ */
+
+/// Marks a slot of the SA that hasn't been filled in yet
+static const TIndexOffU SAIS_EMPTY = OFF_MASK;
+
+/**
+ * The top-level text as sais() sees it: the DNA characters (0-3)
+ * shifted up by one, then a unique largest character (5) standing in
+ * for '$', which bowtie sorts after every other character, then the
+ * unique smallest character (0) that SA-IS needs at the end.  Entries
+ * 1..len+1 of the SA of this string are therefore the SA of the
+ * original text in bowtie's order.
+ */
+template<typename TStr>
+class SaisText {
+public:
+	SaisText(const TStr& s) : s_(s), len_((TIndexOffU)s.length()) { }
+
+	inline TIndexOffU operator[](TIndexOffU i) const {
+		assert_leq(i, len_ + 1);
+		return i < len_ ? (TIndexOffU)s_[i] + 1 : (i == len_ ? 5 : 0);
+	}
+
+	/// Length including both terminators
+	TIndexOffU length() const { return len_ + 2; }
+
+	/// Largest character
+	static TIndexOffU alphabetMax() { return 5; }
+
+private:
+	const TStr& s_;
+	TIndexOffU  len_;
+};
+
+/**
+ * The string of LMS-substring names sorted at recursion levels > 0.
+ */
+class SaisReduced {
+public:
+	SaisReduced(const TIndexOffU *s) : s_(s) { }
+
+	inline TIndexOffU operator[](TIndexOffU i) const {
+		return s_[i];
+	}
+
+private:
+	const TIndexOffU *s_;
+};
+
+/**
+ * One bit per suffix: set for S-type, clear for L-type.
+ */
+class SaisTypes {
+public:
+	SaisTypes(TIndexOffU n) : bits_(EBWTB_CAT) {
+		bits_.resizeExact((size_t)(n >> 3) + 1);
+		bits_.fillZero();
+	}
+
+	inline bool isS(TIndexOffU i) const {
+		return ((bits_[(size_t)(i >> 3)] >> (i & 7)) & 1) != 0;
+	}
+
+	inline void setS(TIndexOffU i) {
+		bits_[(size_t)(i >> 3)] |= (uint8_t)(1 << (i & 7));
+	}
+
+	/// Return true iff suffix i is the leftmost of a run of S-type suffixes
+	inline bool isLMS(TIndexOffU i) const {
+		return i > 0 && i != SAIS_EMPTY && isS(i) && !isS(i-1);
+	}
+
+private:
+	EList<uint8_t> bits_;
+};
+
+/**
+ * Set bkt[c] to the start (or, if 'end', one past the end) of the
+ * bucket for character c, for c in [0, K].
+ */
+template<typename T>
+static void saisBuckets(
+	const T& s,
+	TIndexOffU n,
+	TIndexOffU K,
+	EList<TIndexOffU>& bkt,
+	bool end)
+{
+	bkt.resizeExact((size_t)K + 1);
+	bkt.fillZero();
+	for(TIndexOffU i = 0; i < n; i++) {
+		bkt[s[i]]++;
+	}
+	TIndexOffU sum = 0;
+	for(TIndexOffU c = 0; c <= K; c++) {
+		sum += bkt[c];
+		bkt[c] = end ? sum : sum - bkt[c];
+	}
+}
+
+/**
+ * Scan left to right, placing each L-type suffix at the front of its
+ * bucket as soon as the suffix one to its right has been placed.
+ */
+template<typename T>
+static void saisInduceL(
+	const T& s,
+	const SaisTypes& t,
+	TIndexOffU *SA,
+	TIndexOffU n,
+	TIndexOffU K,
+	EList<TIndexOffU>& bkt)
+{
+	saisBuckets(s, n, K, bkt, false);
+	for(TIndexOffU i = 0; i < n; i++) {
+		TIndexOffU j = SA[i];
+		if(j != SAIS_EMPTY && j > 0 && !t.isS(j-1)) {
+			SA[bkt[s[j-1]]++] = j-1;
+		}
+	}
+}
+
+/**
+ * Scan right to left, placing each S-type suffix at the back of its
+ * bucket as soon as the suffix one to its right has been placed.
+ */
+template<typename T>
+static void saisInduceS(
+	const T& s,
+	const SaisTypes& t,
+	TIndexOffU *SA,
+	TIndexOffU n,
+	TIndexOffU K,
+	EList<TIndexOffU>& bkt)
+{
+	saisBuckets(s, n, K, bkt, true);
+	for(TIndexOffU i = n; i-- > 0;) {
+		TIndexOffU j = SA[i];
+		if(j != SAIS_EMPTY && j > 0 && t.isS(j-1)) {
+			SA[--bkt[s[j-1]]] = j-1;
+		}
+	}
+}
+
+/**
+ * Fill SA[0..n) with the suffix array of s[0..n), whose characters are
+ * in [0, K] and whose last character is a unique 0.  If 'log' is
+ * non-NULL, report the size of each level there.
+ */
+template<typename T>
+static void sais(
+	const T& s,
+	TIndexOffU *SA,
+	TIndexOffU n,
+	TIndexOffU K,
+	std::ostream *log = NULL,
+	int level = 0)
+{
+	assert_geq(n, 2);
+	assert_eq(0, s[n-1]);
+	SaisTypes t(n);
+	t.setS(n-1); // the final 0 is S-type, and the character before it L-type
+	for(TIndexOffU i = n-1; i-- > 0;) {
+		if(s[i] < s[i+1] || (s[i] == s[i+1] && t.isS(i+1))) {
+			t.setS(i);
+		}
+	}
+	// Stage 1: sort the LMS substrings by inducing from the LMS
+	// suffixes placed in arbitrary order at the ends of their buckets
+	{
+		EList<TIndexOffU> bkt(EBWTB_CAT);
+		saisBuckets(s, n, K, bkt, true);
+		for(TIndexOffU i = 0; i < n; i++) {
+			SA[i] = SAIS_EMPTY;
+		}
+		for(TIndexOffU i = 1; i < n; i++) {
+			if(t.isLMS(i)) {
+				SA[--bkt[s[i]]] = i;
+			}
+		}
+		saisInduceL(s, t, SA, n, K, bkt);
+		saisInduceS(s, t, SA, n, K, bkt);
+	}
+	// Move the sorted LMS substrings to the front of SA
+	TIndexOffU n1 = 0;
+	for(TIndexOffU i = 0; i < n; i++) {
+		if(t.isLMS(SA[i])) {
+			SA[n1++] = SA[i];
+		}
+	}
+	assert_leq(n1, (n >> 1) + 1);
+	// Name them: equal substrings get equal names, and names increase
+	// in sorted order.  LMS positions are at least two apart, so
+	// position/2 is a collision-free slot in the back half of SA.
+	for(TIndexOffU i = n1; i < n; i++) {
+		SA[i] = SAIS_EMPTY;
+	}
+	TIndexOffU name = 0, prev = SAIS_EMPTY;
+	for(TIndexOffU i = 0; i < n1; i++) {
+		TIndexOffU pos = SA[i];
+		bool diff = false;
+		for(TIndexOffU d = 0; d < n; d++) {
+			if(prev == SAIS_EMPTY ||
+			   s[pos+d] != s[prev+d] ||
+			   t.isS(pos+d) != t.isS(prev+d))
+			{
+				diff = true;
+				break;
+			} else if(d > 0 && (t.isLMS(pos+d) || t.isLMS(prev+d))) {
+				break;
+			}
+		}
+		if(diff) {
+			name++;
+			prev = pos;
+		}
+		SA[n1 + (pos >> 1)] = name - 1;
+	}
+	for(TIndexOffU i = n, j = n; i-- > n1;) {
+		if(SA[i] != SAIS_EMPTY) {
+			SA[--j] = SA[i];
+		}
+	}
+	if(log != NULL) {
+		(*log) << "  SA-IS level " << level << ": " << n << " suffixes, "
+		       << n1 << " LMS substrings, " << name << " distinct" << std::endl;
+	}
+	// Stage 2: sort the LMS suffixes, recursing if their names alone
+	// don't determine the order
+	TIndexOffU *SA1 = SA, *s1 = SA + n - n1;
+	if(name < n1) {
+		sais(SaisReduced(s1), SA1, n1, name - 1, log, level + 1);
+	} else {
+		for(TIndexOffU i = 0; i < n1; i++) {
+			SA1[s1[i]] = i;
+		}
+	}
+	// Stage 3: place the sorted LMS suffixes at the ends of their
+	// buckets and induce the rest
+	EList<TIndexOffU> bkt(EBWTB_CAT);
+	saisBuckets(s, n, K, bkt, true);
+	for(TIndexOffU i = 1, j = 0; i < n; i++) {
+		if(t.isLMS(i)) {
+			s1[j++] = i;
+		}
+	}
+	for(TIndexOffU i = 0; i < n1; i++) {
+		SA1[i] = s1[SA1[i]];
+	}
+	for(TIndexOffU i = n1; i < n; i++) {
+		SA[i] = SAIS_EMPTY;
+	}
+	for(TIndexOffU i = n1; i-- > 0;) {
+		TIndexOffU j = SA[i];
+		SA[i] = SAIS_EMPTY;
+		SA[--bkt[s[j]]] = j;
+	}
+	saisInduceL(s, t, SA, n, K, bkt);
+	saisInduceS(s, t, SA, n, K, bkt);
+}
+
+#endif /*SA_IS_H_*/
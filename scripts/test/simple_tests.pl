@@ -4294,6 +4294,119 @@ my @cases = (
 		       "YT:Z:UU" => 1, "MD:Z:2G2C2"    => 1 },
 	  }],
 	},
+
+	#
+	# Shared seed cache
+	#
+
+	# Reads overlapping by a multiple of the seed interval share seeds;
+	# hits served from the cache must give the same alignments
+	{ name   => "Shared seed cache, unpaired",
+	  ref    => [ "CTTGTCTCCAAGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGACCGGGGCACACTGCACTCAGTTCCCATTTAGAGGATCCTAGCCTAGCTACGCGTTTGCGCATCAGGCTGTCCCATACATCAAGCGGTTCCCCTCAAATTATCCGGACTCGGTAAGGGCAGCGAGTAAATATTTTACAATACGTTTCTTGTCAATCTGCTGCTTTGTACGCGTCACAGTTACTCGGCGAAGGCCCGTCTTTTTGCTGACCAGGAAATTTCACAGCTGAGCC" ],
+	  reads  => [ "AGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCG",
+	              "TTTAGTAGACAAATCGTTCCATCACCAATTCGCTGGTTGT",
+	              "ACAAATCGTTCCATCACCAATTCGCTGGTTGTTGAACTAT",
+	              "GAGGATCCTAGCCTAGCTACGCGTTTGCGCATCAGGCTGT",
+	              "TAGCCTAGCTACGCGTTTGCGCATCAGGCTGTCCCATACA",
+	              "TTTTACAATACGTTTCTTGTAAATCTGCTGCTTTGTACGC" ],
+	  args    => "--cache",
+	  same_as => "",
+	  hits   => [ { 10 => 1 }, { 18 => 1 }, { 26 => 1 },
+	              { 100 => 1 }, { 108 => 1 }, { 200 => 1 } ] },
+
+	{ name   => "Shared seed cache, paired, multithreaded",
+	  ref    => [ "CTTGTCTCCAAGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGACCGGGGCACACTGCACTCAGTTCCCATTTAGAGGATCCTAGCCTAGCTACGCGTTTGCGCATCAGGCTGTCCCATACATCAAGCGGTTCCCCTCAAATTATCCGGACTCGGTAAGGGCAGCGAGTAAATATTTTACAATACGTTTCTTGTCAATCTGCTGCTTTGTACGCGTCACAGTTACTCGGCGAAGGCCCGTCTTTTTGCTGACCAGGAAATTTCACAGCTGAGCC" ],
+	  mate1s => [ "ATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGA",
+	              "ATCACCAATTCGCTGGTTGTTGAACTATACGACCGGGGCA" ],
+	  mate2s => [ "TAACTGTGACGCGTACAAAGCAGCAGATTGACAAGAAACG",
+	              "TCGCCGAGTAACTGTGACGCGTACAAAGCAGCAGATTGAC" ],
+	  args    => "--cache -p 2 --reorder",
+	  same_as => "-p 2 --reorder",
+	  pairhits => [ { "30,210" => 1 }, { "38,218" => 1 } ] },
+
+	#
+	# Alignments reused for duplicate reads
+	#
+
+	# Exact duplicates, qualities and all, get the alignments of the
+	# first copy; the last read differs from its first copy only in its
+	# qualities and must be aligned itself
+	{ name   => "Collapsed duplicates, unpaired",
+	  ref    => [ "CTTGTCTCCAAGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGACCGGGGCACACTGCACTCAGTTCCCATTTAGAGGATCCTAGCCTAGCTACGCGTTTGCGCATCAGGCTGTCCCATACATCAAGCGGTTCCCCTCAAATTATCCGGACTCGGTAAGGGCAGCGAGTAAATATTTTACAATACGTTTCTTGTCAATCTGCTGCTTTGTACGCGTCACAGTTACTCGGCGAAGGCCCGTCTTTTTGCTGACCAGGAAATTTCACAGCTGAGCC" ],
+	  reads  => [ "AGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCG",
+	              "TTTTACAATACGTTTCTTGTAAATCTGCTGCTTTGTACGC",
+	              "AGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCG",
+	              "TTTTACAATACGTTTCTTGTAAATCTGCTGCTTTGTACGC",
+	              "TTTTACAATACGTTTCTTGTAAATCTGCTGCTTTGTACGC" ],
+	  quals  => [ "IIIIIIIIIIIIIIIIIIII55555IIIIIIIIIIIIIII",
+	              "IIIIIIIIIIIIIIIIIIII+IIIIIIIIIIIIIIIIIII",
+	              "IIIIIIIIIIIIIIIIIIII55555IIIIIIIIIIIIIII",
+	              "IIIIIIIIIIIIIIIIIIII+IIIIIIIIIIIIIIIIIII",
+	              "IIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIII" ],
+	  args    => "--collapse-dups",
+	  same_as => "",
+	  hits   => [ { 10 => 1 }, { 200 => 1 }, { 10 => 1 }, { 200 => 1 }, { 200 => 1 } ] },
+
+	{ name   => "Collapsed duplicates, paired, multithreaded",
+	  ref    => [ "CTTGTCTCCAAGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGACCGGGGCACACTGCACTCAGTTCCCATTTAGAGGATCCTAGCCTAGCTACGCGTTTGCGCATCAGGCTGTCCCATACATCAAGCGGTTCCCCTCAAATTATCCGGACTCGGTAAGGGCAGCGAGTAAATATTTTACAATACGTTTCTTGTCAATCTGCTGCTTTGTACGCGTCACAGTTACTCGGCGAAGGCCCGTCTTTTTGCTGACCAGGAAATTTCACAGCTGAGCC" ],
+	  mate1s => [ "ATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGA",
+	              "ATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGA",
+	              "ATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGA" ],
+	  mate2s => [ "TAACTGTGACGCGTACAAAGCAGCAGATTGACAAGAAACG",
+	              "TAACTGTGACGCGTACAAAGCAGCAGATTGACAAGAAACG",
+	              "TAACTGTGACGCGTACAAAGCAGCAGATTGACAAGAAACG" ],
+	  args    => "--collapse-dups -p 2 --reorder",
+	  same_as => "-p 2 --reorder",
+	  pairhits => [ { "30,210" => 1 }, { "30,210" => 1 }, { "30,210" => 1 } ] },
+
+	#
+	# Effort adapted to a budget
+	#
+
+	# The reads cost far less than the budget, so after the first epoch
+	# of about 4000 reads effort steps up to 3 seed rounds (-R); the
+	# step doesn't help any read align, so it's undone after the second.
+	# Each read's seeds hit but it doesn't align, and --seed-boost 0
+	# makes it go through every round, so the second epoch must average
+	# 3 rounds rather than the 2 -R gives.
+	{ name   => "Adaptive effort, extra seed round",
+	  ref    => [ "CTTGTCTCCAAGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGACCGGGGCACACTGCACTCAGTTCCCATTTAGAGGATCCTAGCCTAGCTACGCGTTTGCGCATCAGGCTGTCCCATACATCAAGCGGTTCCCCTCAAATTATCCGGACTCGGTAAGGGCAGCGAGTAAATATTTTACAATACGTTTCTTGTCAATCTGCTGCTTTGTACGCGTCACAGTTACTCGGCGAAGGCCCGTCTTTTTGCTGACCAGGAAATTTCACAGCTGAGCC" ],
+	  fastq  => join("", map { "\@r$_\nAGTACCCATTTAGTAGACAAATCGTTCCATGATTACAGAT\n+\n".("I" x 40)."\n" } (1..8100)),
+	  args   => "--effort-budget 100000 --seed-boost 0",
+	  report => "",
+	  stderr => qr/^  Per read: [0-9.]+ extensions, 2\.50 seed rounds; 0\.00% aligned$/,
+	  lines  => 8100 },
+
+	#
+	# Skipping seeds that are frequent in the reference
+	#
+
+	# The second reference is five copies of the second read, so all of
+	# its seeds are in the .kmer table.  They're put off, then searched
+	# anyway since no other seed hits, so the alignments must be the
+	# same as without --skip-freq-seeds.
+	{ name   => "Frequent seeds skipped",
+	  ref    => [ "CTTGTCTCCAAGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGACCGGGGCACACTGCACTCAGTTCCCATTTAGAGGATCCTAGCCTAGCTACGCGTTTGCGCATCAGGCTGTCCCATACATCAAGCGGTTCCCCTCAAATTATCCGGACTCGGTAAGGGCAGCGAGTAAATATTTTACAATACGTTTCTTGTCAATCTGCTGCTTTGTACGCGTCACAGTTACTCGGCGAAGGCCCGTCTTTTTGCTGACCAGGAAATTTCACAGCTGAGCC",
+	              "TTTCCTCATGCAATTCAAAACCATGTCCGTAATGTAGGCG" x 5 ],
+	  reads  => [ "AGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCG",
+	              "TTTCCTCATGCAATTCAAAACCATGTCCGTAATGTAGGCG" ],
+	  build_args => "--freq-kmers 4 --freq-kmer-len 10",
+	  args   => "--skip-freq-seeds 4",
+	  same_as => "",
+	  stderr => qr/^Skipped [1-9][0-9]* seeds occurring at least 4 times$/,
+	  hits   => [ { 10 => 1 }, { 0 => 1, 40 => 1, 80 => 1, 120 => 1, 160 => 1 } ] },
+
+	# Building the same index without --freq-kmers removes the .kmer
+	# table the case above left, which wouldn't match a new index
+	{ name   => "Frequent seeds, no table",
+	  ref    => [ "CTTGTCTCCAAGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCGCTGGTTGTTGAACTATACGACCGGGGCACACTGCACTCAGTTCCCATTTAGAGGATCCTAGCCTAGCTACGCGTTTGCGCATCAGGCTGTCCCATACATCAAGCGGTTCCCCTCAAATTATCCGGACTCGGTAAGGGCAGCGAGTAAATATTTTACAATACGTTTCTTGTCAATCTGCTGCTTTGTACGCGTCACAGTTACTCGGCGAAGGCCCGTCTTTTTGCTGACCAGGAAATTTCACAGCTGAGCC",
+	              "TTTCCTCATGCAATTCAAAACCATGTCCGTAATGTAGGCG" x 5 ],
+	  reads  => [ "AGTACCCATTTAGTAGACAAATCGTTCCATCACCAATTCG",
+	              "TTTCCTCATGCAATTCAAAACCATGTCCGTAATGTAGGCG" ],
+	  args   => "--skip-freq-seeds 4",
+	  same_as => "",
+	  stderr => qr/^Warning: could not read k-mer table /,
+	  hits   => [ { 10 => 1 }, { 0 => 1, 40 => 1, 80 => 1, 120 => 1, 160 => 1 } ] },
 );
 
 ##
@@ -4369,7 +4482,7 @@ sub writeReads($$$$$$$$$) {
 ##
 # Run bowtie2 with given arguments
 #
-sub runbowtie2($$$$$$$$$$$$$$$$$$$$$$) {
+sub runbowtie2($$$$$$$$$$$$$$$$$$$$$$$$) {
 
 	my (
 		$do_build,
@@ -4393,10 +4506,12 @@ sub runbowtie2($$$$$$$$$$$$$$$$$$$$$$) {
 		$rawls,
 		$header_ls,
 		$raw_header_ls,
-		$should_abort) = @_;
+		$should_abort,
+		$err_ls,
+		$build_args) = @_;
 
 my  $idx_type = "";
-	$args .= " --quiet";
+	$args .= " --quiet" unless defined($err_ls);
 	$reportargs = "-a" unless defined($reportargs);
 	$args .= " $reportargs";
 	if ($large_idx){
@@ -4408,7 +4523,7 @@ my  $idx_type = "";
 	while(<FA>) { print $_; }
 	close(FA);
 	if($do_build) {
-		my $build_args = "";
+		$build_args = "" unless defined($build_args);
 		my $cmd = "$bowtie2_build $idx_type --quiet --sanity $build_args $fa .simple_tests.tmp";
 		print "$cmd\n";
 		system($cmd);
@@ -4538,6 +4653,8 @@ my  $idx_type = "";
 			$cmd = "$bowtie2 $binary_type @ARGV $idx_type $args --reads-per-batch $batch_size -x .simple_tests.tmp $formatarg $readarg";
 		}
 	}
+	# Keep bowtie2's standard error if the caller wants to check it
+	$cmd .= " 2> .simple_tests.err" if defined($err_ls);
 	print "$cmd\n";
 	open(BT, "$cmd |") || die "Could not open pipe '$cmd |'";
 	while(<BT>) {
@@ -4552,6 +4669,17 @@ my  $idx_type = "";
 		}
 	}
 	close(BT);
+	my $exitlevel = $?;
+	if(defined($err_ls)) {
+		open(ERR, ".simple_tests.err") || die;
+		while(<ERR>) {
+			print STDERR $_;
+			chomp;
+			push @$err_ls, $_;
+		}
+		close(ERR);
+	}
+	$? = $exitlevel;
 	($? == 0 ||  $should_abort) || die "bowtie2 aborted with exitlevel $?\n";
 	($? != 0 || !$should_abort) || die "bowtie2 failed to abort!\n";
 }
@@ -4590,6 +4718,7 @@ sub matchSamOptionalFlags($$) {
 
 my $tmpfafn = ".simple_tests.pl.fa";
 my $last_ref = undef;
+my $last_build_args = undef;
 foreach my $large_idx (undef,1) {
 	foreach my $binary_type ("release", "debug", "sanitized") {
 		for (my $ci = 0; $ci < scalar(@cases); $ci++) {
@@ -4598,11 +4727,15 @@ foreach my $large_idx (undef,1) {
 			# If there's any skipping of cases to be done, do it here prior to the
 			# eq_deeply check
 			my $do_build = 0;
-			unless(defined($last_ref) && eq_deeply($c->{ref}, $last_ref)) {
+			my $build_args = defined($c->{build_args}) ? $c->{build_args} : "";
+			unless(defined($last_ref) && eq_deeply($c->{ref}, $last_ref) &&
+			       $build_args eq $last_build_args)
+			{
 				writeFasta($c->{ref}, $tmpfafn);
 				$do_build = 1;
 			}
 			$last_ref = $c->{ref};
+			$last_build_args = $build_args;
 			# For each set of arguments...
 			my $case_args = $c->{args};
 			$case_args = "" unless defined($case_args);
@@ -4666,6 +4799,7 @@ foreach my $large_idx (undef,1) {
 				my @rawlines = ();
 				my @header_lines = ();
 				my @header_rawlines = ();
+				my @errlines = ();
 				print $c->{name}." " if defined($c->{name});
 				print "(fw:".($fw ? 1 : 0).", sam:$sam)\n";
 				my $mate1fw = 1;
@@ -4698,12 +4832,13 @@ foreach my $large_idx (undef,1) {
 					$m2s   = \@m1 if defined($m2s);
 					$q2s   = \@q1 if defined($q2s);
 				}
-				my $a = $case_args;
+				my $orientarg = "";
 				if(defined($m2s)) {
-					$a .= " --";
-					$a .= ($mate1fw ? "f" : "r");
-					$a .= ($mate2fw ? "f" : "r");
+					$orientarg .= " --";
+					$orientarg .= ($mate1fw ? "f" : "r");
+					$orientarg .= ($mate2fw ? "f" : "r");
 				}
+				my $a = $case_args.$orientarg;
 				runbowtie2(
 					$do_build && $first,
 					$large_idx,
@@ -4726,8 +4861,53 @@ foreach my $large_idx (undef,1) {
 					\@rawlines,
 					\@header_lines,
 					\@header_rawlines,
-					$c->{should_abort});
+					$c->{should_abort},
+					defined($c->{stderr}) ? \@errlines : undef,
+					$build_args);
 				$first = 0;
+				if(defined($c->{stderr})) {
+					# Some line of bowtie2's standard error must match
+					my $re = $c->{stderr};
+					scalar(grep { $_ =~ $re } @errlines) > 0 ||
+						die "Expected a line matching $re on standard error";
+				}
+				if(defined($c->{same_as})) {
+					# Align the same reads with the 'same_as' arguments in
+					# place of 'args'; the SAM records must be identical
+					my (@lines2, @rawlines2, @header_lines2, @header_rawlines2) = ();
+					runbowtie2(
+						0,
+						$large_idx,
+						$binary_type,
+						$c->{same_as}.$orientarg,
+						$tmpfafn,
+						$c->{report},
+						$read_file_format,
+						$read_file,
+						$mate1_file,
+						$mate2_file,
+						$reads,
+						$quals,
+						$m1s,
+						$q1s,
+						$m2s,
+						$q2s,
+						$c->{names},
+						\@lines2,
+						\@rawlines2,
+						\@header_lines2,
+						\@header_rawlines2,
+						0,
+						undef,
+						undef);
+					scalar(@rawlines) == scalar(@rawlines2) ||
+						die "Expected ".scalar(@rawlines2)." lines as with \"$c->{same_as}\", got ".scalar(@rawlines);
+					for my $li (0 .. $#rawlines) {
+						$rawlines[$li] eq $rawlines2[$li] ||
+							die "Expected the same output as with \"$c->{same_as}\":\n".
+							    "$rawlines2[$li]\ngot:\n$rawlines[$li]\n";
+					}
+				}
 				my $pe = defined($c->{mate1s}) && $c->{mate1s} ne "";
 				$pe = $pe || defined($mate1_file);
 				$pe = $pe || $c->{paired};
@@ -21,19 +21,240 @@
 
 #include <iostream>
 #include <string>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
-#include <sys/shm.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "shmem.h"
+#include "assert_helpers.h"
+#include "ds.h"
+#include "threading.h"
 
 using namespace std;
 
+/// How many times a follower polls an object whose leader hasn't
+/// written the header yet before deciding the leader is gone
+static const int SHMEM_HDR_POLLS = 200;
+
+/**
+ * One shared-memory object this process is attached to.  The open
+ * descriptor carries our flock(), so it stays open until we detach.
+ */
+struct SharedMemAttachment {
+	void   *mem;    // start of data
+	size_t  mapLen; // header + data
+	int     fd;
+};
+
+static EList<SharedMemAttachment> attachments;
+static MUTEX_T attachmentsMutex;
+
+/**
+ * Split "<file>[<array>]" into the path of the file and the array tag,
+ * resolving the path so that every process uses the same object no
+ * matter what directory it was started from.
+ */
+static void splitSharedName(const string& fname, string& path, string& tag) {
+	size_t br = fname.rfind('[');
+	path = (br == string::npos) ? fname : fname.substr(0, br);
+	tag  = (br == string::npos) ? string() : fname.substr(br);
+	char buf[PATH_MAX];
+	if(realpath(path.c_str(), buf) != NULL) {
+		path = buf;
+	}
+}
+
+/**
+ * Return the shm_open() name for 'fname'.  Names are kept short (some
+ * systems cap them at 31 characters) by hashing the resolved path.
+ */
+static string sharedMemName(const string& fname) {
+	string path, tag;
+	splitSharedName(fname, path, tag);
+	path += tag;
+	uint64_t h = 14695981039346656037ULL; // FNV-1a
+	for(size_t i = 0; i < path.length(); i++) {
+		h ^= (uint8_t)path[i];
+		h *= 1099511628211ULL;
+	}
+	char buf[32];
+	snprintf(buf, sizeof(buf), "/bt2-%016llx", (unsigned long long)h);
+	return string(buf);
+}
+
+/**
+ * Fill in the fields of 'hdr' that describe the data and the index
+ * file it came from.
+ */
+static void describeSharedMem(const string& fname, size_t len, SharedMemHeader& hdr) {
+	string path, tag;
+	splitSharedName(fname, path, tag);
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SHMEM_MAGIC, 8);
+	hdr.version = SHMEM_VERSION;
+	hdr.len = len;
+	struct stat st;
+	if(stat(path.c_str(), &st) == 0) {
+		hdr.fileSize = (uint64_t)st.st_size;
+		hdr.fileMtime = (int64_t)st.st_mtime;
+	}
+}
+
+static bool pidAlive(int32_t pid) {
+	return pid > 0 && (kill((pid_t)pid, 0) == 0 || errno == EPERM);
+}
+
+bool attachSharedMem(
+	const string& fname,
+	size_t len,
+	void **mem,
+	const char *memName,
+	bool verbose)
+{
+	string name = sharedMemName(fname);
+	SharedMemHeader want;
+	describeSharedMem(fname, len, want);
+	size_t mapLen = SHMEM_HDR_SZ + len;
+	if(verbose) {
+		cerr << "Attaching " << len << " bytes of shared memory " << name
+		     << " for " << memName << endl;
+	}
+	int polls = 0;
+	while(true) {
+		bool leader = true;
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0666);
+		if(fd >= 0) {
+			// Hold the object exclusively until NOTIFY_SHARED
+			if(flock(fd, LOCK_EX) < 0 || ftruncate(fd, (off_t)mapLen) < 0) {
+				cerr << "Could not size shared memory " << name << " for " << memName
+				     << " to " << mapLen << " bytes: " << strerror(errno) << endl;
+				close(fd);
+				shm_unlink(name.c_str());
+				throw 1;
+			}
+		} else if(errno == EEXIST) {
+			leader = false;
+			if((fd = shm_open(name.c_str(), O_RDWR, 0)) < 0) {
+				if(errno == ENOENT) continue; // unlinked in the meantime
+				cerr << "Could not open shared memory " << name << " for " << memName
+				     << ": " << strerror(errno) << endl;
+				throw 1;
+			}
+			// Blocks until the leader has finished loading
+			if(flock(fd, LOCK_SH) < 0) {
+				cerr << "Could not lock shared memory " << name << " for " << memName
+				     << ": " << strerror(errno) << endl;
+				close(fd);
+				throw 1;
+			}
+			struct stat st;
+			if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SharedMemHeader)) {
+				// The leader has created the object but not yet locked and
+				// sized it, or died in between
+				close(fd);
+				if(++polls < SHMEM_HDR_POLLS) {
+					usleep(5000);
+				} else {
+					shm_unlink(name.c_str());
+					polls = 0;
+				}
+				continue;
+			}
+			if((size_t)st.st_size != mapLen) {
+				if(verbose) {
+					cerr << "  Shared memory " << name << " has size " << st.st_size
+					     << ", expected " << mapLen << "; replacing it" << endl;
+				}
+				close(fd);
+				shm_unlink(name.c_str());
+				continue;
+			}
+		} else {
+			cerr << "Could not create shared memory " << name << " for " << memName
+			     << ": " << strerror(errno) << endl;
+			throw 1;
+		}
+		void *p = mmap(NULL, mapLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(p == MAP_FAILED) {
+			cerr << "Failed to map shared memory " << name << " for " << memName
+			     << ": " << strerror(errno) << endl;
+			close(fd);
+			if(leader) shm_unlink(name.c_str());
+			throw 1;
+		}
+		SharedMemHeader *hdr = (SharedMemHeader*)p;
+		if(leader) {
+			*hdr = want;
+			hdr->state = SHMEM_UNINIT;
+			hdr->leader = (int32_t)getpid();
+		} else if(memcmp(hdr->magic, SHMEM_MAGIC, 8) != 0 ||
+		          hdr->version != want.version ||
+		          hdr->len != want.len ||
+		          hdr->fileSize != want.fileSize ||
+		          hdr->fileMtime != want.fileMtime ||
+		          hdr->state != SHMEM_INIT)
+		{
+			// Left behind by a different version, built from a different
+			// index file, or abandoned by a leader that died mid-load
+			if(verbose) {
+				cerr << "  Shared memory " << name << " is "
+				     << (hdr->state == SHMEM_UNINIT && !pidAlive(hdr->leader) ?
+				         "incomplete" : "stale") << "; replacing it" << endl;
+			}
+			munmap(p, mapLen);
+			close(fd);
+			shm_unlink(name.c_str());
+			continue;
+		}
+		int32_t users = __sync_add_and_fetch(&hdr->users, 1);
+		*mem = (char*)p + SHMEM_HDR_SZ;
+		{
+			ThreadSafe ts(attachmentsMutex);
+			attachments.expand();
+			attachments.back().mem = *mem;
+			attachments.back().mapLen = mapLen;
+			attachments.back().fd = fd;
+		}
+		if(verbose) {
+			if(leader) {
+				cerr << "  I (pid = " << getpid() << ") created the "
+				     << "shared memory for " << memName << endl;
+			} else {
+				cerr << "  I (pid = " << getpid()
+				     << ") did not create the shared memory for "
+				     << memName << ".  Pid " << hdr->leader << " did; "
+				     << users << " process(es) attached." << endl;
+			}
+		}
+		return leader;
+	}
+}
+
 /**
  * Notify other users of a shared-memory chunk that the leader has
  * finished initializing it.
  */
 void notifySharedMem(void *mem, size_t len) {
-	((volatile uint32_t*)((char*)mem + len))[0] = SHMEM_INIT;
+	SharedMemHeader *hdr = (SharedMemHeader*)((char*)mem - SHMEM_HDR_SZ);
+	assert_eq(len, hdr->len);
+	(void)len;
+	__sync_synchronize();
+	hdr->state = SHMEM_INIT;
+	ThreadSafe ts(attachmentsMutex);
+	for(size_t i = 0; i < attachments.size(); i++) {
+		if(attachments[i].mem == mem) {
+			// Let the followers blocked in attachSharedMem() through
+			flock(attachments[i].fd, LOCK_SH);
+			break;
+		}
+	}
 }
 
 /**
@@ -41,9 +262,52 @@ void notifySharedMem(void *mem, size_t len) {
  * initializing it.
  */
 void waitSharedMem(void *mem, size_t len) {
-	while(((volatile uint32_t*)((char*)mem + len))[0] != SHMEM_INIT) {
-		sleep(1);
+	SharedMemHeader *hdr = (SharedMemHeader*)((char*)mem - SHMEM_HDR_SZ);
+	assert_eq(len, hdr->len);
+	(void)len;
+	if(hdr->state != SHMEM_INIT) {
+		cerr << "Shared memory was not initialized by its leader (pid "
+		     << hdr->leader << ")" << endl;
+		throw 1;
+	}
+}
+
+void freeSharedMem(void *mem) {
+	ThreadSafe ts(attachmentsMutex);
+	for(size_t i = 0; i < attachments.size(); i++) {
+		if(attachments[i].mem != mem) continue;
+		SharedMemHeader *hdr = (SharedMemHeader*)((char*)mem - SHMEM_HDR_SZ);
+		__sync_sub_and_fetch(&hdr->users, 1);
+		munmap((char*)mem - SHMEM_HDR_SZ, attachments[i].mapLen);
+		close(attachments[i].fd); // drops our lock
+		attachments.erase(i);
+		return;
+	}
+}
+
+bool removeSharedMem(const string& fname, bool verbose) {
+	string name = sharedMemName(fname);
+	int fd = shm_open(name.c_str(), O_RDONLY, 0);
+	if(fd < 0) {
+		return false;
+	}
+	if(verbose) {
+		// A failed non-blocking exclusive lock means someone is still
+		// attached (or loading); the header count can't be trusted for
+		// processes that died without detaching.
+		bool busy = flock(fd, LOCK_EX | LOCK_NB) < 0;
+		SharedMemHeader hdr;
+		memset(&hdr, 0, sizeof(hdr));
+		if(pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t)sizeof(hdr)) {
+			hdr.len = 0;
+		}
+		cerr << "Removing shared memory " << name << " for " << fname
+		     << " (" << hdr.len << " bytes, "
+		     << (busy ? "still in use" : "not in use") << ")" << endl;
 	}
+	close(fd);
+	shm_unlink(name.c_str());
+	return true;
 }
 
 #endif
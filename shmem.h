@@ -23,28 +23,90 @@
 #ifdef BOWTIE_SHARED_MEM
 
 #include <string>
-#include <sys/shm.h>
-#include <unistd.h>
-#include <sys/shm.h>
-#include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
-#include <stdexcept>
-#include "str_util.h"
 #include "btypes.h"
 
+/**
+ * Index arrays shared between processes through POSIX shared memory
+ * (shm_open).  Each array lives in its own object, named after a hash
+ * of the canonical path of the index file it was read from, and laid
+ * out as one page of SharedMemHeader followed by the data.
+ *
+ * The first process to create an object is its leader: it holds an
+ * exclusive flock() on the object while it reads the array in, then
+ * downgrades to a shared lock when it calls NOTIFY_SHARED.  Every
+ * other process (a follower) takes a shared lock, which blocks until
+ * the leader is done, and keeps it for as long as it stays attached.
+ * Because the kernel drops flock() locks when a process exits, a
+ * follower that finds an object still uninitialized once it has the
+ * lock knows the leader died, unlinks the object and starts over.
+ * Objects whose header doesn't match the version, size or modification
+ * time of the index file are likewise unlinked and rebuilt; processes
+ * still attached to the old copy keep it until they detach.
+ *
+ * Objects outlive the processes using them, so that later runs attach
+ * in milliseconds instead of reading the index again.  They're removed
+ * with removeSharedMem() (bowtie2-inspect --shmem-remove).
+ */
+
+#define SHMEM_MAGIC   "BT2SHMEM"
+#define SHMEM_VERSION 1
+#define SHMEM_HDR_SZ  4096
+
+#define SHMEM_UNINIT  0xafba4242
+#define SHMEM_INIT    0xffaa6161
+
+/**
+ * Header occupying the first page of each shared-memory object.
+ */
+struct SharedMemHeader {
+	char              magic[8];  // SHMEM_MAGIC
+	uint32_t          version;   // SHMEM_VERSION
+	volatile uint32_t state;     // SHMEM_UNINIT or SHMEM_INIT
+	uint64_t          len;       // bytes of data following the header
+	uint64_t          fileSize;  // size of the index file at load time
+	int64_t           fileMtime; // mtime of the index file at load time
+	volatile int32_t  users;     // processes currently attached
+	int32_t           leader;    // pid of the process that loaded it
+};
+
+/**
+ * Attach to (or create) the shared-memory object for 'fname', which
+ * has the form "<file>[<array>]", holding 'len' bytes of data.  Sets
+ * 'mem' to the start of the data.  Returns true iff the caller is the
+ * leader and must fill in the data and then call notifySharedMem().
+ */
+extern bool attachSharedMem(
+	const std::string& fname,
+	size_t len,
+	void **mem,
+	const char *memName,
+	bool verbose);
+
+/**
+ * Mark a shared-memory object as initialized and let followers in.
+ */
 extern void notifySharedMem(void *mem, size_t len);
 
+/**
+ * Check that a shared-memory object we follow is initialized.
+ * attachSharedMem() has already waited for the leader.
+ */
 extern void waitSharedMem(void *mem, size_t len);
 
-#define ALLOC_SHARED_U allocSharedMem<TIndexOffU>
-#define ALLOC_SHARED_U8 allocSharedMem<uint8_t>
-#define ALLOC_SHARED_U32 allocSharedMem<uint32_t>
-#define FREE_SHARED shmdt
-#define NOTIFY_SHARED notifySharedMem
-#define WAIT_SHARED waitSharedMem
+/**
+ * Detach from a shared-memory object.  The object stays resident.
+ */
+extern void freeSharedMem(void *mem);
 
-#define SHMEM_UNINIT  0xafba4242
-#define SHMEM_INIT    0xffaa6161
+/**
+ * Unlink the shared-memory object for 'fname' (as passed to
+ * attachSharedMem()), if there is one.  Processes still attached keep
+ * their mapping; the memory is released when the last one detaches.
+ * Returns true iff an object was found.
+ */
+extern bool removeSharedMem(const std::string& fname, bool verbose);
 
 /**
  * Tries to allocate a shared-memory chunk for a given file of a given size.
@@ -56,97 +118,19 @@ bool allocSharedMem(std::string fname,
                     const char *memName,
                     bool verbose)
 {
-	using namespace std;
-	int shmid = -1;
-	// Calculate key given string
-	key_t key = (key_t)hash_string(fname);
-	shmid_ds ds;
-	int ret;
-	// Reserve 4 bytes at the end for silly synchronization
-	size_t shmemLen = len + 4;
-	if(verbose) {
-		cerr << "Reading " << len << "+4 bytes into shared memory for " << memName << endl;
-	}
-	T *ptr = NULL;
-	while(true) {
-		// Create the shrared-memory block
-		if((shmid = shmget(key, shmemLen, IPC_CREAT | 0666)) < 0) {
-			if(errno == ENOMEM) {
-				cerr << "Out of memory allocating shared area " << memName << endl;
-			} else if(errno == EACCES) {
-				cerr << "EACCES" << endl;
-			} else if(errno == EEXIST) {
-				cerr << "EEXIST" << endl;
-			} else if(errno == EINVAL) {
-				cerr << "Warning: shared-memory chunk's segment size doesn't match expected size (" << (shmemLen) << ")" << endl
-					 << "Deleteing old shared memory block and trying again." << endl;
-				shmid = shmget(key, 0, 0);
-				if((ret = shmctl(shmid, IPC_RMID, &ds)) < 0) {
-					cerr << "shmctl returned " << ret
-						 << " for IPC_RMID, errno is " << errno
-						 << ", shmid is " << shmid << endl;
-					throw 1;
-				} else {
-					cerr << "Deleted shared mem chunk with shmid " << shmid << endl;
-				}
-				continue;
-			} else if(errno == ENOENT) {
-				cerr << "ENOENT" << endl;
-			} else if(errno == ENOSPC) {
-				cerr << "ENOSPC" << endl;
-			} else {
-				cerr << "shmget returned " << shmid << " for and errno is " << errno << endl;
-			}
-			throw 1;
-		}
-		ptr = (T*)shmat(shmid, 0, 0);
-		if(ptr == (void*)-1) {
-			cerr << "Failed to attach " << memName << " to shared memory with shmat()." << endl;
-			throw 1;
-		}
-		if(ptr == NULL) {
-			cerr << memName << " pointer returned by shmat() was NULL." << endl;
-			throw 1;
-		}
-		// Did I create it, or did I just attach to one created by
-		// another process?
-		if((ret = shmctl(shmid, IPC_STAT, &ds)) < 0) {
-			cerr << "shmctl returned " << ret << " for IPC_STAT and errno is " << errno << endl;
-			throw 1;
-		}
-		if(ds.shm_segsz != shmemLen) {
-			cerr << "Warning: shared-memory chunk's segment size (" << ds.shm_segsz
-				 << ") doesn't match expected size (" << shmemLen << ")" << endl
-				 << "Deleteing old shared memory block and trying again." << endl;
-			if((ret = shmctl(shmid, IPC_RMID, &ds)) < 0) {
-				cerr << "shmctl returned " << ret << " for IPC_RMID and errno is " << errno << endl;
-				throw 1;
-			}
-		} else {
-			break;
-		}
-	} // while(true)
-	*dst = ptr;
-	bool initid = (((volatile uint32_t*)((char*)ptr + len))[0] == SHMEM_INIT);
-	if(ds.shm_cpid == getpid() && !initid) {
-		if(verbose) {
-			cerr << "  I (pid = " << getpid() << ") created the "
-			     << "shared memory for " << memName << endl;
-		}
-		// Set this value just off the end of the chunk to
-		// indicate that the data hasn't been read yet.
-		((volatile uint32_t*)((char*)ptr + len))[0] = SHMEM_UNINIT;
-		return true;
-	} else {
-		if(verbose) {
-			cerr << "  I (pid = " << getpid()
-			     << ") did not create the shared memory for "
-			     << memName << ".  Pid " << ds.shm_cpid << " did." << endl;
-		}
-		return false;
-	}
+	void *mem = NULL;
+	bool leader = attachSharedMem(fname, len, &mem, memName, verbose);
+	*dst = (T*)mem;
+	return leader;
 }
 
+#define ALLOC_SHARED_U allocSharedMem<TIndexOffU>
+#define ALLOC_SHARED_U8 allocSharedMem<uint8_t>
+#define ALLOC_SHARED_U32 allocSharedMem<uint32_t>
+#define FREE_SHARED freeSharedMem
+#define NOTIFY_SHARED notifySharedMem
+#define WAIT_SHARED waitSharedMem
+
 #else
 
 #define ALLOC_SHARED_U(...) 0
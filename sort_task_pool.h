@@ -0,0 +1,244 @@
+/*
+ * Copyright 2011, Ben Langmead <langmea@cs.jhu.edu>
+ *
+ * This file is part of Bowtie 2.
+ *
+ * Bowtie 2 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Bowtie 2 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Bowtie 2.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SORT_TASK_POOL_H_
+#define SORT_TASK_POOL_H_
+
+#include <stddef.h>
+#include "assert_helpers.h"
+#include "ds.h"
+#include "threading.h"
+
+/**
+ * Work-stealing pool for the partitions of a multikey quicksort.
+ *
+ * The threads sorting the blocks of a KarkkainenBlockwiseSA share one
+ * pool.  When a sort splits off a partition big enough to be worth
+ * handing over, it pushes it onto the back of its thread's own queue
+ * instead of recursing into it.  A thread pops from the back of its own
+ * queue (so it mostly works depth-first on the data it just touched)
+ * and, when that's empty, steals from the front of another thread's
+ * queue, where the oldest and usually largest partitions are.  A thread
+ * with no blocks left to sort keeps stealing until every thread is
+ * done, so one large or skewed block no longer leaves the other cores
+ * idle.
+ *
+ * Partitions are disjoint ranges of the block being sorted, so tasks
+ * never touch the same elements, and the result doesn't depend on which
+ * thread sorts which partition.
+ */
+
+class SortJob;
+
+/**
+ * What became of the partitions of one sort; reported in the build log.
+ */
+struct SortJobStats {
+	SortJobStats() : spawned(0), stolen(0) { }
+	size_t spawned; // partitions handed to the pool
+	size_t stolen;  // ... and sorted by a thread other than the owner
+};
+
+/**
+ * A range of a block still to be sorted, starting at the given depth.
+ */
+struct SortTask {
+	SortJob *job;
+	size_t   begin;
+	size_t   end;
+	size_t   depth;
+};
+
+/**
+ * One top-level sort whose partitions may be handed to other threads.
+ * run() sorts a range the way the original recursive call would have.
+ */
+class SortJob {
+public:
+	SortJob(int owner) : owner_(owner), pending_(0), spawned_(0), stolen_(0) { }
+	virtual ~SortJob() { }
+
+	virtual void run(const SortTask& t, int tid) = 0;
+
+	/// Thread that started the sort and waits for it
+	int owner() const { return owner_; }
+
+	/// Copy the partition counts into 'st', if it's non-NULL
+	void stats(SortJobStats *st) const {
+		if(st != NULL) {
+			st->spawned = spawned_;
+			st->stolen = stolen_;
+		}
+	}
+
+protected:
+	friend class SortTaskPool;
+
+	int             owner_;
+	volatile int    pending_;  // pushed but not yet finished
+	volatile size_t spawned_;
+	volatile size_t stolen_;
+};
+
+class SortTaskPool {
+
+public:
+
+	SortTaskPool() : nthreads_(0), queues_(NULL), heads_(NULL), locks_(NULL), active_(0) { }
+
+	~SortTaskPool() {
+		delete[] queues_;
+		delete[] heads_;
+		delete[] locks_;
+	}
+
+	/**
+	 * Set up one queue per thread; threads are numbered 0..nthreads-1.
+	 */
+	void init(int nthreads) {
+		assert(queues_ == NULL);
+		nthreads_ = nthreads;
+		queues_ = new EList<SortTask>[nthreads];
+		heads_ = new size_t[nthreads];
+		locks_ = new MUTEX_T[nthreads];
+		for(int i = 0; i < nthreads; i++) {
+			heads_[i] = 0;
+		}
+	}
+
+	/// Return true iff init() has been called
+	bool enabled() const { return queues_ != NULL; }
+
+	/**
+	 * Hand the range [begin, end) at 'depth' over to the pool.
+	 */
+	void push(int tid, SortJob& job, size_t begin, size_t end, size_t depth) {
+		assert_range(0, nthreads_-1, tid);
+		__sync_add_and_fetch(&job.pending_, 1);
+		__sync_add_and_fetch(&job.spawned_, 1);
+		SortTask t;
+		t.job = &job; t.begin = begin; t.end = end; t.depth = depth;
+		ThreadSafe ts(locks_[tid]);
+		queues_[tid].push_back(t);
+	}
+
+	/**
+	 * Run one task: the newest of our own, or else the oldest of
+	 * someone else's.  Return false if there was nothing to do.
+	 */
+	bool runOne(int tid) {
+		SortTask t;
+		if(!popBack(tid, t)) {
+			bool found = false;
+			for(int i = 1; i < nthreads_ && !found; i++) {
+				found = popFront((tid + i) % nthreads_, t);
+			}
+			if(!found) return false;
+		}
+		if(t.job->owner_ != tid) {
+			__sync_add_and_fetch(&t.job->stolen_, 1);
+		}
+		t.job->run(t, tid);
+		__sync_sub_and_fetch(&t.job->pending_, 1);
+		return true;
+	}
+
+	/**
+	 * Run tasks until every partition of 'job' has been sorted.  Tasks
+	 * of other jobs are fair game while we wait for ours to come back.
+	 */
+	void wait(int tid, SortJob& job) {
+		while(job.pending_ > 0) {
+			if(!runOne(tid)) {
+				SLEEP(1);
+			}
+		}
+	}
+
+	/**
+	 * Called by a thread when it starts sorting blocks.
+	 */
+	void enter() {
+		__sync_add_and_fetch(&active_, 1);
+	}
+
+	/**
+	 * Called by a thread with no blocks left to sort; keeps running
+	 * other threads' tasks until all threads that entered have left.
+	 */
+	void retire(int tid) {
+		__sync_sub_and_fetch(&active_, 1);
+		while(true) {
+			if(runOne(tid)) continue;
+			if(active_ == 0) break;
+			SLEEP(1);
+		}
+	}
+
+private:
+
+	bool popBack(int tid, SortTask& t) {
+		ThreadSafe ts(locks_[tid]);
+		EList<SortTask>& q = queues_[tid];
+		if(heads_[tid] == q.size()) return false;
+		t = q.back();
+		q.pop_back();
+		if(heads_[tid] == q.size()) {
+			q.clear();
+			heads_[tid] = 0;
+		}
+		return true;
+	}
+
+	bool popFront(int tid, SortTask& t) {
+		ThreadSafe ts(locks_[tid]);
+		EList<SortTask>& q = queues_[tid];
+		if(heads_[tid] == q.size()) return false;
+		t = q[heads_[tid]++];
+		if(heads_[tid] == q.size()) {
+			q.clear();
+			heads_[tid] = 0;
+		}
+		return true;
+	}
+
+	int              nthreads_;
+	EList<SortTask> *queues_;  // per-thread queues; live part is [heads_[i], size())
+	size_t          *heads_;
+	MUTEX_T         *locks_;
+	volatile int     active_;  // threads still sorting blocks of their own
+};
+
+/**
+ * What a sort needs to hand partitions to the pool: the pool, the job
+ * they belong to and the thread doing the handing.
+ */
+struct SortSpawner {
+	SortSpawner(SortTaskPool& p, SortJob& j, int t) : pool(p), job(j), tid(t) { }
+
+	void spawn(size_t begin, size_t end, size_t depth) const {
+		pool.push(tid, job, begin, end, depth);
+	}
+
+	SortTaskPool& pool;
+	SortJob&      job;
+	int           tid;
+};
+
+#endif /*SORT_TASK_POOL_H_*/